@@ -0,0 +1,489 @@
+#include "adaptive_sweep.h"
+
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    struct adaptive_sweep *head;
+    uint64_t next_id;
+    uint64_t pending;
+    uint32_t budget;
+} g_adaptive = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0 };
+
+/*
+    Function:
+
+        new_ctx (static)
+
+    Description:
+
+        Creates a context for one point of a sweep, configured the same way the
+        exhaustive producers in cpr.c configure theirs
+
+    Parameters:
+
+        sweep   -   Ptr to the sweep
+        point   -   OBS or IBC to run
+
+    Return:
+
+        Ptr to the new context
+*/
+static struct context *new_ctx(struct adaptive_sweep *sweep, uint32_t point)
+{
+    struct context *ctx;
+    uint64_t id;
+
+    pthread_mutex_lock(&g_adaptive.mutex);
+    id = g_adaptive.next_id++;
+    pthread_mutex_unlock(&g_adaptive.mutex);
+
+    ctx = create_ctx(sweep->opt, id);
+    fill_ctx_sess(ctx, sweep->cpr_lvl, sweep->huff_type,
+            sweep->opt->stateless ? CPA_DC_STATELESS : CPA_DC_STATEFUL, 7);
+    ctx->src_data = sweep->src_data;
+    ctx->sweep = sweep;
+
+    if (sweep->underflow) {
+        ctx->uf_ibc = point;
+    } else {
+        ctx->obs = point;
+    }
+
+    return ctx;
+}
+
+/*
+    Function:
+
+        insert_sample (static)
+
+    Description:
+
+        Inserts a pending sample at idx, keeping the list sorted. Caller holds the
+        sweep mutex
+
+    Parameters:
+
+        sweep   -   Ptr to the sweep
+        idx     -   Position to insert at
+        point   -   OBS or IBC of the sample
+
+    Return:
+
+        false if the list could not grow
+*/
+static bool insert_sample(struct adaptive_sweep *sweep, uint32_t idx, uint32_t point)
+{
+    if (sweep->num_samples == sweep->max_samples) {
+        struct sweep_sample *tmp;
+        uint32_t new_max = sweep->max_samples ? (sweep->max_samples * 2) : ADAPTIVE_SEEDS;
+
+        tmp = (struct sweep_sample *)realloc(sweep->samples, new_max * sizeof(struct sweep_sample));
+        if (tmp == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not grow adaptive sweep for [%s]\n", sweep->src_data->filename);
+            return false;
+        }
+
+        sweep->samples = tmp;
+        sweep->max_samples = new_max;
+    }
+
+    memmove(&sweep->samples[idx + 1], &sweep->samples[idx], (sweep->num_samples - idx) * sizeof(struct sweep_sample));
+
+    sweep->samples[idx].point = point;
+    sweep->samples[idx].done = false;
+    sweep->samples[idx].sig = 0;
+    sweep->num_samples++;
+
+    return true;
+}
+
+/*
+    Function:
+
+        adaptive_sweep_create
+
+    Description:
+
+        Creates the sweep for one (file, level, huffman) key and places its seed
+        points, evenly spaced on the step grid. Nothing is enqueued yet, so that the
+        producer can set the file's ref count from every key's seeds first
+
+    Parameters:
+
+        opt         -   Ptr to the command line options struct
+        s           -   Ptr to the source data
+        cpr_lvl     -   Compression level
+        huff_type   -   CPA_DC_HT_STATIC/FULL_DYNAMIC
+        start       -   First OBS/IBC of the range
+        end         -   Last OBS/IBC of the range
+        step        -   Finest spacing the sweep will bisect down to
+
+    Return:
+
+        Ptr to the new sweep; its issued count is the number of seeds
+*/
+struct adaptive_sweep *adaptive_sweep_create(struct mg_options *opt, struct src_data *s, Cpa32U cpr_lvl,
+        Cpa32U huff_type, uint32_t start, uint32_t end, uint32_t step)
+{
+    struct adaptive_sweep *sweep;
+    uint64_t grid;
+    uint32_t seeds;
+
+    sweep = (struct adaptive_sweep *)calloc(1, sizeof(struct adaptive_sweep));
+
+    pthread_mutex_init(&(sweep->sweep_mutex), NULL);
+    sweep->opt = opt;
+    sweep->src_data = s;
+    sweep->cpr_lvl = cpr_lvl;
+    sweep->huff_type = huff_type;
+    sweep->underflow = opt->underflow;
+    sweep->start = start;
+    sweep->end = end < start ? start : end;
+    sweep->step = step ? step : 1;
+    sweep->budget = opt->adaptive ? opt->adaptive : 1;
+
+    grid = ((sweep->end - sweep->start) / sweep->step) + 1;
+
+    seeds = ADAPTIVE_SEEDS;
+    if (seeds > sweep->budget) {
+        seeds = sweep->budget;
+    }
+    if (seeds > grid) {
+        seeds = grid;
+    }
+
+    for (uint32_t i = 0; i < seeds; i++)
+    {
+        uint64_t k = (seeds == 1) ? 0 : ((i * (grid - 1)) / (seeds - 1));
+
+        if (!insert_sample(sweep, sweep->num_samples, sweep->start + (k * sweep->step))) {
+            break;
+        }
+    }
+
+    sweep->issued = sweep->num_samples;
+
+    pthread_mutex_lock(&g_adaptive.mutex);
+    sweep->next = g_adaptive.head;
+    g_adaptive.head = sweep;
+    g_adaptive.budget = sweep->budget;
+    pthread_mutex_unlock(&g_adaptive.mutex);
+
+    return sweep;
+}
+
+/*
+    Function:
+
+        adaptive_sweep_start
+
+    Description:
+
+        Enqueues the sweep's seed contexts. Everything after that is issued by the
+        consumers as results come back
+
+    Parameters:
+
+        sweep   -   Ptr to the sweep
+
+    Return:
+
+        none
+*/
+void adaptive_sweep_start(struct adaptive_sweep *sweep)
+{
+    pthread_mutex_lock(&g_adaptive.mutex);
+    g_adaptive.pending += sweep->num_samples;
+    pthread_mutex_unlock(&g_adaptive.mutex);
+
+    for (uint32_t i = 0; i < sweep->num_samples; i++)
+    {
+        enq_ctx(new_ctx(sweep, sweep->samples[i].point));
+    }
+}
+
+/*
+    Function:
+
+        adaptive_sweep_report
+
+    Description:
+
+        Records a finished context's signature, and bisects towards each finished
+        neighbour that behaved differently while the budget allows. New points go
+        to the front of the Q, since this is called from a consumer and they are
+        what the sweep is waiting on. The file's ref count is raised before the
+        caller drops this context's reference
+
+    Parameters:
+
+        ctx     -   Ptr to the finished context
+        status  -   Result of meatjet(), folded into the signature
+
+    Return:
+
+        none
+*/
+void adaptive_sweep_report(struct context *ctx, CpaStatus status)
+{
+    struct adaptive_sweep *sweep = ctx->sweep;
+    uint32_t children[2];
+    uint32_t num_children = 0;
+    uint32_t point;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t idx;
+
+    point = sweep->underflow ? ctx->uf_ibc : ctx->obs;
+
+    // A failure is never equivalent to a pass
+    ctx_sig_mark(ctx, (Cpa32U)status);
+
+    pthread_mutex_lock(&(sweep->sweep_mutex));
+
+    lo = 0;
+    hi = sweep->num_samples;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + ((hi - lo) / 2);
+
+        if (sweep->samples[mid].point < point) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    idx = lo;
+
+    sweep->samples[idx].done = true;
+    sweep->samples[idx].sig = ctx->sig;
+
+    for (int d = -1; d <= 1; d += 2)
+    {
+        struct sweep_sample *nb;
+        uint32_t gap;
+        uint32_t mid;
+
+        if ((d < 0 && idx == 0) || (d > 0 && idx + 1 >= sweep->num_samples)) {
+            continue;
+        }
+
+        nb = &sweep->samples[idx + d];
+        if (!nb->done || nb->sig == ctx->sig) {
+            continue;
+        }
+
+        lo = (d < 0) ? nb->point : point;
+        hi = (d < 0) ? point : nb->point;
+        gap = (hi - lo) / sweep->step;
+
+        // Already a step apart: the boundary is found
+        if (gap < 2 || sweep->issued >= sweep->budget) {
+            continue;
+        }
+
+        mid = lo + ((gap / 2) * sweep->step);
+
+        if (!insert_sample(sweep, (d < 0) ? idx : idx + 1, mid)) {
+            continue;
+        }
+
+        if (d < 0) {
+            idx++;
+        }
+
+        sweep->issued++;
+        children[num_children++] = mid;
+    }
+
+    pthread_mutex_unlock(&(sweep->sweep_mutex));
+
+    if (num_children) {
+        pthread_mutex_lock(&(sweep->src_data->src_mutex));
+        sweep->src_data->ref_count += num_children;
+        sweep->src_data->orig_ref_count += num_children;
+        pthread_mutex_unlock(&(sweep->src_data->src_mutex));
+
+        pthread_mutex_lock(&g_adaptive.mutex);
+        g_adaptive.pending += num_children;
+        pthread_mutex_unlock(&g_adaptive.mutex);
+
+        for (uint32_t i = 0; i < num_children; i++)
+        {
+            requeue_ctx(new_ctx(sweep, children[i]));
+        }
+    }
+
+    pthread_mutex_lock(&g_adaptive.mutex);
+    g_adaptive.pending--;
+    pthread_mutex_unlock(&g_adaptive.mutex);
+}
+
+/*
+    Function:
+
+        adaptive_sweep_pending
+
+    Description:
+
+        Consumers must not exit on an empty Q while a sweep point is still running,
+        since its result may issue more
+
+    Parameters:
+
+        none
+
+    Return:
+
+        true if any issued sweep point has not been reported yet
+*/
+bool adaptive_sweep_pending()
+{
+    bool pending;
+
+    pthread_mutex_lock(&g_adaptive.mutex);
+    pending = g_adaptive.pending != 0;
+    pthread_mutex_unlock(&g_adaptive.mutex);
+
+    return pending;
+}
+
+static int cmp_sig(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+    Function:
+
+        adaptive_sweep_print_stats
+
+    Description:
+
+        Appends the coverage report to the summary, if any sweep ran. A grid point
+        counts as covered if it ran, or if it lies between two finished neighbours
+        with the same signature. Boundaries are neighbours whose signatures differ,
+        and are unresolved if the budget ran out before they were a step apart
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void adaptive_sweep_print_stats()
+{
+    uint64_t keys = 0;
+    uint64_t grid = 0;
+    uint64_t executed = 0;
+    uint64_t covered = 0;
+    uint64_t distinct = 0;
+    uint64_t found = 0;
+    uint64_t unresolved = 0;
+
+    if (g_adaptive.head == NULL) {
+        return;
+    }
+
+    for (struct adaptive_sweep *sweep = g_adaptive.head; sweep != NULL; sweep = sweep->next)
+    {
+        uint64_t *sigs;
+        uint32_t num_sigs = 0;
+        struct sweep_sample *prev = NULL;
+
+        keys++;
+        grid += ((sweep->end - sweep->start) / sweep->step) + 1;
+
+        sigs = (uint64_t *)calloc(sweep->num_samples ? sweep->num_samples : 1, sizeof(uint64_t));
+
+        for (uint32_t i = 0; i < sweep->num_samples; i++)
+        {
+            struct sweep_sample *smp = &sweep->samples[i];
+            uint32_t gap;
+
+            if (!smp->done) {
+                continue;
+            }
+
+            executed++;
+            covered++;
+            sigs[num_sigs++] = smp->sig;
+
+            if (prev != NULL) {
+                gap = (smp->point - prev->point) / sweep->step;
+
+                if (prev->sig == smp->sig) {
+                    covered += gap - 1;
+                } else if (gap > 1) {
+                    unresolved++;
+                } else {
+                    found++;
+                }
+            }
+
+            prev = smp;
+        }
+
+        qsort(sigs, num_sigs, sizeof(uint64_t), cmp_sig);
+        for (uint32_t i = 0; i < num_sigs; i++)
+        {
+            if (i == 0 || sigs[i] != sigs[i - 1]) {
+                distinct++;
+            }
+        }
+
+        free(sigs);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Adaptive Sweep: %lu keys, budget %u points per key\n", keys, g_adaptive.budget);
+    MG_LOG_PRINT(g_log_fd, "        Executed:   %lu of %lu grid points (%.2f%%)\n", executed, grid,
+            grid ? (executed * 100.0) / grid : 0.0);
+    MG_LOG_PRINT(g_log_fd, "        Coverage:   %lu of %lu grid points (%.2f%%) ran or bracketed by equal signatures\n",
+            covered, grid, grid ? (covered * 100.0) / grid : 0.0);
+    MG_LOG_PRINT(g_log_fd, "        Behaviours: %lu distinct signatures (summed per key)\n", distinct);
+    MG_LOG_PRINT(g_log_fd, "        Boundaries: %lu located to one step, %lu unresolved at budget\n\n",
+            found, unresolved);
+}
+
+/*
+    Function:
+
+        adaptive_sweep_free_all
+
+    Description:
+
+        Frees every sweep. Called once all consumers have joined and the summary
+        has been printed
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void adaptive_sweep_free_all()
+{
+    struct adaptive_sweep *sweep = g_adaptive.head;
+
+    while (sweep != NULL)
+    {
+        struct adaptive_sweep *next = sweep->next;
+
+        pthread_mutex_destroy(&(sweep->sweep_mutex));
+        free(sweep->samples);
+        free(sweep);
+
+        sweep = next;
+    }
+
+    g_adaptive.head = NULL;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+
+// Evenly spaced points each key starts with, before any bisection
+#define ADAPTIVE_SEEDS      (17)
+
+struct sweep_sample {
+    uint32_t point;
+    bool done;
+    uint64_t sig;
+};
+
+/*
+    One OBS or IBC range for one (file, level, huffman) key. Samples are kept sorted
+    by point, and a finished sample bisects towards any finished neighbour whose
+    signature differs, until the two are a step apart or the budget runs out
+*/
+struct adaptive_sweep {
+    pthread_mutex_t sweep_mutex;
+    struct mg_options *opt;
+    struct src_data *src_data;
+    Cpa32U cpr_lvl;
+    Cpa32U huff_type;
+    bool underflow;
+
+    uint32_t start;
+    uint32_t end;
+    uint32_t step;
+    uint32_t budget;
+    uint32_t issued;
+
+    struct sweep_sample *samples;
+    uint32_t num_samples;
+    uint32_t max_samples;
+
+    struct adaptive_sweep *next;
+};
+
+struct adaptive_sweep *adaptive_sweep_create(struct mg_options *opt, struct src_data *s, Cpa32U cpr_lvl,
+        Cpa32U huff_type, uint32_t start, uint32_t end, uint32_t step);
+void adaptive_sweep_start(struct adaptive_sweep *sweep);
+void adaptive_sweep_report(struct context *ctx, CpaStatus status);
+bool adaptive_sweep_pending();
+void adaptive_sweep_print_stats();
+void adaptive_sweep_free_all();
@@ -0,0 +1,847 @@
+#include <time.h>
+#include <zlib.h>
+#include "chunk_engine.h"
+#include "buf_handler.h"
+#include "credit.h"
+#include "watchdog.h"
+#include "health.h"
+#include "meatjet.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    uint32_t lanes;
+    uint32_t inflight;
+    uint32_t instances;
+    uint64_t contexts;
+    uint64_t chunks;
+    uint64_t discarded;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t setups;
+} g_chunk_stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static void *lane_entry(void *arg);
+static void remove_lane_sessions(struct chunk_engine *eng);
+
+/*
+    Function:
+
+        chunk_engine_enabled
+
+    Description:
+
+        Only stateless compression has independent chunks, and only a lane count > 1
+        buys anything over the serial loop in meatjet()
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        true if the context should fan its chunks out through the engine
+*/
+bool chunk_engine_enabled(struct context *ctx)
+{
+    if (ctx->decomp_only || CPA_DC_STATELESS != ctx->sessCprSetupData.sessState) {
+        return false;
+    }
+
+    return (ctx->chunk_inflight * ctx->chunk_instances) > 1;
+}
+
+/*
+    Function:
+
+        stop_lanes (static)
+
+    Description:
+
+        Tells the lane threads to exit and joins them. The waves run on the caller
+        afterwards
+
+    Parameters:
+
+        eng -   Ptr to the engine
+
+    Return:
+
+        none
+*/
+static void stop_lanes(struct chunk_engine *eng)
+{
+    pthread_mutex_lock(&eng->mutex);
+    eng->quit = true;
+    pthread_cond_broadcast(&eng->wave_cond);
+    pthread_mutex_unlock(&eng->mutex);
+
+    for (uint32_t i = 0; i < eng->threads; i++)
+    {
+        pthread_join(eng->lanes[i].thread, NULL);
+    }
+
+    eng->threads = 0;
+    eng->quit = false;
+}
+
+/*
+    Function:
+
+        create_engine (static)
+
+    Description:
+
+        Allocates the lanes for a consumer thread and starts a thread per lane, which
+        waits for waves for as long as the engine lives. Lanes are striped across
+        instances with chunk_inflight lanes per instance, starting at the context's
+        instance on every run. Done once per thread, like init_sgl_mem. If the lane
+        threads can't all be started, the waves run their lanes on the caller instead
+
+    Parameters:
+
+        ctx     -   Ptr to the first context that needs the engine
+        sgls    -   Ptr to the thread's sgl container
+
+    Return:
+
+        Ptr to the engine, or NULL on allocation failure
+*/
+static struct chunk_engine *create_engine(struct context *ctx, struct sgl_container *sgls)
+{
+    CpaStatus status;
+    struct chunk_engine *eng;
+    uint32_t meta_size = 0;
+    uint32_t inst_meta;
+
+    eng = (struct chunk_engine *)calloc(1, sizeof(struct chunk_engine));
+    if (eng == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the chunk engine\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&eng->mutex, NULL);
+    pthread_cond_init(&eng->wave_cond, NULL);
+    pthread_cond_init(&eng->done_cond, NULL);
+
+    eng->inflight = ctx->chunk_inflight ? ctx->chunk_inflight : 1;
+    eng->instances = ctx->chunk_instances ? ctx->chunk_instances : 1;
+    if (eng->instances > numDcInstances_g) {
+        eng->instances = numDcInstances_g;
+    }
+
+    eng->num_lanes = eng->inflight * eng->instances;
+    eng->lanes = (struct chunk_lane *)calloc(eng->num_lanes, sizeof(struct chunk_lane));
+    eng->slots = (struct chunk_slot *)calloc(eng->num_lanes, sizeof(struct chunk_slot));
+    if (eng->lanes == NULL || eng->slots == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate %u chunk engine lanes\n", eng->num_lanes);
+        eng->num_lanes = 0;
+        chunk_engine_free(eng);
+        return NULL;
+    }
+
+    // Lanes move with the context's instance, so their metadata is sized for the largest
+    for (uint32_t i = 0; i < numDcInstances_g; i++)
+    {
+        cpaDcBufferListGetMetaSize(dcInstances_g[i], 1, &inst_meta);
+        if (inst_meta > meta_size) {
+            meta_size = inst_meta;
+        }
+    }
+
+    for (uint32_t i = 0; i < eng->num_lanes; i++)
+    {
+        struct chunk_lane *lane = &eng->lanes[i];
+
+        lane->lane_id = i;
+        lane->inst = (sgls->t_id + (i / eng->inflight)) % numDcInstances_g;
+        lane->eng = eng;
+
+        lane->src_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
+        lane->dest_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
+
+        status = CPA_STATUS_FAIL;
+        if (lane->src_sgl && lane->dest_sgl) {
+            status = mg_build_sgl(lane->src_sgl, 0, 1, DEFAULT_BUF_SIZE, meta_size);
+        }
+        if (status == CPA_STATUS_SUCCESS) {
+            status = mg_build_sgl(lane->dest_sgl, 0, 1, CHUNK_BOUND, meta_size);
+        }
+
+        eng->slots[i].out = (Cpa8U *)calloc(1, CHUNK_SLOT_SIZE);
+
+        if (status != CPA_STATUS_SUCCESS || eng->slots[i].out == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not allocate chunk engine lane %u\n", i);
+            eng->num_lanes = i + 1;
+            chunk_engine_free(eng);
+            return NULL;
+        }
+    }
+
+    // A single lane gains nothing from a thread, the waves run it on the caller
+    for (uint32_t i = 0; eng->num_lanes > 1 && i < eng->num_lanes; i++)
+    {
+        if (pthread_create(&(eng->lanes[i].thread), NULL, lane_entry, &(eng->lanes[i])) != 0) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not start chunk lane thread %u, the lanes run one at a time\n", i);
+            stop_lanes(eng);
+            break;
+        }
+        eng->threads++;
+    }
+
+    pthread_mutex_lock(&g_chunk_stats.mutex);
+    g_chunk_stats.lanes = eng->num_lanes;
+    g_chunk_stats.inflight = eng->inflight;
+    g_chunk_stats.instances = eng->instances;
+    pthread_mutex_unlock(&g_chunk_stats.mutex);
+
+    return eng;
+}
+
+/*
+    Function:
+
+        chunk_engine_free
+
+    Description:
+
+        Stops the lane threads, removes their sessions and frees all lane SGLs and
+        staging slots. Called from free_sgls
+
+    Parameters:
+
+        eng -   Ptr to the engine, may be NULL
+
+    Return:
+
+        none
+*/
+void chunk_engine_free(struct chunk_engine *eng)
+{
+    if (eng == NULL) {
+        return;
+    }
+
+    stop_lanes(eng);
+    remove_lane_sessions(eng);
+
+    for (uint32_t i = 0; i < eng->num_lanes; i++)
+    {
+        if (eng->lanes[i].src_sgl) {
+            mg_free_sgl(eng->lanes[i].src_sgl);
+            free(eng->lanes[i].src_sgl);
+        }
+        if (eng->lanes[i].dest_sgl) {
+            mg_free_sgl(eng->lanes[i].dest_sgl);
+            free(eng->lanes[i].dest_sgl);
+        }
+        free(eng->slots[i].out);
+    }
+
+    pthread_cond_destroy(&eng->done_cond);
+    pthread_cond_destroy(&eng->wave_cond);
+    pthread_mutex_destroy(&eng->mutex);
+
+    free(eng->lanes);
+    free(eng->slots);
+    free(eng);
+}
+
+/*
+    Function:
+
+        remove_lane_session (static)
+
+    Description:
+
+        Removes a lane's session and frees it, if it has one
+
+    Parameters:
+
+        lane    -   Ptr to the lane
+
+    Return:
+
+        none
+*/
+static void remove_lane_session(struct chunk_lane *lane)
+{
+    if (lane->sessHandle == NULL) {
+        return;
+    }
+
+    cpaDcRemoveSession(dcInstances_g[lane->sess_inst], lane->sessHandle);
+    qaeMemFreeNUMA((void**)&(lane->sessHandle));
+}
+
+static void remove_lane_sessions(struct chunk_engine *eng)
+{
+    for (uint32_t i = 0; eng->lanes && i < eng->num_lanes; i++)
+    {
+        remove_lane_session(&eng->lanes[i]);
+    }
+}
+
+/*
+    Function:
+
+        init_lane_sessions (static)
+
+    Description:
+
+        Every lane gets its own stateless session on its own instance, using the
+        context's compression setup. No context buffer is needed for stateless. A
+        stateless session carries nothing from one request to the next, so a lane keeps
+        its session across contexts and only sets it up again when the context's setup
+        or the lane's instance differs from the one it was made for
+
+    Parameters:
+
+        eng -   Ptr to the engine
+        ctx -   Ptr to the context
+
+    Return:
+
+        Result of the session API calls
+*/
+static CpaStatus init_lane_sessions(struct chunk_engine *eng, struct context *ctx)
+{
+    CpaStatus status;
+    uint32_t sess_size;
+    uint32_t ctx_size;
+    uint32_t setups = 0;
+
+    for (uint32_t i = 0; i < eng->num_lanes; i++)
+    {
+        struct chunk_lane *lane = &eng->lanes[i];
+
+        if (lane->sessHandle && lane->sess_inst == lane->inst &&
+                !memcmp(&lane->sess_sd, &ctx->sessCprSetupData, sizeof(lane->sess_sd))) {
+            continue;
+        }
+
+        remove_lane_session(lane);
+
+        status = cpaDcGetSessionSize(dcInstances_g[lane->inst], &(ctx->sessCprSetupData), &sess_size, &ctx_size);
+        if (status != CPA_STATUS_SUCCESS) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not get session size for chunk lane %u!\n", i);
+            return status;
+        }
+
+        lane->sessHandle = (CpaDcSessionHandle) qaeMemAllocNUMA(sess_size, ctx->nodeId, BYTE_ALIGNMENT_64);
+        if (lane->sessHandle == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not allocate session for chunk lane %u!\n", i);
+            return CPA_STATUS_FAIL;
+        }
+
+        status = cpaDcInitSession(dcInstances_g[lane->inst],
+                                  lane->sessHandle,
+                                  &(ctx->sessCprSetupData),
+                                  NULL,
+                                  NULL);
+        if (status != CPA_STATUS_SUCCESS) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not initialize session for chunk lane %u\n", i);
+            qaeMemFreeNUMA((void**)&(lane->sessHandle));
+            return status;
+        }
+
+        lane->sess_sd = ctx->sessCprSetupData;
+        lane->sess_inst = lane->inst;
+        setups++;
+    }
+
+    if (setups) {
+        __sync_fetch_and_add(&g_chunk_stats.setups, setups);
+    }
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        compress_chunk (static)
+
+    Description:
+
+        Compresses one 64KB source chunk as a standalone stateless request. Any overflow
+        is resubmitted on the same lane with the remainder, exactly like the serial loop,
+        so the slot always ends up with the full chunk. The CRC is seeded at zero so the
+        caller can crc32_combine the chunks in order.
+
+    Parameters:
+
+        lane    -   Ptr to the lane doing the work
+        slot    -   Ptr to the staging slot for this chunk
+        src     -   Ptr to the chunk's source data
+        final   -   Whether this is the last chunk of the file
+
+    Return:
+
+        Status of the compression
+*/
+static CpaStatus compress_chunk(struct chunk_lane *lane, struct chunk_slot *slot, Cpa8U *src, bool final)
+{
+    CpaStatus status = CPA_STATUS_FAIL;
+    CpaDcOpData opData = {};
+    Cpa32U consumed;
+    Cpa32U job_size;
+    Cpa32U data_copied;
+
+    memset(&(slot->results), 0, sizeof(CpaDcRqResults));
+    slot->produced = 0;
+    consumed = 0;
+
+    opData.flushFlag = final ? CPA_DC_FLUSH_FINAL : CPA_DC_FLUSH_FULL;
+    opData.compressAndVerify = CPA_TRUE;
+
+    do
+    {
+        job_size = slot->len - consumed;
+
+        data_copied = copy_mem_to_sgl(src + consumed, lane->src_sgl, DEFAULT_BUF_SIZE, job_size);
+        if (data_copied != job_size) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data to the chunk lane src SGL!\n");
+            return CPA_STATUS_FAIL;
+        }
+
+        credit_acquire(lane->inst);
+        do {
+            status = cpaDcCompressData2(dcInstances_g[lane->inst],
+                                        lane->sessHandle,
+                                        lane->src_sgl,
+                                        lane->dest_sgl,
+                                        &opData,
+                                        &(slot->results),
+                                        NULL);
+        } while (credit_retry(lane->inst, status));
+        credit_release(lane->inst);
+        health_record(lane->inst, lane->eng->ctx, status, slot->results.status);
+
+        if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != slot->results.status) {
+            MG_LOG_PRINT(g_log_fd, "Chunk Compress Error: status %d (lane %u, inst %u)\n",
+                    status, lane->lane_id, lane->inst);
+            return (status == CPA_STATUS_SUCCESS) ? CPA_STATUS_FAIL : status;
+        }
+
+        if (CPA_DC_OVERFLOW == slot->results.status &&
+                slot->results.consumed == 0 && slot->results.produced == 0) {
+            MG_LOG_PRINT(g_log_fd, "Chunk Compress Error: overflow without progress (lane %u, inst %u)\n",
+                    lane->lane_id, lane->inst);
+            return CPA_STATUS_FAIL;
+        }
+
+        if (CPA_DC_OVERFLOW == slot->results.status) {
+            meatjet_count_overflow(false);
+        }
+
+        if (slot->produced + slot->results.produced > CHUNK_SLOT_SIZE) {
+            MG_LOG_PRINT(g_log_fd, "Error: chunk output exceeds the %u byte staging slot\n", CHUNK_SLOT_SIZE);
+            return CPA_STATUS_FAIL;
+        }
+
+        data_copied = copy_sgl_to_mem(lane->dest_sgl,
+                                      slot->out + slot->produced,
+                                      CHUNK_BOUND,
+                                      slot->results.produced);
+        if (data_copied != slot->results.produced) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from chunk lane dest SGL\n");
+            return CPA_STATUS_FAIL;
+        }
+
+        consumed += slot->results.consumed;
+        slot->produced += slot->results.produced;
+
+    } while (consumed < slot->len || slot->results.status == CPA_DC_OVERFLOW);
+
+    slot->crc32 = slot->results.checksum;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        lane_run (static)
+
+    Description:
+
+        Runs a lane's share of the current wave: every num_lanes'th chunk of it
+
+    Parameters:
+
+        lane    -   Ptr to the lane
+
+    Return:
+
+        none
+*/
+static void lane_run(struct chunk_lane *lane)
+{
+    struct chunk_engine *eng = lane->eng;
+    struct context *ctx = eng->ctx;
+
+    // Requests stamp the worker that owns the engine
+    wd_adopt(eng->wd);
+
+    for (uint32_t w = lane->lane_id; w < eng->wave_size; w += eng->num_lanes)
+    {
+        struct chunk_slot *slot = &eng->slots[w];
+        uint64_t chunk = eng->wave_start + w;
+        Cpa8U *src = ctx->src_data->src_mem + (chunk * DEFAULT_BUF_SIZE);
+
+        slot->status = compress_chunk(lane, slot, src, (chunk + 1) == eng->num_chunks);
+    }
+}
+
+/*
+    Function:
+
+        lane_entry (static)
+
+    Description:
+
+        Lane thread body. Waits for each wave, runs its share and reports it done, until
+        the engine is freed
+
+    Parameters:
+
+        arg -   Ptr to the lane
+
+    Return:
+
+        none
+*/
+static void *lane_entry(void *arg)
+{
+    struct chunk_lane *lane = (struct chunk_lane *)arg;
+    struct chunk_engine *eng = lane->eng;
+
+    pthread_mutex_lock(&eng->mutex);
+    while (true)
+    {
+        while (!eng->quit && lane->wave_seen == eng->wave_gen)
+        {
+            pthread_cond_wait(&eng->wave_cond, &eng->mutex);
+        }
+        if (eng->quit) {
+            break;
+        }
+        lane->wave_seen = eng->wave_gen;
+        pthread_mutex_unlock(&eng->mutex);
+
+        lane_run(lane);
+
+        pthread_mutex_lock(&eng->mutex);
+        if (--eng->lanes_busy == 0) {
+            pthread_cond_signal(&eng->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&eng->mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        chunk_engine_compress
+
+    Description:
+
+        Compresses chunks [0, limit) of a context's source as independent stateless
+        requests, fanned out in waves across all lanes. Completed chunks are handed to
+        the accept callback strictly in chunk order; once it sets stop, the rest of the
+        wave is discarded and no further waves are issued.
+
+    Parameters:
+
+        ctx     -   Ptr to the context (source data and session setup)
+        sgls    -   Ptr to the thread's sgl container (owns the engine)
+        limit   -   Number of chunks from the start of the file to compress
+        accept  -   In-order consumer for each completed chunk
+        arg     -   Passed through to accept
+
+    Return:
+
+        Status of the compression, or the first failure returned by accept
+*/
+CpaStatus chunk_engine_compress(struct context *ctx, struct sgl_container *sgls, uint64_t limit,
+        chunk_accept_fn accept, void *arg)
+{
+    CpaStatus status;
+    struct chunk_engine *eng;
+    uint64_t next;
+    uint64_t accepted;
+    uint64_t accepted_bytes;
+    uint64_t discarded;
+    uint64_t start_ns;
+    bool stop;
+
+    if (sgls->chunk_eng == NULL) {
+        sgls->chunk_eng = create_engine(ctx, sgls);
+        if (sgls->chunk_eng == NULL) {
+            return CPA_STATUS_FAIL;
+        }
+    }
+    eng = sgls->chunk_eng;
+
+    eng->ctx = ctx;
+    eng->wd = wd_current();
+    eng->num_chunks = calculate_num_buf(ctx->src_data->file_size, DEFAULT_BUF_SIZE);
+
+    if (limit > eng->num_chunks) {
+        limit = eng->num_chunks;
+    }
+
+    if (limit == 0) {
+        return CPA_STATUS_SUCCESS;
+    }
+
+    start_ns = now_ns();
+
+    // Stripe from the context's instance, which health_pick may have moved off the thread's
+    for (uint32_t i = 0; i < eng->num_lanes; i++)
+    {
+        eng->lanes[i].inst = (ctx->inst + (i / eng->inflight)) % numDcInstances_g;
+    }
+
+    status = init_lane_sessions(eng, ctx);
+    if (status != CPA_STATUS_SUCCESS) {
+        return status;
+    }
+
+    next = 0;
+    accepted = 0;
+    accepted_bytes = 0;
+    discarded = 0;
+    stop = false;
+
+    while (next < limit && !stop && status == CPA_STATUS_SUCCESS)
+    {
+        eng->wave_start = next;
+        eng->wave_size = (limit - next) < eng->num_lanes ? (limit - next) : eng->num_lanes;
+
+        for (uint32_t w = 0; w < eng->wave_size; w++)
+        {
+            uint64_t chunk = next + w;
+
+            eng->slots[w].len = DEFAULT_BUF_SIZE;
+            if ((chunk + 1) * DEFAULT_BUF_SIZE > ctx->src_data->file_size) {
+                eng->slots[w].len = ctx->src_data->file_size - (chunk * DEFAULT_BUF_SIZE);
+            }
+        }
+
+        if (eng->threads == 0) {
+            for (uint32_t i = 0; i < eng->num_lanes && i < eng->wave_size; i++)
+            {
+                lane_run(&(eng->lanes[i]));
+            }
+        } else {
+            pthread_mutex_lock(&eng->mutex);
+            eng->wave_gen++;
+            eng->lanes_busy = eng->threads;
+            pthread_cond_broadcast(&eng->wave_cond);
+            while (eng->lanes_busy)
+            {
+                pthread_cond_wait(&eng->done_cond, &eng->mutex);
+            }
+            pthread_mutex_unlock(&eng->mutex);
+        }
+
+        for (uint32_t w = 0; w < eng->wave_size; w++)
+        {
+            struct chunk_slot *slot = &eng->slots[w];
+
+            if (slot->status != CPA_STATUS_SUCCESS) {
+                status = slot->status;
+                break;
+            }
+
+            status = accept(slot, next + w, &stop, arg);
+            if (stop || status != CPA_STATUS_SUCCESS) {
+                discarded += eng->wave_size - w;
+                break;
+            }
+
+            accepted++;
+            accepted_bytes += slot->len;
+        }
+
+        next += eng->wave_size;
+    }
+
+    pthread_mutex_lock(&g_chunk_stats.mutex);
+    g_chunk_stats.contexts++;
+    g_chunk_stats.chunks += accepted;
+    g_chunk_stats.discarded += discarded;
+    g_chunk_stats.bytes += accepted_bytes;
+    g_chunk_stats.ns += now_ns() - start_ns;
+    pthread_mutex_unlock(&g_chunk_stats.mutex);
+
+    return status;
+}
+
+struct ctx_splice {
+    struct context *ctx;
+    uLong crc;
+};
+
+/*
+    Function:
+
+        accept_into_ctx (static)
+
+    Description:
+
+        Splices a completed chunk onto the context's compressed stream, unless the
+        context has reached its overflow target bucket, which the serial loop owns
+
+    Parameters:
+
+        slot    -   Completed chunk
+        chunk   -   Chunk index
+        stop    -   Set once the overflow target bucket is reached
+        arg     -   Ptr to the ctx_splice state
+
+    Return:
+
+        CPA_STATUS_FAIL if dest_mem would overflow, otherwise CPA_STATUS_SUCCESS
+*/
+static CpaStatus accept_into_ctx(struct chunk_slot *slot, uint64_t chunk, bool *stop, void *arg)
+{
+    struct ctx_splice *sp = (struct ctx_splice *)arg;
+    struct context *ctx = sp->ctx;
+
+    (void)chunk;
+
+    if (!ctx->underflow && (ctx->cpr_produced + CHUNK_BOUND) >= ctx->obs) {
+        *stop = true;
+        return CPA_STATUS_SUCCESS;
+    }
+
+    if ((ctx->cpr_produced + slot->produced) > ctx->mem_size) {
+        MG_LOG_PRINT(g_log_fd, "Error: chunk engine output exceeds dest_mem [%s]\n", ctx->src_data->filename);
+        return CPA_STATUS_FAIL;
+    }
+
+    memcpy(ctx->dest_mem + ctx->cpr_produced, slot->out, slot->produced);
+
+    sp->crc = crc32_combine(sp->crc, slot->crc32, slot->len);
+
+    ctx->cpr_results = slot->results;
+    ctx->cpr_results.checksum = sp->crc;
+    ctx->cpr_consumed += slot->len;
+    ctx->cpr_produced += slot->produced;
+
+    ctx_add_flush_point(ctx, ctx->cpr_produced, ctx->cpr_consumed);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        chunk_target_bucket
+
+    Description:
+
+        The underflow target bucket is the first chunk where consumed + 64KB reaches the
+        IBC. Overflow targets depend on produced bytes and can't be known up front. Never
+        past the last chunk, which the context's own session always submits with
+        FLUSH_FINAL, even when the IBC or OBS is beyond the whole file
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        Index of the underflow target chunk, or of the last chunk if there is none
+*/
+uint64_t chunk_target_bucket(struct context *ctx)
+{
+    uint64_t num_chunks;
+    uint64_t last;
+
+    num_chunks = calculate_num_buf(ctx->src_data->file_size, DEFAULT_BUF_SIZE);
+    last = num_chunks ? num_chunks - 1 : 0;
+
+    if (ctx->underflow && ctx->uf_ibc && ((ctx->uf_ibc - 1) / DEFAULT_BUF_SIZE) < last) {
+        return (ctx->uf_ibc - 1) / DEFAULT_BUF_SIZE;
+    }
+
+    return last;
+}
+
+/*
+    Function:
+
+        chunk_engine_run
+
+    Description:
+
+        Compresses the stateless prefix of a context in parallel. Every chunk ahead of
+        the context's target (IBC bucket for underflow, OBS bucket for overflow) is
+        independent of it, so those are fanned out, reassembled in order into dest_mem,
+        and the CRC is combined with crc32_combine. The context's byte counts and
+        cpr_results are left exactly where the serial loop in meatjet() expects to pick
+        up, at the target bucket.
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the thread's sgl container (owns the engine)
+
+    Return:
+
+        Status of the compression
+*/
+CpaStatus chunk_engine_run(struct context *ctx, struct sgl_container *sgls)
+{
+    struct ctx_splice sp;
+
+    sp.ctx = ctx;
+    sp.crc = 0;
+
+    return chunk_engine_compress(ctx, sgls, chunk_target_bucket(ctx), accept_into_ctx, &sp);
+}
+
+/*
+    Function:
+
+        chunk_engine_print_stats
+
+    Description:
+
+        Appends chunk engine scaling numbers to the summary, if the engine ran at all
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void chunk_engine_print_stats()
+{
+    double secs;
+
+    if (g_chunk_stats.contexts == 0) {
+        return;
+    }
+
+    secs = g_chunk_stats.ns / 1e9;
+
+    MG_LOG_PRINT(g_log_fd, "    Chunk Engine: %u lanes (%u in flight x %u instances)\n",
+            g_chunk_stats.lanes, g_chunk_stats.inflight, g_chunk_stats.instances);
+    MG_LOG_PRINT(g_log_fd, "        Runs:     %lu (%lu lane sessions set up)\n", g_chunk_stats.contexts, g_chunk_stats.setups);
+    MG_LOG_PRINT(g_log_fd, "        Chunks:   %lu (%lu discarded past target)\n",
+            g_chunk_stats.chunks, g_chunk_stats.discarded);
+    MG_LOG_PRINT(g_log_fd, "        Prefix:   %lu bytes in %.3f s (%.2f MB/s per context)\n\n",
+            g_chunk_stats.bytes, secs, secs > 0 ? (g_chunk_stats.bytes / secs) / (1024 * 1024) : 0.0);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+#include "watchdog.h"
+
+// Each chunk may overflow its dest and resubmit the remainder, so leave room for both halves
+#define CHUNK_SLOT_SIZE     (DEFAULT_BUF_SIZE * 2)
+
+struct chunk_slot {
+    Cpa8U *out;
+    Cpa32U len;
+    Cpa32U produced;
+    Cpa32U crc32;
+    CpaStatus status;
+    CpaDcRqResults results;
+};
+
+struct chunk_lane {
+    uint32_t lane_id;
+    uint32_t inst;
+
+    CpaBufferList *src_sgl;
+    CpaBufferList *dest_sgl;
+
+    // Kept across contexts, set up again only when the setup or the instance changes
+    CpaDcSessionHandle *sessHandle;
+    CpaDcSessionSetupData sess_sd;
+    uint32_t sess_inst;
+
+    pthread_t thread;
+    uint64_t wave_seen;
+    struct chunk_engine *eng;
+};
+
+struct chunk_engine {
+    uint32_t num_lanes;
+    uint32_t inflight;
+    uint32_t instances;
+    struct chunk_lane *lanes;
+
+    // Lane threads live as long as the engine and wait here for each wave
+    pthread_mutex_t mutex;
+    pthread_cond_t wave_cond;
+    pthread_cond_t done_cond;
+    uint64_t wave_gen;
+    uint32_t lanes_busy;
+    uint32_t threads;
+    bool quit;
+
+    // Current wave, shared read-only with the lanes while they run
+    struct context *ctx;
+    uint64_t wave_start;
+    uint32_t wave_size;
+    uint64_t num_chunks;
+    struct chunk_slot *slots;
+    struct wd_binding wd;
+};
+
+/*
+    Called in chunk order for each completed chunk. Set *stop to discard the rest
+*/
+typedef CpaStatus (*chunk_accept_fn)(struct chunk_slot *slot, uint64_t chunk, bool *stop, void *arg);
+
+bool chunk_engine_enabled(struct context *ctx);
+CpaStatus chunk_engine_compress(struct context *ctx, struct sgl_container *sgls, uint64_t limit,
+        chunk_accept_fn accept, void *arg);
+uint64_t chunk_target_bucket(struct context *ctx);
+CpaStatus chunk_engine_run(struct context *ctx, struct sgl_container *sgls);
+void chunk_engine_free(struct chunk_engine *eng);
+void chunk_engine_print_stats();
@@ -2,6 +2,9 @@
 #include "main.h"
 #include "context.h"
 #include "buf_handler.h"
+#include "lpt_sched.h"
+#include "health.h"
+#include "pipeline.h"
 
 #ifdef MG_UNIT_TEST
 #include "mg_unit_test.h"
@@ -19,6 +22,9 @@ extern FILE *g_log_fd;
 
 uint64_t g_q_size;
 bool g_draining_q;
+
+// One FIFO per scheduling class. Without --lpt everything is class 0
+static TAILQ_HEAD(ctx_q, context) g_ctx_q[SCHED_CLASSES];
 pthread_mutex_t queue_mutex;
 pthread_mutex_t queue_size_mutex;
 
@@ -52,7 +58,10 @@ void ctx_init()
     g_q_size = 0;
     g_draining_q = false;
 
-    TAILQ_INIT(&tailq_head);
+    for (uint32_t i = 0; i < SCHED_CLASSES; i++)
+    {
+        TAILQ_INIT(&g_ctx_q[i]);
+    }
 }
 
 /*
@@ -102,6 +111,9 @@ struct context *create_ctx(struct mg_options *opts, Cpa32U id)
     ctx->underflow = opts->underflow;
     ctx->debug = opts->debug;
     ctx->zlibcompare = opts->zlibcompare;
+    ctx->chunk_inflight = opts->chunk_inflight;
+    ctx->chunk_instances = opts->chunk_instances;
+    ctx->sig = CTX_SIG_INIT;
 
     return ctx;
 }
@@ -118,7 +130,7 @@ struct context *create_ctx(struct mg_options *opts, Cpa32U id)
     Parameters:
 
         ctx     -   Ptr to the context
-        sgls    -   Ptr to the sgl container to determine instance
+        sgls    -   Ptr to the sgl container it ran with
 
     Return:
 
@@ -128,11 +140,20 @@ void free_ctx(struct context *ctx, struct sgl_container *sgls)
 {
     uint32_t iNum;
 
-    iNum = sgls->t_id % numDcInstances_g;
+    (void)sgls;
+    iNum = ctx->inst;
+
+    health_ctx_done(ctx);
+
+    if (ctx->pooled) {
+        free(ctx->flush_pts);
+        free(ctx);
+        return;
+    }
 
     cpaDcRemoveSession(dcInstances_g[iNum], ctx->sessCprHandle);
     qaeMemFreeNUMA((void**)&(ctx->sessCprHandle));
-    cpaDcRemoveSession(dcInstances_g[iNum], ctx->sessDcprHandle);
+    cpaDcRemoveSession(dcInstances_g[ctx->dcpr_inst], ctx->sessDcprHandle);
     qaeMemFreeNUMA((void**)&(ctx->sessDcprHandle));
 
 #ifdef DEBUG_CODE
@@ -145,10 +166,175 @@ void free_ctx(struct context *ctx, struct sgl_container *sgls)
     free(ctx->compare_mem);
     if(ctx->zlibcompare)
 	    free(ctx->zlib_mem);
+    free(ctx->flush_pts);
 
     free(ctx);
 }
 
+/*
+    Function:
+
+        ctx_redo
+
+    Description:
+
+        Copies a context's parameters into a fresh context, to run it again from the
+        start. Sessions, buffers and results are left for launch_ctx and meatjet. The
+        copy takes over the original's source reference and sweep. It has no stratum,
+        having been admitted already, and keeps the instance so health_pick can avoid it
+
+    Parameters:
+
+        ctx -   Ptr to the context to copy
+
+    Return:
+
+        Ptr to the new context, or NULL on allocation failure
+*/
+struct context *ctx_redo(struct context *ctx)
+{
+    struct context *redo;
+
+    redo = (struct context *)calloc(1, sizeof(struct context));
+    if (redo == NULL) {
+        return NULL;
+    }
+
+    redo->id = ctx->id;
+    redo->nodeId = ctx->nodeId;
+    redo->sessCprSetupData = ctx->sessCprSetupData;
+    redo->sessDcprSetupData = ctx->sessDcprSetupData;
+    redo->src_data = ctx->src_data;
+    redo->obs = ctx->obs;
+    redo->uf_ibc = ctx->uf_ibc;
+    redo->sig = CTX_SIG_INIT;
+    redo->sweep = ctx->sweep;
+    redo->pred_ns = ctx->pred_ns;
+    redo->decomp_only = ctx->decomp_only;
+    redo->underflow = ctx->underflow;
+    redo->debug = ctx->debug;
+    redo->zlibcompare = ctx->zlibcompare;
+    redo->chunk_inflight = ctx->chunk_inflight;
+    redo->chunk_instances = ctx->chunk_instances;
+    redo->inst = ctx->inst;
+    redo->failovers = ctx->failovers + 1;
+
+    return redo;
+}
+
+/*
+    Function:
+
+        ctx_add_flush_point
+
+    Description:
+
+        Records a full-flush boundary of the compressed stream. Only meaningful for
+        stateless sessions, where every request stands alone
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        cpr_off -   Compressed bytes produced up to the boundary
+        src_off -   Source bytes consumed up to the boundary
+
+    Return:
+
+        none
+*/
+void ctx_add_flush_point(struct context *ctx, uint64_t cpr_off, uint64_t src_off)
+{
+    if (ctx->num_flush_pts == ctx->max_flush_pts) {
+        struct flush_point *tmp;
+        uint32_t new_max = ctx->max_flush_pts ? (ctx->max_flush_pts * 2) : 64;
+
+        tmp = (struct flush_point *)realloc(ctx->flush_pts, new_max * sizeof(struct flush_point));
+        if (tmp == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Failed to grow flush point list, parallel verify disabled for ctx %lu\n", ctx->id);
+            free(ctx->flush_pts);
+            ctx->flush_pts = NULL;
+            ctx->num_flush_pts = 0;
+            ctx->max_flush_pts = 0;
+            return;
+        }
+
+        ctx->flush_pts = tmp;
+        ctx->max_flush_pts = new_max;
+    }
+
+    ctx->flush_pts[ctx->num_flush_pts].cpr_off = cpr_off;
+    ctx->flush_pts[ctx->num_flush_pts].src_off = src_off;
+    ctx->num_flush_pts++;
+}
+
+static Cpa32U sig_class(Cpa32U n, Cpa32U full)
+{
+    if (n == 0) {
+        return 0;
+    }
+
+    return (n >= full) ? 2 : 1;
+}
+
+/*
+    Function:
+
+        ctx_sig_add
+
+    Description:
+
+        Folds one request into the context's signature. Byte counts only
+        enter as none/partial/all of what the request was offered, so two contexts
+        share a signature when every request took the same path, even if the exact
+        OBS or IBC differed
+
+    Parameters:
+
+        ctx         -   Ptr to the context
+        job_size    -   Source bytes submitted
+        dest_len    -   Dest buffer length offered
+        flush       -   Flush flag of the request
+        res         -   Ptr to the request's results
+
+    Return:
+
+        none
+*/
+void ctx_sig_add(struct context *ctx, Cpa32U job_size, Cpa32U dest_len, Cpa32U flush, CpaDcRqResults *res)
+{
+    ctx_sig_mark(ctx, (sig_class(res->consumed, job_size) << 8) | sig_class(res->produced, dest_len));
+    ctx_sig_mark(ctx, flush);
+    ctx_sig_mark(ctx, (Cpa32U)res->status);
+}
+
+/*
+    Function:
+
+        ctx_sig_mark
+
+    Description:
+
+        Folds one value into the context's signature (FNV-1a), for anything the
+        requests alone don't show: chunks done before the serial loop, final result
+
+    Parameters:
+
+        ctx -   Ptr to the context
+        v   -   Value to fold in
+
+    Return:
+
+        none
+*/
+void ctx_sig_mark(struct context *ctx, Cpa32U v)
+{
+    for (uint32_t i = 0; i < sizeof(v); i++)
+    {
+        ctx->sig ^= (v >> (i * 8)) & 0xff;
+        ctx->sig *= 0x100000001b3ULL;
+    }
+}
+
 /*
     Function:
 
@@ -227,7 +413,9 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
 {
     CpaStatus status;
     uint32_t iNum;
+    uint32_t dNum;
     uint32_t sess_size;
+    uint32_t dcpr_sess_size;
     uint32_t ctx_size;
 
     if (ctx == NULL)
@@ -236,7 +424,9 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
         return CPA_STATUS_FAIL;
     }
 
-    iNum = sgls->t_id % numDcInstances_g;
+    // The thread's own instance, unless it is quarantined
+    iNum = health_pick(ctx, sgls->t_id % numDcInstances_g);
+    dNum = pipeline_peer(ctx);
 
     //
     // Setup session handle
@@ -247,7 +437,7 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
         MG_LOG_PRINT(g_log_fd, "Error: could not get session size!\n");
         return status;
     }
-    status = cpaDcGetSessionSize(dcInstances_g[iNum], &(ctx->sessDcprSetupData), &sess_size, &ctx_size);
+    status = cpaDcGetSessionSize(dcInstances_g[dNum], &(ctx->sessDcprSetupData), &dcpr_sess_size, &ctx_size);
     if (status != CPA_STATUS_SUCCESS)
     {
         MG_LOG_PRINT(g_log_fd, "Error: could not get session size!\n");
@@ -261,7 +451,7 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
         MG_LOG_PRINT(g_log_fd, "Error: could not allocate space for session handle!\n");
         return CPA_STATUS_FAIL;
     }
-    ctx->sessDcprHandle = (CpaDcSessionHandle) qaeMemAllocNUMA(sess_size, ctx->nodeId, BYTE_ALIGNMENT_64);
+    ctx->sessDcprHandle = (CpaDcSessionHandle) qaeMemAllocNUMA(dcpr_sess_size, ctx->nodeId, BYTE_ALIGNMENT_64);
     if (ctx->sessDcprHandle == NULL)
     {
         MG_LOG_PRINT(g_log_fd, "Error: could not allocate space for session handle!\n");
@@ -285,7 +475,7 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
         MG_LOG_PRINT(g_log_fd, "Error: could not initialize session\n");
         return status;
     }
-    status = cpaDcInitSession(dcInstances_g[iNum],
+    status = cpaDcInitSession(dcInstances_g[dNum],
                               ctx->sessDcprHandle,
                               &(ctx->sessDcprSetupData),
                               sgls->context_sgl,
@@ -302,6 +492,11 @@ CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls)
     // Allocate memory for dest/compare buffers in DRAM
     //
 
+    // A streamed file's buffers are the window stream_run() allocates
+    if (ctx->src_data->backing == SRC_MEM_STREAMED) {
+        return status;
+    }
+
     if (ctx->decomp_only) {
         ctx->dest_mem    = (Cpa8U *)calloc(1, ctx->src_data->dcpr_size);
         ctx->compare_mem = (Cpa8U *)calloc(1, ctx->src_data->dcpr_size);
@@ -377,10 +572,45 @@ static void guard_q_size()
 */
 void enq_ctx(struct context *ctx)
 {
+    ctx->q_class = sched_class(ctx);
+
     guard_q_size();
 
     pthread_mutex_lock(&queue_mutex);
-    TAILQ_INSERT_TAIL(&tailq_head, ctx, entries);
+    TAILQ_INSERT_TAIL(&g_ctx_q[ctx->q_class], ctx, entries);
+
+    pthread_mutex_lock(&queue_size_mutex);
+    g_q_size++;
+    pthread_mutex_unlock(&queue_size_mutex);
+
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+/*
+    Function:
+
+        requeue_ctx
+
+    Description:
+
+        Puts a context at the front of the Q. For consumers issuing follow-up work:
+        it skips the size guard, since a consumer waiting for the Q to drain would be
+        waiting on itself
+
+    Parameters:
+
+        ctx -   Ptr to context to enq
+
+    Return:
+
+        none
+*/
+void requeue_ctx(struct context *ctx)
+{
+    ctx->q_class = sched_class(ctx);
+
+    pthread_mutex_lock(&queue_mutex);
+    TAILQ_INSERT_HEAD(&g_ctx_q[ctx->q_class], ctx, entries);
 
     pthread_mutex_lock(&queue_size_mutex);
     g_q_size++;
@@ -396,7 +626,8 @@ void enq_ctx(struct context *ctx)
 
     Description:
 
-        Dequeues a context; Responsible for letting producer thd know when Q has space again
+        Dequeues a context from the highest non-empty class; Responsible for letting
+        producer thd know when Q has space again
 
     Parameters:
 
@@ -408,17 +639,25 @@ void enq_ctx(struct context *ctx)
 */
 struct context *deq_ctx()
 {
-    struct context *ctx;
+    struct context *ctx = NULL;
+    int cls;
 
     pthread_mutex_lock(&queue_mutex);
 
-    ctx = tailq_head.tqh_first;
+    for (cls = SCHED_CLASSES - 1; cls >= 0; cls--)
+    {
+        ctx = g_ctx_q[cls].tqh_first;
+        if (ctx != NULL) {
+            break;
+        }
+    }
+
     if (ctx == NULL) {
         pthread_mutex_unlock(&queue_mutex);
         return ctx;
     }
 
-    TAILQ_REMOVE(&tailq_head, ctx, entries);
+    TAILQ_REMOVE(&g_ctx_q[cls], ctx, entries);
 
     pthread_mutex_lock(&queue_size_mutex);
 
@@ -434,3 +673,31 @@ struct context *deq_ctx()
 
     return ctx;
 }
+
+/*
+    Function:
+
+        ctx_q_empty
+
+    Description:
+
+        Checks whether any context is waiting in the Q
+
+    Parameters:
+
+        none
+
+    Return:
+
+        true if the Q is empty
+*/
+bool ctx_q_empty()
+{
+    bool empty;
+
+    pthread_mutex_lock(&queue_size_mutex);
+    empty = (g_q_size == 0);
+    pthread_mutex_unlock(&queue_size_mutex);
+
+    return empty;
+}
@@ -6,10 +6,18 @@
 #include "cpa_dc.h"
 #include "main.h"
 #include "cpr.h"
+#include "par_inflate.h"
 
 #define MAX_Q_SIZE      (32768)
 #define DRAIN_Q_SIZE    (8192)
 
+// FNV-1a basis for a context's result signature
+#define CTX_SIG_INIT    (0xcbf29ce484222325ULL)
+
+struct adaptive_sweep;
+struct sample_stratum;
+struct pipe_state;
+
 struct swresults {
     int status;
     uint32_t size;
@@ -46,22 +54,59 @@ struct context {
 
     struct swresults zlib_results;
 
+    // Full-flush boundaries of a stateless compression, for parallel verification
+    struct flush_point *flush_pts;
+    uint32_t num_flush_pts;
+    uint32_t max_flush_pts;
+
+    // Hash of every compression request's outcome, for adaptive sweeps
+    uint64_t sig;
+    struct adaptive_sweep *sweep;
+
+    // Stratum this context was drawn from, for --budget/--duration sampling
+    struct sample_stratum *stratum;
+
+    // Predicted run time and the queue class it put the context in, for --lpt
+    uint64_t pred_ns;
+    uint32_t q_class;
+
 
     bool decomp_only;
     bool underflow;
     bool debug;
     uint32_t zlibcompare;
 
+    uint32_t chunk_inflight;
+    uint32_t chunk_instances;
+
+    // Instance the context runs on, chosen by health_pick when it is launched, and the one
+    // its decompression session is on: the same, or a second one with --pipeline
+    uint32_t inst;
+    uint32_t dcpr_inst;
+    bool inst_probe;
+    uint32_t inst_errs;
+    uint32_t failovers;
+
+    // Sessions and buffers belong to the worker's small-input pool (--small), not the context
+    bool pooled;
+
+    // Set while pipeline_run has a decompressor following the compression
+    struct pipe_state *pipe;
+
     TAILQ_ENTRY(context) entries;
 };
 
 void ctx_init();
 struct context *create_ctx(struct mg_options *opts, Cpa32U id);
 void free_ctx(struct context *ctx, struct sgl_container *sgls);
+struct context *ctx_redo(struct context *ctx);
 void fill_ctx_sess(struct context *c, Cpa32U compLvl, Cpa32U huffType, Cpa32U sessState, Cpa32U deflateWindowSize);
 CpaStatus launch_ctx(struct context *ctx, struct sgl_container *sgls);
+void ctx_add_flush_point(struct context *ctx, uint64_t cpr_off, uint64_t src_off);
+void ctx_sig_add(struct context *ctx, Cpa32U job_size, Cpa32U dest_len, Cpa32U flush, CpaDcRqResults *res);
+void ctx_sig_mark(struct context *ctx, Cpa32U v);
 uint32_t calculate_num_buf(uint32_t file_size, uint32_t buf_size);
 void enq_ctx(struct context *ctx);
+void requeue_ctx(struct context *ctx);
 struct context *deq_ctx();
-
-TAILQ_HEAD(, context) tailq_head;
+bool ctx_q_empty();
@@ -2,7 +2,29 @@
 #include "context.h"
 #include "buf_handler.h"
 #include "meatjet.h"
+#include "chunk_engine.h"
+#include "prefix_cache.h"
+#include "obs_prune.h"
+#include "adaptive_sweep.h"
+#include "sample_plan.h"
+#include "lvl_probe.h"
+#include "readahead.h"
+#include "dir_scan.h"
+#include "lpt_sched.h"
+#include "dedup.h"
+#include "pack.h"
+#include "stream.h"
+#include "input_gen.h"
+#include "credit.h"
+#include "watchdog.h"
+#include "health.h"
+#include "small_batch.h"
+#include "pipeline.h"
+#include "mix.h"
 #include <zlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #ifdef DEBUG_CODE
 Cpa32U g_alloc;
@@ -15,6 +37,28 @@ pthread_mutex_t of_mutex;
 
 bool g_all_ctx_created = false;
 pthread_t mg_threads[MAX_THREAD_COUNT];
+static struct sgl_container *g_probe_sgls;
+
+#if !defined(COLETO_CREEK) && !defined(CPM17) && !defined(CPM18)
+// Found by lvl_probe_run() on platforms without a compile-time level table
+static uint16_t g_probed_lvl_mask;
+static uint8_t g_probed_lvls;
+#endif
+
+// Loaded by the producer or the read-ahead threads
+static struct {
+    pthread_mutex_t mutex;
+    uint64_t files;
+    uint64_t mapped;
+    uint64_t packed;
+    uint64_t streamed;
+    uint64_t generated;
+    uint64_t bytes;
+    uint64_t ns;
+} g_load_stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, 0 };
+
+static CpaStatus init_sgl_mem(struct sgl_container *sgls);
+static void free_sgls(struct sgl_container *sgls);
 extern CpaInstanceHandle *dcInstances_g;
 extern Cpa16U numDcInstances_g;
 extern FILE *g_log_fd;
@@ -139,8 +183,184 @@ static void threads_join(uint32_t threads)
 
     for (uint32_t i = 0; i < threads; i++)
     {
-        pthread_join(mg_threads[i], NULL);
+        // With --abandon, mg_threads[i] may have been replaced; this waits for the current one,
+        // and there is none to join if the replacement couldn't be started
+        if (wd_wait_exit(i)) {
+            pthread_join(mg_threads[i], NULL);
+        }
+    }
+}
+
+/*
+    Function:
+
+        abandon_worker (static)
+
+    Description:
+
+        Watchdog callback for a stalled context under --abandon. Writes off the credits
+        the stuck worker holds and counts the stall against the instance its overdue
+        request went to, which --health quarantines. The context runs again from a copy on another instance if health
+        allows it, otherwise it is failed in place of its worker. The worker is detached
+        and a replacement started with the same thread id; health_pick keeps it off the
+        quarantined instance. If the stuck worker ever comes back it frees the context
+        and exits
+
+    Parameters:
+
+        t_id    -   Thread id of the stuck worker
+        ctx     -   Ptr to its context
+        inst    -   Instance the overdue request went to
+
+    Return:
+
+        true if the replacement worker was started
+*/
+static bool abandon_worker(uint32_t t_id, struct context *ctx, uint32_t inst)
+{
+    struct context *redo = NULL;
+    pthread_t thread;
+    int *id;
+
+    credit_write_off(t_id);
+
+    // The copy takes a source reference of its own, the stuck worker still holds the original's
+    if (health_stall(ctx, inst)) {
+        redo = ctx_redo(ctx);
+    }
+
+    if (redo) {
+        pthread_mutex_lock(&ctx->src_data->src_mutex);
+        ctx->src_data->ref_count++;
+        ctx->src_data->orig_ref_count++;
+        pthread_mutex_unlock(&ctx->src_data->src_mutex);
+
+        MG_LOG_PRINT(g_log_fd, "Running ctx %lu again after it stalled on instance %u\n", ctx->id, inst);
+        requeue_ctx(redo);
+    } else {
+        ctx->src_data->fail_count++;
+
+        // The sweep can't finish without this point
+        if (ctx->sweep) {
+            adaptive_sweep_report(ctx, CPA_STATUS_FAIL);
+        }
+    }
+
+    id = (int *)calloc(1, sizeof(int));
+    if (id == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate a replacement for thread %u, the other workers take its contexts\n", t_id);
+        pthread_detach(mg_threads[t_id]);
+        return false;
+    }
+    *id = t_id;
+
+    if (pthread_create(&thread, NULL, cpr_thread_entry, id) != 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not start a replacement for thread %u, the other workers take its contexts\n", t_id);
+        free(id);
+        pthread_detach(mg_threads[t_id]);
+        return false;
+    }
+
+    pthread_detach(mg_threads[t_id]);
+    mg_threads[t_id] = thread;
+
+    return true;
+}
+
+/*
+    Function:
+
+        map_src_file (static)
+
+    Description:
+
+        Maps a source file read-only and shared with the page cache, so threads share
+        one copy and forked processes (-p) share the cached pages instead of each
+        reading into a private buffer. MAP_POPULATE faults it all in up front, like
+        the fread it replaces. QAT never sees src_mem: every request goes through
+        copy_mem_to_sgl() into the pinned SGL buffers first, so nothing here needs to
+        be DMA-able
+
+    Parameters:
+
+        filename    -   File to map
+        size        -   Size of the file
+        huge        -   Ask for transparent huge pages on the mapping. The mapping is
+                        shared with the page cache, so this only helps where the
+                        filesystem backs it with huge pages (tmpfs huge=advise, or
+                        read-only file THP collapsing it later); elsewhere it is a no-op
+
+    Return:
+
+        Ptr to the mapping, or NULL if the file could not be mapped
+*/
+static Cpa8U *map_src_file(char *filename, size_t size, bool huge)
+{
+    void *mem;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    mem = mmap(NULL, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Every context reads the whole file, and many at once, so the hints are about keeping it resident
+    madvise(mem, size, MADV_WILLNEED);
+    madvise(mem, size, MADV_DONTDUMP);
+    if (huge) {
+        if (madvise(mem, size, MADV_HUGEPAGE) != 0) {
+            MG_LOG_PRINT(g_log_fd, "Info: no huge pages for [%s], using normal pages\n", filename);
+        }
+    }
+
+    return (Cpa8U *)mem;
+}
+
+/*
+    Function:
+
+        free_src_mem (static)
+
+    Description:
+
+        Releases the source buffer, whichever way it was loaded, and gives its bytes
+        back to the --readahead cap
+
+    Parameters:
+
+        src -   Ptr to the source data
+
+    Return:
+
+        none
+*/
+static void free_src_mem(struct src_data *src)
+{
+    switch (src->backing)
+    {
+        case SRC_MEM_MAPPED:
+            munmap(src->src_mem, src->file_size);
+            break;
+        case SRC_MEM_PACK:
+            // Points into the pack, which is unmapped once the run is over
+            break;
+        case SRC_MEM_STREAMED:
+            // Never loaded
+            break;
+        default:
+            free(src->src_mem);
+            break;
     }
+
+    src->src_mem = NULL;
+    readahead_release(src);
 }
 
 /*
@@ -150,52 +370,280 @@ static void threads_join(uint32_t threads)
 
     Description:
 
-        Allocates space for the source data, copies data from a file into mem buf, and inits members
+        Allocates space for the source data, copies data from a file into mem buf, and inits members.
+        With --mmap the file is mapped instead of read, falling back to the read if mapping fails.
+        A file bigger than the --stream window isn't loaded at all
 
     Parameters:
 
         filename    -   File from which to read data
-        decomp_only -   Decomp only?
+        opts        -   Ptr to the command line options struct
 
     Return:
 
         Pointer to the newly created src_data struct
 */
-static struct src_data *create_src_data(char *filename, bool decomp_only)
+static struct src_data *create_src_data(char *filename, struct mg_options *opts)
 {
     FILE *fd;
     struct src_data *src;
+    uint64_t start = now_ns();
 
     src = (struct src_data *)calloc(1, sizeof(struct src_data));
+    if (src == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Unable to allocate src_data!\n");
+        return NULL;
+    }
 
     strncpy(src->filename, filename, MAX_FILE_LEN);
     src->file_size = get_file_size(filename);
 
-    src->src_mem = (Cpa8U *)calloc(1, src->file_size);
+    if (stream_wanted(opts, src->file_size)) {
+        src->backing = SRC_MEM_STREAMED;
+        src->stream_path = src->filename;
+        src->stream_off = 0;
+    } else if (opts->src_mmap && src->file_size) {
+        src->src_mem = map_src_file(filename, src->file_size, opts->src_huge);
+        if (src->src_mem != NULL) {
+            src->backing = SRC_MEM_MAPPED;
+        }
+    }
+
+    if (src->src_mem == NULL && src->backing != SRC_MEM_STREAMED) {
+        src->src_mem = (Cpa8U *)calloc(1, src->file_size);
+        if (src->src_mem == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Unable to allocate src_mem data!\n");
+            free(src);
+            return NULL;
+        }
+
+        fd = fopen(filename, "r");
+        if (fd == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Could not open [%s]!\n", filename);
+            free(src->src_mem);
+            free(src);
+            return NULL;
+        }
+
+        if (fread(src->src_mem, 1, src->file_size, fd) != src->file_size)
+        {
+            MG_LOG_PRINT(g_log_fd, "Could not read all source data from file!\n");
+            fclose(fd);
+            free(src->src_mem);
+            free(src);
+            return NULL;
+        }
+
+        fclose(fd);
+    }
+
+    pthread_mutex_init(&(src->src_mutex), NULL);
+
+    if (opts->decomp_only) {
+        src->dcpr_size = calc_dcpr_size(src);
+    }
+
+    pthread_mutex_lock(&g_load_stats.mutex);
+    g_load_stats.files++;
+    g_load_stats.mapped += (src->backing == SRC_MEM_MAPPED);
+    g_load_stats.streamed += (src->backing == SRC_MEM_STREAMED);
+    g_load_stats.bytes += (src->backing == SRC_MEM_STREAMED) ? 0 : src->file_size;
+    g_load_stats.ns += now_ns() - start;
+    pthread_mutex_unlock(&g_load_stats.mutex);
+
+    return src;
+}
+
+/*
+    Function:
+
+        create_pack_src_data
+
+    Description:
+
+        Creates the src_data for a pack entry. src_mem points straight into the
+        pack's mapping, so nothing is read or copied, and the sizes and CRC come
+        from the index
+
+    Parameters:
+
+        pack    -   Ptr to the open pack
+        idx     -   Entry in the pack's index
+        opts    -   Ptr to the command line options struct
+
+    Return:
+
+        Pointer to the newly created src_data struct
+*/
+static struct src_data *create_pack_src_data(struct pack *pack, uint32_t idx, struct mg_options *opts)
+{
+    struct pack_entry *e = &pack->entries[idx];
+    struct src_data *src;
+
+    src = (struct src_data *)calloc(1, sizeof(struct src_data));
+    if (src == NULL) {
+        return NULL;
+    }
+
+    snprintf(src->filename, MAX_FILE_LEN, "%s:%s", pack->path, pack->names + e->name_off);
+    src->file_size = e->size;
+
+    if (stream_wanted(opts, src->file_size)) {
+        src->backing = SRC_MEM_STREAMED;
+        src->stream_path = pack->path;
+        src->stream_off = e->offset;
+    } else {
+        src->src_mem = pack->map + e->offset;
+        src->backing = SRC_MEM_PACK;
+    }
+
+    pthread_mutex_init(&(src->src_mutex), NULL);
+
+    if (opts->decomp_only) {
+        if (e->dcpr_size) {
+            src->dcpr_size = e->dcpr_size;
+            src->clear_crc32 = e->dcpr_crc32;
+            src->has_clear_crc = true;
+        } else {
+            src->dcpr_size = calc_dcpr_size(src);
+        }
+    } else {
+        src->clear_crc32 = e->crc32;
+        src->has_clear_crc = true;
+    }
+
+    pthread_mutex_lock(&g_load_stats.mutex);
+    g_load_stats.files++;
+    g_load_stats.packed++;
+    g_load_stats.streamed += (src->backing == SRC_MEM_STREAMED);
+    g_load_stats.bytes += (src->backing == SRC_MEM_STREAMED) ? 0 : src->file_size;
+    pthread_mutex_unlock(&g_load_stats.mutex);
+
+    return src;
+}
+
+/*
+    Function:
+
+        create_gen_src_data (static)
+
+    Description:
+
+        Creates the src_data for a generated input. The filename is the canonical
+        spec, so a failure's logs say how to make the same bytes again
+
+    Parameters:
+
+        name    -   Canonical spec from the file list
+
+    Return:
+
+        Pointer to the newly created src_data struct
+*/
+static struct src_data *create_gen_src_data(char *name)
+{
+    struct input_gen_spec spec;
+    struct src_data *src;
+    uint64_t start = now_ns();
+
+    if (input_gen_parse(name, 0, &spec) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Input gen: could not parse [%s]\n", name);
+        return NULL;
+    }
+
+    src = (struct src_data *)calloc(1, sizeof(struct src_data));
+    if (src == NULL) {
+        return NULL;
+    }
+
+    strncpy(src->filename, name, MAX_FILE_LEN - 1);
+    src->file_size = spec.size;
+    src->backing = SRC_MEM_GENERATED;
+
+    src->src_mem = (Cpa8U *)malloc(src->file_size);
     if (src->src_mem == NULL) {
         MG_LOG_PRINT(g_log_fd, "Unable to allocate src_mem data!\n");
         free(src);
         return NULL;
     }
 
+    input_gen_fill(&spec, src->src_mem);
+
     pthread_mutex_init(&(src->src_mutex), NULL);
 
-    fd = fopen(filename, "r");
+    pthread_mutex_lock(&g_load_stats.mutex);
+    g_load_stats.files++;
+    g_load_stats.generated++;
+    g_load_stats.bytes += src->file_size;
+    g_load_stats.ns += now_ns() - start;
+    pthread_mutex_unlock(&g_load_stats.mutex);
 
-    if (fread(src->src_mem, 1, src->file_size, fd) != src->file_size)
-    {
-        MG_LOG_PRINT(g_log_fd, "Could not read all source data from file!\n");
-        free(src->src_mem);
-        free(src);
-        return NULL;
+    return src;
+}
+
+/*
+    Function:
+
+        load_src_data (static)
+
+    Description:
+
+        Loads one entry of the file list, from its pack, its generator or its file
+
+    Parameters:
+
+        list    -   Ptr to the file list
+        idx     -   Index into the list
+        opts    -   Ptr to the command line options struct
+
+    Return:
+
+        Pointer to the newly created src_data struct
+*/
+static struct src_data *load_src_data(struct file_list *list, uint32_t idx, struct mg_options *opts)
+{
+    if (list->pack) {
+        return create_pack_src_data(list->pack, list->pack_idx[idx], opts);
     }
 
-    fclose(fd);
+    if (list->gen) {
+        return create_gen_src_data(list->paths[idx]);
+    }
 
-    if (decomp_only) {
-        src->dcpr_size = calc_dcpr_size(src);
+    return create_src_data(list->paths[idx], opts);
+}
+
+/*
+    Function:
+
+        failed_src_data (static)
+
+    Description:
+
+        Stands in for a file that could not be loaded, so the summary and exit status
+        still count it. It has no data and never gets contexts
+
+    Parameters:
+
+        filename    -   The file's name in the list
+
+    Return:
+
+        Pointer to the placeholder, or NULL if even that could not be allocated
+*/
+static struct src_data *failed_src_data(char *filename)
+{
+    struct src_data *src;
+
+    src = (struct src_data *)calloc(1, sizeof(struct src_data));
+    if (src == NULL) {
+        return NULL;
     }
 
+    strncpy(src->filename, filename, MAX_FILE_LEN - 1);
+    src->load_failed = true;
+    src->fail_count = 1;
+
     return src;
 }
 
@@ -235,7 +683,7 @@ static void decrement_src_ref(struct src_data *s)
     ref--;
 
     if (ref % 2000 == 0) {
-        pct = (ref/(s->orig_ref_count*1.0))*100;
+        pct = s->orig_ref_count ? (ref/(s->orig_ref_count*1.0))*100 : 0.0;
         MG_LOG_PRINT(g_log_fd, "Context Update: %u of %u (%.3f%%) remaining for [%s]\n",
                 ref, s->orig_ref_count, pct, s->filename);
     }
@@ -243,7 +691,9 @@ static void decrement_src_ref(struct src_data *s)
     if (ref == 0) {
         MG_LOG_PRINT(g_log_fd, "Source data [%s] has 0 ctx references. Freeing memory\n", s->filename);
         s->ref_count = ref;
-        free(s->src_mem);
+        free_src_mem(s);
+        prefix_cache_free(s->prefix_cache);
+        s->prefix_cache = NULL;
         pthread_mutex_unlock(&(s->src_mutex));
         pthread_mutex_destroy(&(s->src_mutex));
         //free(s);
@@ -255,6 +705,50 @@ static void decrement_src_ref(struct src_data *s)
     pthread_mutex_unlock(&(s->src_mutex));
 }
 
+/*
+    Function:
+
+        get_probe_sgls
+
+    Description:
+
+        SGLs for work the producer does itself before building contexts (OBS
+        profiles, the level probe). Allocated on first use, on thread 0's instance
+
+    Parameters:
+
+        none
+
+    Return:
+
+        Ptr to the producer's sgl container, or NULL if it could not be set up
+*/
+static struct sgl_container *get_probe_sgls()
+{
+    struct sgl_container *sgls;
+
+    if (g_probe_sgls != NULL) {
+        return g_probe_sgls;
+    }
+
+    sgls = (struct sgl_container *)calloc(1, sizeof(struct sgl_container));
+    if (sgls == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate producer SGLs\n");
+        return NULL;
+    }
+
+    if (init_sgl_mem(sgls) != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not initialize producer SGLs\n");
+        free_sgls(sgls);
+        free(sgls);
+        return NULL;
+    }
+
+    g_probe_sgls = sgls;
+
+    return g_probe_sgls;
+}
+
 /*
     Function:
 
@@ -267,7 +761,8 @@ static void decrement_src_ref(struct src_data *s)
         driver are redundant -- only to match gzip API. We want to run the minimum
         number of levels to achieve 100% coverage.
 
-        Refer to dc_session.c to see how they are mapped for each IP
+        Refer to dc_session.c to see how they are mapped for each IP. Builds without
+        a PROJ table use the grouping lvl_probe_run() found at startup, if any
 
     Parameters:
 
@@ -323,9 +818,15 @@ static uint8_t create_cpr_lvl_mask(uint16_t *mask, struct mg_options *opt)
     total = 5;
 
 #else
-    // DEFAULT: just do all contexts to be safe
-    tmp = 0x3FE;    // 0011 1111 1110
-    total = 9;
+    if (g_probed_lvl_mask) {
+        // Discovered at startup by lvl_probe_run()
+        tmp = g_probed_lvl_mask;
+        total = g_probed_lvls;
+    } else {
+        // DEFAULT: just do all contexts to be safe
+        tmp = 0x3FE;    // 0011 1111 1110
+        total = 9;
+    }
 #endif
 
     // If a specific compression level was passed in via CL...
@@ -452,33 +953,144 @@ static void build_underflow_ctx_list(struct mg_options *opt, struct src_data *s)
 /*
     Function:
 
-        build_overflow_ctx_list
+        build_pruned_overflow_ctx_list
 
     Description:
 
-        Initializes the source data for each file. Then goes and creates all of the
-        necessary contexts at the appropriate overflow points, and enqueues them for
-        the consumer threads to pull off and churn through
-
-        Primary CTX producer
+        Overflow producer for --obs-prune. Profiles every (level, huffman) key of the
+        file on the producer's own instance first, so the file's ref count can be set
+        from the pruned sweeps before any context is enqueued. A key whose profile
+        fails keeps its full sweep
 
     Parameters:
 
-        opt -   Ptr to the command line options struct
+        opt         -   Ptr to the command line options struct
+        s           -   Ptr to the source data
+        start_obs   -   First OBS of the unpruned sweep
+        end_obs     -   Last OBS of the unpruned sweep
+        obs_step    -   OBS step
 
     Return:
 
         none
 */
-static void build_overflow_ctx_list(struct mg_options *opt, struct src_data *s)
+static void build_pruned_overflow_ctx_list(struct mg_options *opt, struct src_data *s,
+        uint32_t start_obs, uint32_t end_obs, uint32_t obs_step)
 {
-    uint32_t OBS_STEP = 1;
-
+    const Cpa32U huff_types[2] = { CPA_DC_HT_STATIC, CPA_DC_HT_FULL_DYNAMIC };
+    uint32_t *points[OBS_PRUNE_LEVELS][2] = {};
+    uint32_t num_points[OBS_PRUNE_LEVELS][2] = {};
     uint64_t id = 0;
+    uint64_t total = 0;
     struct context *ctx;
-    uint32_t num_obs;
-    uint32_t start_obs;
-    uint32_t end_obs;
+    uint16_t cpr_lvl_mask;
+
+    create_cpr_lvl_mask(&cpr_lvl_mask, opt);
+
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        if (((cpr_lvl_mask >> cpr_lvl) & 1) == 0) {
+            continue;
+        }
+
+        for (int h = 0; h < 2; h++)
+        {
+            struct obs_profile prof;
+            struct sgl_container *probe_sgls;
+            CpaStatus status;
+
+            if ((h == 0 && opt->dynamic_only) || (h == 1 && opt->static_only)) {
+                continue;
+            }
+
+            probe_sgls = get_probe_sgls();
+            if (probe_sgls == NULL) {
+                status = CPA_STATUS_RESOURCE;
+                memset(&prof, 0, sizeof(prof));
+            } else {
+                status = obs_profile_measure(opt, s, probe_sgls, cpr_lvl, huff_types[h], &prof);
+            }
+            if (status != CPA_STATUS_SUCCESS) {
+                MG_LOG_PRINT(g_log_fd, "OBS profile failed for [%s] level %u (status %d), running the full sweep\n",
+                        s->filename, cpr_lvl, status);
+                num_points[cpr_lvl][h] = obs_prune_points(NULL, start_obs, end_obs, obs_step, &points[cpr_lvl][h]);
+            } else {
+                num_points[cpr_lvl][h] = obs_prune_points(&prof, start_obs, end_obs, obs_step, &points[cpr_lvl][h]);
+
+                MG_LOG_PRINT(g_log_fd, "OBS profile [%s] level %u %s: %lu bytes compressed, %u points kept\n",
+                        s->filename, cpr_lvl, h ? "DYNAMIC" : "STATIC", prof.offset[prof.num_reqs],
+                        num_points[cpr_lvl][h]);
+            }
+
+            obs_profile_free(&prof);
+            total += num_points[cpr_lvl][h];
+        }
+    }
+
+    s->ref_count = total;
+    s->orig_ref_count = s->ref_count;
+
+    MG_LOG_PRINT(g_log_fd, "Expected overflow contexts created for file [%s]: %u\n", s->filename, s->orig_ref_count);
+
+    // Same enqueue order as the unpruned sweep: level, then OBS, static before dynamic
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        uint32_t most = num_points[cpr_lvl][0] > num_points[cpr_lvl][1] ? num_points[cpr_lvl][0] : num_points[cpr_lvl][1];
+
+        for (uint32_t i = 0; i < most; i++)
+        {
+            for (int h = 0; h < 2; h++)
+            {
+                if (i >= num_points[cpr_lvl][h]) {
+                    continue;
+                }
+
+                ctx = create_ctx(opt, id++);
+                fill_ctx_sess(ctx, cpr_lvl, huff_types[h], opt->stateless ? CPA_DC_STATELESS : CPA_DC_STATEFUL, 7);
+                ctx->src_data = s;
+                ctx->obs = points[cpr_lvl][h][i];
+                enq_ctx(ctx);
+            }
+        }
+
+        free(points[cpr_lvl][0]);
+        free(points[cpr_lvl][1]);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "Total overflow contexts created for file [%s]: %lu\n\t(ref count: %u)\n",
+            s->filename, id, s->orig_ref_count);
+}
+
+/*
+    Function:
+
+        build_overflow_ctx_list
+
+    Description:
+
+        Initializes the source data for each file. Then goes and creates all of the
+        necessary contexts at the appropriate overflow points, and enqueues them for
+        the consumer threads to pull off and churn through
+
+        Primary CTX producer
+
+    Parameters:
+
+        opt -   Ptr to the command line options struct
+
+    Return:
+
+        none
+*/
+static void build_overflow_ctx_list(struct mg_options *opt, struct src_data *s)
+{
+    uint32_t OBS_STEP = 1;
+
+    uint64_t id = 0;
+    struct context *ctx;
+    uint32_t num_obs;
+    uint32_t start_obs;
+    uint32_t end_obs;
 
     uint8_t total_cpr_lvls;
     uint16_t cpr_lvl_mask;
@@ -519,6 +1131,11 @@ static void build_overflow_ctx_list(struct mg_options *opt, struct src_data *s)
         }
     }
 
+    if (opt->obs_prune && !opt->obs && !opt->decomp_only) {
+        build_pruned_overflow_ctx_list(opt, s, start_obs, end_obs, OBS_STEP);
+        return;
+    }
+
     if (!opt->dynamic_only && !opt->static_only) {
         num_obs *= 2;
     }
@@ -573,6 +1190,144 @@ static void build_overflow_ctx_list(struct mg_options *opt, struct src_data *s)
             s->filename, id, s->orig_ref_count);
 }
 
+/*
+    Function:
+
+        build_adaptive_ctx_list
+
+    Description:
+
+        Producer for --adaptive. Creates one sweep per (level, huffman) key over the
+        same OBS or IBC range the exhaustive producers would cover, sets the file's
+        ref count from the seeds, then enqueues them. The consumers issue the rest
+
+    Parameters:
+
+        opt -   Ptr to the command line options struct
+        s   -   Ptr to the source data
+
+    Return:
+
+        none
+*/
+static void build_adaptive_ctx_list(struct mg_options *opt, struct src_data *s)
+{
+    const Cpa32U huff_types[2] = { CPA_DC_HT_STATIC, CPA_DC_HT_FULL_DYNAMIC };
+    struct adaptive_sweep *sweeps[OBS_PRUNE_LEVELS][2] = {};
+    uint16_t cpr_lvl_mask;
+    uint32_t start;
+    uint32_t end;
+    uint32_t step;
+    uint32_t total = 0;
+
+    if (opt->underflow) {
+        start = MIN_IBC_VALUE;
+        end = s->file_size;
+        step = opt->ibc_step ? opt->ibc_step : 1;
+    } else {
+        start = MIN_OBS_VALUE;
+        end = s->file_size / 2;
+        step = opt->obs_step ? opt->obs_step : 1;
+    }
+
+    create_cpr_lvl_mask(&cpr_lvl_mask, opt);
+
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        if (((cpr_lvl_mask >> cpr_lvl) & 1) == 0) {
+            continue;
+        }
+
+        for (int h = 0; h < 2; h++)
+        {
+            if ((h == 0 && opt->dynamic_only) || (h == 1 && opt->static_only)) {
+                continue;
+            }
+
+            sweeps[cpr_lvl][h] = adaptive_sweep_create(opt, s, cpr_lvl, huff_types[h], start, end, step);
+            total += sweeps[cpr_lvl][h]->issued;
+        }
+    }
+
+    s->ref_count = total;
+    s->orig_ref_count = s->ref_count;
+
+    MG_LOG_PRINT(g_log_fd, "Adaptive %s sweep of [%s]: %u..%u step %u, %u seed contexts\n",
+            opt->underflow ? "IBC" : "OBS", s->filename, start, end < start ? start : end, step, total);
+
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        for (int h = 0; h < 2; h++)
+        {
+            if (sweeps[cpr_lvl][h]) {
+                adaptive_sweep_start(sweeps[cpr_lvl][h]);
+            }
+        }
+    }
+}
+
+/*
+    Function:
+
+        build_stream_ctx_list (static)
+
+    Description:
+
+        Producer for a --stream file. A sweep would stream the whole file once per
+        point, so there is one context per level/huffman, at the --obs or --ibc given
+        on the command line or with no forced overflow/underflow at all
+
+    Parameters:
+
+        opt -   Ptr to the command line options struct
+        s   -   Ptr to the source data
+
+    Return:
+
+        none
+*/
+static void build_stream_ctx_list(struct mg_options *opt, struct src_data *s)
+{
+    const Cpa32U huff_types[2] = { CPA_DC_HT_STATIC, CPA_DC_HT_FULL_DYNAMIC };
+    uint64_t id = 0;
+    uint8_t total_cpr_lvls;
+    uint16_t cpr_lvl_mask;
+    struct context *ctx;
+
+    total_cpr_lvls = create_cpr_lvl_mask(&cpr_lvl_mask, opt);
+
+    s->ref_count = total_cpr_lvls * ((!opt->dynamic_only && !opt->static_only) ? 2 : 1);
+    s->orig_ref_count = s->ref_count;
+
+    MG_LOG_PRINT(g_log_fd, "Streaming [%s] (%lu bytes): %u context(s), %s %u\n", s->filename, s->file_size,
+            s->orig_ref_count, opt->underflow ? "IBC" : "OBS", opt->underflow ? opt->ibc : opt->obs);
+
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        // Skip this compression level if it's not in the mask
+        if (((cpr_lvl_mask >> cpr_lvl) & 1) == 0) {
+            continue;
+        }
+
+        for (int h = 0; h < 2; h++)
+        {
+            if ((h == 0 && opt->dynamic_only) || (h == 1 && opt->static_only)) {
+                continue;
+            }
+
+            ctx = create_ctx(opt, id++);
+            fill_ctx_sess(ctx, cpr_lvl, huff_types[h], opt->stateless ? CPA_DC_STATELESS : CPA_DC_STATEFUL, 7);
+            ctx->src_data = s;
+            if (opt->underflow) {
+                ctx->uf_ibc = opt->ibc;
+            } else {
+                ctx->obs = opt->obs;
+            }
+            enq_ctx(ctx);
+        }
+    }
+}
+
 /*
     Function:
 
@@ -593,7 +1348,19 @@ static void build_overflow_ctx_list(struct mg_options *opt, struct src_data *s)
 static void build_ctx_list(struct mg_options *opt, struct src_data *s)
 {
 
-    if (opt->underflow) {
+    if (s->backing == SRC_MEM_STREAMED) {
+        build_stream_ctx_list(opt, s);
+    } else if (opt->adaptive && !opt->decomp_only && !opt->obs && !opt->ibc) {
+        build_adaptive_ctx_list(opt, s);
+    } else if (sample_plan_enabled(opt)) {
+        uint16_t cpr_lvl_mask;
+
+        create_cpr_lvl_mask(&cpr_lvl_mask, opt);
+        sample_plan_build(opt, s, cpr_lvl_mask);
+
+        // Drop the producer's reference now that every context holds its own
+        decrement_src_ref(s);
+    } else if (opt->underflow) {
         build_underflow_ctx_list(opt, s);
     } else {
         build_overflow_ctx_list(opt, s);
@@ -622,19 +1389,24 @@ static void build_ctx_list(struct mg_options *opt, struct src_data *s)
 static CpaStatus init_sgl_mem(struct sgl_container *sgls)
 {
     CpaStatus status = CPA_STATUS_SUCCESS;
-    uint32_t meta_size;
-    uint32_t iNum;
+    uint32_t meta_size = 0;
+    uint32_t inst_meta;
 
     sgls->src_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
     sgls->dest_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
     sgls->context_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
 
-    iNum = sgls->t_id % numDcInstances_g;
-
     //
-    // Setup src/dest/context SGL's
+    // Setup src/dest/context SGL's. Failover can run the thread's contexts on any
+    // instance, so the metadata is sized for the largest
     //
-    cpaDcBufferListGetMetaSize(dcInstances_g[iNum], 1, &meta_size);
+    for (uint32_t i = 0; i < numDcInstances_g; i++)
+    {
+        cpaDcBufferListGetMetaSize(dcInstances_g[i], 1, &inst_meta);
+        if (inst_meta > meta_size) {
+            meta_size = inst_meta;
+        }
+    }
 
     status = mg_build_sgl(sgls->src_sgl, 0, 1, DEFAULT_BUF_SIZE, meta_size);
     if (status != CPA_STATUS_SUCCESS)
@@ -643,12 +1415,15 @@ static CpaStatus init_sgl_mem(struct sgl_container *sgls)
         return status;
     }
 
-    status = mg_build_sgl(sgls->dest_sgl, 0, 1, DEFAULT_BUF_SIZE, meta_size);
+    // Room for the deflate bound of a full chunk, so compression requests can be given
+    // more than a chunk. The buffer rests at a chunk, which is all decompression uses
+    status = mg_build_sgl(sgls->dest_sgl, 0, 1, DEST_BUF_SIZE, meta_size);
     if (status != CPA_STATUS_SUCCESS)
     {
         MG_LOG_PRINT(g_log_fd, "Error: could not build dest sgl!\n");
         return status;
     }
+    sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
 
     /*
         NOTE: This SGL allocation (context_sgl) is typically dependent on the
@@ -694,41 +1469,140 @@ static void free_sgls(struct sgl_container *sgls)
     free(sgls->src_sgl);
     free(sgls->dest_sgl);
     free(sgls->context_sgl);
+
+    chunk_engine_free(sgls->chunk_eng);
+    small_pool_free(sgls->small);
+    pipeline_lane_free(sgls->pipe);
 }
 
 /*
 */
 static void shutdown_services()
 {
+#ifdef MG_SW_DC
+    sw_dc_detach();
+#endif
     stopDcServices();
     icp_sal_userStop();
     qaeMemDestroy();
 }
 
-static void print_summary(struct src_data **list, int num_files)
+/*
+    Function:
+
+        file_result (static)
+
+    Description:
+
+        The summary's verdict for one file. A file whose contexts only passed when run
+        again elsewhere says so, since their instance errors still fail the run
+
+    Parameters:
+
+        s   -   Ptr to the source data
+        buf -   Where to write the verdict
+        len -   Size of buf
+
+    Return:
+
+        buf
+*/
+static const char *file_result(struct src_data *s, char *buf, size_t len)
+{
+    if (s->load_failed) {
+        snprintf(buf, len, "FAIL, not loaded");
+    } else if (s->fail_count) {
+        snprintf(buf, len, "FAIL");
+    } else if (s->rerun_count == 0) {
+        snprintf(buf, len, "PASS");
+    } else if (s->rerun_count == 1) {
+        snprintf(buf, len, "PASS after rerun on inst %u", s->rerun_inst - 1);
+    } else {
+        snprintf(buf, len, "PASS after %lu reruns on inst %u%s", s->rerun_count, s->rerun_inst - 1,
+                s->rerun_mixed ? " and others" : "");
+    }
+
+    return buf;
+}
+
+static void print_summary(struct src_data **list, int num_files, struct mg_options *opts)
 {
+    uint32_t num_aliases = 0;
+    char result[64];
+
+    for (int i = 0; i < num_files; i++)
+    {
+        num_aliases += list[i] ? list[i]->num_aliases : 0;
+    }
+
     MG_LOG_PRINT(g_log_fd, "\n*******************************\n");
     MG_LOG_PRINT(g_log_fd, "***** Meatgrinder Summary *****\n");
     MG_LOG_PRINT(g_log_fd, "*******************************\n\n");
-    MG_LOG_PRINT(g_log_fd, "    Total Files: %d\n\n", num_files);
+    MG_LOG_PRINT(g_log_fd, "    Total Files: %d\n\n", num_files + num_aliases);
 
     for (int i = 0; i < num_files; i++)
     {
-        MG_LOG_PRINT(g_log_fd, "    [%s] %s\n", list[i]->fail_count == 0 ? "PASS" : "FAIL", list[i]->filename);
+        if (list[i] == NULL) {
+            MG_LOG_PRINT(g_log_fd, "    [FAIL, not loaded] file %d of the list\n", i);
+            continue;
+        }
+
+        file_result(list[i], result, sizeof(result));
+
+        MG_LOG_PRINT(g_log_fd, "    [%s] %s\n", result, list[i]->filename);
+
+        // Duplicates share the result of the copy that ran
+        for (uint32_t a = 0; a < list[i]->num_aliases; a++)
+        {
+            MG_LOG_PRINT(g_log_fd, "    [%s] %s (same as %s)\n", result, list[i]->aliases[a], list[i]->filename);
+        }
     }
 
     MG_LOG_PRINT(g_log_fd, "\n");
+
+    MG_LOG_PRINT(g_log_fd, "    Source Load: %lu files (%lu mapped, %lu from a pack, %lu streamed, %lu generated), %.2f MB in %.3f s\n\n",
+            g_load_stats.files, g_load_stats.mapped, g_load_stats.packed, g_load_stats.streamed, g_load_stats.generated,
+            g_load_stats.bytes / (1024.0 * 1024.0), g_load_stats.ns / 1e9);
+    meatjet_print_stats();
+    readahead_print_stats();
+    dedup_print_stats(list, num_files);
+    sched_print_stats();
+    stream_print_stats();
+    credit_print_stats();
+    health_print_stats();
+    small_print_stats();
+    pipeline_print_stats();
+    mix_print_stats();
+    wd_print_stats();
+#ifdef MG_SW_DC
+    sw_dc_print_stats();
+#endif
+
+    chunk_engine_print_stats();
+    prefix_cache_print_stats();
+    obs_prune_print_stats(opts->threads);
+    adaptive_sweep_print_stats();
+    sample_plan_print_stats();
 }
 
 static CpaStatus check_fail(struct src_data **list, int num_files)
 {
     for (int i = 0; i < num_files; i++)
     {
-        if (list[i]->fail_count) {
+        if (list[i] == NULL || list[i]->fail_count) {
             return CPA_STATUS_FAIL;
         }
     }
 
+    // Contexts moved off a bad instance may all have passed, the instance still failed
+    if (health_errors()) {
+        return CPA_STATUS_FAIL;
+    }
+
+    if (mix_errors()) {
+        return CPA_STATUS_FAIL;
+    }
+
     return CPA_STATUS_SUCCESS;
 }
 
@@ -754,7 +1628,8 @@ CpaStatus cpr_start(struct mg_options *opts)
 {
     CpaStatus status;
     int num_files;
-    char **file_list;
+    struct file_list files;
+    struct pack *pack = NULL;
     struct src_data **src_list;
 
 #ifdef DEBUG_CODE
@@ -798,47 +1673,172 @@ CpaStatus cpr_start(struct mg_options *opts)
         exit(CPA_STATUS_FAIL);
     }
 
+#ifdef MG_SW_DC
+    // After the polling threads, which must only see hardware instances
+    if (CPA_STATUS_SUCCESS != sw_dc_attach(opts))
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+#endif
+
+    if (credit_init(opts, numDcInstances_g) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
+    if (health_init(opts, numDcInstances_g) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
+    if (small_init(opts) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
+    if (pipeline_init(opts) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
+    if (mix_init(opts) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
+    if (wd_start(opts, opts->threads, abandon_worker) < 0)
+    {
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
+    }
+
     ctx_init();
 
+    par_inflate_pool_init(opts->inflate_workers);
+
+#if !defined(COLETO_CREEK) && !defined(CPM17) && !defined(CPM18)
+    // No compile-time level table for this platform, so find the redundant levels on the instance itself
+    if (!opts->all_levels && !opts->decomp_only && opts->min_cpr_lvl != opts->max_cpr_lvl) {
+        struct sgl_container *probe_sgls = get_probe_sgls();
+
+        if (probe_sgls != NULL) {
+            g_probed_lvl_mask = lvl_probe_run(opts, probe_sgls, &g_probed_lvls);
+        }
+        if (g_probed_lvl_mask == 0) {
+            MG_LOG_PRINT(g_log_fd, "Level probe failed, running all levels\n");
+        }
+    }
+#endif
+
     threads_init(opts->threads);
 
     //
     // Build the entire list of files that will be tested
     //
 
-    // Get the total number of files we will be running through
-    if (opts->use_dir) {
-        num_files = get_num_files(opts->dir);
+    // One walk finds every file and its size, or a pack's index or the generator specs already have them
+    if (opts->input_gen[0]) {
+        num_files = input_gen_file_list(opts, &files);
+    } else if (opts->pack[0]) {
+        pack = pack_open(opts->pack, false);
+        num_files = pack ? pack_file_list(pack, &files) : -1;
+    } else if (opts->use_dir) {
+        num_files = dir_scan(opts->dir, opts->scan_threads, &files);
     } else {
-        num_files = 1;
+        num_files = dir_scan_single(opts->input_file, &files);
     }
 
-    // Allocate space for the file list
-    file_list = (char **)calloc(num_files, sizeof(char *));
-    for (int i = 0; i < num_files; i++)
-    {
-        file_list[i] = (char *)calloc(1, MAX_FILE_LEN);
+    if (num_files < 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not build the file list\n");
+        shutdown_services();
+        exit(CPA_STATUS_FAIL);
     }
-    src_list = (struct src_data **)calloc(num_files, sizeof(struct src_data *));
 
-    // Populate the file list with the appropriate file name
-    if (opts->use_dir) {
-        populate_file_list(&file_list, opts->dir, 0);
-    } else {
-        strcpy(file_list[0], opts->input_file);
+    if (opts->dedup && num_files > 1) {
+        if (dedup_file_list(&files) < 0) {
+            MG_LOG_PRINT(g_log_fd, "Dedup failed, running every file\n");
+        }
+        num_files = files.num_files;
     }
 
+    // Biggest files first, so a large file at the end of the list can't leave the run tailing on it
+    if (opts->lpt) {
+        dir_scan_sort_size(&files);
+    }
+
+    sched_init(opts);
+    stream_init(opts);
+    sample_plan_init(opts, num_files);
+
+    src_list = (struct src_data **)calloc(num_files, sizeof(struct src_data *));
+
+    // Files load in the background (--readahead) while earlier files' contexts run
+    readahead_start(opts, &files, load_src_data);
+
     // Build a context list for each file
     for (int i = 0; i < num_files; i++)
     {
-        src_list[i] = create_src_data(file_list[i], opts->decomp_only);
+        src_list[i] = readahead_get(i);
+
+        // One unreadable file fails in the summary instead of taking the run down
+        if (src_list[i] == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not load [%s], counting it as failed\n", files.paths[i]);
+            src_list[i] = failed_src_data(files.paths[i]);
+            if (src_list[i] == NULL) {
+                continue;
+            }
+        }
+
+        if (files.aliases) {
+            src_list[i]->aliases = files.aliases[i].paths;
+            src_list[i]->num_aliases = files.aliases[i].num;
+        }
+
+        if (src_list[i]->load_failed) {
+            continue;
+        }
+
+        if (opts->prefix_reuse && opts->stateless && !opts->decomp_only && src_list[i]->backing != SRC_MEM_STREAMED) {
+            src_list[i]->prefix_cache = prefix_cache_create();
+        }
+
+        // Under --mix the files only fill the pool the requests are cut from
+        if (mix_enabled()) {
+            mix_add_source(src_list[i]);
+            free_src_mem(src_list[i]);
+            continue;
+        }
+
         build_ctx_list(opts, src_list[i]);
 
         sleep(.2);
     }
 
+    readahead_stop();
+
     threads_join(opts->threads);
 
+    // With --mix no contexts were built, so the sweep's workers are gone and the instances idle
+    mix_run(opts);
+
+    wd_stop();
+
+    if (g_probe_sgls) {
+        free_sgls(g_probe_sgls);
+        free(g_probe_sgls);
+    }
+
+    par_inflate_pool_destroy();
+
+#ifdef MG_SW_DC
+    sw_dc_detach();
+#endif
     stopDcServices();
     icp_sal_userStop();
     qaeMemDestroy();
@@ -852,22 +1852,180 @@ CpaStatus cpr_start(struct mg_options *opts)
     pthread_mutex_destroy(&of_mutex);
 #endif
 
-    print_summary(src_list, num_files);
+    print_summary(src_list, num_files, opts);
     status = check_fail(src_list, num_files);
 
+    adaptive_sweep_free_all();
+    sample_plan_free_all();
+
     // Free the file list memory
     for (int i = 0; i < num_files; i++)
     {
-        free(file_list[i]);
         free(src_list[i]);
     }
 
-    free(file_list);
+    dir_scan_free(&files);
+    pack_close(pack);
     free(src_list);
 
     return status;
 }
 
+/*
+    Function:
+
+        finish_ctx (static)
+
+    Description:
+
+        Everything a worker does with a context once it has run: runs it again if it hit
+        an instance error, counts a failure against its file, reports it to the scheduler
+        and the sweep, and frees it
+
+    Parameters:
+
+        ctx         -   Ptr to the context
+        sgls        -   Ptr to the worker's sgl container
+        status      -   What meatjet() returned
+        start_ns    -   When it was launched
+        end_ns      -   When it finished
+
+    Return:
+
+        none
+*/
+static void finish_ctx(struct context *ctx, struct sgl_container *sgls, CpaStatus status, uint64_t start_ns, uint64_t end_ns)
+{
+    // Hit an instance error: run it again from the start, on a healthy instance if
+    // there is one. The copy inherits the source reference
+    if (status != CPA_STATUS_SUCCESS && health_failover(ctx)) {
+        struct context *redo = ctx_redo(ctx);
+
+        if (redo) {
+            MG_LOG_PRINT(g_log_fd, "Running ctx %lu again after %u error(s) on instance %u\n",
+                    ctx->id, ctx->inst_errs, ctx->inst);
+            free_ctx(ctx, sgls);
+            requeue_ctx(redo);
+            return;
+        }
+    }
+
+    if (status != CPA_STATUS_SUCCESS)
+    {
+        ctx->src_data->fail_count++;
+    } else if (ctx->failovers) {
+        struct src_data *s = ctx->src_data;
+        uint32_t first = __sync_val_compare_and_swap(&s->rerun_inst, 0, ctx->inst + 1);
+
+        __sync_fetch_and_add(&s->rerun_count, 1);
+        if (first != 0 && first != ctx->inst + 1) {
+            s->rerun_mixed = true;
+        }
+    }
+
+    if (sched_enabled()) {
+        sched_report(ctx, start_ns, end_ns);
+    }
+
+    if (ctx->sweep) {
+        adaptive_sweep_report(ctx, status);
+    }
+
+    small_record(ctx, end_ns - start_ns);
+
+    decrement_src_ref(ctx->src_data);
+
+    free_ctx(ctx, sgls);
+}
+
+/*
+    Function:
+
+        run_small (static)
+
+    Description:
+
+        Takes up to a batch of small contexts off the Q, starting with one already taken,
+        and runs them through the worker's small-input pool. Taking stops at the first
+        context that can't join, which goes back to the front of the Q
+
+    Parameters:
+
+        first   -   Ptr to the small context already dequeued and admitted
+        sgls    -   Ptr to the worker's sgl container
+
+    Return:
+
+        true if the watchdog abandoned one of them and the worker must exit
+*/
+static bool run_small(struct context *first, struct sgl_container *sgls)
+{
+    struct small_batch b;
+    struct context *ctx;
+    bool abandoned;
+
+    b.n = 0;
+    b.ctx[b.n++] = first;
+
+    while (b.n < small_batch_max())
+    {
+        ctx = deq_ctx();
+        if (ctx == NULL) {
+            break;
+        }
+
+        // Before admission, which a context must only go through once
+        if (!small_fits(ctx) || !small_batch_can_add(&b, ctx)) {
+            requeue_ctx(ctx);
+            break;
+        }
+
+        if (ctx->stratum && !sample_plan_admit(ctx)) {
+            decrement_src_ref(ctx->src_data);
+            free(ctx);
+            continue;
+        }
+
+        b.ctx[b.n++] = ctx;
+    }
+
+    abandoned = small_batch_run(&b, sgls);
+
+    for (uint32_t i = 0; i < b.n; i++)
+    {
+        struct context *redo;
+
+        ctx = b.ctx[i];
+
+        if (i < b.done) {
+            finish_ctx(ctx, sgls, b.status[i], b.start_ns[i], b.start_ns[i] + b.busy_ns[i]);
+            continue;
+        }
+
+        // Failed, or run again from a copy, by the watchdog already
+        if ((int32_t)i == b.abandoned) {
+            decrement_src_ref(ctx->src_data);
+            free_ctx(ctx, sgls);
+            continue;
+        }
+
+        // Not finished when its worker was abandoned: start it over on another worker,
+        // as the context it was rather than a failover
+        redo = ctx_redo(ctx);
+        if (redo == NULL) {
+            ctx->src_data->fail_count++;
+            decrement_src_ref(ctx->src_data);
+            free_ctx(ctx, sgls);
+            continue;
+        }
+        redo->failovers = ctx->failovers;
+        free_ctx(ctx, sgls);
+        requeue_ctx(redo);
+    }
+
+    return abandoned;
+}
+
 /*
     Function:
 
@@ -893,11 +2051,14 @@ void *cpr_thread_entry(void *arg_id)
     uint32_t t_id;
     struct context *ctx;
     struct sgl_container *sgls;
+    uint64_t start_ns;
 
     // Do some evil ptr hax to save thread id
     t_id = *((int *)arg_id);
     free(arg_id);
 
+    wd_bind(t_id);
+
     // Initialize the container, and then all memory within
     sgls = (struct sgl_container *)calloc(1, sizeof(struct sgl_container));
     sgls->t_id = t_id;
@@ -907,11 +2068,12 @@ void *cpr_thread_entry(void *arg_id)
     {
         MG_LOG_PRINT(g_log_fd, "Error: Could not initialize thread-specific phys memory!\n");
         free_sgls(sgls);
+        wd_unbind();
         return NULL;
     }
 
     // Continuously loop on the Q until all contexts are completed
-    while (!g_all_ctx_created || !TAILQ_EMPTY(&tailq_head))
+    while (!g_all_ctx_created || !ctx_q_empty() || adaptive_sweep_pending())
     {
         // Try and acquire context from the queue
         ctx = deq_ctx();
@@ -920,21 +2082,43 @@ void *cpr_thread_entry(void *arg_id)
             sleep(.1); continue;
         }
 
+        // Sampled contexts past their file's deadline are dropped before any session exists
+        if (ctx->stratum && !sample_plan_admit(ctx)) {
+            decrement_src_ref(ctx->src_data);
+            free(ctx);
+            continue;
+        }
+
+        // Small inputs go through the worker's pooled sessions, a batch at a time
+        if (small_batching() && small_fits(ctx)) {
+            if (run_small(ctx, sgls)) {
+                break;
+            }
+            continue;
+        }
+
+        start_ns = now_ns();
+
+        wd_ctx_begin(ctx);
+
         launch_ctx(ctx, sgls);
 
         status = meatjet(ctx, sgls);
-        if (status != CPA_STATUS_SUCCESS)
-        {
-            ctx->src_data->fail_count++;
-        }
 
-        decrement_src_ref(ctx->src_data);
+        // Abandoned by the watchdog, which already failed it; a replacement has this thread id
+        if (wd_ctx_end()) {
+            decrement_src_ref(ctx->src_data);
+            free_ctx(ctx, sgls);
+            break;
+        }
 
-        free_ctx(ctx, sgls);
+        finish_ctx(ctx, sgls, status, start_ns, now_ns());
     }
 
     free_sgls(sgls);
     free(sgls);
 
+    wd_unbind();
+
     return NULL;
 }
@@ -12,9 +12,21 @@
 #include "cpa_dc.h"
 #include "qae_mem.h"
 #include "icp_sal_user.h"
+#ifdef MG_SW_DC
+#include "sw_dc.h"
+#endif
 
 #define MAX_INSTANCES           (6)
 #define DEFAULT_BUF_SIZE        (65536)
+
+// Most a compression request of len bytes can produce: 9 bits per literal under the
+// static code, or a stored block, plus headers, the block header and the flush marker.
+// The level only changes how often that is reached, not the bound. The dest buffer
+// holds a chunk's bound twice, since the request after an overflow in a stateful
+// session also carries what the overflow left behind
+#define DEFLATE_BOUND(len)      ((len) + ((len) >> 3) + 64)
+#define CHUNK_BOUND             DEFLATE_BOUND(DEFAULT_BUF_SIZE)
+#define DEST_BUF_SIZE           (CHUNK_BOUND * 2)
 #define DEFAULT_DEST_BUF_SIZE   (4096)
 #define NUM_INTER_BUFS          (2)
 #define MAX_THREAD_COUNT        (1000)
@@ -36,15 +48,53 @@ struct hw_setup_state {
     uint16_t num_inst;
 };
 
+// Where a src_data's src_mem came from, so it is released the right way
+enum src_backing {
+    SRC_MEM_HEAP,
+    SRC_MEM_MAPPED,
+    SRC_MEM_PACK,
+    SRC_MEM_STREAMED,
+    SRC_MEM_GENERATED,
+};
+
 struct src_data {
     char filename[MAX_FILE_LEN];
     size_t file_size;
     size_t dcpr_size;
     Cpa8U *src_mem;
+    enum src_backing backing;
+
+    // Where a --stream file is read from: no src_mem, its contexts read it through a window
+    const char *stream_path;
+    uint64_t stream_off;
+
+    // CRC32 of the cleartext (the decompressed payload under --decomp-only), when the pack index had it
+    bool has_clear_crc;
+    Cpa32U clear_crc32;
+
     Cpa32U ref_count;
     Cpa32U orig_ref_count;
     Cpa64U fail_count;
     pthread_mutex_t src_mutex;
+
+    // Could not be loaded: a placeholder that only carries the name and the failure
+    bool load_failed;
+
+    // Contexts that passed only when run again after an instance error or stall, and the
+    // instance (plus one) the first of them passed on
+    Cpa64U rerun_count;
+    uint32_t rerun_inst;
+    bool rerun_mixed;
+
+    struct prefix_cache *prefix_cache;
+    struct sample_file *sample;
+
+    // Bytes --readahead counts against its cap until src_mem is freed
+    uint64_t ra_held;
+
+    // Byte-identical files this one ran for, from --dedup
+    char **aliases;
+    uint32_t num_aliases;
 };
 
 struct sgl_container {
@@ -53,6 +103,10 @@ struct sgl_container {
     CpaBufferList *src_sgl;
     CpaBufferList *dest_sgl;
     CpaBufferList *context_sgl;
+
+    struct chunk_engine *chunk_eng;
+    struct small_pool *small;
+    struct pipe_lane *pipe;
 };
 
 struct hw_setup_state g_hw_state;
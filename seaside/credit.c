@@ -0,0 +1,531 @@
+/*
+    Submit flow control (--credits, --backoff)
+
+    Each instance has a pool of --credits credits. A thread takes one before it submits a
+    compress or decompress request and returns it when the request completes, so when the
+    pool is empty the thread waits here rather than hammering a full ring, and the polling
+    threads keep their CPU. --credits 0 leaves the pool unlimited and only counts.
+
+    Waiting, for a credit or after a CPA_STATUS_RETRY, is one of:
+        pause   PAUSE, doubling per attempt, then yield once that stops being short
+        yield   sched_yield
+        futex   sleep until another request on the instance completes, with a timeout
+                doubling from 1us to 1ms in case the ring is shared with another process
+
+    With --abandon, the credits each worker slot holds are counted per instance, so the
+    watchdog can write off those of a stuck worker. The count's high half is an epoch the
+    write-off bumps; a stuck worker that comes back finds it changed and returns nothing
+*/
+#include <time.h>
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "credit.h"
+#include "watchdog.h"
+
+extern FILE *g_log_fd;
+
+#define PAUSE_MAX_SHIFT         (10)
+#define FUTEX_MIN_WAIT_NS       (1000)
+#define FUTEX_MAX_WAIT_NS       (1000000)
+
+struct credit_inst {
+    // Futex words: credits left, and requests completed (what a RETRY waits to move)
+    int32_t avail;
+    int32_t done;
+    int32_t credit_waiters;
+    int32_t retry_waiters;
+
+    int32_t in_use;
+    int32_t peak;
+
+    uint64_t requests;
+    uint64_t credit_waits;
+    uint64_t wait_ns;
+    uint64_t retries;
+    uint64_t retry_ns;
+    uint64_t written_off;
+} __attribute__((aligned(64)));
+
+static struct {
+    uint32_t credits;
+    enum credit_backoff backoff;
+    uint32_t num_inst;
+    struct credit_inst *inst;
+
+    // With --abandon: per slot and instance, epoch << 32 | credits held
+    uint32_t num_slots;
+    uint64_t *held;
+} g_credit;
+
+static const char *g_backoff_names[BACKOFF_MODES] = { "pause", "yield", "futex" };
+
+// Attempts at the current request, for the backoff to grow with
+static __thread uint32_t t_tries;
+
+// The held count the thread's credit is in, and its epoch then; NULL if it isn't counted
+static __thread uint64_t *t_held;
+static __thread uint32_t t_epoch;
+
+// The request went out without a credit, having been abandoned while it waited
+static __thread bool t_uncredited;
+
+static void cpu_pause(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        __asm__ __volatile__("" ::: "memory");
+#endif
+    }
+}
+
+static void futex_wait(int32_t *word, int32_t seen, uint64_t timeout_ns)
+{
+    struct timespec ts = { (time_t)(timeout_ns / 1000000000ULL), (long)(timeout_ns % 1000000000ULL) };
+
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, &ts, NULL, 0);
+}
+
+static void futex_wake(int32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+    Function:
+
+        backoff (static)
+
+    Description:
+
+        One wait step. In futex mode it sleeps while *word is still seen
+
+    Parameters:
+
+        word    -   Futex word to wait on
+        seen    -   Value it had when the caller decided to wait
+        waiters -   Ptr to the count of threads asleep on word
+        attempt -   Attempts so far, for the wait to grow with
+
+    Return:
+
+        none
+*/
+static void backoff(int32_t *word, int32_t seen, int32_t *waiters, uint32_t attempt)
+{
+    switch (g_credit.backoff)
+    {
+        case BACKOFF_PAUSE:
+            if (attempt < PAUSE_MAX_SHIFT) {
+                cpu_pause(1u << attempt);
+            } else {
+                sched_yield();
+            }
+            break;
+        case BACKOFF_YIELD:
+            sched_yield();
+            break;
+        case BACKOFF_FUTEX:
+            __sync_fetch_and_add(waiters, 1);
+            futex_wait(word, seen, MIN((uint64_t)FUTEX_MIN_WAIT_NS << MIN(attempt, 20), FUTEX_MAX_WAIT_NS));
+            __sync_fetch_and_sub(waiters, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+    Function:
+
+        credit_parse_backoff
+
+    Description:
+
+        Maps a --backoff name to its mode
+
+    Parameters:
+
+        str -   pause, yield or futex
+
+    Return:
+
+        The mode, or -1 if there's no such mode
+*/
+int credit_parse_backoff(const char *str)
+{
+    for (int b = 0; b < BACKOFF_MODES; b++)
+    {
+        if (!strcmp(str, g_backoff_names[b])) {
+            return b;
+        }
+    }
+
+    return -1;
+}
+
+/*
+    Function:
+
+        credit_init
+
+    Description:
+
+        Sets up a credit pool per instance. Called once the instance list is final
+
+    Parameters:
+
+        opt         -   Ptr to the options (--credits, --backoff)
+        num_inst    -   Instances in dcInstances_g
+
+    Return:
+
+        0 on success, -1 on allocation failure
+*/
+int credit_init(struct mg_options *opt, uint32_t num_inst)
+{
+    g_credit.credits = opt->credits;
+    g_credit.backoff = (enum credit_backoff)opt->backoff;
+    g_credit.num_inst = num_inst ? num_inst : 1;
+
+    if (posix_memalign((void **)&g_credit.inst, 64, g_credit.num_inst * sizeof(struct credit_inst))) {
+        g_credit.inst = NULL;
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the instance credits\n");
+        return -1;
+    }
+    memset(g_credit.inst, 0, g_credit.num_inst * sizeof(struct credit_inst));
+
+    for (uint32_t i = 0; i < g_credit.num_inst; i++)
+    {
+        g_credit.inst[i].avail = g_credit.credits;
+    }
+
+    // Only an abandoned worker's credits need tracking, and only when there is a limit to leak from
+    if (opt->abandon && g_credit.credits) {
+        g_credit.num_slots = opt->threads;
+        g_credit.held = (uint64_t *)calloc((size_t)g_credit.num_slots * g_credit.num_inst, sizeof(uint64_t));
+        if (g_credit.held == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not allocate the held credit counts\n");
+            return -1;
+        }
+    }
+
+    if (g_credit.credits) {
+        MG_LOG_PRINT(g_log_fd, "Flow control: %u credits per instance, %s backoff\n",
+                g_credit.credits, g_backoff_names[g_credit.backoff]);
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        credit_acquire
+
+    Description:
+
+        Takes a credit on the instance before a submit, waiting in the backoff while its
+        pool is empty, and stamps the submit for the watchdog. A request the watchdog has
+        abandoned stops waiting and goes out without one; credit_retry fails its first
+        RETRY
+
+    Parameters:
+
+        idx -   Instance number in dcInstances_g
+
+    Return:
+
+        none
+*/
+void credit_acquire(uint32_t idx)
+{
+    struct credit_inst *ci;
+    uint64_t start = 0;
+    uint32_t attempt = 0;
+    int32_t in_use;
+    int32_t peak;
+
+    t_tries = 0;
+    t_held = NULL;
+    t_uncredited = false;
+
+    if (g_credit.inst == NULL) {
+        return;
+    }
+    ci = &g_credit.inst[idx % g_credit.num_inst];
+
+    while (g_credit.credits)
+    {
+        int32_t avail = ci->avail;
+
+        // The watchdog has given up on this worker and written off what it held
+        if (wd_abandoned()) {
+            t_uncredited = true;
+            if (start) {
+                __sync_fetch_and_add(&ci->wait_ns, now_ns() - start);
+            }
+            return;
+        }
+
+        if (avail > 0) {
+            if (__sync_bool_compare_and_swap(&ci->avail, avail, avail - 1)) {
+                break;
+            }
+            continue;
+        }
+
+        if (start == 0) {
+            start = now_ns();
+            __sync_fetch_and_add(&ci->credit_waits, 1);
+        }
+        backoff(&ci->avail, 0, &ci->credit_waiters, attempt++);
+    }
+
+    if (start) {
+        __sync_fetch_and_add(&ci->wait_ns, now_ns() - start);
+    }
+
+    if (g_credit.held && g_credit.credits) {
+        int32_t slot = wd_current().slot;
+
+        if (slot >= 0 && (uint32_t)slot < g_credit.num_slots) {
+            t_held = &g_credit.held[slot * g_credit.num_inst + idx % g_credit.num_inst];
+            t_epoch = __sync_add_and_fetch(t_held, 1) >> 32;
+        }
+    }
+
+    wd_submit(idx);
+
+    __sync_fetch_and_add(&ci->requests, 1);
+    in_use = __sync_add_and_fetch(&ci->in_use, 1);
+    peak = ci->peak;
+    while (in_use > peak && !__sync_bool_compare_and_swap(&ci->peak, peak, in_use))
+    {
+        peak = ci->peak;
+    }
+}
+
+/*
+    Function:
+
+        credit_retry
+
+    Description:
+
+        The loop condition for a submit: backs off and says to go again on a
+        CPA_STATUS_RETRY, says to stop on anything else
+
+    Parameters:
+
+        idx     -   Instance number in dcInstances_g
+        status  -   Status the submit returned
+
+    Return:
+
+        true to submit again
+*/
+bool credit_retry(uint32_t idx, CpaStatus status)
+{
+    struct credit_inst *ci;
+    uint64_t start;
+    int32_t seen;
+
+    if (status != CPA_STATUS_RETRY) {
+        return false;
+    }
+    // The watchdog gave up on this request; the RETRY fails it
+    if (wd_abandoned()) {
+        return false;
+    }
+    if (g_credit.inst == NULL) {
+        return true;
+    }
+    ci = &g_credit.inst[idx % g_credit.num_inst];
+
+    start = now_ns();
+    seen = ci->done;
+    __sync_fetch_and_add(&ci->retries, 1);
+    backoff(&ci->done, seen, &ci->retry_waiters, t_tries++);
+    __sync_fetch_and_add(&ci->retry_ns, now_ns() - start);
+
+    return true;
+}
+
+/*
+    Function:
+
+        credit_release
+
+    Description:
+
+        Returns the credit once the request has completed, waking a waiter if there is one.
+        Stamps the completion for the watchdog
+
+    Parameters:
+
+        idx -   Instance number in dcInstances_g
+
+    Return:
+
+        none
+*/
+void credit_release(uint32_t idx)
+{
+    struct credit_inst *ci;
+
+    wd_progress();
+
+    if (g_credit.inst == NULL) {
+        return;
+    }
+    ci = &g_credit.inst[idx % g_credit.num_inst];
+
+    if (t_uncredited) {
+        t_uncredited = false;
+        return;
+    }
+
+    // Written off while the request was stuck: the pool already has the credit back
+    if (t_held) {
+        uint64_t held;
+
+        do {
+            held = *t_held;
+            if ((held >> 32) != t_epoch) {
+                t_held = NULL;
+                return;
+            }
+        } while (!__sync_bool_compare_and_swap(t_held, held, held - 1));
+        t_held = NULL;
+    }
+
+    __sync_fetch_and_sub(&ci->in_use, 1);
+    __sync_fetch_and_add(&ci->done, 1);
+    if (g_credit.credits) {
+        __sync_fetch_and_add(&ci->avail, 1);
+    }
+
+    if (g_credit.backoff == BACKOFF_FUTEX) {
+        if (ci->credit_waiters) {
+            futex_wake(&ci->avail);
+        }
+        if (ci->retry_waiters) {
+            futex_wake(&ci->done);
+        }
+    }
+}
+
+/*
+    Function:
+
+        credit_write_off
+
+    Description:
+
+        Returns the credits a worker slot holds to their pools, for a worker the watchdog
+        has abandoned. Bumps the slot's epochs so the stuck worker's own credit_release,
+        if it ever comes, returns nothing
+
+    Parameters:
+
+        slot    -   Watchdog slot of the abandoned worker
+
+    Return:
+
+        none
+*/
+void credit_write_off(uint32_t slot)
+{
+    if (g_credit.held == NULL || slot >= g_credit.num_slots) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < g_credit.num_inst; i++)
+    {
+        uint64_t *h = &g_credit.held[slot * g_credit.num_inst + i];
+        struct credit_inst *ci = &g_credit.inst[i];
+        uint64_t held;
+        int32_t n;
+
+        do {
+            held = *h;
+        } while (!__sync_bool_compare_and_swap(h, held, ((held >> 32) + 1) << 32));
+
+        n = (int32_t)(held & 0xffffffffULL);
+        if (n == 0) {
+            continue;
+        }
+
+        __sync_fetch_and_sub(&ci->in_use, n);
+        __sync_fetch_and_add(&ci->written_off, n);
+        __sync_fetch_and_add(&ci->avail, n);
+        if (g_credit.backoff == BACKOFF_FUTEX && ci->credit_waiters) {
+            futex_wake(&ci->avail);
+        }
+    }
+}
+
+/*
+    Function:
+
+        credit_print_stats
+
+    Description:
+
+        Prints, per instance, how often submits waited for a credit or were told to retry,
+        and for how long. Quiet when there were no credits and no retries
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void credit_print_stats()
+{
+    uint64_t retries = 0;
+
+    if (g_credit.inst == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < g_credit.num_inst; i++)
+    {
+        retries += g_credit.inst[i].retries;
+    }
+    if (g_credit.credits == 0 && retries == 0) {
+        return;
+    }
+
+    if (g_credit.credits) {
+        MG_LOG_PRINT(g_log_fd, "    Flow control: %u credits per instance, %s backoff\n",
+                g_credit.credits, g_backoff_names[g_credit.backoff]);
+    } else {
+        MG_LOG_PRINT(g_log_fd, "    Flow control: no credit limit, %s backoff\n", g_backoff_names[g_credit.backoff]);
+    }
+    MG_LOG_PRINT(g_log_fd, "        %-4s %10s %12s %10s %10s %10s %5s %11s\n",
+            "inst", "requests", "credit waits", "wait ms", "retries", "retry ms", "peak", "written off");
+
+    for (uint32_t i = 0; i < g_credit.num_inst; i++)
+    {
+        struct credit_inst *ci = &g_credit.inst[i];
+
+        if (ci->requests == 0) {
+            continue;
+        }
+
+        MG_LOG_PRINT(g_log_fd, "        %-4u %10lu %12lu %10.2f %10lu %10.2f %5d %11lu\n",
+                i, ci->requests, ci->credit_waits, ci->wait_ns / 1e6, ci->retries, ci->retry_ns / 1e6, ci->peak,
+                ci->written_off);
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+    Submit flow control. Every cpaDc compress/decompress submit takes a credit on its
+    instance first and gives it back when the request completes, so at most --credits
+    requests are in flight per instance and the rest wait in the backoff instead of
+    spinning on CPA_STATUS_RETRY. A RETRY that still happens backs off the same way. With
+    --abandon, the watchdog writes off the credits of a worker it abandons
+*/
+
+#include "main.h"
+#include "cpa_types.h"
+#include "cpa.h"
+
+enum credit_backoff {
+    BACKOFF_PAUSE,
+    BACKOFF_YIELD,
+    BACKOFF_FUTEX,
+    BACKOFF_MODES,
+};
+
+int credit_parse_backoff(const char *str);
+int credit_init(struct mg_options *opt, uint32_t num_inst);
+void credit_acquire(uint32_t inst);
+bool credit_retry(uint32_t inst, CpaStatus status);
+void credit_release(uint32_t inst);
+void credit_write_off(uint32_t slot);
+void credit_print_stats();
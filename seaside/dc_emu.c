@@ -0,0 +1,741 @@
+/*
+    Accelerator timing emulator (--dc-emu)
+
+    sw_dc.c hands every request on a software instance to dc_emu_submit before doing it and
+    to dc_emu_complete after, and the emulator holds it until the modelled instance would
+    have finished it:
+
+        ring        requests in flight per instance; a submit past it gets CPA_STATUS_RETRY,
+                    which meatjet's callers spin on as they would on a full hardware ring
+        bw          the instance serves its requests one at a time, in submission order, at this
+                    rate, so a saturated instance shows up as queueing time. A request is
+                    charged for its cleartext side as submitted: the source for compression,
+                    the destination buffer for decompression
+        lat         sampled per request and added after service, like pipeline latency
+        poll        completions are only seen on poll ticks, as with a polling thread
+        fault       one instance fails a fraction of its requests with a fatal or soft
+                    error, without doing them, for exercising instance health
+
+    Sync callers wait in dc_emu_complete; sessions with a callback get it from the completion
+    thread once the request is due. On the real clock waiting means sleeping, and a request
+    whose zlib work alone overran its due time is counted late. The simulated clock never
+    sleeps: each thread keeps its own time, which jumps to each due time it waits for, so
+    runs finish at zlib speed and report the emulated time of the furthest thread. Instances
+    still serve requests in the order they arrive in real time, so it is an approximation
+*/
+#include <time.h>
+#include <math.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include "dc_emu.h"
+
+extern FILE *g_log_fd;
+
+struct emu_inst {
+    pthread_mutex_t mutex;
+    uint64_t rng;
+    uint64_t busy_until;
+
+    /*
+        Ring slots: a slot is free once its request is released and due. Released requests
+        are always due on the real clock, but on the simulated one a callback can be released
+        before the submitting thread's time reaches it
+    */
+    bool *used;
+    uint64_t *due;
+
+    uint64_t reqs;
+    uint64_t retries;
+    uint64_t faults;
+    uint64_t late;
+    uint32_t peak;
+    uint64_t bytes;
+    uint64_t svc_ns;
+    uint64_t queue_ns;
+    uint64_t lat_ns;
+};
+
+// A callback completion waiting for its due time
+struct emu_pending {
+    uint64_t due;
+    uint32_t inst;
+    uint32_t slot;
+    CpaDcCallbackFn cb;
+    void *tag;
+    CpaStatus status;
+};
+
+static struct {
+    bool enabled;
+    struct dc_emu_config cfg;
+    char spec[MAX_FILE_LEN];
+    uint32_t num_inst;
+    struct emu_inst *inst;
+    uint64_t start_ns;
+
+    // Simulated clock: the furthest any thread has got
+    uint64_t sim_end;
+
+    pthread_mutex_t cb_mutex;
+    pthread_cond_t cb_cond;
+    pthread_t cb_thread;
+    struct emu_pending *pending;
+    uint32_t num_pending;
+    bool cb_stop;
+    uint64_t callbacks;
+} g_emu;
+
+static const char *g_dist_names[] = { "fixed", "uniform", "exp", "normal" };
+
+// Simulated clock: this thread's time
+static __thread uint64_t t_sim_now;
+
+static uint64_t next_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double next_unit(uint64_t *state)
+{
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t emu_now()
+{
+    if (g_emu.cfg.sim_clock) {
+        return t_sim_now;
+    }
+
+    return now_ns() - g_emu.start_ns;
+}
+
+// Simulated clock only: move this thread on to t, unless it is already past
+static void advance_to(uint64_t t)
+{
+    uint64_t end = g_emu.sim_end;
+
+    if (t_sim_now >= t) {
+        return;
+    }
+    t_sim_now = t;
+
+    while (end < t && !__sync_bool_compare_and_swap(&g_emu.sim_end, end, t))
+    {
+        end = g_emu.sim_end;
+    }
+}
+
+/*
+    Function:
+
+        wait_until (static)
+
+    Description:
+
+        Waits for an emulated time: sleeps on the real clock, spinning for the last stretch
+        so short latencies aren't lost to timer slack, or moves the simulated clock on
+
+    Parameters:
+
+        due -   Emulated time to wait for
+
+    Return:
+
+        none
+*/
+static void wait_until(uint64_t due)
+{
+    uint64_t now;
+
+    if (g_emu.cfg.sim_clock) {
+        advance_to(due);
+        return;
+    }
+
+    while ((now = emu_now()) < due)
+    {
+        if (due - now > 100000) {
+            struct timespec ts = { 0, (long)(due - now - 50000) };
+
+            nanosleep(&ts, NULL);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/*
+    Function:
+
+        sample_lat (static)
+
+    Description:
+
+        Draws one request's latency from the configured distribution. Called under the
+        instance mutex, so each instance's sequence is reproducible for a given seed
+
+    Parameters:
+
+        inst    -   Ptr to the instance
+
+    Return:
+
+        Latency in ns
+*/
+static uint64_t sample_lat(struct emu_inst *inst)
+{
+    double us = g_emu.cfg.lat_a;
+    double u;
+
+    switch (g_emu.cfg.lat_dist)
+    {
+        case EMU_LAT_UNIFORM:
+            us = g_emu.cfg.lat_a + (g_emu.cfg.lat_b - g_emu.cfg.lat_a) * next_unit(&inst->rng);
+            break;
+        case EMU_LAT_EXP:
+            us = -g_emu.cfg.lat_a * log(1.0 - next_unit(&inst->rng));
+            break;
+        case EMU_LAT_NORMAL:
+            u = next_unit(&inst->rng);
+            us = g_emu.cfg.lat_a + g_emu.cfg.lat_b * sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * next_unit(&inst->rng));
+            break;
+        default:
+            break;
+    }
+
+    return us > 0 ? (uint64_t)(us * 1000.0) : 0;
+}
+
+static void release_slot(uint32_t idx, uint32_t slot)
+{
+    struct emu_inst *inst = &g_emu.inst[idx];
+
+    pthread_mutex_lock(&inst->mutex);
+    inst->used[slot] = false;
+    pthread_mutex_unlock(&inst->mutex);
+}
+
+/*
+    Function:
+
+        cb_entry (static)
+
+    Description:
+
+        Completion thread. Delivers callback completions in due order, then frees their
+        ring slots
+
+    Parameters:
+
+        arg -   unused
+
+    Return:
+
+        none
+*/
+static void *cb_entry(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&g_emu.cb_mutex);
+    while (true)
+    {
+        struct emu_pending p;
+        uint32_t first = 0;
+
+        if (g_emu.num_pending == 0) {
+            if (g_emu.cb_stop) {
+                break;
+            }
+            pthread_cond_wait(&g_emu.cb_cond, &g_emu.cb_mutex);
+            continue;
+        }
+
+        for (uint32_t i = 1; i < g_emu.num_pending; i++)
+        {
+            if (g_emu.pending[i].due < g_emu.pending[first].due) {
+                first = i;
+            }
+        }
+
+        // Short naps, so a completion that arrives due sooner isn't held up behind this one
+        if (!g_emu.cfg.sim_clock && emu_now() < g_emu.pending[first].due) {
+            uint64_t due = MIN(g_emu.pending[first].due, emu_now() + 20000);
+
+            pthread_mutex_unlock(&g_emu.cb_mutex);
+            wait_until(due);
+            pthread_mutex_lock(&g_emu.cb_mutex);
+            continue;
+        }
+
+        p = g_emu.pending[first];
+        g_emu.pending[first] = g_emu.pending[--g_emu.num_pending];
+        g_emu.callbacks++;
+        pthread_mutex_unlock(&g_emu.cb_mutex);
+
+        wait_until(p.due);
+        release_slot(p.inst, p.slot);
+        p.cb(p.tag, p.status);
+
+        pthread_mutex_lock(&g_emu.cb_mutex);
+    }
+    pthread_mutex_unlock(&g_emu.cb_mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        parse_lat (static)
+
+    Description:
+
+        Parses a latency distribution: US, uniform:LO:HI, exp:MEAN or normal:MEAN:SD
+
+    Parameters:
+
+        str -   Distribution to parse
+        cfg -   Ptr to the config to fill in
+
+    Return:
+
+        0 on success, -1 if malformed
+*/
+static int parse_lat(const char *str, struct dc_emu_config *cfg)
+{
+    char *end;
+    int args = 1;
+
+    cfg->lat_dist = EMU_LAT_FIXED;
+    cfg->lat_b = 0;
+
+    for (int d = EMU_LAT_UNIFORM; d <= EMU_LAT_NORMAL; d++)
+    {
+        size_t len = strlen(g_dist_names[d]);
+
+        if (!strncmp(str, g_dist_names[d], len) && str[len] == ':') {
+            cfg->lat_dist = (enum dc_emu_dist)d;
+            args = d == EMU_LAT_EXP ? 1 : 2;
+            str += len + 1;
+            break;
+        }
+    }
+
+    cfg->lat_a = strtod(str, &end);
+    if (end == str || cfg->lat_a < 0) {
+        return -1;
+    }
+
+    if (args == 2) {
+        if (*end != ':') {
+            return -1;
+        }
+        str = end + 1;
+        cfg->lat_b = strtod(str, &end);
+        if (end == str || cfg->lat_b < 0) {
+            return -1;
+        }
+        if (cfg->lat_dist == EMU_LAT_UNIFORM && cfg->lat_b < cfg->lat_a) {
+            return -1;
+        }
+    }
+
+    return *end == '\0' ? 0 : -1;
+}
+
+/*
+    Function:
+
+        dc_emu_parse
+
+    Description:
+
+        Parses a --dc-emu spec, "key=value,..." with keys ring, lat, bw, poll, clock and
+        fault. Keys left out keep their defaults: a 128 deep ring, no latency, no bandwidth
+        cap, completions as soon as due, the real clock and no faults
+
+    Parameters:
+
+        str -   Spec to parse
+        cfg -   Ptr to the config to fill in
+
+    Return:
+
+        0 on success, -1 if the spec is malformed
+*/
+int dc_emu_parse(const char *str, struct dc_emu_config *cfg)
+{
+    char buf[MAX_FILE_LEN];
+    char *save = NULL;
+    char *tok;
+    char *end;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->ring = DC_EMU_DEFAULT_RING;
+    cfg->fault_inst = -1;
+
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *val = strchr(tok, '=');
+
+        if (val == NULL) {
+            return -1;
+        }
+        *val++ = '\0';
+
+        if (!strcmp(tok, "ring")) {
+            cfg->ring = strtoul(val, &end, 0);
+            if (end == val || *end || cfg->ring == 0 || cfg->ring > DC_EMU_MAX_RING) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "lat")) {
+            if (parse_lat(val, cfg) < 0) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "bw")) {
+            cfg->bw_mbps = strtod(val, &end);
+            if (end == val || *end || cfg->bw_mbps < 0) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "poll")) {
+            cfg->poll_us = strtod(val, &end);
+            if (end == val || *end || cfg->poll_us < 0) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "clock")) {
+            if (!strcmp(val, "sim")) {
+                cfg->sim_clock = true;
+            } else if (strcmp(val, "real")) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "fault")) {
+            cfg->fault_inst = strtol(val, &end, 0);
+            if (end == val || *end != ':' || cfg->fault_inst < 0) {
+                return -1;
+            }
+            val = end + 1;
+            cfg->fault_p = strtod(val, &end);
+            if (end == val || cfg->fault_p < 0 || cfg->fault_p > 1) {
+                return -1;
+            }
+            if (*end == '\0') {
+                cfg->fault_status = CPA_DC_FATALERR;
+            } else if (!strcmp(end, ":soft")) {
+                cfg->fault_status = CPA_DC_SOFTERR;
+            } else {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        dc_emu_start
+
+    Description:
+
+        Sets up the emulated instances and the completion thread, if --dc-emu was given
+
+    Parameters:
+
+        opt         -   Ptr to the options
+        num_inst    -   Software instances to emulate
+
+    Return:
+
+        0 on success (or nothing to emulate), -1 on a bad spec or allocation failure
+*/
+int dc_emu_start(struct mg_options *opt, uint32_t num_inst)
+{
+    if (opt->dc_emu[0] == '\0' || num_inst == 0) {
+        return 0;
+    }
+
+    if (dc_emu_parse(opt->dc_emu, &g_emu.cfg) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: bad --dc-emu spec \"%s\"\n", opt->dc_emu);
+        return -1;
+    }
+    strncpy(g_emu.spec, opt->dc_emu, sizeof(g_emu.spec) - 1);
+
+    g_emu.inst = (struct emu_inst *)calloc(num_inst, sizeof(struct emu_inst));
+    g_emu.pending = (struct emu_pending *)calloc((size_t)num_inst * g_emu.cfg.ring, sizeof(struct emu_pending));
+    if (g_emu.inst == NULL || g_emu.pending == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the emulated instances\n");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_inst; i++)
+    {
+        struct emu_inst *inst = &g_emu.inst[i];
+
+        pthread_mutex_init(&inst->mutex, NULL);
+        inst->rng = (opt->seed ? opt->seed : 1) ^ ((i + 1) * 0xd1b54a32d192ed03ULL);
+        inst->used = (bool *)calloc(g_emu.cfg.ring, sizeof(bool));
+        inst->due = (uint64_t *)calloc(g_emu.cfg.ring, sizeof(uint64_t));
+        if (inst->used == NULL || inst->due == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not allocate the emulated rings\n");
+            return -1;
+        }
+    }
+
+    g_emu.num_inst = num_inst;
+    g_emu.start_ns = now_ns();
+    g_emu.sim_end = 0;
+    g_emu.cb_stop = false;
+    pthread_mutex_init(&g_emu.cb_mutex, NULL);
+    pthread_cond_init(&g_emu.cb_cond, NULL);
+
+    if (pthread_create(&g_emu.cb_thread, NULL, cb_entry, NULL)) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not start the emulator's completion thread\n");
+        return -1;
+    }
+
+    g_emu.enabled = true;
+
+    MG_LOG_PRINT(g_log_fd, "Emulating %u instance(s): ring %u, latency %s %.1f/%.1f us, %s, %s, %s clock\n",
+            num_inst, g_emu.cfg.ring, g_dist_names[g_emu.cfg.lat_dist], g_emu.cfg.lat_a, g_emu.cfg.lat_b,
+            g_emu.cfg.bw_mbps > 0 ? "bandwidth capped" : "no bandwidth cap",
+            g_emu.cfg.poll_us > 0 ? "polled" : "completion when due",
+            g_emu.cfg.sim_clock ? "simulated" : "real");
+
+    return 0;
+}
+
+/*
+    Function:
+
+        dc_emu_stop
+
+    Description:
+
+        Delivers any callbacks still pending and stops the completion thread. The instance
+        counters are kept for dc_emu_print_stats
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void dc_emu_stop()
+{
+    if (!g_emu.enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_emu.cb_mutex);
+    g_emu.cb_stop = true;
+    pthread_cond_signal(&g_emu.cb_cond);
+    pthread_mutex_unlock(&g_emu.cb_mutex);
+    pthread_join(g_emu.cb_thread, NULL);
+
+    g_emu.enabled = false;
+}
+
+bool dc_emu_enabled()
+{
+    return g_emu.enabled;
+}
+
+/*
+    Function:
+
+        dc_emu_submit
+
+    Description:
+
+        Takes a ring slot on the instance for a new request, and books its service behind
+        the instance's earlier requests, which fixes when it is due. On the simulated clock
+        a full ring also moves time on to its first completion, since nothing else would
+
+    Parameters:
+
+        idx     -   Software instance number
+        bytes   -   Cleartext bytes the request is charged for
+        req     -   Ptr to the request to fill in
+
+    Return:
+
+        CPA_STATUS_SUCCESS, or CPA_STATUS_RETRY if the ring is full
+*/
+CpaStatus dc_emu_submit(uint32_t idx, uint64_t bytes, struct dc_emu_req *req)
+{
+    struct emu_inst *inst = &g_emu.inst[idx % g_emu.num_inst];
+    uint64_t poll_ns = (uint64_t)(g_emu.cfg.poll_us * 1000.0);
+    uint64_t svc = g_emu.cfg.bw_mbps > 0 ? (uint64_t)(bytes * 1000.0 / g_emu.cfg.bw_mbps) : 0;
+    uint64_t earliest = UINT64_MAX;
+    uint64_t now = emu_now();
+    uint64_t start;
+    uint32_t slot = g_emu.cfg.ring;
+    uint32_t busy = 0;
+
+    pthread_mutex_lock(&inst->mutex);
+
+    for (uint32_t i = 0; i < g_emu.cfg.ring; i++)
+    {
+        if (!inst->used[i] && inst->due[i] <= now) {
+            slot = MIN(slot, i);
+            continue;
+        }
+        busy++;
+        if (inst->due[i] > now) {
+            earliest = MIN(earliest, inst->due[i]);
+        }
+    }
+
+    if (slot == g_emu.cfg.ring) {
+        inst->retries++;
+        pthread_mutex_unlock(&inst->mutex);
+
+        if (g_emu.cfg.sim_clock && earliest != UINT64_MAX) {
+            advance_to(earliest);
+        }
+
+        return CPA_STATUS_RETRY;
+    }
+
+    start = MAX(now, inst->busy_until);
+    inst->busy_until = start + svc;
+    req->due = start + svc + sample_lat(inst);
+    if (poll_ns) {
+        req->due = ((req->due + poll_ns - 1) / poll_ns) * poll_ns;
+    }
+    req->inst = idx % g_emu.num_inst;
+    req->slot = slot;
+    req->fault = CPA_DC_OK;
+    if ((int32_t)req->inst == g_emu.cfg.fault_inst && next_unit(&inst->rng) < g_emu.cfg.fault_p) {
+        req->fault = g_emu.cfg.fault_status;
+        inst->faults++;
+    }
+
+    inst->used[slot] = true;
+    inst->due[slot] = req->due;
+    inst->peak = MAX(inst->peak, busy + 1);
+    inst->reqs++;
+    inst->bytes += bytes;
+    inst->svc_ns += svc;
+    inst->queue_ns += start - now;
+    inst->lat_ns += req->due - now;
+
+    pthread_mutex_unlock(&inst->mutex);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        dc_emu_complete
+
+    Description:
+
+        Delivers the request's completion when it is due: by returning, for a sync caller,
+        or through the callback from the completion thread
+
+    Parameters:
+
+        req     -   Ptr to the request from dc_emu_submit
+        cb      -   Session callback, or NULL for a sync request
+        tag     -   Callback tag
+        status  -   Status to hand the callback
+
+    Return:
+
+        none
+*/
+void dc_emu_complete(struct dc_emu_req *req, CpaDcCallbackFn cb, void *tag, CpaStatus status)
+{
+    // The zlib work alone took longer than the modelled instance would have
+    if (!g_emu.cfg.sim_clock && emu_now() > req->due) {
+        __sync_fetch_and_add(&g_emu.inst[req->inst].late, 1);
+    }
+
+    if (cb) {
+        pthread_mutex_lock(&g_emu.cb_mutex);
+        g_emu.pending[g_emu.num_pending++] = (struct emu_pending){ req->due, req->inst, req->slot, cb, tag, status };
+        pthread_cond_signal(&g_emu.cb_cond);
+        pthread_mutex_unlock(&g_emu.cb_mutex);
+        return;
+    }
+
+    wait_until(req->due);
+    release_slot(req->inst, req->slot);
+}
+
+/*
+    Function:
+
+        dc_emu_print_stats
+
+    Description:
+
+        Prints each emulated instance's requests, ring retries and peak depth, where its
+        time went, and how busy the bandwidth cap kept it over the emulated run
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void dc_emu_print_stats()
+{
+    uint64_t elapsed;
+    uint64_t total = 0;
+    uint64_t reqs = 0;
+
+    for (uint32_t i = 0; i < g_emu.num_inst; i++)
+    {
+        reqs += g_emu.inst[i].reqs;
+    }
+    if (reqs == 0) {
+        return;
+    }
+
+    elapsed = g_emu.cfg.sim_clock ? g_emu.sim_end : emu_now();
+
+    MG_LOG_PRINT(g_log_fd, "    DC emulator (%s):\n", g_emu.spec);
+    MG_LOG_PRINT(g_log_fd, "        %-4s %10s %10s %5s %10s %10s %10s %6s %8s %8s\n",
+            "inst", "requests", "retries", "peak", "MB", "queue us", "total us", "util", "late", "faults");
+
+    for (uint32_t i = 0; i < g_emu.num_inst; i++)
+    {
+        struct emu_inst *inst = &g_emu.inst[i];
+
+        if (inst->reqs == 0) {
+            continue;
+        }
+
+        total += inst->bytes;
+        MG_LOG_PRINT(g_log_fd, "        %-4u %10lu %10lu %5u %10.2f %10.1f %10.1f %5.1f%% %8lu %8lu\n",
+                i, inst->reqs, inst->retries, inst->peak, inst->bytes / (1024.0 * 1024.0),
+                inst->queue_ns / 1e3 / inst->reqs, inst->lat_ns / 1e3 / inst->reqs,
+                elapsed ? 100.0 * inst->svc_ns / elapsed : 0.0, inst->late, inst->faults);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "        %.3f s %s, %.1f MB/s across instances, %lu callback(s)\n\n",
+            elapsed / 1e9, g_emu.cfg.sim_clock ? "simulated" : "elapsed",
+            elapsed ? (total / (1024.0 * 1024.0)) / (elapsed / 1e9) : 0.0, g_emu.callbacks);
+}
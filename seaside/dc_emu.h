@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+    Accelerator timing emulator (--dc-emu), on top of the software DC backend.
+
+    The software instances still do the work on zlib; the emulator decides when each request
+    completes: a bounded ring per instance (CPA_STATUS_RETRY when it is full), a bandwidth cap
+    the instance's requests queue behind, a sampled latency on top, and completions delivered
+    on poll ticks or straight away, to sync waiters or to session callbacks. The clock is real
+    time, or a simulated one that jumps to each completion instead of sleeping
+*/
+
+#include "main.h"
+#include "cpa_types.h"
+#include "cpa.h"
+#include "cpa_dc.h"
+
+#define DC_EMU_DEFAULT_RING     (128)
+#define DC_EMU_MAX_RING         (4096)
+
+enum dc_emu_dist {
+    EMU_LAT_FIXED,
+    EMU_LAT_UNIFORM,
+    EMU_LAT_EXP,
+    EMU_LAT_NORMAL,
+};
+
+/*
+    "ring=N,lat=DIST,bw=MBPS,poll=US,clock=real|sim,fault=I:P[:soft]", any subset. DIST is US,
+    uniform:LO:HI, exp:MEAN or normal:MEAN:SD, in microseconds. bw is per instance on the
+    cleartext side, 0 for no cap. poll=0 delivers each completion as soon as it is due.
+    fault makes instance I fail a fraction P of its requests with CPA_DC_FATALERR, or
+    CPA_DC_SOFTERR with :soft
+*/
+struct dc_emu_config {
+    uint32_t ring;
+    enum dc_emu_dist lat_dist;
+    double lat_a;
+    double lat_b;
+    double bw_mbps;
+    double poll_us;
+    bool sim_clock;
+    int32_t fault_inst;
+    double fault_p;
+    CpaDcReqStatus fault_status;
+};
+
+// A request between dc_emu_submit and dc_emu_complete
+struct dc_emu_req {
+    uint32_t inst;
+    uint32_t slot;
+    uint64_t due;
+
+    // CPA_DC_OK, or the error the request is to fail with instead of being done
+    CpaDcReqStatus fault;
+};
+
+int dc_emu_parse(const char *str, struct dc_emu_config *cfg);
+int dc_emu_start(struct mg_options *opt, uint32_t num_inst);
+void dc_emu_stop();
+bool dc_emu_enabled();
+CpaStatus dc_emu_submit(uint32_t inst, uint64_t bytes, struct dc_emu_req *req);
+void dc_emu_complete(struct dc_emu_req *req, CpaDcCallbackFn cb, void *tag, CpaStatus status);
+void dc_emu_print_stats();
@@ -0,0 +1,460 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "dedup.h"
+#include "cpr.h"
+#include "hash128.h"
+#include "pack.h"
+
+extern FILE *g_log_fd;
+
+struct dedup_entry {
+    uint32_t idx;
+    uint64_t size;
+    uint64_t h1;
+    uint64_t h2;
+    char *path;
+};
+
+static struct {
+    uint64_t hashed;
+    uint64_t hashed_bytes;
+    uint64_t ns;
+    uint64_t groups;
+    uint64_t dups;
+    uint64_t dup_bytes;
+    uint64_t collisions;
+    uint64_t compared_bytes;
+} g_dedup_stats;
+
+/*
+    Function:
+
+        hash_file (static)
+
+    Description:
+
+        Hashes a whole file with 128-bit MurmurHash3
+
+    Parameters:
+
+        path    -   File to hash
+        buf     -   DEDUP_READ_SIZE scratch buffer
+        e       -   Ptr to the entry, its hash is set
+
+    Return:
+
+        0 on success, -1 if the file could not be read
+*/
+static int hash_file(char *path, uint8_t *buf, struct dedup_entry *e)
+{
+    struct hash128 h;
+    ssize_t n;
+    size_t have = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    hash128_init(&h);
+
+    while (1)
+    {
+        n = read(fd, buf + have, DEDUP_READ_SIZE - have);
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+
+        have += n;
+
+        // Only hash full buffers until EOF, so partial reads can't split a block
+        if (n == 0) {
+            hash128_blocks(&h, buf, have / 16);
+            hash128_final(&h, buf + (have & ~(size_t)15), have & 15);
+            break;
+        }
+
+        if (have == DEDUP_READ_SIZE) {
+            hash128_blocks(&h, buf, have / 16);
+            have = 0;
+        }
+    }
+
+    close(fd);
+
+    e->h1 = h.h1;
+    e->h2 = h.h2;
+
+    g_dedup_stats.hashed++;
+    g_dedup_stats.hashed_bytes += h.total;
+
+    // The file changed since the scan; don't trust it to match anything
+    if (h.total != e->size) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        same_file (static)
+
+    Description:
+
+        Compares two files of the same size byte for byte
+
+    Parameters:
+
+        a       -   First file
+        b       -   Second file
+        size    -   Their size from the scan
+        buf     -   DEDUP_READ_SIZE scratch buffer, split between the two
+
+    Return:
+
+        true if both could be read in full and are identical
+*/
+static bool same_file(char *a, char *b, uint64_t size, uint8_t *buf)
+{
+    size_t half = DEDUP_READ_SIZE / 2;
+    bool same = true;
+    int fa;
+    int fb;
+
+    fa = open(a, O_RDONLY | O_CLOEXEC);
+    fb = open(b, O_RDONLY | O_CLOEXEC);
+    if (fa < 0 || fb < 0) {
+        same = false;
+    }
+
+    for (uint64_t off = 0; same && off < size; off += half)
+    {
+        size_t n = (size - off < half) ? (size - off) : half;
+
+        if (pread(fa, buf, n, off) != (ssize_t)n || pread(fb, buf + half, n, off) != (ssize_t)n ||
+                memcmp(buf, buf + half, n) != 0) {
+            same = false;
+        }
+
+        g_dedup_stats.compared_bytes += n;
+    }
+
+    if (fa >= 0) {
+        close(fa);
+    }
+    if (fb >= 0) {
+        close(fb);
+    }
+
+    return same;
+}
+
+/*
+    Function:
+
+        same_bytes (static)
+
+    Description:
+
+        Confirms two entries whose size and hash match really are identical, so a
+        hash collision can't make a file report another's result. Pack payloads
+        are compared in the mapped pack, generated inputs by their spec
+
+    Parameters:
+
+        list    -   Ptr to the list being deduplicated
+        a       -   Ptr to the keeper's entry
+        b       -   Ptr to the candidate alias's entry
+        buf     -   DEDUP_READ_SIZE scratch buffer
+
+    Return:
+
+        true if the bytes are identical
+*/
+static bool same_bytes(struct file_list *list, struct dedup_entry *a, struct dedup_entry *b, uint8_t *buf)
+{
+    if (list->pack) {
+        struct pack_entry *pa = &list->pack->entries[list->pack_idx[a->idx]];
+        struct pack_entry *pb = &list->pack->entries[list->pack_idx[b->idx]];
+
+        // meatjet-pack stores byte-identical files once
+        if (pa->offset == pb->offset) {
+            return true;
+        }
+
+        g_dedup_stats.compared_bytes += a->size;
+
+        return memcmp(list->pack->map + pa->offset, list->pack->map + pb->offset, a->size) == 0;
+    }
+
+    if (list->gen) {
+        return strcmp(a->path, b->path) == 0;
+    }
+
+    return same_file(a->path, b->path, a->size, buf);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+    const struct dedup_entry *x = (const struct dedup_entry *)a;
+    const struct dedup_entry *y = (const struct dedup_entry *)b;
+
+    if (x->size != y->size) {
+        return (x->size < y->size) ? -1 : 1;
+    }
+
+    return (x->idx < y->idx) ? -1 : 1;
+}
+
+static int cmp_hash(const void *a, const void *b)
+{
+    const struct dedup_entry *x = (const struct dedup_entry *)a;
+    const struct dedup_entry *y = (const struct dedup_entry *)b;
+
+    if (x->h1 != y->h1) {
+        return (x->h1 < y->h1) ? -1 : 1;
+    }
+    if (x->h2 != y->h2) {
+        return (x->h2 < y->h2) ? -1 : 1;
+    }
+
+    return (x->idx < y->idx) ? -1 : 1;
+}
+
+/*
+    Function:
+
+        dedup_file_list
+
+    Description:
+
+        Collapses byte-identical files in a scanned list. Only files that share a
+        size with another are read and hashed, with a 128-bit hash, so a corpus
+        without duplicates costs nothing beyond the sort. Pack entries use the
+        hash stored in the index instead, and generated inputs hash their spec. Of each identical group,
+        the file earliest in the list stays and the others become its aliases,
+        once their bytes are compared against it; the list keeps its order otherwise
+
+    Parameters:
+
+        list    -   Ptr to the list from dir_scan(); its aliases are set
+
+    Return:
+
+        Number of files removed from the list, or -1 on failure (list unchanged)
+*/
+int dedup_file_list(struct file_list *list)
+{
+    struct dedup_entry *e;
+    struct file_alias *aliases;
+    uint32_t *keep_of;
+    uint8_t *buf;
+    uint32_t n = list->num_files;
+    uint32_t out = 0;
+    uint64_t start = now_ns();
+
+    e = (struct dedup_entry *)calloc(n ? n : 1, sizeof(struct dedup_entry));
+    keep_of = (uint32_t *)calloc(n ? n : 1, sizeof(uint32_t));
+    aliases = (struct file_alias *)calloc(n ? n : 1, sizeof(struct file_alias));
+    buf = (uint8_t *)malloc(DEDUP_READ_SIZE);
+    if (e == NULL || keep_of == NULL || aliases == NULL || buf == NULL) {
+        free(e);
+        free(keep_of);
+        free(aliases);
+        free(buf);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        e[i].idx = i;
+        e[i].size = list->sizes[i];
+        e[i].path = list->paths[i];
+        keep_of[i] = i;
+    }
+
+    qsort(e, n, sizeof(struct dedup_entry), cmp_size);
+
+    for (uint32_t i = 0; i < n;)
+    {
+        uint32_t j = i + 1;
+        uint32_t unreadable = 0;
+
+        while (j < n && e[j].size == e[i].size)
+        {
+            j++;
+        }
+
+        // Same size as something else: hash the run, and group it by hash
+        if (j - i > 1) {
+            for (uint32_t k = i; k < j; k++)
+            {
+                // Packs carry their hashes in the index
+                if (list->pack) {
+                    struct pack_entry *pe = &list->pack->entries[list->pack_idx[e[k].idx]];
+
+                    e[k].h1 = pe->hash[0];
+                    e[k].h2 = pe->hash[1];
+                    g_dedup_stats.hashed++;
+                    continue;
+                }
+
+                // A generated input is its spec, so equal specs are equal bytes
+                if (list->gen) {
+                    uint64_t h[2];
+
+                    hash128_buf(e[k].path, strlen(e[k].path), h);
+                    e[k].h1 = h[0];
+                    e[k].h2 = h[1];
+                    g_dedup_stats.hashed++;
+                    continue;
+                }
+
+                if (hash_file(e[k].path, buf, &e[k]) != 0) {
+                    // Make it unique, so it runs (and fails) on its own
+                    e[k].h1 = ~0ULL;
+                    e[k].h2 = unreadable++;
+                }
+            }
+
+            qsort(&e[i], j - i, sizeof(struct dedup_entry), cmp_hash);
+
+            // Sorted by index within a hash, so each group's first entry is the keeper
+            for (uint32_t k = i; k < j;)
+            {
+                uint32_t g = k + 1;
+                uint32_t dups = 0;
+
+                while (g < j && e[g].h1 == e[k].h1 && e[g].h2 == e[k].h2)
+                {
+                    // A collision, or a file that changed since it was hashed, runs on its own
+                    if (!same_bytes(list, &e[k], &e[g], buf)) {
+                        g_dedup_stats.collisions++;
+                        g++;
+                        continue;
+                    }
+
+                    keep_of[e[g].idx] = e[k].idx;
+                    g_dedup_stats.dups++;
+                    g_dedup_stats.dup_bytes += e[g].size;
+                    dups++;
+                    g++;
+                }
+
+                if (dups) {
+                    g_dedup_stats.groups++;
+                }
+
+                k = g;
+            }
+        }
+
+        i = j;
+    }
+
+    // Count the aliases of each keeper, then fill them in list order
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (keep_of[i] != i) {
+            aliases[keep_of[i]].num++;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (aliases[i].num) {
+            aliases[i].paths = (char **)calloc(aliases[i].num, sizeof(char *));
+            aliases[i].num = 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (keep_of[i] != i) {
+            struct file_alias *a = &aliases[keep_of[i]];
+
+            if (a->paths) {
+                a->paths[a->num++] = list->paths[i];
+            }
+        }
+    }
+
+    // Compact the list to the keepers
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (keep_of[i] != i) {
+            continue;
+        }
+
+        list->paths[out] = list->paths[i];
+        list->sizes[out] = list->sizes[i];
+        aliases[out] = aliases[i];
+        if (list->pack_idx) {
+            list->pack_idx[out] = list->pack_idx[i];
+        }
+        out++;
+    }
+
+    list->num_files = out;
+    list->total_bytes -= g_dedup_stats.dup_bytes;
+    list->aliases = aliases;
+
+    g_dedup_stats.ns = now_ns() - start;
+
+    free(e);
+    free(keep_of);
+    free(buf);
+
+    MG_LOG_PRINT(g_log_fd, "Dedup: hashed %lu files (%.2f MB) in %.3f s, %lu duplicate(s) of %lu file(s) collapsed, "
+            "%lu hash match(es) that differed\n", g_dedup_stats.hashed, g_dedup_stats.hashed_bytes / (1024.0 * 1024.0),
+            g_dedup_stats.ns / 1e9, g_dedup_stats.dups, g_dedup_stats.groups, g_dedup_stats.collisions);
+
+    return n - out;
+}
+
+/*
+    Function:
+
+        dedup_print_stats
+
+    Description:
+
+        Prints how much input and sweep work the collapsed duplicates would have cost
+
+    Parameters:
+
+        src_list    -   The files that ran
+        num_files   -   Number of them
+
+    Return:
+
+        none
+*/
+void dedup_print_stats(struct src_data **src_list, int num_files)
+{
+    uint64_t ctxs = 0;
+
+    if (g_dedup_stats.hashed == 0) {
+        return;
+    }
+
+    for (int i = 0; i < num_files; i++)
+    {
+        if (src_list[i] != NULL) {
+            ctxs += (uint64_t)src_list[i]->num_aliases * src_list[i]->orig_ref_count;
+        }
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Dedup: %lu duplicate(s) of %lu file(s), hashed %lu files (%.2f MB) in %.3f s\n",
+            g_dedup_stats.dups, g_dedup_stats.groups, g_dedup_stats.hashed,
+            g_dedup_stats.hashed_bytes / (1024.0 * 1024.0), g_dedup_stats.ns / 1e9);
+    MG_LOG_PRINT(g_log_fd, "        skipped %lu contexts over %.2f MB of input, %.2f MB compared to confirm, %lu hash match(es) differed\n\n",
+            ctxs, g_dedup_stats.dup_bytes / (1024.0 * 1024.0), g_dedup_stats.compared_bytes / (1024.0 * 1024.0),
+            g_dedup_stats.collisions);
+}
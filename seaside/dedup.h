@@ -0,0 +1,12 @@
+#pragma once
+
+#include "main.h"
+#include "dir_scan.h"
+
+// Read size while hashing; a multiple of the hash's 16 byte block
+#define DEDUP_READ_SIZE     (1024 * 1024)
+
+struct src_data;
+
+int dedup_file_list(struct file_list *list);
+void dedup_print_stats(struct src_data **src_list, int num_files);
@@ -0,0 +1,656 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dir_scan.h"
+
+extern FILE *g_log_fd;
+
+// A directory waiting to be read: already opened relative to its parent
+struct scan_dir {
+    int fd;
+    char *path;
+    struct scan_dir *next;
+};
+
+// What one worker found. Entries are arena offsets, since the arena moves as it grows
+struct scan_out {
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+
+    uint64_t *offset;
+    uint64_t *size;
+    uint32_t num;
+    uint32_t cap;
+
+    uint64_t dirs;
+    uint64_t stats;
+};
+
+struct scan_entry {
+    char *path;
+    uint64_t size;
+    struct file_alias alias;
+    uint32_t pack_idx;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct scan_dir *queue;
+    uint32_t queued;
+    uint32_t busy;
+    bool failed;
+} g_scan;
+
+/*
+    Function:
+
+        out_add (static)
+
+    Description:
+
+        Appends "dir/name" and its size to a worker's results
+
+    Parameters:
+
+        out     -   Ptr to the worker's results
+        dir     -   Path of the directory the file is in
+        name    -   Entry name within dir
+        size    -   File size
+
+    Return:
+
+        0 on success, -1 if out of memory
+*/
+static int out_add(struct scan_out *out, char *dir, char *name, uint64_t size)
+{
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    size_t need = dir_len + 1 + name_len + 1;
+
+    if (out->arena_len + need > out->arena_cap) {
+        size_t cap = out->arena_cap ? out->arena_cap * 2 : 65536;
+        char *arena;
+
+        while (cap < out->arena_len + need)
+        {
+            cap *= 2;
+        }
+
+        arena = (char *)realloc(out->arena, cap);
+        if (arena == NULL) {
+            return -1;
+        }
+        out->arena = arena;
+        out->arena_cap = cap;
+    }
+
+    if (out->num == out->cap) {
+        uint32_t cap = out->cap ? out->cap * 2 : 1024;
+        uint64_t *offset = (uint64_t *)realloc(out->offset, cap * sizeof(uint64_t));
+        uint64_t *sz;
+
+        if (offset == NULL) {
+            return -1;
+        }
+        out->offset = offset;
+
+        sz = (uint64_t *)realloc(out->size, cap * sizeof(uint64_t));
+        if (sz == NULL) {
+            return -1;
+        }
+        out->size = sz;
+        out->cap = cap;
+    }
+
+    out->offset[out->num] = out->arena_len;
+    out->size[out->num] = size;
+    out->num++;
+
+    memcpy(out->arena + out->arena_len, dir, dir_len);
+    out->arena[out->arena_len + dir_len] = '/';
+    memcpy(out->arena + out->arena_len + dir_len + 1, name, name_len + 1);
+    out->arena_len += need;
+
+    return 0;
+}
+
+/*
+    Function:
+
+        push_dir (static)
+
+    Description:
+
+        Queues a subdirectory for any worker, or returns false if the queue is full
+        and the caller should walk it itself
+
+    Parameters:
+
+        fd      -   Open fd of the subdirectory
+        path    -   Its path, taken over by the queue on success
+
+    Return:
+
+        true if queued
+*/
+static bool push_dir(int fd, char *path)
+{
+    struct scan_dir *d;
+
+    pthread_mutex_lock(&g_scan.mutex);
+
+    if (g_scan.queued >= DIR_SCAN_MAX_QUEUED) {
+        pthread_mutex_unlock(&g_scan.mutex);
+        return false;
+    }
+
+    d = (struct scan_dir *)malloc(sizeof(struct scan_dir));
+    if (d == NULL) {
+        pthread_mutex_unlock(&g_scan.mutex);
+        return false;
+    }
+
+    d->fd = fd;
+    d->path = path;
+    d->next = g_scan.queue;
+    g_scan.queue = d;
+    g_scan.queued++;
+
+    pthread_cond_signal(&g_scan.cond);
+    pthread_mutex_unlock(&g_scan.mutex);
+
+    return true;
+}
+
+/*
+    Function:
+
+        scan_fail (static)
+
+    Description:
+
+        Marks the scan as failed. Any worker can get here, so it goes under the lock
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+static void scan_fail()
+{
+    pthread_mutex_lock(&g_scan.mutex);
+    g_scan.failed = true;
+    pthread_mutex_unlock(&g_scan.mutex);
+}
+
+/*
+    Function:
+
+        walk_dir (static)
+
+    Description:
+
+        Reads one directory. Files are recorded with the size from an fstatat
+        relative to the directory fd, and d_type saves the stat for anything the
+        filesystem already labels as something other than a file or directory.
+        Subdirectories are opened with openat and handed to the queue, or walked
+        right here if the queue is full. Like the stat() walk this replaces,
+        symlinks are followed
+
+    Parameters:
+
+        out     -   Ptr to this worker's results
+        fd      -   Open fd of the directory, closed before returning
+        path    -   Path of the directory, for building file paths
+
+    Return:
+
+        none
+*/
+static void walk_dir(struct scan_out *out, int fd, char *path)
+{
+    DIR *dirp;
+    struct dirent *dp;
+
+    dirp = fdopendir(fd);
+    if (dirp == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: Could not open dir %s\n", path);
+        close(fd);
+        return;
+    }
+
+    out->dirs++;
+
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        struct stat st;
+        int sub_fd;
+        char *sub_path;
+
+        // Skip current and parent directories
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+            continue;
+        }
+
+        if (dp->d_type != DT_UNKNOWN && dp->d_type != DT_LNK && dp->d_type != DT_REG && dp->d_type != DT_DIR) {
+            continue;
+        }
+
+        if (dp->d_type != DT_DIR) {
+            out->stats++;
+            if (fstatat(fd, dp->d_name, &st, 0) != 0) {
+                continue;
+            }
+
+            if (S_ISREG(st.st_mode)) {
+                if (out_add(out, path, dp->d_name, st.st_size) != 0) {
+                    scan_fail();
+                    break;
+                }
+                continue;
+            }
+
+            if (!S_ISDIR(st.st_mode)) {
+                continue;
+            }
+        }
+
+        sub_fd = openat(fd, dp->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub_fd < 0) {
+            MG_LOG_PRINT(g_log_fd, "Error: Could not open dir %s/%s\n", path, dp->d_name);
+            continue;
+        }
+
+        sub_path = (char *)malloc(strlen(path) + 1 + strlen(dp->d_name) + 1);
+        if (sub_path == NULL) {
+            close(sub_fd);
+            scan_fail();
+            break;
+        }
+        sprintf(sub_path, "%s/%s", path, dp->d_name);
+
+        if (!push_dir(sub_fd, sub_path)) {
+            walk_dir(out, sub_fd, sub_path);
+            free(sub_path);
+        }
+    }
+
+    closedir(dirp);
+}
+
+/*
+    Function:
+
+        scan_worker (static)
+
+    Description:
+
+        Takes queued directories until the queue is empty and no other worker is
+        still reading one, since that worker could queue more
+
+    Parameters:
+
+        arg -   Ptr to this worker's scan_out
+
+    Return:
+
+        none
+*/
+static void *scan_worker(void *arg)
+{
+    struct scan_out *out = (struct scan_out *)arg;
+    struct scan_dir *d;
+
+    pthread_mutex_lock(&g_scan.mutex);
+
+    while (1)
+    {
+        while (g_scan.queue == NULL && g_scan.busy)
+        {
+            pthread_cond_wait(&g_scan.cond, &g_scan.mutex);
+        }
+
+        if (g_scan.queue == NULL) {
+            break;
+        }
+
+        d = g_scan.queue;
+        g_scan.queue = d->next;
+        g_scan.queued--;
+        g_scan.busy++;
+
+        pthread_mutex_unlock(&g_scan.mutex);
+
+        walk_dir(out, d->fd, d->path);
+        free(d->path);
+        free(d);
+
+        pthread_mutex_lock(&g_scan.mutex);
+
+        g_scan.busy--;
+        if (g_scan.queue == NULL && g_scan.busy == 0) {
+            pthread_cond_broadcast(&g_scan.cond);
+        }
+    }
+
+    pthread_mutex_unlock(&g_scan.mutex);
+
+    return NULL;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return strcmp(((const struct scan_entry *)a)->path, ((const struct scan_entry *)b)->path);
+}
+
+/*
+    Function:
+
+        dir_scan
+
+    Description:
+
+        Walks a directory tree once and builds the list of files in it. Each
+        thread is one worker pulling directories off a shared queue. The list is
+        sorted by path afterwards, so the order does not depend on which worker
+        got where first
+
+    Parameters:
+
+        dirname -   Root of the tree
+        threads -   Number of walker threads, 1 walks on the calling thread
+        list    -   Ptr to the list to fill in, freed with dir_scan_free()
+
+    Return:
+
+        Number of files found, or -1 on failure
+*/
+int dir_scan(char *dirname, uint32_t threads, struct file_list *list)
+{
+    struct scan_out *outs;
+    struct scan_entry *entries = NULL;
+    pthread_t tids[DIR_SCAN_MAX_THREADS];
+    uint32_t started = 0;
+    uint64_t dirs = 0, stats = 0;
+    size_t arena_len = 0;
+    uint32_t num = 0;
+    uint64_t start = now_ns();
+    char *root;
+    int fd;
+
+    memset(list, 0, sizeof(struct file_list));
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > DIR_SCAN_MAX_THREADS) {
+        threads = DIR_SCAN_MAX_THREADS;
+    }
+
+    fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: Could not open dir %s\n", dirname);
+        return -1;
+    }
+
+    root = strdup(dirname);
+    outs = (struct scan_out *)calloc(threads, sizeof(struct scan_out));
+    if (root == NULL || outs == NULL) {
+        close(fd);
+        free(root);
+        free(outs);
+        return -1;
+    }
+
+    pthread_mutex_init(&g_scan.mutex, NULL);
+    pthread_cond_init(&g_scan.cond, NULL);
+    g_scan.queue = NULL;
+    g_scan.queued = 0;
+    g_scan.busy = 0;
+    g_scan.failed = false;
+
+    // The queue is empty, so this can't be refused
+    push_dir(fd, root);
+
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, scan_worker, &outs[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    scan_worker(&outs[0]);
+
+    for (uint32_t i = 1; i <= started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    // The workers are joined, so g_scan.failed can be read without the lock from here on
+    pthread_cond_destroy(&g_scan.cond);
+    pthread_mutex_destroy(&g_scan.mutex);
+
+    // Merge the workers' results into one arena
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        arena_len += outs[i].arena_len;
+        num += outs[i].num;
+        dirs += outs[i].dirs;
+        stats += outs[i].stats;
+    }
+
+    if (!g_scan.failed) {
+        list->arena = (char *)malloc(arena_len ? arena_len : 1);
+        list->paths = (char **)calloc(num ? num : 1, sizeof(char *));
+        list->sizes = (uint64_t *)calloc(num ? num : 1, sizeof(uint64_t));
+        entries = (struct scan_entry *)calloc(num ? num : 1, sizeof(struct scan_entry));
+        if (list->arena == NULL || list->paths == NULL || list->sizes == NULL || entries == NULL) {
+            g_scan.failed = true;
+        }
+    }
+
+    if (!g_scan.failed) {
+        size_t pos = 0;
+        uint32_t n = 0;
+
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            memcpy(list->arena + pos, outs[i].arena, outs[i].arena_len);
+            for (uint32_t f = 0; f < outs[i].num; f++)
+            {
+                entries[n].path = list->arena + pos + outs[i].offset[f];
+                entries[n].size = outs[i].size[f];
+                n++;
+            }
+            pos += outs[i].arena_len;
+        }
+
+        qsort(entries, num, sizeof(struct scan_entry), cmp_entry);
+
+        for (uint32_t f = 0; f < num; f++)
+        {
+            list->paths[f] = entries[f].path;
+            list->sizes[f] = entries[f].size;
+            list->total_bytes += entries[f].size;
+        }
+
+        list->num_files = num;
+    }
+
+    free(entries);
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        free(outs[i].arena);
+        free(outs[i].offset);
+        free(outs[i].size);
+    }
+    free(outs);
+
+    if (g_scan.failed) {
+        MG_LOG_PRINT(g_log_fd, "Error: Out of memory scanning %s\n", dirname);
+        dir_scan_free(list);
+        return -1;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "Scanned %s: %u files, %.2f MB, %lu dirs, %lu stats in %.3f s (%u thread(s))\n",
+            dirname, num, list->total_bytes / (1024.0 * 1024.0), dirs, stats, (now_ns() - start) / 1e9, started + 1);
+
+    return num;
+}
+
+static int cmp_entry_size(const void *a, const void *b)
+{
+    const struct scan_entry *x = (const struct scan_entry *)a;
+    const struct scan_entry *y = (const struct scan_entry *)b;
+
+    if (x->size != y->size) {
+        return (x->size < y->size) ? 1 : -1;
+    }
+
+    return strcmp(x->path, y->path);
+}
+
+/*
+    Function:
+
+        dir_scan_sort_size
+
+    Description:
+
+        Reorders a list largest file first, by path among equal sizes
+
+    Parameters:
+
+        list    -   Ptr to the list
+
+    Return:
+
+        0 on success, -1 if out of memory (the list is left as it was)
+*/
+int dir_scan_sort_size(struct file_list *list)
+{
+    struct scan_entry *entries;
+
+    entries = (struct scan_entry *)calloc(list->num_files ? list->num_files : 1, sizeof(struct scan_entry));
+    if (entries == NULL) {
+        return -1;
+    }
+
+    for (uint32_t f = 0; f < list->num_files; f++)
+    {
+        entries[f].path = list->paths[f];
+        entries[f].size = list->sizes[f];
+        if (list->aliases) {
+            entries[f].alias = list->aliases[f];
+        }
+        if (list->pack_idx) {
+            entries[f].pack_idx = list->pack_idx[f];
+        }
+    }
+
+    qsort(entries, list->num_files, sizeof(struct scan_entry), cmp_entry_size);
+
+    for (uint32_t f = 0; f < list->num_files; f++)
+    {
+        list->paths[f] = entries[f].path;
+        list->sizes[f] = entries[f].size;
+        if (list->aliases) {
+            list->aliases[f] = entries[f].alias;
+        }
+        if (list->pack_idx) {
+            list->pack_idx[f] = entries[f].pack_idx;
+        }
+    }
+
+    free(entries);
+
+    return 0;
+}
+
+/*
+    Function:
+
+        dir_scan_single
+
+    Description:
+
+        Builds a one-entry list for -i, so a single file goes through the same
+        path as a directory
+
+    Parameters:
+
+        filename    -   The input file
+        list        -   Ptr to the list to fill in, freed with dir_scan_free()
+
+    Return:
+
+        1, or -1 on failure
+*/
+int dir_scan_single(char *filename, struct file_list *list)
+{
+    struct stat st;
+
+    memset(list, 0, sizeof(struct file_list));
+
+    if (stat(filename, &st) != 0) {
+        return -1;
+    }
+
+    list->arena = strdup(filename);
+    list->paths = (char **)calloc(1, sizeof(char *));
+    list->sizes = (uint64_t *)calloc(1, sizeof(uint64_t));
+    if (list->arena == NULL || list->paths == NULL || list->sizes == NULL) {
+        dir_scan_free(list);
+        return -1;
+    }
+
+    list->num_files = 1;
+    list->paths[0] = list->arena;
+    list->sizes[0] = st.st_size;
+    list->total_bytes = list->sizes[0];
+
+    return 1;
+}
+
+/*
+    Function:
+
+        dir_scan_free
+
+    Description:
+
+        Frees a list built by dir_scan(), dir_scan_single() or pack_file_list().
+        A pack is left open
+
+    Parameters:
+
+        list    -   Ptr to the list
+
+    Return:
+
+        none
+*/
+void dir_scan_free(struct file_list *list)
+{
+    if (list->aliases) {
+        for (uint32_t f = 0; f < list->num_files; f++)
+        {
+            free(list->aliases[f].paths);
+        }
+        free(list->aliases);
+    }
+
+    free(list->arena);
+    free(list->paths);
+    free(list->sizes);
+    free(list->pack_idx);
+    memset(list, 0, sizeof(struct file_list));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <pthread.h>
+#include "main.h"
+
+struct pack;
+
+#define DIR_SCAN_MAX_THREADS    (64)
+
+// Past this many directories waiting, a worker walks new subdirectories itself, so open fds stay bounded
+#define DIR_SCAN_MAX_QUEUED     (256)
+
+/*
+    Files found to be byte-identical to a list entry, which runs once for all of them
+*/
+struct file_alias {
+    uint32_t num;
+    char **paths;
+};
+
+/*
+    The files to run, in path order. Paths point into one arena instead of a
+    MAX_FILE_LEN buffer each, and sizes come from the walk so nothing needs to
+    stat the files again
+*/
+struct file_list {
+    uint32_t num_files;
+    char **paths;
+    uint64_t *sizes;
+    uint64_t total_bytes;
+
+    // Set by dedup_file_list(), NULL otherwise
+    struct file_alias *aliases;
+
+    // Set by pack_file_list(): the pack, and each file's entry in its index
+    struct pack *pack;
+    uint32_t *pack_idx;
+
+    // Set by input_gen_file_list(): paths are generator specs
+    bool gen;
+
+    char *arena;
+};
+
+int dir_scan(char *dirname, uint32_t threads, struct file_list *list);
+int dir_scan_sort_size(struct file_list *list);
+int dir_scan_single(char *filename, struct file_list *list);
+void dir_scan_free(struct file_list *list);
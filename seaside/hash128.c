@@ -0,0 +1,93 @@
+#include <string.h>
+#include "hash128.h"
+
+#define ROTL64(x, r)    (((x) << (r)) | ((x) >> (64 - (r))))
+
+static const uint64_t c1 = 0x87c37b91114253d5ULL;
+static const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+void hash128_init(struct hash128 *h)
+{
+    h->h1 = 0;
+    h->h2 = 0;
+    h->total = 0;
+}
+
+void hash128_blocks(struct hash128 *h, const uint8_t *data, size_t nblocks)
+{
+    uint64_t h1 = h->h1;
+    uint64_t h2 = h->h2;
+
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        uint64_t k1, k2;
+
+        memcpy(&k1, data + (i * 16), 8);
+        memcpy(&k2, data + (i * 16) + 8, 8);
+
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = (h1 * 5) + 0x52dce729;
+
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = (h2 * 5) + 0x38495ab5;
+    }
+
+    h->h1 = h1;
+    h->h2 = h2;
+    h->total += nblocks * 16;
+}
+
+void hash128_final(struct hash128 *h, const uint8_t *tail, size_t len)
+{
+    uint64_t k1 = 0, k2 = 0;
+
+    for (size_t i = len; i > 8; i--)
+    {
+        k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    }
+    if (len > 8) {
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h->h2 ^= k2;
+    }
+
+    for (size_t i = (len > 8 ? 8 : len); i > 0; i--)
+    {
+        k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    }
+    if (len) {
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h->h1 ^= k1;
+    }
+
+    h->total += len;
+
+    h->h1 ^= h->total;
+    h->h2 ^= h->total;
+    h->h1 += h->h2;
+    h->h2 += h->h1;
+    h->h1 = fmix64(h->h1);
+    h->h2 = fmix64(h->h2);
+    h->h1 += h->h2;
+    h->h2 += h->h1;
+}
+
+void hash128_buf(const void *data, size_t len, uint64_t out[2])
+{
+    struct hash128 h;
+
+    hash128_init(&h);
+    hash128_blocks(&h, (const uint8_t *)data, len / 16);
+    hash128_final(&h, (const uint8_t *)data + (len & ~(size_t)15), len & 15);
+
+    out[0] = h.h1;
+    out[1] = h.h2;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    MurmurHash3 x64_128 (Austin Appleby, public domain). Data can be fed in pieces
+    of whole 16 byte blocks, with any partial block passed to hash128_final()
+*/
+struct hash128 {
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t total;
+};
+
+void hash128_init(struct hash128 *h);
+void hash128_blocks(struct hash128 *h, const uint8_t *data, size_t nblocks);
+void hash128_final(struct hash128 *h, const uint8_t *tail, size_t len);
+void hash128_buf(const void *data, size_t len, uint64_t out[2]);
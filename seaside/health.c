@@ -0,0 +1,606 @@
+/*
+    Instance health (--health)
+
+    Counting is always on, so the summary can attribute fatal and soft errors to instances.
+    Quarantine and failover are on unless --health off. A request that went through cleanly
+    only bumps counters; the instance's lock is taken for errors, window roll-over and state
+    changes. The window is a plain count of requests, restarted every window requests, and
+    an instance is quarantined once errors in the current window reach the threshold
+*/
+#include <time.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include "health.h"
+#include "context.h"
+
+extern FILE *g_log_fd;
+
+enum health_state {
+    HEALTH_OK,
+    HEALTH_QUARANTINED,
+    HEALTH_PROBING,
+    HEALTH_STATES,
+};
+
+struct health_inst {
+    pthread_mutex_t mutex;
+    volatile enum health_state state;
+    uint32_t win_reqs;
+    uint32_t win_errs;
+    uint64_t until_ns;
+    uint32_t probe_ms;
+
+    uint64_t requests;
+    uint64_t fatal;
+    uint64_t soft;
+    uint64_t stalls;
+    uint64_t quarantines;
+    uint64_t moved;
+    uint64_t reruns;
+    uint64_t dumps;
+    uint64_t suppressed;
+} __attribute__((aligned(64)));
+
+static struct {
+    bool enabled;
+    uint32_t window;
+    uint32_t errors;
+    uint32_t probe_ms;
+    uint32_t num_inst;
+    struct health_inst *inst;
+} g_health;
+
+static const char *g_state_names[HEALTH_STATES] = { "ok", "quarantined", "probing" };
+
+/*
+    Function:
+
+        parse_spec (static)
+
+    Description:
+
+        Parses a --health spec: "off", or "key=value,..." with keys window, errors and probe
+
+    Parameters:
+
+        str -   Spec to parse
+
+    Return:
+
+        0 on success, -1 if the spec is malformed
+*/
+static int parse_spec(const char *str)
+{
+    char buf[MAX_FILE_LEN];
+    char *save = NULL;
+    char *tok;
+    char *end;
+
+    if (!strcmp(str, "off")) {
+        g_health.enabled = false;
+        return 0;
+    }
+
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *val = strchr(tok, '=');
+        unsigned long v;
+
+        if (val == NULL) {
+            return -1;
+        }
+        *val++ = '\0';
+
+        v = strtoul(val, &end, 0);
+        if (end == val || *end || v == 0 || v > UINT32_MAX) {
+            return -1;
+        }
+
+        if (!strcmp(tok, "window")) {
+            g_health.window = v;
+        } else if (!strcmp(tok, "errors")) {
+            g_health.errors = v;
+        } else if (!strcmp(tok, "probe")) {
+            g_health.probe_ms = v;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        quarantine (static)
+
+    Description:
+
+        Takes an instance out of service until its probe interval has passed
+
+    Parameters:
+
+        idx -   Instance number
+        h   -   Ptr to its health, locked
+        why -   What to log as the reason
+
+    Return:
+
+        none
+*/
+static void quarantine(uint32_t idx, struct health_inst *h, const char *why)
+{
+    h->state = HEALTH_QUARANTINED;
+    h->until_ns = now_ns() + (uint64_t)h->probe_ms * 1000000ULL;
+    h->quarantines++;
+
+    MG_LOG_PRINT(g_log_fd, "Instance %u quarantined: %s (%lu fatal, %lu soft so far), probing again in %u ms\n",
+            idx, why, h->fatal, h->soft, h->probe_ms);
+}
+
+/*
+    Function:
+
+        health_init
+
+    Description:
+
+        Sets up the health of every instance. Called once the instance list is final
+
+    Parameters:
+
+        opt         -   Ptr to the options (--health)
+        num_inst    -   Instances in dcInstances_g
+
+    Return:
+
+        0 on success, -1 on a bad spec or allocation failure
+*/
+int health_init(struct mg_options *opt, uint32_t num_inst)
+{
+    g_health.enabled = true;
+    g_health.window = HEALTH_DEFAULT_WINDOW;
+    g_health.errors = HEALTH_DEFAULT_ERRORS;
+    g_health.probe_ms = HEALTH_DEFAULT_PROBE_MS;
+    g_health.num_inst = num_inst ? num_inst : 1;
+
+    if (opt->health[0] && parse_spec(opt->health) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: bad --health spec \"%s\"\n", opt->health);
+        return -1;
+    }
+
+    if (posix_memalign((void **)&g_health.inst, 64, g_health.num_inst * sizeof(struct health_inst))) {
+        g_health.inst = NULL;
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the instance health\n");
+        return -1;
+    }
+    memset(g_health.inst, 0, g_health.num_inst * sizeof(struct health_inst));
+
+    for (uint32_t i = 0; i < g_health.num_inst; i++)
+    {
+        pthread_mutex_init(&g_health.inst[i].mutex, NULL);
+        g_health.inst[i].probe_ms = g_health.probe_ms;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        health_pick
+
+    Description:
+
+        Chooses the instance a context runs on: its thread's own instance if that is in
+        service, otherwise the next one that is. A context being run again skips the
+        instance it failed on. A quarantined instance whose probe interval has passed takes
+        this context as its probe. If none is in service, the context runs on its own
+        instance anyway
+
+    Parameters:
+
+        ctx         -   Ptr to the context, whose inst and inst_probe are set. For a
+                        context being run again, inst is the instance it failed on
+        preferred   -   The thread's own instance
+
+    Return:
+
+        The instance
+*/
+uint32_t health_pick(struct context *ctx, uint32_t preferred)
+{
+    uint32_t avoid = ctx->failovers ? ctx->inst : UINT32_MAX;
+    uint32_t chosen = preferred;
+    uint64_t now;
+
+    ctx->inst = preferred;
+    ctx->inst_probe = false;
+
+    if (g_health.inst == NULL || !g_health.enabled) {
+        return preferred;
+    }
+
+    now = now_ns();
+
+    for (uint32_t k = 0; k < g_health.num_inst; k++)
+    {
+        uint32_t i = (preferred + k) % g_health.num_inst;
+        struct health_inst *h = &g_health.inst[i];
+        bool ok;
+
+        if (i == avoid && g_health.num_inst > 1) {
+            continue;
+        }
+
+        if (h->state == HEALTH_OK) {
+            chosen = i;
+            break;
+        }
+
+        pthread_mutex_lock(&h->mutex);
+        if (h->state == HEALTH_QUARANTINED && now >= h->until_ns) {
+            h->state = HEALTH_PROBING;
+            ctx->inst_probe = true;
+            MG_LOG_PRINT(g_log_fd, "Instance %u probing with ctx %lu\n", i, ctx->id);
+        }
+        ok = h->state == HEALTH_OK || ctx->inst_probe;
+        pthread_mutex_unlock(&h->mutex);
+
+        if (ok) {
+            chosen = i;
+            break;
+        }
+    }
+
+    if (chosen != preferred) {
+        __sync_fetch_and_add(&g_health.inst[preferred % g_health.num_inst].moved, 1);
+    }
+
+    ctx->inst = chosen;
+
+    return chosen;
+}
+
+/*
+    Function:
+
+        health_record
+
+    Description:
+
+        Counts a request's outcome against its instance. A fatal or soft error is also
+        counted against the context, and can quarantine the instance
+
+    Parameters:
+
+        idx         -   Instance number in dcInstances_g
+        ctx         -   Ptr to the context, or NULL
+        status      -   Status the submit returned
+        res_status  -   Status in the request's results
+
+    Return:
+
+        none
+*/
+void health_record(uint32_t idx, struct context *ctx, CpaStatus status, CpaDcReqStatus res_status)
+{
+    struct health_inst *h;
+    bool fatal;
+    bool soft;
+
+    if (g_health.inst == NULL) {
+        return;
+    }
+    idx %= g_health.num_inst;
+    h = &g_health.inst[idx];
+
+    fatal = res_status == CPA_DC_FATALERR || status == CPA_STATUS_FATAL;
+    soft = res_status == CPA_DC_SOFTERR;
+
+    __sync_fetch_and_add(&h->requests, 1);
+
+    if (!fatal && !soft) {
+        if (__sync_add_and_fetch(&h->win_reqs, 1) >= g_health.window) {
+            pthread_mutex_lock(&h->mutex);
+            if (h->win_reqs >= g_health.window) {
+                h->win_reqs = 0;
+                h->win_errs = 0;
+            }
+            pthread_mutex_unlock(&h->mutex);
+        }
+        return;
+    }
+
+    if (ctx) {
+        __sync_fetch_and_add(&ctx->inst_errs, 1);
+    }
+
+    pthread_mutex_lock(&h->mutex);
+
+    if (fatal) {
+        h->fatal++;
+    } else {
+        h->soft++;
+    }
+    h->win_reqs++;
+    h->win_errs++;
+
+    if (g_health.enabled) {
+        if (h->state == HEALTH_PROBING) {
+            h->probe_ms = MIN(h->probe_ms * 2, HEALTH_MAX_PROBE_MS);
+            quarantine(idx, h, "failed its probe");
+        } else if (h->state == HEALTH_OK && h->win_errs >= g_health.errors) {
+            char why[64];
+
+            snprintf(why, sizeof(why), "%u errors in its last %u requests", h->win_errs, h->win_reqs);
+            quarantine(idx, h, why);
+        }
+    }
+
+    pthread_mutex_unlock(&h->mutex);
+}
+
+/*
+    Function:
+
+        health_ctx_done
+
+    Description:
+
+        Closes out a context. If it was its instance's probe and hit no errors, the
+        instance goes back in service. Called from free_ctx
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        none
+*/
+void health_ctx_done(struct context *ctx)
+{
+    struct health_inst *h;
+
+    if (g_health.inst == NULL || !ctx->inst_probe) {
+        return;
+    }
+    h = &g_health.inst[ctx->inst % g_health.num_inst];
+
+    pthread_mutex_lock(&h->mutex);
+    if (h->state == HEALTH_PROBING && ctx->inst_errs == 0) {
+        h->state = HEALTH_OK;
+        h->win_reqs = 0;
+        h->win_errs = 0;
+        h->probe_ms = g_health.probe_ms;
+        MG_LOG_PRINT(g_log_fd, "Instance %u passed its probe, back in service\n", ctx->inst);
+    }
+    pthread_mutex_unlock(&h->mutex);
+
+    ctx->inst_probe = false;
+}
+
+/*
+    Function:
+
+        health_failover
+
+    Description:
+
+        Whether a failed context should run again on another instance: it hit an instance
+        error and hasn't been run again already
+
+    Parameters:
+
+        ctx -   Ptr to the failed context
+
+    Return:
+
+        true to run it again
+*/
+bool health_failover(struct context *ctx)
+{
+    if (g_health.inst == NULL || !g_health.enabled || ctx->inst_errs == 0 || ctx->failovers >= HEALTH_MAX_FAILOVERS) {
+        return false;
+    }
+
+    __sync_fetch_and_add(&g_health.inst[ctx->inst % g_health.num_inst].reruns, 1);
+
+    return true;
+}
+
+/*
+    Function:
+
+        health_stall
+
+    Description:
+
+        Counts a context the watchdog abandoned against the instance its overdue request
+        went to, which is taken out of service straight away: whatever hung the request
+        may hang the next one. The watchdog only abandons a context with a request in
+        flight past --deadline, so a worker that was merely slow between requests never
+        gets here. Like health_failover, says whether the context should run again
+        elsewhere. Called from the watchdog thread
+
+    Parameters:
+
+        ctx     -   Ptr to the abandoned context
+        inst    -   Instance number in dcInstances_g of the overdue request
+
+    Return:
+
+        true to run it again
+*/
+bool health_stall(struct context *ctx, uint32_t inst)
+{
+    struct health_inst *h;
+
+    if (g_health.inst == NULL) {
+        return false;
+    }
+    h = &g_health.inst[inst % g_health.num_inst];
+
+    pthread_mutex_lock(&h->mutex);
+    h->stalls++;
+    if (g_health.enabled && h->state != HEALTH_QUARANTINED) {
+        if (h->state == HEALTH_PROBING) {
+            h->probe_ms = MIN(h->probe_ms * 2, HEALTH_MAX_PROBE_MS);
+        }
+        quarantine(inst % g_health.num_inst, h, "a request stalled past the --deadline");
+    }
+    pthread_mutex_unlock(&h->mutex);
+
+    if (!g_health.enabled || ctx->failovers >= HEALTH_MAX_FAILOVERS) {
+        return false;
+    }
+
+    __sync_fetch_and_add(&h->reruns, 1);
+
+    return true;
+}
+
+/*
+    Function:
+
+        health_in_service
+
+    Description:
+
+        Whether an instance is in service, for picking one a context uses besides its
+        own. Quarantined and probing instances are not
+
+    Parameters:
+
+        idx -   Instance number in dcInstances_g
+
+    Return:
+
+        true if it is in service, or health tracking is off
+*/
+bool health_in_service(uint32_t idx)
+{
+    if (g_health.inst == NULL || !g_health.enabled) {
+        return true;
+    }
+
+    return g_health.inst[idx % g_health.num_inst].state == HEALTH_OK;
+}
+
+/*
+    Function:
+
+        health_dump_allowed
+
+    Description:
+
+        Whether mg_log should dump a failed context. Contexts that hit an instance error
+        are dumped HEALTH_MAX_DUMPS times per instance, then only counted, so a bad
+        instance can't fill the disk with errlog directories
+
+    Parameters:
+
+        ctx -   Ptr to the failed context
+
+    Return:
+
+        true to dump it
+*/
+bool health_dump_allowed(struct context *ctx)
+{
+    struct health_inst *h;
+
+    if (g_health.inst == NULL || !g_health.enabled || ctx->inst_errs == 0) {
+        return true;
+    }
+    h = &g_health.inst[ctx->inst % g_health.num_inst];
+
+    if (__sync_add_and_fetch(&h->dumps, 1) <= HEALTH_MAX_DUMPS) {
+        return true;
+    }
+    __sync_fetch_and_add(&h->suppressed, 1);
+
+    return false;
+}
+
+/*
+    Function:
+
+        health_errors
+
+    Description:
+
+        Fatal and soft errors and stalls across all instances, for the exit status
+
+    Parameters:
+
+        none
+
+    Return:
+
+        The number of errors
+*/
+uint64_t health_errors()
+{
+    uint64_t errors = 0;
+
+    for (uint32_t i = 0; g_health.inst && i < g_health.num_inst; i++)
+    {
+        errors += g_health.inst[i].fatal + g_health.inst[i].soft + g_health.inst[i].stalls;
+    }
+
+    return errors;
+}
+
+/*
+    Function:
+
+        health_print_stats
+
+    Description:
+
+        Prints each instance's errors, quarantines and the contexts moved off it or run
+        again. Quiet when no instance had an error
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void health_print_stats()
+{
+    if (health_errors() == 0) {
+        return;
+    }
+
+    if (g_health.enabled) {
+        MG_LOG_PRINT(g_log_fd, "    Instance health: quarantine at %u errors in %u requests, probe after %u ms\n",
+                g_health.errors, g_health.window, g_health.probe_ms);
+    } else {
+        MG_LOG_PRINT(g_log_fd, "    Instance health: no quarantine (--health off)\n");
+    }
+    MG_LOG_PRINT(g_log_fd, "        %-4s %10s %8s %8s %8s %11s %10s %7s %10s %-11s\n",
+            "inst", "requests", "fatal", "soft", "stalls", "quarantines", "moved off", "reruns", "no errlog", "state");
+
+    for (uint32_t i = 0; i < g_health.num_inst; i++)
+    {
+        struct health_inst *h = &g_health.inst[i];
+
+        if (h->requests == 0 && h->moved == 0) {
+            continue;
+        }
+
+        MG_LOG_PRINT(g_log_fd, "        %-4u %10lu %8lu %8lu %8lu %11lu %10lu %7lu %10lu %-11s\n",
+                i, h->requests, h->fatal, h->soft, h->stalls, h->quarantines, h->moved, h->reruns, h->suppressed,
+                g_state_names[h->state]);
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
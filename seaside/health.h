@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+    Instance health (--health). Every request's outcome is counted against its instance, and an
+    instance with too many fatal or soft errors in its recent window is quarantined: contexts
+    that would have run on it go to the next healthy instance instead. After the probe interval
+    one context is let through as a probe; a clean run puts the instance back in service, an
+    error quarantines it again for twice as long. A context that hit an instance error is run
+    again elsewhere, once, and its error is still reported in the summary and the exit status.
+    An instance a context stalled on under --abandon is quarantined at once
+*/
+
+#include <stdbool.h>
+#include "main.h"
+#include "cpa_types.h"
+#include "cpa.h"
+#include "cpa_dc.h"
+
+#define HEALTH_DEFAULT_WINDOW       (256)
+#define HEALTH_DEFAULT_ERRORS       (8)
+#define HEALTH_DEFAULT_PROBE_MS     (1000)
+#define HEALTH_MAX_PROBE_MS         (60000)
+
+// Errlog dumps kept per instance for contexts that hit an instance error
+#define HEALTH_MAX_DUMPS            (4)
+
+// Times a context that hit an instance error is run again
+#define HEALTH_MAX_FAILOVERS        (1)
+
+struct context;
+
+int health_init(struct mg_options *opt, uint32_t num_inst);
+uint32_t health_pick(struct context *ctx, uint32_t preferred);
+void health_record(uint32_t inst, struct context *ctx, CpaStatus status, CpaDcReqStatus res_status);
+void health_ctx_done(struct context *ctx);
+bool health_failover(struct context *ctx);
+bool health_stall(struct context *ctx, uint32_t inst);
+bool health_in_service(uint32_t idx);
+bool health_dump_allowed(struct context *ctx);
+uint64_t health_errors();
+void health_print_stats();
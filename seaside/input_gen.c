@@ -0,0 +1,574 @@
+/*
+    Synthetic inputs (--input-gen)
+
+    Data is generated in memory from a spec and a seed instead of read from disk:
+
+        random      uniform bytes, incompressible
+        zeros       all zero
+        motif       a few PARAM-byte motifs (default 32) repeated, with occasional mutations
+        text        words from a Markov chain, PARAM successors per word (default 4)
+        mix         literals and back-references, aiming at a PARAM:1 deflate ratio (default 3,
+                    all matches past about 10:1)
+        expand      bytes 144-255 with no matches, which static huffman codes in 9 bits
+
+    The buffer is cut into INPUT_GEN_BLOCK_SIZE blocks, each seeded from the spec's
+    seed and its index, and blocks are generated in parallel
+*/
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include "input_gen.h"
+
+extern FILE *g_log_fd;
+
+static const char *g_kind_names[GEN_KINDS] = { "random", "zeros", "motif", "text", "mix", "expand" };
+static const double g_kind_params[GEN_KINDS] = { 0, 0, 32, 4, 3.0, 0 };
+
+static const char *g_vocab[] = {
+    "the ", "of ", "and ", "to ", "in ", "a ", "is ", "that ", "for ", "it ", "as ", "was ", "with ",
+    "be ", "by ", "on ", "not ", "he ", "this ", "are ", "or ", "his ", "from ", "at ", "which ",
+    "but ", "have ", "an ", "had ", "they ", "you ", "were ", "their ", "one ", "all ", "we ",
+    "can ", "her ", "has ", "there ", "been ", "if ", "more ", "when ", "will ", "would ", "who ",
+    "so ", "no ", "data ", "block ", "stream ", "window ", "buffer ", "level ", "match ", "length ",
+    "distance ", "literal ", "header ", ". ", ", ", ".\n", "\n\n",
+};
+
+#define GEN_VOCAB       (sizeof(g_vocab) / sizeof(g_vocab[0]))
+#define GEN_MAX_BRANCH  (16)
+#define GEN_MOTIFS      (8)
+
+struct gen_fill_job {
+    struct input_gen_spec *spec;
+    uint8_t *buf;
+    uint64_t num_blocks;
+    uint64_t next;
+};
+
+// splitmix64: small, seedable, and the same sequence on every host
+static uint64_t next_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+/*
+    Function:
+
+        parse_size (static)
+
+    Description:
+
+        Parses a byte count with an optional K/M/G suffix
+
+    Parameters:
+
+        str -   String to parse
+        end -   Set to the first character after the size
+
+    Return:
+
+        The size in bytes
+*/
+static uint64_t parse_size(const char *str, char **end)
+{
+    uint64_t size = strtoull(str, end, 0);
+
+    switch (**end)
+    {
+        case 'k': case 'K': size <<= 10; (*end)++; break;
+        case 'm': case 'M': size <<= 20; (*end)++; break;
+        case 'g': case 'G': size <<= 30; (*end)++; break;
+        default: break;
+    }
+
+    return size;
+}
+
+/*
+    Function:
+
+        input_gen_parse
+
+    Description:
+
+        Parses "[gen:]KIND:SIZE[:PARAM][@SEED]". SIZE takes K/M/G suffixes, and a
+        missing PARAM or SEED gets the kind's default or default_seed
+
+    Parameters:
+
+        str             -   Spec to parse
+        default_seed    -   Seed when the spec has none
+        spec            -   Ptr to the spec to fill in
+
+    Return:
+
+        0 on success, -1 if the spec is malformed
+*/
+int input_gen_parse(const char *str, uint64_t default_seed, struct input_gen_spec *spec)
+{
+    const char *colon;
+    char *end;
+    int k;
+
+    if (!strncmp(str, "gen:", 4)) {
+        str += 4;
+    }
+
+    colon = strchr(str, ':');
+    if (colon == NULL) {
+        return -1;
+    }
+
+    for (k = 0; k < GEN_KINDS; k++)
+    {
+        if (strlen(g_kind_names[k]) == (size_t)(colon - str) && !strncmp(str, g_kind_names[k], colon - str)) {
+            break;
+        }
+    }
+
+    if (k == GEN_KINDS) {
+        return -1;
+    }
+
+    spec->kind = (enum input_gen_kind)k;
+    spec->param = g_kind_params[k];
+    spec->seed = default_seed;
+
+    spec->size = parse_size(colon + 1, &end);
+    if (end == colon + 1 || spec->size == 0) {
+        return -1;
+    }
+
+    if (*end == ':') {
+        const char *p = end + 1;
+
+        spec->param = strtod(p, &end);
+        if (end == p) {
+            return -1;
+        }
+    }
+
+    if (*end == '@') {
+        const char *p = end + 1;
+
+        spec->seed = strtoull(p, &end, 0);
+        if (end == p) {
+            return -1;
+        }
+    }
+
+    if (*end != '\0') {
+        return -1;
+    }
+
+    // Keep the parameters where the generators make sense of them
+    switch (spec->kind)
+    {
+        case GEN_MOTIF:
+            spec->param = MIN(MAX((uint32_t)spec->param, 1), 4096);
+            break;
+        case GEN_TEXT:
+            spec->param = MIN(MAX((uint32_t)spec->param, 1), GEN_MAX_BRANCH);
+            break;
+        case GEN_MIX:
+            spec->param = MAX(spec->param, 1.0);
+            break;
+        default:
+            spec->param = 0;
+            break;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        input_gen_name
+
+    Description:
+
+        Writes the spec's canonical name, which parses back to the same spec
+
+    Parameters:
+
+        spec    -   Ptr to the spec
+        buf     -   Output buffer
+        len     -   Size of the buffer
+
+    Return:
+
+        Length of the name, as snprintf()
+*/
+int input_gen_name(struct input_gen_spec *spec, char *buf, size_t len)
+{
+    return snprintf(buf, len, "gen:%s:%lu:%.17g@%lu", g_kind_names[spec->kind], spec->size, spec->param, spec->seed);
+}
+
+/*
+    Function:
+
+        gen_text_chain (static)
+
+    Description:
+
+        Draws the Markov chain's successor table from the spec's seed, so every
+        block of a file walks the same chain
+
+    Parameters:
+
+        spec    -   Ptr to the spec
+        succ    -   Successor table to fill in
+
+    Return:
+
+        none
+*/
+static void gen_text_chain(struct input_gen_spec *spec, uint8_t succ[GEN_VOCAB][GEN_MAX_BRANCH])
+{
+    uint64_t rng = spec->seed;
+
+    for (uint32_t w = 0; w < GEN_VOCAB; w++)
+    {
+        for (uint32_t b = 0; b < GEN_MAX_BRANCH; b++)
+        {
+            succ[w][b] = next_rand(&rng) % GEN_VOCAB;
+        }
+    }
+}
+
+/*
+    Function:
+
+        gen_mix (static)
+
+    Description:
+
+        Alternates runs of random literals with back-references into the block.
+        A literal costs deflate about 8 bits and a match about 24, so the share of
+        literal bytes is picked to land the requested ratio
+
+    Parameters:
+
+        buf     -   Block to fill
+        len     -   Block length
+        ratio   -   Target compression ratio
+        rng     -   Ptr to the block's PRNG state
+
+    Return:
+
+        none
+*/
+static void gen_mix(uint8_t *buf, uint64_t len, double ratio, uint64_t *rng)
+{
+    const double avg_lit_run = 8.5;
+    const double avg_match = 32.0;
+    double lit_share;
+    uint64_t p_lit;
+    uint64_t pos = 0;
+
+    lit_share = ((8.0 / ratio) - (24.0 / avg_match)) / (8.0 - (24.0 / avg_match));
+    lit_share = MIN(MAX(lit_share, 0.0), 1.0);
+
+    // Chance, out of 2^32, that the next run is literals rather than a match
+    p_lit = (uint64_t)(((avg_match * lit_share) / ((avg_lit_run * (1.0 - lit_share)) + (avg_match * lit_share)))
+            * 4294967296.0);
+
+    while (pos < len)
+    {
+        uint64_t r = next_rand(rng);
+        uint64_t run;
+
+        if (pos < 3 || (r & 0xffffffff) < p_lit) {
+            run = MIN(1 + ((r >> 32) % 16), len - pos);
+
+            for (uint64_t i = 0; i < run; i++)
+            {
+                buf[pos++] = next_rand(rng);
+            }
+        } else {
+            uint64_t dist = 1 + ((r >> 32) % MIN(pos, 32768));
+
+            run = MIN(3 + ((r >> 48) % 59), len - pos);
+
+            // Byte by byte, so a match may overlap itself like deflate's
+            for (uint64_t i = 0; i < run; i++, pos++)
+            {
+                buf[pos] = buf[pos - dist];
+            }
+        }
+    }
+}
+
+/*
+    Function:
+
+        gen_block (static)
+
+    Description:
+
+        Generates one block of the input
+
+    Parameters:
+
+        spec    -   Ptr to the spec
+        buf     -   Block to fill
+        len     -   Block length
+        block   -   Index of the block in the input
+
+    Return:
+
+        none
+*/
+static void gen_block(struct input_gen_spec *spec, uint8_t *buf, uint64_t len, uint64_t block)
+{
+    uint64_t rng = spec->seed ^ (block * 0xd1b54a32d192ed03ULL);
+    uint64_t pos = 0;
+
+    next_rand(&rng);
+
+    switch (spec->kind)
+    {
+        case GEN_RANDOM:
+            for (; pos + 8 <= len; pos += 8)
+            {
+                uint64_t r = next_rand(&rng);
+
+                memcpy(buf + pos, &r, 8);
+            }
+            for (; pos < len; pos++)
+            {
+                buf[pos] = next_rand(&rng);
+            }
+            break;
+
+        case GEN_ZEROS:
+            memset(buf, 0, len);
+            break;
+
+        case GEN_MOTIF: {
+            uint32_t mlen = spec->param;
+            uint8_t motifs[GEN_MOTIFS][4096];
+
+            for (uint32_t m = 0; m < GEN_MOTIFS; m++)
+            {
+                for (uint32_t i = 0; i < mlen; i++)
+                {
+                    motifs[m][i] = next_rand(&rng);
+                }
+            }
+
+            while (pos < len)
+            {
+                uint64_t r = next_rand(&rng);
+                uint64_t n = MIN(mlen, len - pos);
+
+                memcpy(buf + pos, motifs[r % GEN_MOTIFS], n);
+
+                // One copy in eight has a byte changed, so the matches aren't all full length
+                if (((r >> 8) & 7) == 0) {
+                    buf[pos + ((r >> 16) % n)] = r >> 40;
+                }
+
+                pos += n;
+            }
+            break;
+        }
+
+        case GEN_TEXT: {
+            uint8_t succ[GEN_VOCAB][GEN_MAX_BRANCH];
+            uint32_t branch = spec->param;
+            uint32_t w;
+
+            gen_text_chain(spec, succ);
+            w = next_rand(&rng) % GEN_VOCAB;
+
+            while (pos < len)
+            {
+                const char *s = g_vocab[w];
+
+                while (*s && pos < len)
+                {
+                    buf[pos++] = *s++;
+                }
+
+                w = succ[w][next_rand(&rng) % branch];
+            }
+            break;
+        }
+
+        case GEN_MIX:
+            gen_mix(buf, len, spec->param, &rng);
+            break;
+
+        case GEN_EXPAND:
+            for (; pos < len; pos++)
+            {
+                buf[pos] = 144 + (next_rand(&rng) % 112);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+    Function:
+
+        fill_entry (static)
+
+    Description:
+
+        Generator thread: claims blocks until none are left
+
+    Parameters:
+
+        arg -   Ptr to the shared gen_fill_job
+
+    Return:
+
+        none
+*/
+static void *fill_entry(void *arg)
+{
+    struct gen_fill_job *job = (struct gen_fill_job *)arg;
+    uint64_t b;
+
+    while ((b = __sync_fetch_and_add(&job->next, 1)) < job->num_blocks)
+    {
+        uint64_t off = b * INPUT_GEN_BLOCK_SIZE;
+
+        gen_block(job->spec, job->buf + off, MIN(INPUT_GEN_BLOCK_SIZE, job->spec->size - off), b);
+    }
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        input_gen_fill
+
+    Description:
+
+        Generates the whole input into buf, on up to INPUT_GEN_MAX_THREADS threads.
+        The calling thread generates too, and does it all if no thread starts
+
+    Parameters:
+
+        spec    -   Ptr to the spec
+        buf     -   Buffer of spec->size bytes
+
+    Return:
+
+        0
+*/
+int input_gen_fill(struct input_gen_spec *spec, uint8_t *buf)
+{
+    struct gen_fill_job job = { spec, buf, 0, 0 };
+    pthread_t threads[INPUT_GEN_MAX_THREADS];
+    uint32_t num_threads;
+    uint32_t started = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    job.num_blocks = (spec->size + INPUT_GEN_BLOCK_SIZE - 1) / INPUT_GEN_BLOCK_SIZE;
+
+    num_threads = MIN(MIN((uint64_t)(cpus > 0 ? cpus : 1), job.num_blocks), INPUT_GEN_MAX_THREADS);
+
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[started], NULL, fill_entry, &job) == 0) {
+            started++;
+        }
+    }
+
+    fill_entry(&job);
+
+    for (uint32_t t = 0; t < started; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        input_gen_file_list
+
+    Description:
+
+        Builds the run's file list from the comma-separated --input-gen specs, each
+        entry named by its canonical spec. Specs without a seed take --seed, or one
+        drawn from the clock, plus their position in the list; the base is logged
+
+    Parameters:
+
+        opt     -   Ptr to the command line options struct
+        list    -   Ptr to the list to fill in, freed with dir_scan_free()
+
+    Return:
+
+        Number of entries, or -1 on failure
+*/
+int input_gen_file_list(struct mg_options *opt, struct file_list *list)
+{
+    struct input_gen_spec spec;
+    char specs[MAX_FILE_LEN];
+    char *save = NULL;
+    char *tok;
+    uint64_t seed;
+    uint32_t n = 0;
+    size_t pos = 0;
+
+    memset(list, 0, sizeof(struct file_list));
+
+    seed = opt->seed ? opt->seed : (((uint64_t)time(NULL) << 16) ^ getpid());
+
+    list->arena = (char *)malloc(INPUT_GEN_MAX_SPECS * 128);
+    list->paths = (char **)calloc(INPUT_GEN_MAX_SPECS, sizeof(char *));
+    list->sizes = (uint64_t *)calloc(INPUT_GEN_MAX_SPECS, sizeof(uint64_t));
+    if (list->arena == NULL || list->paths == NULL || list->sizes == NULL) {
+        dir_scan_free(list);
+        return -1;
+    }
+
+    strncpy(specs, opt->input_gen, MAX_FILE_LEN - 1);
+    specs[MAX_FILE_LEN - 1] = '\0';
+
+    for (tok = strtok_r(specs, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        if (n == INPUT_GEN_MAX_SPECS) {
+            MG_LOG_PRINT(g_log_fd, "Input gen: more than %u specs, ignoring the rest\n", INPUT_GEN_MAX_SPECS);
+            break;
+        }
+
+        if (input_gen_parse(tok, seed + n, &spec) < 0) {
+            MG_LOG_PRINT(g_log_fd, "Input gen: bad spec [%s], expected KIND:SIZE[:PARAM][@SEED] with KIND one of "
+                    "random, zeros, motif, text, mix, expand\n", tok);
+            dir_scan_free(list);
+            return -1;
+        }
+
+        list->paths[n] = list->arena + pos;
+        pos += input_gen_name(&spec, list->arena + pos, 128) + 1;
+        list->sizes[n] = spec.size;
+        list->total_bytes += spec.size;
+        n++;
+    }
+
+    list->num_files = n;
+    list->gen = true;
+
+    MG_LOG_PRINT(g_log_fd, "Input gen: %u input(s), %.2f MB, base seed %lu\n", n,
+            list->total_bytes / (1024.0 * 1024.0), seed);
+
+    return n;
+}
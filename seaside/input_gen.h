@@ -0,0 +1,36 @@
+#pragma once
+
+#include "main.h"
+#include "dir_scan.h"
+
+#define INPUT_GEN_MAX_SPECS     (64)
+#define INPUT_GEN_MAX_THREADS   (16)
+
+// Every block is generated from its own seed, so the data doesn't depend on how many threads made it
+#define INPUT_GEN_BLOCK_SIZE    (1024 * 1024)
+
+enum input_gen_kind {
+    GEN_RANDOM,
+    GEN_ZEROS,
+    GEN_MOTIF,
+    GEN_TEXT,
+    GEN_MIX,
+    GEN_EXPAND,
+    GEN_KINDS,
+};
+
+/*
+    One generated input. Its canonical name, "gen:KIND:SIZE:PARAM@SEED", is what the
+    file list and the logs carry, and parses back to the same bytes
+*/
+struct input_gen_spec {
+    enum input_gen_kind kind;
+    uint64_t size;
+    double param;
+    uint64_t seed;
+};
+
+int input_gen_parse(const char *str, uint64_t default_seed, struct input_gen_spec *spec);
+int input_gen_name(struct input_gen_spec *spec, char *buf, size_t len);
+int input_gen_fill(struct input_gen_spec *spec, uint8_t *buf);
+int input_gen_file_list(struct mg_options *opt, struct file_list *list);
@@ -0,0 +1,295 @@
+#include <math.h>
+#include "lpt_sched.h"
+
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    bool enabled;
+    uint32_t threads;
+    double prior_rate;
+
+    struct sched_fit key[SCHED_LEVELS][SCHED_HUFF_TYPES];
+    struct sched_fit all;
+
+    // Predicted vs actual, over completed contexts
+    uint64_t completed;
+    double pred_ns;
+    double actual_ns;
+    double abs_err;
+    double max_pred_ns;
+    uint64_t first_start_ns;
+    uint64_t last_end_ns;
+} g_sched;
+
+/*
+    Function:
+
+        fit_solve (static)
+
+    Description:
+
+        Solves a fit for its fixed cost and per-byte rate. With too few samples, or
+        all of them the same size, the fixed cost can't be separated out, so the
+        prior's is kept and only the rate is fitted
+
+    Parameters:
+
+        f       -   Ptr to the fit
+        fixed   -   Set to the fixed ns per context
+        rate    -   Set to the ns per source byte
+
+    Return:
+
+        false if the fit has no samples
+*/
+static bool fit_solve(struct sched_fit *f, double *fixed, double *rate)
+{
+    double det;
+
+    if (f->n == 0) {
+        return false;
+    }
+
+    det = (f->n * f->sxx) - (f->sx * f->sx);
+
+    if (f->n >= 2 && det > 1e-9 * f->sxx * f->n) {
+        *rate = ((f->n * f->sxy) - (f->sx * f->sy)) / det;
+        *fixed = (f->sy - (*rate * f->sx)) / f->n;
+
+        if (*rate > 0 && *fixed >= 0) {
+            return true;
+        }
+    }
+
+    *fixed = SCHED_PRIOR_FIXED_NS;
+    *rate = (f->sx > 0) ? ((f->sy - (f->n * *fixed)) / f->sx) : g_sched.prior_rate;
+    if (*rate <= 0) {
+        *fixed = f->sy / f->n;
+        *rate = 0;
+    }
+
+    return true;
+}
+
+static void fit_add(struct sched_fit *f, double x, double y)
+{
+    f->n++;
+    f->sx += x;
+    f->sy += y;
+    f->sxx += x * x;
+    f->sxy += x * y;
+}
+
+/*
+    Function:
+
+        sched_init
+
+    Description:
+
+        Turns on cost-ordered dispatch (--lpt). --lpt=NS sets the ns/byte assumed
+        until contexts have been measured, normally taken from a previous run's summary
+
+    Parameters:
+
+        opt -   Ptr to the command line options struct
+
+    Return:
+
+        none
+*/
+void sched_init(struct mg_options *opt)
+{
+    pthread_mutex_init(&g_sched.mutex, NULL);
+
+    g_sched.enabled = opt->lpt;
+    g_sched.threads = opt->threads;
+    g_sched.prior_rate = (opt->lpt_rate > 0) ? opt->lpt_rate : SCHED_PRIOR_NS_PER_BYTE;
+}
+
+bool sched_enabled()
+{
+    return g_sched.enabled;
+}
+
+/*
+    Function:
+
+        sched_class
+
+    Description:
+
+        Predicts how long a context will take to run, from its file size and what
+        contexts of the same level and huffman type have taken so far, and maps the
+        prediction to a queue class. Classes are powers of two, so dispatch is only
+        roughly longest-first within a factor of 2, which is plenty for filling the
+        tail with small work and keeps enq/deq O(1)
+
+    Parameters:
+
+        ctx -   Ptr to the context, its pred_ns is set
+
+    Return:
+
+        Queue class, 0 when --lpt is off
+*/
+uint32_t sched_class(struct context *ctx)
+{
+    uint32_t lvl = ctx->sessCprSetupData.compLevel;
+    uint32_t huff = ctx->sessCprSetupData.huffType;
+    double fixed = SCHED_PRIOR_FIXED_NS;
+    double rate = g_sched.prior_rate;
+    double pred;
+    uint32_t cls;
+
+    if (!g_sched.enabled) {
+        return 0;
+    }
+
+    if (lvl >= SCHED_LEVELS) {
+        lvl = 0;
+    }
+    if (huff >= SCHED_HUFF_TYPES) {
+        huff = 0;
+    }
+
+    pthread_mutex_lock(&g_sched.mutex);
+
+    if (g_sched.key[lvl][huff].n < SCHED_MIN_SAMPLES || !fit_solve(&g_sched.key[lvl][huff], &fixed, &rate)) {
+        fit_solve(&g_sched.all, &fixed, &rate);
+    }
+
+    pthread_mutex_unlock(&g_sched.mutex);
+
+    pred = fixed + (rate * ctx->src_data->file_size);
+    ctx->pred_ns = (pred > 1) ? (uint64_t)pred : 1;
+
+    cls = 63 - __builtin_clzll(ctx->pred_ns);
+    if (cls >= SCHED_CLASSES) {
+        cls = SCHED_CLASSES - 1;
+    }
+
+    return cls;
+}
+
+/*
+    Function:
+
+        sched_report
+
+    Description:
+
+        Feeds a finished context's run time back into the model, and into the
+        predicted vs actual totals
+
+    Parameters:
+
+        ctx         -   Ptr to the finished context
+        start_ns    -   When it was launched
+        end_ns      -   When it finished
+
+    Return:
+
+        none
+*/
+void sched_report(struct context *ctx, uint64_t start_ns, uint64_t end_ns)
+{
+    uint32_t lvl = ctx->sessCprSetupData.compLevel;
+    uint32_t huff = ctx->sessCprSetupData.huffType;
+    double actual = end_ns - start_ns;
+    double bytes = ctx->src_data->file_size;
+
+    if (!g_sched.enabled) {
+        return;
+    }
+
+    if (lvl >= SCHED_LEVELS) {
+        lvl = 0;
+    }
+    if (huff >= SCHED_HUFF_TYPES) {
+        huff = 0;
+    }
+
+    pthread_mutex_lock(&g_sched.mutex);
+
+    fit_add(&g_sched.key[lvl][huff], bytes, actual);
+    fit_add(&g_sched.all, bytes, actual);
+
+    g_sched.completed++;
+    g_sched.pred_ns += ctx->pred_ns;
+    g_sched.actual_ns += actual;
+    g_sched.abs_err += fabs(ctx->pred_ns - actual);
+    if (ctx->pred_ns > g_sched.max_pred_ns) {
+        g_sched.max_pred_ns = ctx->pred_ns;
+    }
+
+    if (g_sched.first_start_ns == 0 || start_ns < g_sched.first_start_ns) {
+        g_sched.first_start_ns = start_ns;
+    }
+    if (end_ns > g_sched.last_end_ns) {
+        g_sched.last_end_ns = end_ns;
+    }
+
+    pthread_mutex_unlock(&g_sched.mutex);
+}
+
+/*
+    Function:
+
+        sched_print_stats
+
+    Description:
+
+        Prints predicted vs actual work and makespan, and the fitted cost of each
+        level/huffman type, for tuning the model
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void sched_print_stats()
+{
+    double bound;
+    double fixed, rate;
+
+    if (!g_sched.enabled || g_sched.completed == 0) {
+        return;
+    }
+
+    // Nothing can finish before the longest context, or before the work is spread over every thread
+    bound = g_sched.pred_ns / g_sched.threads;
+    if (g_sched.max_pred_ns > bound) {
+        bound = g_sched.max_pred_ns;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    LPT Schedule: %lu contexts\n", g_sched.completed);
+    MG_LOG_PRINT(g_log_fd, "        work: predicted %.3f s, actual %.3f s, mean error %.1f%% per context\n",
+            g_sched.pred_ns / 1e9, g_sched.actual_ns / 1e9, (100.0 * g_sched.abs_err) / g_sched.actual_ns);
+    MG_LOG_PRINT(g_log_fd, "        makespan: predicted >= %.3f s on %u thread(s), actual %.3f s\n",
+            bound / 1e9, g_sched.threads, (g_sched.last_end_ns - g_sched.first_start_ns) / 1e9);
+
+    if (fit_solve(&g_sched.all, &fixed, &rate)) {
+        MG_LOG_PRINT(g_log_fd, "        pooled: %.3f ns/B + %.1f us per context (--lpt=%.3f to start from it)\n",
+                rate, fixed / 1e3, rate);
+    }
+
+    for (uint32_t lvl = 0; lvl < SCHED_LEVELS; lvl++)
+    {
+        for (uint32_t huff = 0; huff < SCHED_HUFF_TYPES; huff++)
+        {
+            if (!fit_solve(&g_sched.key[lvl][huff], &fixed, &rate)) {
+                continue;
+            }
+
+            MG_LOG_PRINT(g_log_fd, "        lvl %u %s: %.3f ns/B + %.1f us per context (%lu samples)\n",
+                    lvl, huff == CPA_DC_HT_STATIC ? "STATIC " : "DYNAMIC", rate, fixed / 1e3, g_sched.key[lvl][huff].n);
+        }
+    }
+
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+
+// Queue classes, one per power of two of predicted ns. The highest non-empty class runs first
+#define SCHED_CLASSES       (48)
+#define SCHED_LEVELS        (10)
+#define SCHED_HUFF_TYPES    (3)
+
+// A key's own fit is used once it has this many samples, the pooled fit before that
+#define SCHED_MIN_SAMPLES   (8)
+
+// Before anything has been measured. --lpt=NS overrides the rate
+#define SCHED_PRIOR_NS_PER_BYTE (1.0)
+#define SCHED_PRIOR_FIXED_NS    (100000.0)
+
+/*
+    Least-squares fit of ns = fixed + rate * bytes, from running sums
+*/
+struct sched_fit {
+    uint64_t n;
+    double sx;
+    double sy;
+    double sxx;
+    double sxy;
+};
+
+void sched_init(struct mg_options *opt);
+bool sched_enabled();
+uint32_t sched_class(struct context *ctx);
+void sched_report(struct context *ctx, uint64_t start_ns, uint64_t end_ns);
+void sched_print_stats();
@@ -0,0 +1,306 @@
+#include "lvl_probe.h"
+#include "buf_handler.h"
+#include "credit.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+static const char *g_words[] = {
+    "the ", "of ", "and ", "compression ", "buffer ", "deflate ", "window ", "match ", "length ",
+    "distance ", "huffman ", "static ", "dynamic ", "block ", "stream ", "level ", "\n", ". ",
+};
+
+/*
+    Function:
+
+        fill_calibration (static)
+
+    Description:
+
+        Fills the calibration buffer deterministically, so every run and every host
+        probes with the same bytes. Each segment leans on a different part of the
+        match finder: short matches, matches further back than a 16K window, few
+        distinct literals, and long runs
+
+    Parameters:
+
+        buf -   Ptr to a LVL_PROBE_SIZE buffer
+
+    Return:
+
+        none
+*/
+static void fill_calibration(Cpa8U *buf)
+{
+    uint32_t lcg = 12345;
+    uint32_t n = 0;
+
+    // Text
+    while (n < DEFAULT_BUF_SIZE)
+    {
+        const char *w;
+
+        lcg = (lcg * 1103515245) + 12345;
+        w = g_words[(lcg >> 16) % (sizeof(g_words) / sizeof(g_words[0]))];
+
+        while (*w && n < DEFAULT_BUF_SIZE)
+        {
+            buf[n++] = *w++;
+        }
+    }
+
+    // Text again, with blocks copied from 20-40K back
+    for (; n < DEFAULT_BUF_SIZE * 2; n++)
+    {
+        lcg = (lcg * 1103515245) + 12345;
+
+        if (((n / 512) % 3) == 0) {
+            buf[n] = buf[n - (20480 + (((n / 512) % 40) * 512))];
+        } else {
+            buf[n] = 'a' + ((lcg >> 16) % 26);
+        }
+    }
+
+    // Small alphabet noise
+    for (; n < DEFAULT_BUF_SIZE * 3; n++)
+    {
+        lcg = (lcg * 1103515245) + 12345;
+        buf[n] = (lcg >> 16) & 0x0f;
+    }
+
+    // Runs of varying length
+    while (n < LVL_PROBE_SIZE)
+    {
+        uint32_t run;
+        Cpa8U c;
+
+        lcg = (lcg * 1103515245) + 12345;
+        run = 1 + ((lcg >> 16) % 300);
+        c = (lcg >> 8) & 0xff;
+
+        while (run-- && n < LVL_PROBE_SIZE)
+        {
+            buf[n++] = c;
+        }
+    }
+}
+
+/*
+    Function:
+
+        probe_level (static)
+
+    Description:
+
+        Compresses the calibration buffer statelessly at one level and huffman
+        type, the way the serial loop in meatjet() submits it
+
+    Parameters:
+
+        opt         -   Ptr to the command line options struct
+        sgls        -   Ptr to the sgl container to use
+        cal         -   Ptr to the calibration source data
+        cpr_lvl     -   Compression level
+        huff_type   -   CPA_DC_HT_STATIC/FULL_DYNAMIC
+        out         -   Ptr to a buffer for the output, at least 2x LVL_PROBE_SIZE
+        out_len     -   Set to the output length
+
+    Return:
+
+        Status of the compression
+*/
+static CpaStatus probe_level(struct mg_options *opt, struct sgl_container *sgls, struct src_data *cal,
+        Cpa32U cpr_lvl, Cpa32U huff_type, Cpa8U *out, uint32_t *out_len)
+{
+    CpaStatus status;
+    CpaDcOpData opData = {};
+    struct context *ctx;
+    Cpa32U job_size;
+    Cpa32U iNum;
+
+    ctx = create_ctx(opt, 0);
+    if (ctx == NULL) {
+        return CPA_STATUS_FAIL;
+    }
+
+    fill_ctx_sess(ctx, cpr_lvl, huff_type, CPA_DC_STATELESS, 7);
+    ctx->src_data = cal;
+
+    status = launch_ctx(ctx, sgls);
+    if (status != CPA_STATUS_SUCCESS) {
+        free_ctx(ctx, sgls);
+        return status;
+    }
+
+    iNum = ctx->inst;
+
+    while (ctx->cpr_consumed < cal->file_size || ctx->cpr_results.status == CPA_DC_OVERFLOW)
+    {
+        job_size = cal->file_size - ctx->cpr_consumed;
+        if (job_size > DEFAULT_BUF_SIZE) {
+            job_size = DEFAULT_BUF_SIZE;
+        }
+
+        opData.flushFlag = (ctx->cpr_consumed + job_size < cal->file_size) ? CPA_DC_FLUSH_FULL : CPA_DC_FLUSH_FINAL;
+
+        copy_mem_to_sgl(cal->src_mem + ctx->cpr_consumed, sgls->src_sgl, DEFAULT_BUF_SIZE, job_size);
+
+        credit_acquire(iNum);
+        do {
+            status = cpaDcCompressData2(dcInstances_g[iNum],
+                                        ctx->sessCprHandle,
+                                        sgls->src_sgl,
+                                        sgls->dest_sgl,
+                                        &opData,
+                                        &(ctx->cpr_results),
+                                        NULL);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->cpr_results.status);
+
+        if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->cpr_results.status) {
+            break;
+        }
+
+        if ((ctx->cpr_results.consumed == 0 && ctx->cpr_results.produced == 0) ||
+                (ctx->cpr_produced + ctx->cpr_results.produced) > (LVL_PROBE_SIZE * 2)) {
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        copy_sgl_to_mem(sgls->dest_sgl, out + ctx->cpr_produced, DEFAULT_BUF_SIZE, ctx->cpr_results.produced);
+
+        ctx->cpr_consumed += ctx->cpr_results.consumed;
+        ctx->cpr_produced += ctx->cpr_results.produced;
+    }
+
+    *out_len = ctx->cpr_produced;
+
+    free_ctx(ctx, sgls);
+
+    return status;
+}
+
+/*
+    Function:
+
+        lvl_probe_run
+
+    Description:
+
+        Compresses a fixed calibration buffer at every requested level, with both
+        huffman types, on the instance actually in use. Levels whose output is
+        byte-identical to an earlier level's for both types are the same
+        configuration in the driver, so only the lowest of each group is kept.
+        The discovered grouping is logged
+
+    Parameters:
+
+        opt     -   Ptr to the command line options struct
+        sgls    -   Ptr to an sgl container for the probe
+        total   -   Set to the number of levels kept
+
+    Return:
+
+        Level mask with one level per group, or 0 if the probe failed
+*/
+uint16_t lvl_probe_run(struct mg_options *opt, struct sgl_container *sgls, uint8_t *total)
+{
+    const Cpa32U huff_types[2] = { CPA_DC_HT_STATIC, CPA_DC_HT_FULL_DYNAMIC };
+    struct src_data cal = {};
+    Cpa8U *out[LVL_PROBE_LEVELS][2] = {};
+    uint32_t out_len[LVL_PROBE_LEVELS][2] = {};
+    uint32_t group[LVL_PROBE_LEVELS] = {};
+    uint16_t mask = 0;
+    char line[256];
+    int pos;
+
+    *total = 0;
+
+    strcpy(cal.filename, "<level probe calibration>");
+    cal.file_size = LVL_PROBE_SIZE;
+    cal.src_mem = (Cpa8U *)malloc(LVL_PROBE_SIZE);
+    if (cal.src_mem == NULL) {
+        return 0;
+    }
+
+    fill_calibration(cal.src_mem);
+
+    for (uint32_t lvl = opt->min_cpr_lvl; lvl <= opt->max_cpr_lvl; lvl++)
+    {
+        for (int h = 0; h < 2; h++)
+        {
+            CpaStatus status;
+
+            out[lvl][h] = (Cpa8U *)malloc(LVL_PROBE_SIZE * 2);
+            if (out[lvl][h] == NULL) {
+                MG_LOG_PRINT(g_log_fd, "Level probe: could not allocate output buffer\n");
+                mask = 0;
+                goto done;
+            }
+
+            status = probe_level(opt, sgls, &cal, lvl, huff_types[h], out[lvl][h], &out_len[lvl][h]);
+            if (status != CPA_STATUS_SUCCESS) {
+                MG_LOG_PRINT(g_log_fd, "Level probe: level %u %s failed (status %d)\n",
+                        lvl, h ? "DYNAMIC" : "STATIC", status);
+                mask = 0;
+                goto done;
+            }
+        }
+
+        // Join the first earlier group whose representative matches on both types
+        group[lvl] = lvl;
+        for (uint32_t rep = opt->min_cpr_lvl; rep < lvl; rep++)
+        {
+            if (group[rep] != rep) {
+                continue;
+            }
+
+            if (out_len[rep][0] == out_len[lvl][0] && out_len[rep][1] == out_len[lvl][1] &&
+                    !memcmp(out[rep][0], out[lvl][0], out_len[lvl][0]) &&
+                    !memcmp(out[rep][1], out[lvl][1], out_len[lvl][1])) {
+                group[lvl] = rep;
+                break;
+            }
+        }
+
+        if (group[lvl] == lvl) {
+            mask |= (1 << lvl);
+            (*total)++;
+        }
+    }
+
+    pos = snprintf(line, sizeof(line), "Level probe: %u groups:", *total);
+    for (uint32_t rep = opt->min_cpr_lvl; rep <= opt->max_cpr_lvl; rep++)
+    {
+        if (group[rep] != rep) {
+            continue;
+        }
+
+        pos += snprintf(line + pos, sizeof(line) - pos, " {%u", rep);
+        for (uint32_t lvl = rep + 1; lvl <= opt->max_cpr_lvl; lvl++)
+        {
+            if (group[lvl] == rep) {
+                pos += snprintf(line + pos, sizeof(line) - pos, ",%u", lvl);
+            }
+        }
+        pos += snprintf(line + pos, sizeof(line) - pos, "}");
+    }
+    MG_LOG_PRINT(g_log_fd, "%s, running levels 0x%x\n", line, mask);
+
+done:
+    for (uint32_t lvl = 0; lvl < LVL_PROBE_LEVELS; lvl++)
+    {
+        free(out[lvl][0]);
+        free(out[lvl][1]);
+    }
+    free(cal.src_mem);
+
+    if (mask == 0) {
+        *total = 0;
+    }
+
+    return mask;
+}
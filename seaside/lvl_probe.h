@@ -0,0 +1,11 @@
+#pragma once
+
+#include "cpr.h"
+#include "context.h"
+
+// 64KB each of text, long-distance repeats, a small alphabet, and runs
+#define LVL_PROBE_SEGMENTS  (4)
+#define LVL_PROBE_SIZE      (DEFAULT_BUF_SIZE * LVL_PROBE_SEGMENTS)
+#define LVL_PROBE_LEVELS    (10)
+
+uint16_t lvl_probe_run(struct mg_options *opt, struct sgl_container *sgls, uint8_t *total);
@@ -1,5 +1,6 @@
 #include "main.h"
 #include "cpr.h"
+#include "credit.h"
 
 // Global log file descriptor
 FILE *g_log_fd;
@@ -9,7 +10,9 @@ size_t get_file_size(char *filename)
     size_t sz;
     struct stat st;
 
-    stat(filename, &st);
+    if (stat(filename, &st)) {
+        return 0;
+    }
     sz = st.st_size;
 
     return sz;
@@ -27,105 +30,6 @@ bool file_exists(char *filename)
     return true;
 }
 
-int get_num_files(char *dirname)
-{
-    DIR *dirp;
-    struct dirent *dp;
-    int num_files;
-    struct stat st;
-    char fullpath[MAX_FILE_LEN];
-
-    num_files = 0;
-
-    if ((dirp = opendir(dirname)) == NULL)
-    {
-        MG_LOG_PRINT(g_log_fd, "Error: Coult not open dir %s\n", dirname);
-        return 0;
-    }
-
-    do
-    {
-        if ((dp = readdir(dirp)) != NULL)
-        {
-            strcpy(fullpath, dirname);
-            strcat(fullpath, "/");
-            strcat(fullpath, dp->d_name);
-
-            // Skip current and parent directories
-            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
-            {
-                continue;
-            }
-
-            stat(fullpath, &st);
-
-            if (S_ISDIR(st.st_mode))
-            {
-                num_files += get_num_files(fullpath);
-            }
-            else
-            {
-                num_files++;
-            }
-
-        }
-    } while (dp != NULL);
-
-    closedir(dirp);
-
-    return num_files;
-}
-
-int populate_file_list(char ***list, char *dirname, int start_idx)
-{
-    DIR *dirp;
-    struct dirent *dp;
-    struct stat st;
-    char fullpath[MAX_FILE_LEN];
-    int idx;
-
-    idx = start_idx;
-
-    if ((dirp = opendir(dirname)) == NULL)
-    {
-        MG_LOG_PRINT(g_log_fd, "Error: Could not open dir %s\n", dirname);
-        return 0;
-    }
-
-    do
-    {
-        if ((dp = readdir(dirp)) != NULL)
-        {
-            strcpy(fullpath, dirname);
-            strcat(fullpath, "/");
-            strcat(fullpath, dp->d_name);
-
-            // Skip current and parent directories
-            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
-            {
-                continue;
-            }
-
-            stat(fullpath, &st);
-
-            if (S_ISDIR(st.st_mode))
-            {
-                 idx = populate_file_list(list, fullpath, idx);
-            }
-            else
-            {
-                strcpy((*list)[idx], fullpath);
-                idx++;
-            }
-
-        }
-    } while (dp != NULL);
-
-    closedir(dirp);
-
-    return idx;
-}
-
 static void opts_init(struct mg_options *opts)
 {
     opts->threads = MAX_THREAD_COUNT;
@@ -143,8 +47,42 @@ static void opts_init(struct mg_options *opts)
     opts->debug = false;
     opts->stateless = false;
     strcpy(opts->log, "");
+    strcpy(opts->pack, "");
     opts->processes = 1;
     opts->zlibcompare = 0;
+    opts->chunk_inflight = 1;
+    opts->chunk_instances = 1;
+    opts->prefix_reuse = false;
+    opts->inflate_workers = 0;
+    opts->obs_prune = false;
+    opts->adaptive = 0;
+    opts->budget = 0;
+    opts->duration = 0;
+    opts->seed = 0;
+    opts->seed_set = false;
+    opts->all_levels = false;
+    opts->src_mmap = false;
+    opts->src_huge = false;
+    opts->readahead = 0;
+    opts->readahead_mem = 1024;
+    opts->scan_threads = 1;
+    opts->lpt = false;
+    opts->lpt_rate = 0;
+    opts->dedup = false;
+    opts->stream_mb = 0;
+    strcpy(opts->stream_spill, "");
+    strcpy(opts->input_gen, "");
+    opts->sw_instances = 0;
+    strcpy(opts->dc_emu, "");
+    opts->credits = 0;
+    opts->backoff = BACKOFF_PAUSE;
+    opts->deadline_ms = 0;
+    opts->abandon = false;
+    strcpy(opts->health, "");
+    strcpy(opts->small, "");
+    opts->pipeline = false;
+    opts->pipeline_measure = false;
+    strcpy(opts->mix, "");
 }
 
 static char doc[] = "Meatjet!";
@@ -153,11 +91,44 @@ static char args_doc[] = "";
 static struct argp_option argp_opts[] = {
     {"infile",          'i',    "FILE",    0, "Input file {required, or -d}", 1},
     {"directory",       'd',    "DIR",     0, "Directory to compress {required, or -i}", 1},
+    {"pack",            0x108,  "PACK",    0, "Corpus built by meatjet-pack {or -i/-d}", 1},
+    {"input-gen",       0x10b,  "SPECS",   0, "Generate inputs instead of reading them: KIND:SIZE[:PARAM][@SEED],... "
+                                           "KIND is random, zeros, motif, text, mix or expand {or -i/-d}", 1},
     {"log",             0x16,   "LOG",     0, "Log file name (defaults to mg_${parameters}.log)", 1},
+    {"mmap",            0x102,  "huge",    OPTION_ARG_OPTIONAL, "Map source files read-only instead of reading them (=huge also asks for transparent huge pages, which only takes effect where the filesystem backs file mappings with them, e.g. tmpfs mounted huge=advise or a kernel with read-only file THP)", 1},
+    {"dedup",           0x107,  NULL,      0, "Run byte-identical -d files once, reporting the result for every copy", 1},
+    {"stream",          0x109,  "MB",      0, "Stream files bigger than MB through an MB window instead of loading them (compression only)", 1},
+    {"stream-spill",    0x10a,  "DIR",     0, "With --stream, spill the compressed stream to DIR and verify after compressing", 1},
+    {"scan-threads",    0x105,  "THDS",    0, "Threads walking -d directories (default 1)", 1},
+    {"readahead",       0x103,  "FILES",   0, "Load up to FILES files ahead in the background while earlier ones run", 1},
+    {"readahead-mem",   0x104,  "MB",      0, "Cap on data loaded ahead by --readahead (default 1024 MB)", 1},
     {"threads",         't',    "THDS",    0, "Number of threads", 2},
+    {"sw-instances",    0x10c,  "N",       0, "Add N zlib software DC instances after the hardware ones (SW_DC builds)", 2},
+    {"dc-emu",          0x10d,  "SPEC",    0, "Time the software instances like an accelerator: "
+                                           "ring=N,lat=US|uniform:LO:HI|exp:MEAN|normal:MEAN:SD,bw=MBPS,poll=US,clock=real|sim,fault=I:P[:soft]", 2},
+    {"lpt",             0x106,  "NS",      OPTION_ARG_OPTIONAL, "Run the longest predicted contexts first (--lpt=NS: ns/byte to assume before measuring)", 2},
+    {"credits",         0x10e,  "N",       0, "At most N requests in flight per instance; the rest wait in the backoff (default unlimited)", 2},
+    {"backoff",         0x10f,  "MODE",    0, "How to wait for a credit or after a ring-full retry: pause (default), yield or futex", 2},
+    {"deadline",        0x110,  "MS",      0, "Flag and dump any thread that makes no progress for MS ms (stalled request or RETRY loop)", 2},
+    {"abandon",         0x111,  NULL,      0, "With --deadline, fail a stalled context and replace its thread instead of waiting on it", 2},
+    {"health",          0x112,  "SPEC",    0, "Quarantine instances with too many fatal/soft errors: window=N,errors=E,probe=MS "
+                                           "(default 256, 8, 1000), or off", 2},
+    {"small",           0x113,  "SPEC",    0, "Run inputs up to max KB in batches on reused sessions: max=KB,batch=N "
+                                           "(default 64, 16); add measure to only report their throughput", 2},
+    {"pipeline",        0x114,  "measure", OPTION_ARG_OPTIONAL, "Decompress each context on a second instance, chunk by chunk behind "
+                                           "its compression (--pipeline=measure: run serially, only report latency)", 2},
+    {"mix",             0x115,  "SPEC",    0, "Send a weighted mix of stateless requests instead of sweeping the files: "
+                                           "compress:W,decompress:W,sizes:SIZE:W[,SIZE:W...],secs:S|requests:N; "
+                                           "open loop: rate:REQS|gbps:G per instance, ramp:STEPS", 2},
     {"comp-lvl",        'c',    "COMPLVL", 0, "Compression level", 2},
+    {"all-levels",      0x101,  NULL,      0, "Builds without a PROJ level table: skip the startup level probe, run all 9", 2},
     {"obs",             'o',    "OBS",     0, "Output buffer size", 3},
     {"obs-step",        0x10,   "OBSSTEP", 0, "Output buffer size, step value b/w ctxs", 3},
+    {"obs-prune",       0x1c,   NULL,      0, "Measure each level/huffman's compressed size first, and skip OBS points that can't differ", 3},
+    {"adaptive",        0x1d,   "BUDGET",  0, "Adaptive OBS/IBC sweep: bisect where results change, at most BUDGET points per level/huffman", 3},
+    {"budget",          0x1e,   "CTXS",    0, "Stratified sampling: run at most CTXS contexts, shared fairly across files", 3},
+    {"duration",        0x1f,   "SECS",    0, "Stratified sampling: fit the run into SECS seconds, shared fairly across files", 3},
+    {"seed",            0x100,  "SEED",    0, "Seed for --budget/--duration sampling (logged if not given)", 3},
     {"underflow",       'u',    NULL,      0, "Underflow test, does not issue overflow contexts", 4},
     {"ibc",             0x14,   "IBC",     0, "Input byte count. Must be in underflow mode", 4},
     {"ibc-step",        0x15,   "IBCSTEP", 0, "Input byte count, step value b/w ctxs (underflow)", 4},
@@ -168,6 +139,10 @@ static struct argp_option argp_opts[] = {
     {"stateless",	's',	NULL,	   0, "Stateless testing, Stateful is the default",5},
     {"processes",       'p',    "N",       0, "Number of Processes", 1},
     {"zlibcompare",	'z',	"zlib",	   0, "Do a Zlib compare on this percent of HW Compressions", 4},	
+    {"chunk-inflight",  0x18,   "N",       0, "Stateless: chunks in flight per instance (parallel chunk engine)", 5},
+    {"chunk-instances", 0x19,   "N",       0, "Stateless: instances to stripe chunks across (parallel chunk engine)", 5},
+    {"inflate-workers", 0x1b,   "N",       0, "Worker pool for parallel SW inflate of stateless output (zlibcompare)", 4},
+    {"prefix-reuse",    0x1a,   NULL,      0, "Stateless: cache each file's chunk results per level/huffman, only submit from the target bucket on", 5},
     {0,0,0,0,0,0}
 };
 
@@ -231,6 +206,101 @@ static int parse_opt(int key, char *arg, struct argp_state *state)
         case 0x17:
             opts->debug = true;
             break;
+        case 0x18:
+            // A count below 1 is left at 0 for main() to reject
+            opts->chunk_inflight = atoi(arg) > 0 ? (uint32_t)atoi(arg) : 0;
+            break;
+        case 0x19:
+            opts->chunk_instances = atoi(arg) > 0 ? (uint32_t)atoi(arg) : 0;
+            break;
+        case 0x1a:
+            opts->prefix_reuse = true;
+            break;
+        case 0x1b:
+            opts->inflate_workers = atoi(arg);
+            break;
+        case 0x1c:
+            opts->obs_prune = true;
+            break;
+        case 0x1d:
+            opts->adaptive = atoi(arg);
+            break;
+        case 0x1e:
+            opts->budget = strtoull(arg, NULL, 0);
+            break;
+        case 0x1f:
+            opts->duration = atoi(arg);
+            break;
+        case 0x100:
+            opts->seed = strtoull(arg, NULL, 0);
+            opts->seed_set = true;
+            break;
+        case 0x101:
+            opts->all_levels = true;
+            break;
+        case 0x102:
+            opts->src_mmap = true;
+            opts->src_huge = (arg != NULL && !strcmp(arg, "huge"));
+            break;
+        case 0x103:
+            opts->readahead = atoi(arg);
+            break;
+        case 0x104:
+            opts->readahead_mem = atoi(arg);
+            break;
+        case 0x105:
+            opts->scan_threads = atoi(arg);
+            break;
+        case 0x106:
+            opts->lpt = true;
+            opts->lpt_rate = (arg != NULL) ? atof(arg) : 0;
+            break;
+        case 0x107:
+            opts->dedup = true;
+            break;
+        case 0x108:
+            strncpy(opts->pack, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x109:
+            opts->stream_mb = atoi(arg);
+            break;
+        case 0x10a:
+            strncpy(opts->stream_spill, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x10b:
+            strncpy(opts->input_gen, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x10c:
+            opts->sw_instances = atoi(arg);
+            break;
+        case 0x10d:
+            strncpy(opts->dc_emu, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x10e:
+            opts->credits = atoi(arg);
+            break;
+        case 0x10f:
+            opts->backoff = credit_parse_backoff(arg);
+            break;
+        case 0x110:
+            opts->deadline_ms = atoi(arg);
+            break;
+        case 0x111:
+            opts->abandon = true;
+            break;
+        case 0x112:
+            strncpy(opts->health, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x113:
+            strncpy(opts->small, arg, MAX_FILE_LEN - 1);
+            break;
+        case 0x114:
+            opts->pipeline = true;
+            opts->pipeline_measure = (arg != NULL && !strcmp(arg, "measure"));
+            break;
+        case 0x115:
+            strncpy(opts->mix, arg, MAX_FILE_LEN - 1);
+            break;
 	case 'z':
 	    opts->zlibcompare = atoi(arg);
 	    if (opts->zlibcompare > 100)
@@ -272,7 +342,8 @@ int main(int argc, char* argv[])
     // Start the logging
     if (strcmp(opts.log, "") == 0)
     {
-        sprintf(opts.log, "mg_%s.log", opts.use_dir ? basename(opts.dir) : basename(opts.input_file));
+        sprintf(opts.log, "mg_%s.log", opts.input_gen[0] ? "input-gen" : (opts.pack[0] ? basename(opts.pack) :
+                (opts.use_dir ? basename(opts.dir) : basename(opts.input_file))));
     }
 
     g_log_fd = fopen(opts.log, "w");
@@ -283,7 +354,7 @@ int main(int argc, char* argv[])
     }
 
     // Make sure we have input files
-    if (!file_exists(opts.input_file) && !opts.use_dir)
+    if (!file_exists(opts.input_file) && !opts.use_dir && !opts.pack[0] && !opts.input_gen[0])
     {
         MG_LOG_PRINT(g_log_fd, "Error: No input file/directory specified!\n");
         return -1;
@@ -296,6 +367,39 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    if (opts.backoff < 0)
+    {
+        MG_LOG_PRINT(g_log_fd, "Error: --backoff must be pause, yield or futex!\n");
+        return -1;
+    }
+
+    if (opts.chunk_inflight == 0 || opts.chunk_instances == 0)
+    {
+        MG_LOG_PRINT(g_log_fd, "Error: --chunk-inflight and --chunk-instances must be at least 1!\n");
+        return -1;
+    }
+
+    if (opts.abandon && opts.deadline_ms == 0)
+    {
+        MG_LOG_PRINT(g_log_fd, "Error: --abandon needs a --deadline!\n");
+        return -1;
+    }
+
+    // Generators make cleartext, there's nothing to decompress
+    if (opts.decomp_only && opts.input_gen[0])
+    {
+        MG_LOG_PRINT(g_log_fd, "Error: --input-gen cannot be used with --decomp-only!\n");
+        return -1;
+    }
+
+#ifndef MG_SW_DC
+    if (opts.sw_instances || opts.dc_emu[0])
+    {
+        MG_LOG_PRINT(g_log_fd, "Error: --sw-instances and --dc-emu need a build with SW_DC=1 or SW_DC=only!\n");
+        return -1;
+    }
+#endif
+
     // If we are in decompression-only mode, we can cheat here a little
     //      - enable static-only
     //      - disable dyanmic-only
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <dirent.h>
+#include <time.h>
 
 #define MAX_FILE_LEN 2048
 #define DEFAULT_NODE_ID 0
@@ -28,10 +29,21 @@ do {                                        \
     MG_LOG(fd, format, ##args);             \
 } while (0);
 
+// Monotonic clock in ns, for the timing every module keeps
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
 struct mg_options {
     char input_file[MAX_FILE_LEN];
     char dir[MAX_FILE_LEN];
     char log[MAX_FILE_LEN];
+    char pack[MAX_FILE_LEN];
     bool use_dir;
     uint32_t threads;
     uint32_t min_cpr_lvl;
@@ -50,10 +62,42 @@ struct mg_options {
     bool stateless;
     uint32_t zlibcompare;
 
+    uint32_t chunk_inflight;
+    uint32_t chunk_instances;
+    bool prefix_reuse;
+    uint32_t inflate_workers;
+    bool obs_prune;
+    uint32_t adaptive;
+    uint64_t budget;
+    uint32_t duration;
+    uint64_t seed;
+    bool seed_set;
+    bool all_levels;
+    bool src_mmap;
+    bool src_huge;
+    uint32_t readahead;
+    uint32_t readahead_mem;
+    uint32_t scan_threads;
+    bool lpt;
+    double lpt_rate;
+    bool dedup;
+    uint32_t stream_mb;
+    char stream_spill[MAX_FILE_LEN];
+    char input_gen[MAX_FILE_LEN];
+    uint32_t sw_instances;
+    char dc_emu[MAX_FILE_LEN];
+    uint32_t credits;
+    int backoff;
+    uint32_t deadline_ms;
+    bool abandon;
+    char health[MAX_FILE_LEN];
+    char small[MAX_FILE_LEN];
+    bool pipeline;
+    bool pipeline_measure;
+    char mix[MAX_FILE_LEN];
+
     uint32_t processes;
 };
 
 size_t get_file_size(char *filename);
 bool file_exists(char *filename);
-int get_num_files(char *dirname);
-int populate_file_list(char ***list, char *dirname, int start_idx);
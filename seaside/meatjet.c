@@ -1,5 +1,8 @@
 #include <time.h>
 #include "meatjet.h"
+#include "credit.h"
+#include "watchdog.h"
+#include "health.h"
 
 extern CpaInstanceHandle *dcInstances_g;
 extern Cpa16U numDcInstances_g;
@@ -11,6 +14,12 @@ extern pthread_mutex_t of_mutex;
 #endif
 static pthread_mutex_t mg_log_mutex;
 
+// Compression overflows, split by whether they were the forced OBS target
+static struct {
+    uint64_t target;
+    uint64_t unintended;
+} g_overflow;
+
 /*
     Function:
 
@@ -81,27 +90,39 @@ static uint32_t zlib_compare(struct context *ctx, CpaStatus status){
         //
 	z_stream strm;
 
-	/* allocate deflate state */
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	ctx->zlib_results.status= inflateInit2(&strm, -15);
-	if (ctx->zlib_results.status != Z_OK)
-		return -ctx->zlib_results.status;
+        // Stateless output splits at every request's full-flush point, so inflate the
+        // segments in parallel and combine their CRCs instead of one long inflate
+        if (par_inflate_enabled() && ctx->num_flush_pts) {
+            uint64_t size;
+            uLong crc;
+
+            ctx->zlib_results.status = par_inflate_verify(ctx->dest_mem, ctx->flush_pts, ctx->num_flush_pts,
+                                                          ctx->zlib_mem, ctx->mem_size, &size, &crc);
+            ctx->zlib_results.size = size;
+            ctx->zlib_results.crc32 = crc;
+        } else {
+            /* allocate deflate state */
+            strm.zalloc = Z_NULL;
+            strm.zfree = Z_NULL;
+            strm.opaque = Z_NULL;
+            ctx->zlib_results.status= inflateInit2(&strm, -15);
+            if (ctx->zlib_results.status != Z_OK)
+                return -ctx->zlib_results.status;
 
-	strm.avail_in = ctx->mem_size;
-	strm.next_in = ctx->dest_mem;
+            strm.avail_in = ctx->mem_size;
+            strm.next_in = ctx->dest_mem;
 
-	strm.avail_out = ctx->mem_size;
-	strm.next_out = ctx->zlib_mem;
-	ctx->zlib_results.status = inflate(&strm, Z_NO_FLUSH);    /* no bad return value */
+            strm.avail_out = ctx->mem_size;
+            strm.next_out = ctx->zlib_mem;
+            ctx->zlib_results.status = inflate(&strm, Z_NO_FLUSH);    /* no bad return value */
 
-	/* clean up and return */
-	(void)inflateEnd(&strm);
+            /* clean up and return */
+            (void)inflateEnd(&strm);
 
-	ctx->zlib_results.size = strm.total_out;
-        
-	ctx->zlib_results.crc32 = calc_crc32(0, ctx->zlib_mem, ctx->zlib_results.size);
+            ctx->zlib_results.size = strm.total_out;
+
+            ctx->zlib_results.crc32 = calc_crc32(0, ctx->zlib_mem, ctx->zlib_results.size);
+        }
 
         // Compare Memory
         if ((status != CPA_STATUS_SUCCESS) || (memcmp(ctx->compare_mem, ctx->zlib_mem, ctx->dcpr_produced))) {
@@ -153,7 +174,6 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
 {
     CpaStatus status;
     CpaDcFlush flush;
-    CpaDcOpData opData = {}; 
     size_t src_file_size;
     size_t job_size;
     size_t data_copied;
@@ -162,10 +182,6 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
     bool target_overflow_complete;
     bool target_underflow_complete;
 
-#ifdef DEBUG_CODE
-    uint64_t of_cnt = 0;
-#endif
-
     /*
         1) Compress
             - send in entire source in 64KB chunks
@@ -180,11 +196,16 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
 
     status = CPA_STATUS_FAIL;
 
+    // Too big to hold; compressed, decompressed and compared through a window instead
+    if (ctx->src_data->backing == SRC_MEM_STREAMED) {
+        return stream_run(ctx, sgls);
+    }
+
     // Set initial values for the ctx targets
     target_overflow_complete = ctx->underflow;
     target_underflow_complete = !target_overflow_complete;
 
-    iNum = sgls->t_id % numDcInstances_g;
+    iNum = ctx->dcpr_inst;
     src_file_size = ctx->src_data->file_size;
 
     ctx->cpr_produced = 0;
@@ -202,6 +223,8 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         uint32_t z_size;
         uint32_t crc32;
 
+        wd_stage(WD_DECOMPRESS);
+
         while (ctx->dcpr_consumed < src_file_size || ctx->dcpr_results.status == CPA_DC_OVERFLOW)
         {
             // Set the potential underflow IBC condition
@@ -249,6 +272,7 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
             }
 
             // Decompress!
+            credit_acquire(iNum);
             do {
                 status = cpaDcDecompressData(dcInstances_g[iNum],
                                          ctx->sessDcprHandle,
@@ -257,7 +281,9 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
                                          &(ctx->dcpr_results),
                                          flush,
                                          NULL);
-            } while (status == CPA_STATUS_RETRY);
+            } while (credit_retry(iNum, status));
+            credit_release(iNum);
+            health_record(iNum, ctx, status, ctx->dcpr_results.status);
             if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->dcpr_results.status) {
                 MG_LOG_PRINT(g_log_fd, "Error: decompression failed with status %d\n", ctx->dcpr_results.status);
                 break;
@@ -286,6 +312,7 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         //
         // Get results with ZLIB
         //
+        wd_stage(WD_VERIFY);
         z_size = zlib_inflate(ctx);
         crc32 = calc_crc32(0, ctx->compare_mem, z_size);
 
@@ -310,6 +337,13 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
             return CPA_STATUS_FAIL;
         }
 
+        // Compare against the CRC recorded when the vector was packed
+        if (ctx->src_data->has_clear_crc && crc32 != ctx->src_data->clear_crc32) {
+            MG_LOG_PRINT(g_log_fd, "\n\n\t******** CRC DIFFERS FROM PACK INDEX ********\n");
+            mg_log(ctx, DC_FAIL_CRC);
+            return CPA_STATUS_FAIL;
+        }
+
         // Debug mode!
 		if (ctx->debug) {
             MG_LOG_PRINT(g_log_fd, "\n\n\t******** Debug Mode: Captures all data ********\n");
@@ -321,10 +355,95 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         return status;
     }
 
+    // Decompression follows compression chunk by chunk on a second instance
+    if (pipeline_enabled(ctx)) {
+        return pipeline_run(ctx, sgls);
+    }
+
+    status = meatjet_compress(ctx, sgls);
+
+    return meatjet_verify(ctx, sgls, status);
+}
+
+/*
+    Function:
+
+        meatjet_compress
+
+    Description:
+
+        First half of meatjet: compresses the whole source into dest_mem, hitting the
+        context's overflow/underflow target on the way. Split out so the small-input
+        path (--small) can compress a batch before verifying any of it
+
+    Parameters:
+
+        ctx     -   Ptr to the context that has all cfg info
+        sgls    -   Ptr to SGLs which are the necessary memory slabs
+
+    Return:
+
+        Status of the last compression request
+*/
+CpaStatus meatjet_compress(struct context *ctx, struct sgl_container *sgls)
+{
+    CpaStatus status;
+    CpaDcOpData opData = {}; 
+    size_t src_file_size;
+    size_t job_size;
+    size_t data_copied;
+    Cpa32U iNum;
+    Cpa32U actual_obs;
+    Cpa32U dest_len;
+    bool target_overflow_complete;
+    bool target_underflow_complete;
+    bool target_req;
+
+#ifdef DEBUG_CODE
+    uint64_t of_cnt = 0;
+#endif
+
+    status = CPA_STATUS_FAIL;
+
+    // Set initial values for the ctx targets
+    target_overflow_complete = ctx->underflow;
+    target_underflow_complete = !target_overflow_complete;
+
+    iNum = ctx->inst;
+    src_file_size = ctx->src_data->file_size;
+
+    ctx->cpr_produced = 0;
+    ctx->cpr_consumed = 0;
+
+    ctx->dcpr_produced = 0;
+    ctx->dcpr_consumed = 0;
+
     //
     // Compression Flow
     //
 
+    wd_stage(WD_COMPRESS);
+
+    // Stateless chunks ahead of the target bucket don't depend on it, so either splice
+    // them from the file's prefix cache or fan them out first. The serial loop below
+    // picks up from wherever that left off
+    if (prefix_cache_enabled(ctx)) {
+        status = prefix_cache_splice(ctx, sgls);
+        if (status != CPA_STATUS_SUCCESS) {
+            MG_LOG_PRINT(g_log_fd, "Compress Error: prefix cache status %d [%s]\n", status, ctx->src_data->filename);
+            return status;
+        }
+    } else if (chunk_engine_enabled(ctx)) {
+        status = chunk_engine_run(ctx, sgls);
+        if (status != CPA_STATUS_SUCCESS) {
+            MG_LOG_PRINT(g_log_fd, "Compress Error: chunk engine status %d [%s]\n", status, ctx->src_data->filename);
+            return status;
+        }
+    }
+
+    // Spliced or fanned-out chunks don't go through the loop, so count them in the signature
+    ctx_sig_mark(ctx, ctx->cpr_consumed / DEFAULT_BUF_SIZE);
+
     // Continue to compress if:
     //  - there's more data to consume (source file > total consumed)
     //  - overflow was the result of the last job. It's possible that all data has been consumed
@@ -370,11 +489,20 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
             break;
         }
 
+        // Give the request room for its deflate bound so only the target overflows.
+        // Residue left in the session by an overflow gets the whole buffer
+        if (ctx->cpr_results.status == CPA_DC_OVERFLOW) {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEST_BUF_SIZE;
+        } else {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFLATE_BOUND(job_size);
+        }
+
         // Set the target overflow condition here
+        target_req = false;
         if (!target_overflow_complete) {
             // Check if we're in the proper overflow SGL bucket
-            if ((ctx->cpr_produced + DEFAULT_BUF_SIZE) >= ctx->obs) {
-                actual_obs = ctx->obs - ctx->cpr_produced;
+            if ((ctx->cpr_produced + CHUNK_BOUND) >= ctx->obs) {
+                actual_obs = (ctx->obs > ctx->cpr_produced) ? (ctx->obs - ctx->cpr_produced) : 0;
 
                 if (actual_obs < MIN_OBS_VALUE) {
                     actual_obs = MIN_OBS_VALUE;
@@ -383,10 +511,14 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
                 sgls->dest_sgl->pBuffers[0].dataLenInBytes = actual_obs;
 
                 target_overflow_complete = true;
+                target_req = true;
             }
         }
 	
+        dest_len = sgls->dest_sgl->pBuffers[0].dataLenInBytes;
+
         // Compress!
+        credit_acquire(iNum);
         do {
             status = cpaDcCompressData2(dcInstances_g[iNum],
                                    ctx->sessCprHandle,
@@ -395,7 +527,9 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
 				                   &opData,
                                    &(ctx->cpr_results),
                                    NULL);
-        } while (status == CPA_STATUS_RETRY);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->cpr_results.status);
 
         // Enter here for non-overflow failures
         if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->cpr_results.status) {
@@ -405,7 +539,7 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
 
         data_copied = copy_sgl_to_mem(sgls->dest_sgl,
                                       ctx->dest_mem + ctx->cpr_produced,
-                                      DEFAULT_BUF_SIZE,
+                                      DEST_BUF_SIZE,
                                       ctx->cpr_results.produced);
 
         if (data_copied != ctx->cpr_results.produced) {
@@ -419,19 +553,67 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
             of_cnt++;
 #endif
 
-            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
-
-            memset(sgls->src_sgl->pBuffers[0].pData,  0, DEFAULT_BUF_SIZE);
-            memset(sgls->dest_sgl->pBuffers[0].pData, 0, DEFAULT_BUF_SIZE);
+            meatjet_count_overflow(target_req);
         }
 
         ctx->cpr_consumed += ctx->cpr_results.consumed;
         ctx->cpr_produced += ctx->cpr_results.produced;
+
+        // Hand the output to the pipelined decompressor, if there is one
+        pipeline_publish(ctx);
+
+        ctx_sig_add(ctx, job_size, dest_len, opData.flushFlag, &(ctx->cpr_results));
+
+        if (CPA_DC_STATELESS == ctx->sessCprSetupData.sessState) {
+            ctx_add_flush_point(ctx, ctx->cpr_produced, ctx->cpr_consumed);
+        }
     }
 
     // Set the dest buffer back to the original size for verification
     sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
 
+#ifdef DEBUG_CODE
+    pthread_mutex_lock(&of_mutex);
+    g_of_cnt += of_cnt;
+    pthread_mutex_unlock(&of_mutex);
+#endif
+
+    return status;
+}
+
+/*
+    Function:
+
+        meatjet_verify
+
+    Description:
+
+        Second half of meatjet: decompresses what meatjet_compress produced, from
+        wherever a pipelined decompressor left off, and compares it, and its CRC, with
+        the source
+
+    Parameters:
+
+        ctx     -   Ptr to the context, compressed by meatjet_compress
+        sgls    -   Ptr to SGLs which are the necessary memory slabs
+        status  -   What meatjet_compress returned
+
+    Return:
+
+        Status of the compress/decompress
+*/
+CpaStatus meatjet_verify(struct context *ctx, struct sgl_container *sgls, CpaStatus status)
+{
+    CpaDcFlush flush;
+    size_t job_size;
+    size_t data_copied;
+    Cpa32U iNum;
+
+    iNum = ctx->dcpr_inst;
+
+
+    wd_stage(WD_DECOMPRESS);
+
     //
     // Decompression - Verification
     //
@@ -456,6 +638,7 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         }
 
         // Decompress!
+        credit_acquire(iNum);
         do {
             status = cpaDcDecompressData(dcInstances_g[iNum],
                                      ctx->sessDcprHandle,
@@ -464,7 +647,9 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
                                      &(ctx->dcpr_results),
                                      flush,
                                      NULL);
-        } while (CPA_STATUS_RETRY == status);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->dcpr_results.status);
 
         if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->dcpr_results.status) {
             MG_LOG_PRINT(g_log_fd, "Error: decompression failed with status %d\n", ctx->dcpr_results.status);
@@ -491,6 +676,36 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         }
     }
 
+    return meatjet_check(ctx, status);
+}
+
+/*
+    Function:
+
+        meatjet_check
+
+    Description:
+
+        Last part of meatjet_verify: compares the decompressed data, and the CRCs, with
+        the source. pipeline_run calls it directly when its decompressor has failed
+
+    Parameters:
+
+        ctx     -   Ptr to the context, compressed and decompressed
+        status  -   Status of the last request
+
+    Return:
+
+        Status of the compress/decompress
+*/
+CpaStatus meatjet_check(struct context *ctx, CpaStatus status)
+{
+    size_t src_file_size;
+
+    src_file_size = ctx->src_data->file_size;
+
+    wd_stage(WD_VERIFY);
+
     // Compare Memory
     if (memcmp(ctx->src_data->src_mem, ctx->compare_mem, src_file_size)) {
         MG_LOG_PRINT(g_log_fd, "\n\n\t******** DATA COMPARE ERROR ********\n");
@@ -505,6 +720,13 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
         return CPA_STATUS_FAIL;
     }
 
+    // Both checksums above come from the device; the pack index has one that doesn't
+    if (ctx->src_data->has_clear_crc && ctx->cpr_results.checksum != ctx->src_data->clear_crc32) {
+        MG_LOG_PRINT(g_log_fd, "\n\n\t******** CRC DIFFERS FROM PACK INDEX ********\n");
+        mg_log(ctx, DC_FAIL_CRC);
+        return CPA_STATUS_FAIL;
+    }
+
     // Debug mode!
     if (ctx->debug) {
         MG_LOG_PRINT(g_log_fd, "\n\n\t******** Debug Mode: Captures all data ********\n");
@@ -519,11 +741,6 @@ CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls)
 	    zlib_compare(ctx, status);
     }
 
-#ifdef DEBUG_CODE
-    pthread_mutex_lock(&of_mutex);
-    g_of_cnt += of_cnt;
-    pthread_mutex_unlock(&of_mutex);
-#endif
 
     return status;
 }
@@ -614,6 +831,12 @@ void mg_log(struct context *ctx, int fail_code)
     time_t rawtime;
     char dir[128];
     char fname[256];
+    static uint32_t stall_seq;
+
+    // A bad instance fails everything on it; its first few contexts say enough
+    if (!health_dump_allowed(ctx)) {
+        return;
+    }
 
     pthread_mutex_lock(&mg_log_mutex);
     time(&rawtime);
@@ -622,10 +845,16 @@ void mg_log(struct context *ctx, int fail_code)
     if(ctx->debug) {
         sprintf(dir, "debuglog_ctx%lu_%lu", ctx->id, rawtime);
     }
+    // Its own name, so the context failing in the same second can still log. A rerun
+    // keeps its ctx id and can stall again, so the pid and a count keep each dump apart
+    if (fail_code == DC_STALL) {
+        sprintf(dir, "stalllog_ctx%lu_%lu_%d_%u", ctx->id, rawtime, (int)getpid(), stall_seq++);
+    }
 
     MG_LOG_PRINT(g_log_fd, "Making directory [%s]\n", dir);
     if (mkdir(dir, 777) < 0) {
         MG_LOG_PRINT(g_log_fd, "Could not make directory %s\n", dir);
+        pthread_mutex_unlock(&mg_log_mutex);
         return;
     }
 
@@ -643,6 +872,9 @@ void mg_log(struct context *ctx, int fail_code)
         case DC_FAIL_SIZE:
             fprintf(session_fp, "\n ******** Failure cause: Size Mismatch ********\n");
             break;
+        case DC_STALL:
+            fprintf(session_fp, "\n ******** Stall: no progress within the --deadline ********\n");
+            break;
         case DC_DEBUG:
             fprintf(session_fp, "\n ******** DEBUG: Captures all data on request ********\n");
             fprintf(session_fp, "\n ******** If you are doing this on 15K jobs, you probobly seg faulted.  ********\n");
@@ -703,8 +935,9 @@ void mg_log(struct context *ctx, int fail_code)
     fprintf(session_fp, "\n");
     fprintf(session_fp, "\n");
 
-    fprintf(session_fp, "Command to reproduce:\nmeatjet --threads=1 --comp-lvl=%u --infile=%s%s%s%s%u\n",
+    fprintf(session_fp, "Command to reproduce:\nmeatjet --threads=1 --comp-lvl=%u %s=%s%s%s%s%u\n",
         ctx->sessCprSetupData.compLevel,
+        ctx->src_data->backing == SRC_MEM_GENERATED ? "--input-gen" : "--infile",
         ctx->src_data->filename,
         ctx->decomp_only ? " --decomp-only" : "",
         ctx->underflow ? " --underflow" : "",
@@ -718,10 +951,13 @@ void mg_log(struct context *ctx, int fail_code)
     fwrite(ctx->compare_mem, ctx->dcpr_produced, 1, compare_fp);
     fclose(compare_fp);
 
-    sprintf(fname, "%s/source.bin", dir);
-    src_fp = fopen(fname, "w");
-    fwrite(ctx->src_data->src_mem, ctx->src_data->file_size, 1, src_fp);
-    fclose(src_fp);
+    // A generated source is its spec, which the command above already carries
+    if (ctx->src_data->backing != SRC_MEM_GENERATED) {
+        sprintf(fname, "%s/source.bin", dir);
+        src_fp = fopen(fname, "w");
+        fwrite(ctx->src_data->src_mem, ctx->src_data->file_size, 1, src_fp);
+        fclose(src_fp);
+    }
 
     sprintf(fname, "%s/dest.bin", dir);
     dest_fp = fopen(fname, "w");
@@ -734,3 +970,57 @@ void mg_log(struct context *ctx, int fail_code)
     fclose(dest_fp);
     pthread_mutex_unlock(&mg_log_mutex);
 }
+
+/*
+    Function:
+
+        meatjet_count_overflow
+
+    Description:
+
+        Counts a compression overflow, either the forced OBS target or one the dest
+        buffer was not meant to have (each of those costs a resubmit)
+
+    Parameters:
+
+        target  -   True if the request was the OBS target
+
+    Return:
+
+        none
+*/
+void meatjet_count_overflow(bool target)
+{
+    if (target) {
+        __sync_fetch_and_add(&g_overflow.target, 1);
+    } else {
+        __sync_fetch_and_add(&g_overflow.unintended, 1);
+    }
+}
+
+/*
+    Function:
+
+        meatjet_print_stats
+
+    Description:
+
+        Prints the compression overflows, forced and unintended
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void meatjet_print_stats()
+{
+    if (g_overflow.target == 0 && g_overflow.unintended == 0) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Overflows: %lu forced at the OBS target, %lu unintended\n\n",
+            g_overflow.target, g_overflow.unintended);
+}
@@ -7,11 +7,21 @@
 #include "context.h"
 #include "buf_handler.h"
 #include "crc32.h"
+#include "chunk_engine.h"
+#include "prefix_cache.h"
+#include "stream.h"
+#include "pipeline.h"
 
 #define DC_FAIL_CRC  0
 #define DC_FAIL_DATA 1
 #define DC_FAIL_SIZE 2
 #define DC_DEBUG 3
+#define DC_STALL 4
 
 CpaStatus meatjet(struct context *ctx, struct sgl_container *sgls);
+CpaStatus meatjet_compress(struct context *ctx, struct sgl_container *sgls);
+CpaStatus meatjet_verify(struct context *ctx, struct sgl_container *sgls, CpaStatus status);
+CpaStatus meatjet_check(struct context *ctx, CpaStatus status);
+void meatjet_count_overflow(bool target);
+void meatjet_print_stats();
 void mg_log(struct context *ctx, int fail_code);
@@ -0,0 +1,1540 @@
+/*
+    Traffic mix (--mix)
+
+    The sweep runs one context at a time per worker, each compressing a whole file and
+    then decompressing it, so an instance never sees compression and decompression
+    traffic from different users at once. Production looks more like 70/30 of the two,
+    in mixed sizes. Here each worker opens a stateless session of both directions on its
+    instance (worker t on instance t % n) and sends a random mix of single requests, the
+    direction and size of each drawn by weight:
+
+        --mix compress:0.7,decompress:0.3,sizes:4k:0.5,64k:0.4,1m:0.1,secs:10
+
+    Sizes continue after sizes: as SIZE:WEIGHT pairs, with k and m suffixes. secs:S runs
+    for S seconds (default 5), requests:N stops after N requests in all. --seed seeds the
+    draws.
+
+    Compression requests are cut from a pool of cleartext filled from the files, at random
+    offsets. Decompression requests take one of MIX_PAYLOADS payloads per size, compressed
+    from the pool on the first worker's instance before the run starts, and their output is
+    compared against the pool. Latency is the request alone, credit wait included,
+    without the copies around it.
+
+    Workers are closed-loop: each sends its next request when the last one returns, so
+    a slow instance is simply sent less and its queueing never shows in the latency.
+    rate:R (requests/s) or gbps:G (of cleartext) makes the run open-loop. R is offered to
+    each instance, split evenly over its workers, each of which sends on a fixed schedule
+    and times every request from when the schedule meant it to go out, so a request held
+    back by a slow one before it counts the wait (coordinated omission). ramp:N runs N
+    steps of secs each, offering R/N, 2R/N .. R. A step's throughput is what completed
+    inside its window. A worker that falls behind sends its backlog before going on;
+    if it is still behind when the step's window is over the instance is saturated and
+    is offered no further steps. The backlog gets one more step's time to drain, and any
+    request still not sent then is counted with the time it has waited so far, so the
+    slowest requests stay in the percentiles. Per instance, the summary gives every step
+    and the knee: the last step that completed MIX_KNEE_ACHIEVED of its offered rate with
+    a p99 within MIX_KNEE_FACTOR of the first step's
+*/
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include "mix.h"
+#include "context.h"
+#include "buf_handler.h"
+#include "credit.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+// Decompression payloads per size, and the least cleartext the pool is filled to
+#define MIX_PAYLOADS        (4)
+#define MIX_POOL_MIN        (16 * 1024 * 1024)
+
+// A step is past the knee when it gets less of its rate, or its p99 grows more, than this
+#define MIX_KNEE_ACHIEVED   (0.95)
+#define MIX_KNEE_FACTOR     (4.0)
+
+// Latency histogram: 8 buckets per power of two of ns, so percentiles are within 12.5%
+#define MIX_HIST_SUB_BITS   (3)
+#define MIX_HIST_BUCKETS    (64 << MIX_HIST_SUB_BITS)
+
+struct mix_class {
+    uint32_t size;
+    double weight;
+};
+
+struct mix_stats {
+    uint64_t reqs;
+    uint64_t unsent;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t lat_ns;
+    uint64_t max_ns;
+    uint64_t hist[MIX_HIST_BUCKETS];
+};
+
+// One open-loop step: latency of the requests it scheduled, and what completed in its window
+struct mix_step {
+    struct mix_stats lat;
+    uint64_t done;
+    uint64_t done_bytes;
+};
+
+// A decompression request: its compressed bytes, and where its cleartext is in the pool
+struct mix_payload {
+    Cpa8U *data;
+    Cpa32U len;
+    size_t off;
+};
+
+struct mix_worker {
+    uint32_t id;
+    uint32_t inst;
+
+    // Place among the instance's workers, which staggers their open-loop schedules
+    uint32_t rank;
+    pthread_t thread;
+    uint64_t rng;
+
+    CpaDcSessionHandle sess[MIX_DIRS];
+    CpaBufferList src_sgl;
+    CpaBufferList dest_sgl;
+    Cpa8U *out;
+
+    struct mix_stats stats[MIX_DIRS][MIX_MAX_SIZES];
+
+    // Open loop: the worker's share of each step
+    struct mix_step *steps;
+};
+
+static struct {
+    bool enabled;
+    double weight[MIX_DIRS];
+    struct mix_class cls[MIX_MAX_SIZES];
+    uint32_t num_cls;
+    uint32_t max_size;
+    uint32_t secs;
+    uint64_t requests;
+    uint64_t seed;
+    Cpa32U level;
+    Cpa32U huff;
+
+    // Cleartext the requests are cut from
+    Cpa8U *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    struct mix_payload payload[MIX_MAX_SIZES][MIX_PAYLOADS];
+
+    // The run couldn't be set up
+    bool failed;
+
+    // Run limits: requests handed out so far, or when to stop
+    uint64_t issued;
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    // Open loop: requests/s offered to each instance at the last step, 0 for closed loop
+    double rate;
+    double gbps;
+    uint32_t steps;
+    uint64_t step_ns;
+    uint32_t all_inst;
+    uint32_t *inst_workers;
+    struct mix_step *step_stats;
+    uint64_t unsent;
+
+    // Per instance, the step (from 1) a worker was still behind at the end of, or 0
+    uint32_t *saturated;
+
+    pthread_mutex_t mutex;
+    uint32_t workers;
+    uint32_t num_inst;
+    uint64_t run_ns;
+    struct mix_stats stats[MIX_DIRS][MIX_MAX_SIZES];
+} g_mix;
+
+static const char *g_dir_names[MIX_DIRS] = { "compress", "decompress" };
+
+// splitmix64, seeded per worker
+static uint64_t next_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double next_unit(uint64_t *state)
+{
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+    Function:
+
+        parse_weight (static)
+
+    Description:
+
+        Parses a non-negative weight
+
+    Parameters:
+
+        str -   Weight to parse
+        w   -   Set to the weight
+
+    Return:
+
+        0 on success, -1 if it is malformed or negative
+*/
+static int parse_weight(const char *str, double *w)
+{
+    char *end;
+
+    *w = strtod(str, &end);
+
+    return (end == str || *end || *w < 0) ? -1 : 0;
+}
+
+/*
+    Function:
+
+        parse_class (static)
+
+    Description:
+
+        Parses a SIZE:WEIGHT pair, SIZE in bytes with an optional k or m suffix, and adds it
+        to the size classes
+
+    Parameters:
+
+        str -   Pair to parse, modified
+
+    Return:
+
+        0 on success, -1 if it is malformed, out of range or one too many
+*/
+static int parse_class(char *str)
+{
+    char *w = strchr(str, ':');
+    unsigned long size;
+    char *end;
+
+    if (w == NULL || g_mix.num_cls == MIX_MAX_SIZES) {
+        return -1;
+    }
+    *w++ = '\0';
+
+    size = strtoul(str, &end, 0);
+    if (end == str) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    }
+    if (*end || size == 0 || size > MIX_MAX_SIZE) {
+        return -1;
+    }
+
+    g_mix.cls[g_mix.num_cls].size = size;
+    if (parse_weight(w, &g_mix.cls[g_mix.num_cls].weight) < 0) {
+        return -1;
+    }
+    g_mix.num_cls++;
+
+    return 0;
+}
+
+/*
+    Function:
+
+        parse_spec (static)
+
+    Description:
+
+        Parses a --mix spec: "key:value,..." with keys compress and decompress (weights),
+        sizes (SIZE:WEIGHT, continued by further SIZE:WEIGHT pairs), secs, requests, and
+        rate or gbps with ramp for the open loop
+
+    Parameters:
+
+        str -   Spec to parse
+
+    Return:
+
+        0 on success, -1 if the spec is malformed or out of range
+*/
+static int parse_spec(const char *str)
+{
+    char buf[MAX_FILE_LEN];
+    char *save = NULL;
+    char *tok;
+    char *end;
+    bool sizes = false;
+    bool dirs = false;
+
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *val = strchr(tok, ':');
+        unsigned long v;
+
+        if (val == NULL) {
+            return -1;
+        }
+
+        // A size class following sizes:
+        if (sizes && isdigit((unsigned char)tok[0])) {
+            if (parse_class(tok) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        *val++ = '\0';
+        sizes = false;
+
+        if (!strcmp(tok, "compress") || !strcmp(tok, "decompress")) {
+            enum mix_dir d = !strcmp(tok, "compress") ? MIX_COMPRESS : MIX_DECOMPRESS;
+
+            // Naming either direction drops the default split
+            if (!dirs) {
+                g_mix.weight[MIX_COMPRESS] = g_mix.weight[MIX_DECOMPRESS] = 0;
+                dirs = true;
+            }
+            if (parse_weight(val, &g_mix.weight[d]) < 0) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "sizes")) {
+            if (parse_class(val) < 0) {
+                return -1;
+            }
+            sizes = true;
+        } else if (!strcmp(tok, "rate") || !strcmp(tok, "gbps")) {
+            if (parse_weight(val, tok[0] == 'r' ? &g_mix.rate : &g_mix.gbps) < 0) {
+                return -1;
+            }
+        } else if (!strcmp(tok, "ramp")) {
+            v = strtoul(val, &end, 0);
+            if (end == val || *end || v == 0 || v > MIX_MAX_STEPS) {
+                return -1;
+            }
+            g_mix.steps = v;
+        } else if (!strcmp(tok, "secs") || !strcmp(tok, "requests")) {
+            v = strtoul(val, &end, 0);
+            if (end == val || *end || v == 0) {
+                return -1;
+            }
+            if (tok[0] == 's') {
+                g_mix.secs = v;
+            } else {
+                g_mix.requests = v;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        mix_init
+
+    Description:
+
+        Reads --mix. Without it the files are swept as usual
+
+    Parameters:
+
+        opt -   Ptr to the options (--mix, -c, --static-only, --seed)
+
+    Return:
+
+        0 on success, -1 on a bad spec or allocation failure
+*/
+int mix_init(struct mg_options *opt)
+{
+    double total = 0;
+    double mean = 0;
+
+    memset(&g_mix, 0, sizeof(g_mix));
+    pthread_mutex_init(&g_mix.mutex, NULL);
+
+    if (opt->mix[0] == '\0') {
+        return 0;
+    }
+
+    g_mix.weight[MIX_COMPRESS] = 0.7;
+    g_mix.weight[MIX_DECOMPRESS] = 0.3;
+    g_mix.secs = MIX_DEFAULT_SECS;
+
+    if (parse_spec(opt->mix) < 0 || g_mix.weight[MIX_COMPRESS] + g_mix.weight[MIX_DECOMPRESS] <= 0 ||
+            (g_mix.rate > 0 && g_mix.gbps > 0) || (g_mix.steps && g_mix.rate == 0 && g_mix.gbps == 0)) {
+        MG_LOG_PRINT(g_log_fd, "Error: bad --mix spec \"%s\" (compress:W,decompress:W,sizes:SIZE:W[,SIZE:W...],"
+                "secs:S|requests:N,rate:R|gbps:G[,ramp:1-%u]; SIZE up to %u MB)\n",
+                opt->mix, MIX_MAX_STEPS, MIX_MAX_SIZE >> 20);
+        return -1;
+    }
+
+    if (opt->decomp_only) {
+        MG_LOG_PRINT(g_log_fd, "Error: --mix makes its own decompression payloads, it can't run with --decomp-only\n");
+        return -1;
+    }
+
+    if (g_mix.num_cls == 0) {
+        g_mix.cls[0].size = DEFAULT_BUF_SIZE;
+        g_mix.cls[0].weight = 1;
+        g_mix.num_cls = 1;
+    }
+
+    for (uint32_t c = 0; c < g_mix.num_cls; c++)
+    {
+        total += g_mix.cls[c].weight;
+        mean += g_mix.cls[c].weight * g_mix.cls[c].size;
+        if (g_mix.cls[c].size > g_mix.max_size) {
+            g_mix.max_size = g_mix.cls[c].size;
+        }
+    }
+    if (total <= 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: --mix sizes all have weight 0\n");
+        return -1;
+    }
+
+    // A bit rate becomes the request rate that carries it at the mix's mean size
+    if (g_mix.gbps > 0) {
+        g_mix.rate = g_mix.gbps * 1e9 / 8 / (mean / total);
+    }
+    if (g_mix.steps == 0) {
+        g_mix.steps = 1;
+    }
+    g_mix.step_ns = g_mix.secs * 1000000000ULL;
+
+    g_mix.pool_cap = 2 * (size_t)g_mix.max_size > MIX_POOL_MIN ? 2 * (size_t)g_mix.max_size : MIX_POOL_MIN;
+    g_mix.pool = (Cpa8U *)malloc(g_mix.pool_cap);
+    if (g_mix.pool == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the --mix data pool\n");
+        return -1;
+    }
+
+    g_mix.seed = opt->seed ? opt->seed : 1;
+    g_mix.level = opt->min_cpr_lvl;
+    g_mix.huff = opt->static_only ? CPA_DC_HT_STATIC : CPA_DC_HT_FULL_DYNAMIC;
+    g_mix.enabled = true;
+
+    return 0;
+}
+
+bool mix_enabled()
+{
+    return g_mix.enabled;
+}
+
+/*
+    Function:
+
+        mix_add_source
+
+    Description:
+
+        Appends a loaded file to the data pool, as much of it as still fits. The caller
+        may release the file's memory afterwards
+
+    Parameters:
+
+        s   -   Ptr to the source data
+
+    Return:
+
+        none
+*/
+void mix_add_source(struct src_data *s)
+{
+    size_t n;
+
+    if (!g_mix.enabled || s->src_mem == NULL || g_mix.pool_len == g_mix.pool_cap) {
+        return;
+    }
+
+    n = g_mix.pool_cap - g_mix.pool_len;
+    if (n > s->file_size) {
+        n = s->file_size;
+    }
+
+    memcpy(g_mix.pool + g_mix.pool_len, s->src_mem, n);
+    g_mix.pool_len += n;
+}
+
+/*
+    Function:
+
+        open_sess (static)
+
+    Description:
+
+        Sets up one of a worker's stateless sessions, synchronous like every other session
+
+    Parameters:
+
+        w   -   Ptr to the worker
+        dir -   Direction of the session
+
+    Return:
+
+        Status of the session calls
+*/
+static CpaStatus open_sess(struct mix_worker *w, enum mix_dir dir)
+{
+    CpaDcSessionSetupData sd;
+    CpaInstanceInfo2 info;
+    CpaStatus status;
+    Cpa32U sess_size;
+    Cpa32U ctx_size;
+    Cpa32U node = 0;
+
+    memset(&sd, 0, sizeof(sd));
+    sd.compLevel = g_mix.level;
+    sd.huffType = g_mix.huff;
+    sd.sessState = CPA_DC_STATELESS;
+    sd.windowSize = 7;
+    sd.sessDirection = (dir == MIX_COMPRESS) ? CPA_DC_DIR_COMPRESS : CPA_DC_DIR_DECOMPRESS;
+    sd.compType = CPA_DC_DEFLATE;
+    sd.autoSelectBestHuffmanTree = CPA_DC_ASB_STATIC_DYNAMIC;
+    sd.checksum = CPA_DC_CRC32;
+
+    if (cpaDcInstanceGetInfo2(dcInstances_g[w->inst], &info) == CPA_STATUS_SUCCESS) {
+        node = info.nodeAffinity;
+    }
+
+    status = cpaDcGetSessionSize(dcInstances_g[w->inst], &sd, &sess_size, &ctx_size);
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not get session size!\n");
+        return status;
+    }
+
+    w->sess[dir] = (CpaDcSessionHandle) qaeMemAllocNUMA(sess_size, node, BYTE_ALIGNMENT_64);
+    if (w->sess[dir] == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate space for session handle!\n");
+        return CPA_STATUS_FAIL;
+    }
+
+    status = cpaDcInitSession(dcInstances_g[w->inst], w->sess[dir], &sd, NULL, NULL);
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not initialize session\n");
+        qaeMemFreeNUMA(&w->sess[dir]);
+        w->sess[dir] = NULL;
+    }
+
+    return status;
+}
+
+/*
+    Function:
+
+        worker_free (static)
+
+    Description:
+
+        Removes a worker's sessions and frees its buffers
+
+    Parameters:
+
+        w   -   Ptr to the worker
+
+    Return:
+
+        none
+*/
+static void worker_free(struct mix_worker *w)
+{
+    for (uint32_t d = 0; d < MIX_DIRS; d++)
+    {
+        if (w->sess[d]) {
+            cpaDcRemoveSession(dcInstances_g[w->inst], w->sess[d]);
+            qaeMemFreeNUMA(&w->sess[d]);
+        }
+    }
+
+    if (w->src_sgl.pBuffers) {
+        mg_free_sgl(&w->src_sgl);
+    }
+    if (w->dest_sgl.pBuffers) {
+        mg_free_sgl(&w->dest_sgl);
+    }
+    free(w->out);
+}
+
+/*
+    Function:
+
+        worker_setup (static)
+
+    Description:
+
+        Opens a worker's sessions and builds SGLs of DEFAULT_BUF_SIZE buffers that hold the
+        largest request either way, cleartext or compressed
+
+    Parameters:
+
+        w   -   Ptr to the worker, its id and instance set
+
+    Return:
+
+        Status of the session calls, or CPA_STATUS_FAIL on allocation failure
+*/
+static CpaStatus worker_setup(struct mix_worker *w)
+{
+    uint32_t num_buf = calculate_num_buf(DEFLATE_BOUND(g_mix.max_size), DEFAULT_BUF_SIZE);
+    uint32_t meta_size = 0;
+    CpaStatus status;
+
+    status = open_sess(w, MIX_COMPRESS);
+    if (status == CPA_STATUS_SUCCESS) {
+        status = open_sess(w, MIX_DECOMPRESS);
+    }
+    if (status != CPA_STATUS_SUCCESS) {
+        return status;
+    }
+
+    cpaDcBufferListGetMetaSize(dcInstances_g[w->inst], num_buf, &meta_size);
+
+    status = mg_build_sgl(&w->src_sgl, 0, num_buf, DEFAULT_BUF_SIZE, meta_size);
+    if (status == CPA_STATUS_SUCCESS) {
+        status = mg_build_sgl(&w->dest_sgl, 0, num_buf, DEFAULT_BUF_SIZE, meta_size);
+    }
+
+    w->out = (Cpa8U *)malloc((size_t)num_buf * DEFAULT_BUF_SIZE);
+    if (status == CPA_STATUS_SUCCESS && w->out == NULL) {
+        status = CPA_STATUS_FAIL;
+    }
+
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the --mix buffers for worker %u\n", w->id);
+    }
+
+    w->rng = g_mix.seed ^ ((uint64_t)(w->id + 1) * 0x9e3779b97f4a7c15ULL);
+
+    return status;
+}
+
+/*
+    Function:
+
+        send_req (static)
+
+    Description:
+
+        Sends one stateless request through a worker's session with len bytes in its src SGL,
+        giving it at most cap bytes of output, and times it
+
+    Parameters:
+
+        w       -   Ptr to the worker
+        dir     -   Direction, and so the session
+        len     -   Bytes of input in the src SGL
+        cap     -   Output space to give the request
+        res     -   Set to the results
+        sched   -   When the open-loop schedule meant the request to go out, or 0
+        ns      -   Set to the request's latency, from sched if there is one
+
+    Return:
+
+        CPA_STATUS_SUCCESS if the request went through and ended the stream
+*/
+static CpaStatus send_req(struct mix_worker *w, enum mix_dir dir, Cpa32U len, Cpa32U cap, CpaDcRqResults *res,
+                          uint64_t sched, uint64_t *ns)
+{
+    CpaDcOpData opData = {};
+    CpaStatus status;
+    uint64_t start;
+
+    memset(res, 0, sizeof(CpaDcRqResults));
+
+    opData.flushFlag = CPA_DC_FLUSH_FINAL;
+    opData.compressAndVerify = CPA_TRUE;
+
+    for (uint32_t i = 0; i < w->dest_sgl.numBuffers; i++)
+    {
+        w->dest_sgl.pBuffers[i].dataLenInBytes = cap < DEFAULT_BUF_SIZE ? cap : DEFAULT_BUF_SIZE;
+        cap -= w->dest_sgl.pBuffers[i].dataLenInBytes;
+    }
+
+    start = sched ? sched : now_ns();
+
+    credit_acquire(w->inst);
+    do {
+        if (dir == MIX_COMPRESS) {
+            status = cpaDcCompressData2(dcInstances_g[w->inst],
+                                        w->sess[dir],
+                                        &w->src_sgl,
+                                        &w->dest_sgl,
+                                        &opData,
+                                        res,
+                                        NULL);
+        } else {
+            status = cpaDcDecompressData(dcInstances_g[w->inst],
+                                         w->sess[dir],
+                                         &w->src_sgl,
+                                         &w->dest_sgl,
+                                         res,
+                                         CPA_DC_FLUSH_FINAL,
+                                         NULL);
+        }
+    } while (credit_retry(w->inst, status));
+    credit_release(w->inst);
+
+    *ns = now_ns() - start;
+
+    health_record(w->inst, NULL, status, res->status);
+
+    if (status != CPA_STATUS_SUCCESS || res->status != CPA_DC_OK || res->consumed != len) {
+        MG_LOG_PRINT(g_log_fd, "Error: --mix %s of %u bytes failed with status %d/%d, %u consumed (worker %u, instance %u)\n",
+                g_dir_names[dir], len, status, res->status, res->consumed, w->id, w->inst);
+        return (status == CPA_STATUS_SUCCESS) ? CPA_STATUS_FAIL : status;
+    }
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        make_payloads (static)
+
+    Description:
+
+        Compresses MIX_PAYLOADS slices of the pool for each size, spread over it, to be the
+        decompression requests
+
+    Parameters:
+
+        w   -   Ptr to the worker to compress them with
+
+    Return:
+
+        CPA_STATUS_SUCCESS, or the status of the first failure
+*/
+static CpaStatus make_payloads(struct mix_worker *w)
+{
+    CpaDcRqResults res;
+    CpaStatus status;
+    uint64_t ns;
+
+    for (uint32_t c = 0; c < g_mix.num_cls; c++)
+    {
+        Cpa32U size = g_mix.cls[c].size;
+
+        for (uint32_t k = 0; k < MIX_PAYLOADS; k++)
+        {
+            struct mix_payload *p = &g_mix.payload[c][k];
+
+            p->off = ((g_mix.pool_len - size) / MIX_PAYLOADS) * k;
+
+            copy_mem_to_sgl(g_mix.pool + p->off, &w->src_sgl, DEFAULT_BUF_SIZE, size);
+
+            status = send_req(w, MIX_COMPRESS, size, DEFLATE_BOUND(size), &res, 0, &ns);
+            if (status != CPA_STATUS_SUCCESS) {
+                return status;
+            }
+
+            p->data = (Cpa8U *)malloc(res.produced);
+            if (p->data == NULL) {
+                MG_LOG_PRINT(g_log_fd, "Error: could not allocate a --mix payload\n");
+                return CPA_STATUS_FAIL;
+            }
+            p->len = copy_sgl_to_mem(&w->dest_sgl, p->data, DEFAULT_BUF_SIZE, res.produced);
+        }
+    }
+
+    return CPA_STATUS_SUCCESS;
+}
+
+// 8 sub-buckets per power of two, the values below 8 getting one each
+static uint32_t hist_bucket(uint64_t ns)
+{
+    uint32_t e;
+
+    if (ns < (1 << MIX_HIST_SUB_BITS)) {
+        return ns;
+    }
+
+    e = 63 - __builtin_clzll(ns);
+
+    return ((e - MIX_HIST_SUB_BITS + 1) << MIX_HIST_SUB_BITS) |
+           ((ns >> (e - MIX_HIST_SUB_BITS)) & ((1 << MIX_HIST_SUB_BITS) - 1));
+}
+
+// Highest value that falls in a bucket
+static uint64_t hist_top(uint32_t b)
+{
+    uint32_t e;
+
+    if (b < (1 << MIX_HIST_SUB_BITS)) {
+        return b;
+    }
+
+    e = (b >> MIX_HIST_SUB_BITS) + MIX_HIST_SUB_BITS - 1;
+
+    return (((uint64_t)(b & ((1 << MIX_HIST_SUB_BITS) - 1)) + (1 << MIX_HIST_SUB_BITS) + 1) << (e - MIX_HIST_SUB_BITS)) - 1;
+}
+
+static void stats_record(struct mix_stats *st, Cpa32U bytes, uint64_t ns, CpaStatus status)
+{
+    st->reqs++;
+    st->bytes += bytes;
+    st->lat_ns += ns;
+    st->hist[hist_bucket(ns)]++;
+    if (ns > st->max_ns) {
+        st->max_ns = ns;
+    }
+    if (status != CPA_STATUS_SUCCESS) {
+        st->errors++;
+    }
+}
+
+// A scheduled request the run ended before sending, timed at least as long as it waited
+static void stats_record_unsent(struct mix_stats *st, uint64_t ns)
+{
+    st->reqs++;
+    st->unsent++;
+    st->lat_ns += ns;
+    st->hist[hist_bucket(ns)]++;
+    if (ns > st->max_ns) {
+        st->max_ns = ns;
+    }
+}
+
+static void stats_add(struct mix_stats *to, struct mix_stats *from)
+{
+    to->reqs += from->reqs;
+    to->unsent += from->unsent;
+    to->bytes += from->bytes;
+    to->errors += from->errors;
+    to->lat_ns += from->lat_ns;
+    if (from->max_ns > to->max_ns) {
+        to->max_ns = from->max_ns;
+    }
+    for (uint32_t b = 0; b < MIX_HIST_BUCKETS; b++)
+    {
+        to->hist[b] += from->hist[b];
+    }
+}
+
+/*
+    Function:
+
+        pick (static)
+
+    Description:
+
+        Draws an index from a list of weights
+
+    Parameters:
+
+        rng     -   Ptr to the worker's PRNG state
+        weight  -   Ptr to the first weight
+        stride  -   Bytes from one weight to the next
+        n       -   Number of weights
+
+    Return:
+
+        The index drawn
+*/
+static uint32_t pick(uint64_t *rng, const double *weight, size_t stride, uint32_t n)
+{
+    double total = 0;
+    double r;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        total += *(const double *)((const char *)weight + i * stride);
+    }
+
+    r = next_unit(rng) * total;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        double w = *(const double *)((const char *)weight + i * stride);
+
+        if (r < w) {
+            return i;
+        }
+        r -= w;
+    }
+
+    // Rounding left r at the very top, or the last weights are 0
+    for (uint32_t i = n; i-- > 0; )
+    {
+        if (*(const double *)((const char *)weight + i * stride) > 0) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        sched_interval (static)
+
+    Description:
+
+        Time between a worker's open-loop sends at a step: the step's share of the rate,
+        split over the instance's workers
+
+    Parameters:
+
+        w       -   Ptr to the worker
+        step    -   Step, from 0
+
+    Return:
+
+        The interval in ns
+*/
+static uint64_t sched_interval(struct mix_worker *w, uint32_t step)
+{
+    double rate = g_mix.rate * (step + 1) / g_mix.steps / g_mix.inst_workers[w->inst];
+    double ns = 1e9 / rate;
+
+    return ns < 1 ? 1 : (uint64_t)ns;
+}
+
+/*
+    Function:
+
+        sched_first (static)
+
+    Description:
+
+        When a worker's first send of a step is due. The instance's workers are spread over
+        the interval, so between them the instance sees an even stream rather than bursts
+
+    Parameters:
+
+        w       -   Ptr to the worker
+        step    -   Step, from 0
+
+    Return:
+
+        The time in ns
+*/
+static uint64_t sched_first(struct mix_worker *w, uint32_t step)
+{
+    return g_mix.start_ns + step * g_mix.step_ns + sched_interval(w, step) * w->rank / g_mix.inst_workers[w->inst];
+}
+
+// Sleeps until an open-loop send is due. Closed loop (0), or behind schedule, it doesn't
+static void sched_wait(uint64_t due)
+{
+    struct timespec ts;
+
+    if (due == 0 || now_ns() >= due) {
+        return;
+    }
+
+    ts.tv_sec = due / 1000000000ULL;
+    ts.tv_nsec = due % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/*
+    Function:
+
+        send_drawn (static)
+
+    Description:
+
+        Draws a request from the mix, loads it, waits until it is due and sends it. A
+        decompression's output is checked against the pool
+
+    Parameters:
+
+        w       -   Ptr to the worker
+        due     -   When the open-loop schedule has it go out, or 0
+        dir     -   Set to its direction
+        c       -   Set to its size class
+        ns      -   Set to its latency, from due if there is one
+
+    Return:
+
+        CPA_STATUS_SUCCESS if it went through and, for decompression, matched
+*/
+static CpaStatus send_drawn(struct mix_worker *w, uint64_t due, enum mix_dir *dir, uint32_t *c, uint64_t *ns)
+{
+    CpaDcRqResults res;
+    CpaStatus status;
+    Cpa32U size;
+
+    *dir = (enum mix_dir)pick(&w->rng, g_mix.weight, sizeof(double), MIX_DIRS);
+    *c = pick(&w->rng, &g_mix.cls[0].weight, sizeof(struct mix_class), g_mix.num_cls);
+    size = g_mix.cls[*c].size;
+
+    if (*dir == MIX_COMPRESS) {
+        size_t off = next_rand(&w->rng) % (g_mix.pool_len - size + 1);
+
+        copy_mem_to_sgl(g_mix.pool + off, &w->src_sgl, DEFAULT_BUF_SIZE, size);
+        sched_wait(due);
+        return send_req(w, *dir, size, DEFLATE_BOUND(size), &res, due, ns);
+    }
+
+    struct mix_payload *p = &g_mix.payload[*c][next_rand(&w->rng) % MIX_PAYLOADS];
+
+    copy_mem_to_sgl(p->data, &w->src_sgl, DEFAULT_BUF_SIZE, p->len);
+    sched_wait(due);
+    status = send_req(w, *dir, p->len, DEFLATE_BOUND(size), &res, due, ns);
+
+    if (status == CPA_STATUS_SUCCESS) {
+        if (res.produced != size ||
+                copy_sgl_to_mem(&w->dest_sgl, w->out, DEFAULT_BUF_SIZE, size) != size ||
+                memcmp(w->out, g_mix.pool + p->off, size)) {
+            MG_LOG_PRINT(g_log_fd, "Error: --mix decompression of %u bytes gave %u bytes that don't match "
+                    "(worker %u, instance %u)\n", size, res.produced, w->id, w->inst);
+            status = CPA_STATUS_FAIL;
+        }
+    }
+
+    return status;
+}
+
+/*
+    Function:
+
+        open_loop (static)
+
+    Description:
+
+        Sends a worker's share of each step on schedule, late ones as soon as it can. A
+        step the worker is still behind on once its window is over saturates the instance,
+        and neither it nor the instance's other workers start another. The backlog gets one
+        step's time past the window; what is still unsent then is counted with the time it
+        has waited
+
+    Parameters:
+
+        w   -   Ptr to the worker
+
+    Return:
+
+        none
+*/
+static void open_loop(struct mix_worker *w)
+{
+    enum mix_dir dir;
+    CpaStatus status;
+    uint64_t done;
+    uint64_t ns;
+    uint32_t c;
+
+    for (uint32_t s = 0; s < g_mix.steps; s++)
+    {
+        uint64_t step_end = g_mix.start_ns + (s + 1) * g_mix.step_ns;
+        uint64_t drain_end = step_end + g_mix.step_ns;
+        uint64_t interval = sched_interval(w, s);
+
+        // The instance is past its knee, more load only tells us that again
+        if (__atomic_load_n(&g_mix.saturated[w->inst], __ATOMIC_ACQUIRE)) {
+            return;
+        }
+
+        for (uint64_t due = sched_first(w, s); due < step_end; due += interval)
+        {
+            // A step's backlog gets the next step's time to drain, what is left after that is lost
+            if (now_ns() >= drain_end) {
+                dir = (enum mix_dir)pick(&w->rng, g_mix.weight, sizeof(double), MIX_DIRS);
+                c = pick(&w->rng, &g_mix.cls[0].weight, sizeof(struct mix_class), g_mix.num_cls);
+                stats_record_unsent(&w->stats[dir][c], drain_end - due);
+                stats_record_unsent(&w->steps[s].lat, drain_end - due);
+                continue;
+            }
+
+            if (g_mix.requests && __sync_fetch_and_add(&g_mix.issued, 1) >= g_mix.requests) {
+                return;
+            }
+
+            status = send_drawn(w, due, &dir, &c, &ns);
+            done = now_ns();
+
+            stats_record(&w->stats[dir][c], g_mix.cls[c].size, ns, status);
+            stats_record(&w->steps[s].lat, g_mix.cls[c].size, ns, status);
+
+            // Throughput goes to the step whose window the request completed in
+            if (done < g_mix.start_ns + g_mix.steps * g_mix.step_ns) {
+                struct mix_step *in = &w->steps[(done - g_mix.start_ns) / g_mix.step_ns];
+
+                in->done++;
+                in->done_bytes += g_mix.cls[c].size;
+            }
+        }
+
+        // Still behind a send interval after the window closed: this step saturated the instance
+        if (now_ns() >= step_end + interval) {
+            uint32_t none = 0;
+
+            __atomic_compare_exchange_n(&g_mix.saturated[w->inst], &none, s + 1, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+/*
+    Function:
+
+        worker (static)
+
+    Description:
+
+        Worker thread body. Sends requests drawn from the mix until the run is over, back
+        to back or on its open-loop schedule, then adds its counts to the totals
+
+    Parameters:
+
+        arg -   Ptr to the worker
+
+    Return:
+
+        none
+*/
+static void *worker(void *arg)
+{
+    struct mix_worker *w = (struct mix_worker *)arg;
+    bool open = g_mix.rate > 0;
+    enum mix_dir dir;
+    CpaStatus status;
+    uint64_t ns;
+    uint32_t c;
+
+    if (open) {
+        open_loop(w);
+    }
+
+    while (!open)
+    {
+        if (g_mix.requests) {
+            if (__sync_fetch_and_add(&g_mix.issued, 1) >= g_mix.requests) {
+                break;
+            }
+        } else if (now_ns() >= g_mix.end_ns) {
+            break;
+        }
+
+        status = send_drawn(w, 0, &dir, &c, &ns);
+        stats_record(&w->stats[dir][c], g_mix.cls[c].size, ns, status);
+    }
+
+    pthread_mutex_lock(&g_mix.mutex);
+    for (uint32_t d = 0; d < MIX_DIRS; d++)
+    {
+        for (uint32_t k = 0; k < g_mix.num_cls; k++)
+        {
+            stats_add(&g_mix.stats[d][k], &w->stats[d][k]);
+        }
+    }
+    for (uint32_t s = 0; open && s < g_mix.steps; s++)
+    {
+        struct mix_step *to = &g_mix.step_stats[s * g_mix.all_inst + w->inst];
+
+        stats_add(&to->lat, &w->steps[s].lat);
+        to->done += w->steps[s].done;
+        to->done_bytes += w->steps[s].done_bytes;
+        g_mix.unsent += w->steps[s].lat.unsent;
+    }
+    pthread_mutex_unlock(&g_mix.mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        mix_run
+
+    Description:
+
+        Runs the traffic mix: one worker per --threads, spread over the instances, for the
+        run's length, every step of it in the open loop. Called with the instances up once
+        the files have filled the pool
+
+    Parameters:
+
+        opt -   Ptr to the options (--threads)
+
+    Return:
+
+        CPA_STATUS_SUCCESS, or CPA_STATUS_FAIL if the run couldn't be set up
+*/
+CpaStatus mix_run(struct mg_options *opt)
+{
+    struct mix_worker *w;
+    CpaStatus status = CPA_STATUS_SUCCESS;
+    uint64_t start;
+    uint32_t n;
+
+    if (!g_mix.enabled) {
+        return CPA_STATUS_SUCCESS;
+    }
+
+    if (g_mix.pool_len == 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: --mix has no data, the input files are empty\n");
+        g_mix.enabled = false;
+        g_mix.failed = true;
+        return CPA_STATUS_FAIL;
+    }
+
+    // Files smaller than the pool are repeated to fill it
+    for (size_t filled = g_mix.pool_len; filled < g_mix.pool_cap; filled += g_mix.pool_len)
+    {
+        size_t len = g_mix.pool_cap - filled < g_mix.pool_len ? g_mix.pool_cap - filled : g_mix.pool_len;
+
+        memcpy(g_mix.pool + filled, g_mix.pool, len);
+    }
+    g_mix.pool_len = g_mix.pool_cap;
+
+    n = opt->threads ? opt->threads : 1;
+    w = (struct mix_worker *)calloc(n, sizeof(struct mix_worker));
+    if (w == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the --mix workers\n");
+        g_mix.enabled = false;
+        g_mix.failed = true;
+        return CPA_STATUS_FAIL;
+    }
+
+    g_mix.workers = n;
+    g_mix.num_inst = n < numDcInstances_g ? n : numDcInstances_g;
+
+    // Kept for the summary, which comes after the instances are gone
+    g_mix.all_inst = numDcInstances_g;
+    g_mix.inst_workers = (uint32_t *)calloc(numDcInstances_g, sizeof(uint32_t));
+    g_mix.saturated = (uint32_t *)calloc(numDcInstances_g, sizeof(uint32_t));
+    g_mix.step_stats = (struct mix_step *)calloc((size_t)g_mix.steps * numDcInstances_g, sizeof(struct mix_step));
+    if (g_mix.inst_workers == NULL || g_mix.saturated == NULL || g_mix.step_stats == NULL) {
+        status = CPA_STATUS_FAIL;
+    }
+
+    for (uint32_t t = 0; t < n && status == CPA_STATUS_SUCCESS; t++)
+    {
+        w[t].id = t;
+        w[t].inst = t % numDcInstances_g;
+        w[t].rank = g_mix.inst_workers[w[t].inst]++;
+        w[t].steps = (struct mix_step *)calloc(g_mix.steps, sizeof(struct mix_step));
+        status = w[t].steps ? worker_setup(&w[t]) : CPA_STATUS_FAIL;
+    }
+
+    if (status == CPA_STATUS_SUCCESS && g_mix.weight[MIX_DECOMPRESS] > 0) {
+        status = make_payloads(&w[0]);
+    }
+
+    if (status == CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Traffic mix: %u worker(s) on %u instance(s), seed %lu\n",
+                g_mix.workers, g_mix.num_inst, g_mix.seed);
+        if (g_mix.rate > 0) {
+            MG_LOG_PRINT(g_log_fd, "Traffic mix: open loop, %u step(s) of %u s up to %.1f req/s per instance\n",
+                    g_mix.steps, g_mix.secs, g_mix.rate);
+        }
+
+        start = now_ns();
+        g_mix.start_ns = start;
+        g_mix.end_ns = start + g_mix.steps * g_mix.step_ns;
+
+        for (uint32_t t = 0; t < n; t++)
+        {
+            pthread_create(&w[t].thread, NULL, worker, &w[t]);
+        }
+        for (uint32_t t = 0; t < n; t++)
+        {
+            pthread_join(w[t].thread, NULL);
+        }
+
+        g_mix.run_ns = now_ns() - start;
+    } else {
+        MG_LOG_PRINT(g_log_fd, "Error: could not set up the --mix run\n");
+        g_mix.enabled = false;
+        g_mix.failed = true;
+    }
+
+    for (uint32_t t = 0; t < n; t++)
+    {
+        worker_free(&w[t]);
+        free(w[t].steps);
+    }
+    free(w);
+
+    for (uint32_t c = 0; c < g_mix.num_cls; c++)
+    {
+        for (uint32_t k = 0; k < MIX_PAYLOADS; k++)
+        {
+            free(g_mix.payload[c][k].data);
+            g_mix.payload[c][k].data = NULL;
+        }
+    }
+    free(g_mix.pool);
+    g_mix.pool = NULL;
+
+    return status;
+}
+
+/*
+    Function:
+
+        mix_errors
+
+    Description:
+
+        Whether the --mix run failed to set up or any of its requests failed, for the
+        exit status
+
+    Parameters:
+
+        none
+
+    Return:
+
+        true if one did
+*/
+bool mix_errors()
+{
+    if (g_mix.failed) {
+        return true;
+    }
+
+    for (uint32_t d = 0; d < MIX_DIRS; d++)
+    {
+        for (uint32_t c = 0; c < g_mix.num_cls; c++)
+        {
+            if (g_mix.stats[d][c].errors) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Latency at quantile q in us, the top of its histogram bucket but no more than the max
+static double percentile_us(struct mix_stats *st, double q)
+{
+    uint64_t seen = 0;
+
+    for (uint32_t b = 0; b < MIX_HIST_BUCKETS; b++)
+    {
+        seen += st->hist[b];
+        if (seen && seen >= q * st->reqs) {
+            uint64_t top = hist_top(b);
+
+            return (top < st->max_ns ? top : st->max_ns) / 1e3;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        print_line (static)
+
+    Description:
+
+        Prints one line of the mix: requests, throughput and latency percentiles. The
+        latency counts unsent requests with the time they waited, the throughput only
+        what completed
+
+    Parameters:
+
+        label   -   What the line counts
+        st      -   Ptr to the latency counts
+        done    -   Requests completed
+        bytes   -   Bytes they carried
+        secs    -   Time they completed in
+
+    Return:
+
+        none
+*/
+static void print_line(const char *label, struct mix_stats *st, uint64_t done, uint64_t bytes, double secs)
+{
+    MG_LOG_PRINT(g_log_fd, "        %-17s: %8lu req, %9.1f req/s, %9.2f MB/s, latency us avg %.1f p50 %.1f p99 %.1f "
+            "p99.9 %.1f max %.1f\n",
+            label, st->reqs, secs ? done / secs : 0.0, secs ? bytes / (1024.0 * 1024.0) / secs : 0.0,
+            st->reqs ? st->lat_ns / 1e3 / st->reqs : 0.0, percentile_us(st, 0.50), percentile_us(st, 0.99),
+            percentile_us(st, 0.999), st->max_ns / 1e3);
+    if (st->errors) {
+        MG_LOG_PRINT(g_log_fd, "        %-17s: %lu request(s) failed\n", label, st->errors);
+    }
+    if (st->unsent) {
+        MG_LOG_PRINT(g_log_fd, "        %-17s: %lu request(s) never sent, timed to when they were given up\n", label, st->unsent);
+    }
+}
+
+/*
+    Function:
+
+        print_steps (static)
+
+    Description:
+
+        Prints the open loop's steps per instance, and where each instance's knee is
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+static void print_steps()
+{
+    double secs = g_mix.step_ns / 1e9;
+    struct mix_step *st;
+    char label[32];
+
+    MG_LOG_PRINT(g_log_fd, "    Open Loop: %u step(s) of %u s up to %.1f req/s per instance, latency from when each "
+            "request was due\n", g_mix.steps, g_mix.secs, g_mix.rate);
+
+    for (uint32_t s = 0; s < g_mix.steps; s++)
+    {
+        MG_LOG_PRINT(g_log_fd, "        step %u: %.1f req/s offered per instance\n", s + 1, g_mix.rate * (s + 1) / g_mix.steps);
+
+        for (uint32_t i = 0; i < g_mix.all_inst; i++)
+        {
+            if (g_mix.inst_workers[i] == 0) {
+                continue;
+            }
+            snprintf(label, sizeof(label), "  instance %u", i);
+            if (g_mix.saturated[i] && s >= g_mix.saturated[i]) {
+                MG_LOG_PRINT(g_log_fd, "        %-17s: not run, saturated at step %u\n", label, g_mix.saturated[i]);
+                continue;
+            }
+            st = &g_mix.step_stats[s * g_mix.all_inst + i];
+            print_line(label, &st->lat, st->done, st->done_bytes, secs);
+        }
+    }
+
+    for (uint32_t i = 0; g_mix.steps > 1 && i < g_mix.all_inst; i++)
+    {
+        double base;
+        int32_t knee = -1;
+
+        if (g_mix.inst_workers[i] == 0) {
+            continue;
+        }
+
+        base = percentile_us(&g_mix.step_stats[i].lat, 0.99);
+
+        for (uint32_t s = 0; s < g_mix.steps; s++)
+        {
+            double offered = g_mix.rate * (s + 1) / g_mix.steps;
+
+            st = &g_mix.step_stats[s * g_mix.all_inst + i];
+            if ((g_mix.saturated[i] && s >= g_mix.saturated[i]) || st->done / secs < MIX_KNEE_ACHIEVED * offered ||
+                    percentile_us(&st->lat, 0.99) > MIX_KNEE_FACTOR * base) {
+                break;
+            }
+            knee = s;
+        }
+
+        if (knee < 0) {
+            MG_LOG_PRINT(g_log_fd, "        Knee of instance %u: below the first step, %.1f req/s\n",
+                    i, g_mix.rate / g_mix.steps);
+        } else if ((uint32_t)knee == g_mix.steps - 1) {
+            MG_LOG_PRINT(g_log_fd, "        Knee of instance %u: not reached at %.1f req/s\n", i, g_mix.rate);
+        } else {
+            st = &g_mix.step_stats[knee * g_mix.all_inst + i];
+            MG_LOG_PRINT(g_log_fd, "        Knee of instance %u: %.1f req/s (%.2f MB/s), p99 %.1f us\n",
+                    i, st->done / secs, st->done_bytes / (1024.0 * 1024.0) / secs, percentile_us(&st->lat, 0.99));
+        }
+    }
+
+    if (g_mix.unsent) {
+        MG_LOG_PRINT(g_log_fd, "        %lu scheduled request(s) not sent, the workers were still behind a step after "
+                "their step's window; they count in the latency with the time they waited\n", g_mix.unsent);
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
+
+/*
+    Function:
+
+        mix_print_stats
+
+    Description:
+
+        Prints the mix per direction and size, then per direction over all sizes, and the
+        open loop's steps
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void mix_print_stats()
+{
+    struct mix_stats *total;
+    double secs = g_mix.run_ns / 1e9;
+    char label[32];
+
+    if (!g_mix.enabled) {
+        return;
+    }
+
+    total = (struct mix_stats *)calloc(MIX_DIRS, sizeof(struct mix_stats));
+    if (total == NULL) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Traffic Mix: %u worker(s) on %u instance(s) for %.2f s, compress:%g decompress:%g\n",
+            g_mix.workers, g_mix.num_inst, secs, g_mix.weight[MIX_COMPRESS], g_mix.weight[MIX_DECOMPRESS]);
+
+    for (uint32_t d = 0; d < MIX_DIRS; d++)
+    {
+        for (uint32_t c = 0; c < g_mix.num_cls; c++)
+        {
+            Cpa32U size = g_mix.cls[c].size;
+
+            stats_add(&total[d], &g_mix.stats[d][c]);
+            if (g_mix.num_cls == 1 || g_mix.stats[d][c].reqs == 0) {
+                continue;
+            }
+
+            if (size % (1 << 20) == 0) {
+                snprintf(label, sizeof(label), "%-10s %5uMB", g_dir_names[d], size >> 20);
+            } else if (size % (1 << 10) == 0) {
+                snprintf(label, sizeof(label), "%-10s %5uKB", g_dir_names[d], size >> 10);
+            } else {
+                snprintf(label, sizeof(label), "%-10s %6uB", g_dir_names[d], size);
+            }
+            print_line(label, &g_mix.stats[d][c], g_mix.stats[d][c].reqs - g_mix.stats[d][c].unsent,
+                    g_mix.stats[d][c].bytes, secs);
+        }
+
+        if (total[d].reqs) {
+            snprintf(label, sizeof(label), "%-10s %7s", g_dir_names[d], "all");
+            print_line(label, &total[d], total[d].reqs - total[d].unsent, total[d].bytes, secs);
+        }
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+
+    free(total);
+
+    if (g_mix.rate > 0) {
+        print_steps();
+    }
+}
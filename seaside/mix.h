@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+    Traffic mix (--mix). Instead of sweeping the files, workers send a weighted mix of
+    stateless compression and decompression requests of weighted sizes, each worker
+    holding a session of both directions on its instance, so every instance sees the two
+    at once. The files only feed the data the requests are cut from. Throughput and
+    latency percentiles are reported per direction and size, so decompression's tail can
+    be compared against a run without the compression load (decompress:1). With rate: or
+    gbps: the workers send on a fixed schedule instead of back to back, timing requests
+    from when they were due, and ramp: steps the rate up to find each instance's knee
+*/
+
+#include "cpr.h"
+
+#define MIX_MAX_SIZES       (8)
+#define MIX_MAX_SIZE        (16 * 1024 * 1024)
+#define MIX_DEFAULT_SECS    (5)
+#define MIX_MAX_STEPS       (16)
+
+enum mix_dir {
+    MIX_COMPRESS,
+    MIX_DECOMPRESS,
+    MIX_DIRS,
+};
+
+int mix_init(struct mg_options *opt);
+bool mix_enabled();
+void mix_add_source(struct src_data *s);
+CpaStatus mix_run(struct mg_options *opt);
+bool mix_errors();
+void mix_print_stats();
@@ -0,0 +1,318 @@
+#include <time.h>
+#include "obs_prune.h"
+#include "buf_handler.h"
+#include "credit.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    uint64_t profiles;
+    uint64_t profile_ns;
+    uint64_t points;
+    uint64_t past_end;
+    uint64_t collapsed;
+    uint64_t saved_ns;
+} g_prune_stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 };
+
+/*
+    Function:
+
+        obs_profile_measure
+
+    Description:
+
+        Compresses the whole file once for the given key with no OBS target, mirroring
+        the request sequence of the serial loop in meatjet(), and records how much had
+        been produced before every request. Run by the producer before the key's
+        overflow contexts are built
+
+    Parameters:
+
+        opt         -   Ptr to the command line options struct
+        s           -   Ptr to the source data
+        sgls        -   Ptr to the producer's sgl container
+        cpr_lvl     -   Compression level
+        huff_type   -   CPA_DC_HT_STATIC/FULL_DYNAMIC
+        prof        -   Ptr to the profile to fill in
+
+    Return:
+
+        Status of the compression
+*/
+CpaStatus obs_profile_measure(struct mg_options *opt, struct src_data *s, struct sgl_container *sgls,
+        Cpa32U cpr_lvl, Cpa32U huff_type, struct obs_profile *prof)
+{
+    CpaStatus status;
+    CpaDcOpData opData = {};
+    struct context *ctx;
+    uint64_t max_reqs;
+    uint64_t start;
+    Cpa32U job_size;
+    Cpa32U data_copied;
+    Cpa32U iNum;
+
+    memset(prof, 0, sizeof(struct obs_profile));
+
+    ctx = create_ctx(opt, 0);
+    if (ctx == NULL) {
+        return CPA_STATUS_FAIL;
+    }
+
+    fill_ctx_sess(ctx, cpr_lvl, huff_type, opt->stateless ? CPA_DC_STATELESS : CPA_DC_STATEFUL, 7);
+    ctx->src_data = s;
+
+    status = launch_ctx(ctx, sgls);
+    if (status != CPA_STATUS_SUCCESS) {
+        free_ctx(ctx, sgls);
+        return status;
+    }
+
+    // Every request makes progress, and overflows at most double the count
+    max_reqs = (calculate_num_buf(s->file_size, DEFAULT_BUF_SIZE) * 2) + 2;
+    prof->offset = (uint64_t *)calloc(max_reqs + 1, sizeof(uint64_t));
+    if (prof->offset == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate OBS profile for [%s]\n", s->filename);
+        free_ctx(ctx, sgls);
+        return CPA_STATUS_FAIL;
+    }
+
+    iNum = ctx->inst;
+
+    if (CPA_DC_STATELESS == ctx->sessCprSetupData.sessState) {
+        opData.compressAndVerify = CPA_TRUE;
+    }
+
+    start = now_ns();
+
+    while (ctx->cpr_consumed < s->file_size || ctx->cpr_results.status == CPA_DC_OVERFLOW)
+    {
+        if (prof->num_reqs == max_reqs) {
+            MG_LOG_PRINT(g_log_fd, "Error: OBS profile of [%s] is not making progress\n", s->filename);
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        job_size = DEFAULT_BUF_SIZE;
+
+        if ((job_size + ctx->cpr_consumed) < s->file_size) {
+            if (CPA_DC_STATEFUL == ctx->sessCprSetupData.sessState) {
+                opData.flushFlag = CPA_DC_FLUSH_SYNC;
+            } else {
+                opData.flushFlag = CPA_DC_FLUSH_FULL;
+            }
+        } else {
+            job_size = (s->file_size - ctx->cpr_consumed);
+            opData.flushFlag = CPA_DC_FLUSH_FINAL;
+        }
+
+        data_copied = copy_mem_to_sgl(s->src_mem + ctx->cpr_consumed, sgls->src_sgl, DEFAULT_BUF_SIZE, job_size);
+        if (data_copied != job_size) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data to the OBS profile src SGL!\n");
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        prof->offset[prof->num_reqs++] = ctx->cpr_produced;
+
+        // The same dest sizing as meatjet(), so the profile sees the same requests
+        if (ctx->cpr_results.status == CPA_DC_OVERFLOW) {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEST_BUF_SIZE;
+        } else {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFLATE_BOUND(job_size);
+        }
+
+        credit_acquire(iNum);
+        do {
+            status = cpaDcCompressData2(dcInstances_g[iNum],
+                                        ctx->sessCprHandle,
+                                        sgls->src_sgl,
+                                        sgls->dest_sgl,
+                                        &opData,
+                                        &(ctx->cpr_results),
+                                        NULL);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->cpr_results.status);
+
+        if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->cpr_results.status) {
+            MG_LOG_PRINT(g_log_fd, "OBS Profile Error: status %d [%s]\n", status, s->filename);
+            break;
+        }
+
+        ctx->cpr_consumed += ctx->cpr_results.consumed;
+        ctx->cpr_produced += ctx->cpr_results.produced;
+    }
+
+    sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
+
+    prof->ns = now_ns() - start;
+    prof->offset[prof->num_reqs] = ctx->cpr_produced;
+
+    free_ctx(ctx, sgls);
+
+    if (status != CPA_STATUS_SUCCESS) {
+        obs_profile_free(prof);
+        return (status == CPA_STATUS_SUCCESS) ? CPA_STATUS_FAIL : status;
+    }
+
+    pthread_mutex_lock(&g_prune_stats.mutex);
+    g_prune_stats.profiles++;
+    g_prune_stats.profile_ns += prof->ns;
+    pthread_mutex_unlock(&g_prune_stats.mutex);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+void obs_profile_free(struct obs_profile *prof)
+{
+    free(prof->offset);
+    prof->offset = NULL;
+    prof->num_reqs = 0;
+}
+
+/*
+    Function:
+
+        obs_prune_points
+
+    Description:
+
+        Builds the OBS sweep for one key from its profile. The sweep ends at the
+        measured compressed size, since nothing above it can overflow. meatjet() only
+        sees an OBS as the request (bucket) it lands in and the length it shortens that
+        request's dest buffer to, clamped at MIN_OBS_VALUE, so consecutive OBS values
+        that give the same pair are the same test and only the first is kept
+
+    Parameters:
+
+        prof        -   Ptr to the key's profile, NULL for the full unpruned sweep
+        start_obs   -   First OBS of the unpruned sweep
+        end_obs     -   Last OBS of the unpruned sweep
+        step        -   OBS step
+        points      -   Set to a malloc'd list of the OBS values to run
+
+    Return:
+
+        Number of OBS values in the list
+*/
+uint32_t obs_prune_points(struct obs_profile *prof, uint32_t start_obs, uint32_t end_obs, uint32_t step,
+        uint32_t **points)
+{
+    uint64_t total = prof ? prof->offset[prof->num_reqs] : end_obs;
+    uint64_t bucket = 0;
+    uint64_t prev_bucket = UINT64_MAX;
+    uint32_t prev_len = 0;
+    uint32_t num_points = 0;
+    uint64_t sweep = 0;
+    uint64_t past_end = 0;
+    uint64_t collapsed = 0;
+    uint32_t clamp_obs;
+
+    clamp_obs = (total < end_obs) ? (uint32_t)total : end_obs;
+    if (clamp_obs < start_obs) {
+        clamp_obs = start_obs;
+    }
+
+    *points = (uint32_t *)malloc(((((uint64_t)clamp_obs - start_obs) / step) + 1) * sizeof(uint32_t));
+    if (*points == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate OBS point list\n");
+        return 0;
+    }
+
+    for (uint64_t obs = start_obs; obs <= end_obs; obs += step)
+    {
+        uint32_t len;
+
+        sweep++;
+
+        if (prof == NULL) {
+            (*points)[num_points++] = obs;
+            continue;
+        }
+
+        if (obs > clamp_obs) {
+            past_end++;
+            continue;
+        }
+
+        while (bucket < prof->num_reqs && (prof->offset[bucket] + CHUNK_BOUND) < obs)
+        {
+            bucket++;
+        }
+
+        // Same arithmetic as the target overflow condition in meatjet()
+        if (bucket == prof->num_reqs) {
+            len = 0;
+        } else {
+            len = obs - prof->offset[bucket];
+            if (len < MIN_OBS_VALUE) {
+                len = MIN_OBS_VALUE;
+            }
+        }
+
+        if (bucket == prev_bucket && len == prev_len) {
+            collapsed++;
+            continue;
+        }
+
+        prev_bucket = bucket;
+        prev_len = len;
+        (*points)[num_points++] = obs;
+    }
+
+    if (prof == NULL) {
+        return num_points;
+    }
+
+    pthread_mutex_lock(&g_prune_stats.mutex);
+    g_prune_stats.points += sweep;
+    g_prune_stats.past_end += past_end;
+    g_prune_stats.collapsed += collapsed;
+    g_prune_stats.saved_ns += (past_end + collapsed) * prof->ns;
+    pthread_mutex_unlock(&g_prune_stats.mutex);
+
+    return num_points;
+}
+
+/*
+    Function:
+
+        obs_prune_print_stats
+
+    Description:
+
+        Appends pruning numbers to the summary, if any profiles were measured. Time
+        saved is estimated from each key's profile, which is one compression pass, so
+        it is a lower bound on what the pruned contexts would have cost
+
+    Parameters:
+
+        threads -   Number of consumer threads the saved work would have spread over
+
+    Return:
+
+        none
+*/
+void obs_prune_print_stats(uint32_t threads)
+{
+    uint64_t pruned;
+
+    if (g_prune_stats.profiles == 0) {
+        return;
+    }
+
+    pruned = g_prune_stats.past_end + g_prune_stats.collapsed;
+
+    MG_LOG_PRINT(g_log_fd, "    OBS Pruning: %lu keys profiled in %.3f s\n",
+            g_prune_stats.profiles, g_prune_stats.profile_ns / 1e9);
+    MG_LOG_PRINT(g_log_fd, "        Pruned:   %lu of %lu points (%.2f%%)\n", pruned, g_prune_stats.points,
+            g_prune_stats.points ? (pruned * 100.0) / g_prune_stats.points : 0.0);
+    MG_LOG_PRINT(g_log_fd, "        Past end: %lu (OBS above compressed size)\n", g_prune_stats.past_end);
+    MG_LOG_PRINT(g_log_fd, "        Same hit: %lu (same bucket and clamped dest length)\n", g_prune_stats.collapsed);
+    MG_LOG_PRINT(g_log_fd, "        Saved:    >= %.3f s wall (%.3f s of compression over %u threads)\n\n",
+            (g_prune_stats.saved_ns / 1e9) / (threads ? threads : 1), g_prune_stats.saved_ns / 1e9, threads);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "cpr.h"
+#include "context.h"
+
+#define OBS_PRUNE_LEVELS    (10)
+
+/*
+    Unrestricted compression of one (file, level, huffman, state) key, as the serial
+    loop in meatjet() would issue it. offset[k] is what had been produced before
+    request k, offset[num_reqs] is the full compressed size
+*/
+struct obs_profile {
+    uint64_t num_reqs;
+    uint64_t *offset;
+    uint64_t ns;
+};
+
+CpaStatus obs_profile_measure(struct mg_options *opt, struct src_data *s, struct sgl_container *sgls,
+        Cpa32U cpr_lvl, Cpa32U huff_type, struct obs_profile *prof);
+void obs_profile_free(struct obs_profile *prof);
+uint32_t obs_prune_points(struct obs_profile *prof, uint32_t start_obs, uint32_t end_obs, uint32_t step,
+        uint32_t **points);
+void obs_prune_print_stats(uint32_t threads);
@@ -0,0 +1,281 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pack.h"
+#include "hash128.h"
+
+extern FILE *g_log_fd;
+
+/*
+    Function:
+
+        pack_open
+
+    Description:
+
+        Maps a pack and checks its header and index. The whole file is mapped
+        read-only and shared, so every thread and forked process reads payloads
+        out of one copy in the page cache
+
+    Parameters:
+
+        path        -   Pack file
+        writable    -   Keep the fd open read/write, for appending
+
+    Return:
+
+        Ptr to the open pack, NULL if it could not be opened or is damaged
+*/
+struct pack *pack_open(char *path, bool writable)
+{
+    struct pack *pack;
+    struct stat st;
+    uint64_t hash[2];
+    uint64_t index_size;
+
+    pack = (struct pack *)calloc(1, sizeof(struct pack));
+    if (pack == NULL) {
+        return NULL;
+    }
+
+    strncpy(pack->path, path, MAX_FILE_LEN - 1);
+
+    pack->fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (pack->fd < 0 || fstat(pack->fd, &st) != 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not open pack %s\n", path);
+        goto fail;
+    }
+
+    if ((uint64_t)st.st_size < PACK_ALIGN) {
+        MG_LOG_PRINT(g_log_fd, "Error: %s is too small to be a pack\n", path);
+        goto fail;
+    }
+
+    pack->map_size = st.st_size;
+    pack->map = (uint8_t *)mmap(NULL, pack->map_size, PROT_READ, MAP_SHARED, pack->fd, 0);
+    if (pack->map == MAP_FAILED) {
+        pack->map = NULL;
+        MG_LOG_PRINT(g_log_fd, "Error: could not map pack %s\n", path);
+        goto fail;
+    }
+
+    pack->hdr = (struct pack_header *)pack->map;
+
+    if (memcmp(pack->hdr->magic, PACK_MAGIC, 8) || pack->hdr->version != PACK_VERSION ||
+            pack->hdr->entry_size != sizeof(struct pack_entry)) {
+        MG_LOG_PRINT(g_log_fd, "Error: %s is not a version %u pack\n", path, PACK_VERSION);
+        goto fail;
+    }
+
+    // Bounded by the map first, so the index size can't wrap around
+    if (pack->hdr->num_entries > pack->map_size / sizeof(struct pack_entry) || pack->hdr->names_size > pack->map_size) {
+        MG_LOG_PRINT(g_log_fd, "Error: pack %s is truncated\n", path);
+        goto fail;
+    }
+
+    index_size = (pack->hdr->num_entries * sizeof(struct pack_entry)) + pack->hdr->names_size;
+
+    if (pack->hdr->index_off < PACK_ALIGN || pack->hdr->index_off > pack->map_size ||
+            index_size > pack->map_size - pack->hdr->index_off) {
+        MG_LOG_PRINT(g_log_fd, "Error: pack %s is truncated\n", path);
+        goto fail;
+    }
+
+    hash128_buf(pack->map + pack->hdr->index_off, index_size, hash);
+    if (hash[0] != pack->hdr->index_hash[0] || hash[1] != pack->hdr->index_hash[1]) {
+        MG_LOG_PRINT(g_log_fd, "Error: pack %s has a damaged index\n", path);
+        goto fail;
+    }
+
+    pack->entries = (struct pack_entry *)(pack->map + pack->hdr->index_off);
+    pack->names = (char *)(pack->entries + pack->hdr->num_entries);
+
+    for (uint64_t i = 0; i < pack->hdr->num_entries; i++)
+    {
+        struct pack_entry *e = &pack->entries[i];
+
+        if (e->offset > pack->hdr->index_off || e->size > pack->hdr->index_off - e->offset ||
+                (uint64_t)e->name_off + e->name_len >= pack->hdr->names_size || pack->names[e->name_off + e->name_len]) {
+            MG_LOG_PRINT(g_log_fd, "Error: pack %s entry %lu is out of bounds\n", path, i);
+            goto fail;
+        }
+    }
+
+    // Payloads are read in order by each context, and all of them by the run
+    madvise(pack->map, pack->map_size, MADV_WILLNEED);
+
+    if (!writable) {
+        close(pack->fd);
+        pack->fd = -1;
+    }
+
+    return pack;
+
+fail:
+    pack_close(pack);
+    return NULL;
+}
+
+/*
+    Function:
+
+        pack_close
+
+    Description:
+
+        Unmaps a pack. Any src_data pointing into it must be done with
+
+    Parameters:
+
+        pack    -   Ptr to the pack
+
+    Return:
+
+        none
+*/
+void pack_close(struct pack *pack)
+{
+    if (pack == NULL) {
+        return;
+    }
+
+    if (pack->map) {
+        munmap(pack->map, pack->map_size);
+    }
+
+    if (pack->fd >= 0) {
+        close(pack->fd);
+    }
+
+    free(pack);
+}
+
+/*
+    Function:
+
+        pack_file_list
+
+    Description:
+
+        Builds the run's file list from a pack's index, in index order. Entries
+        are named "pack:name", and pack_idx maps each back to its index entry
+
+    Parameters:
+
+        pack    -   Ptr to the open pack
+        list    -   Ptr to the list to fill in, freed with dir_scan_free()
+
+    Return:
+
+        Number of entries, or -1 on failure
+*/
+int pack_file_list(struct pack *pack, struct file_list *list)
+{
+    uint64_t n = pack->hdr->num_entries;
+    size_t path_len = strlen(pack->path);
+    size_t arena_size = 0;
+    size_t pos = 0;
+
+    memset(list, 0, sizeof(struct file_list));
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        arena_size += path_len + 1 + pack->entries[i].name_len + 1;
+    }
+
+    list->arena = (char *)malloc(arena_size ? arena_size : 1);
+    list->paths = (char **)calloc(n ? n : 1, sizeof(char *));
+    list->sizes = (uint64_t *)calloc(n ? n : 1, sizeof(uint64_t));
+    list->pack_idx = (uint32_t *)calloc(n ? n : 1, sizeof(uint32_t));
+    if (list->arena == NULL || list->paths == NULL || list->sizes == NULL || list->pack_idx == NULL) {
+        dir_scan_free(list);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        struct pack_entry *e = &pack->entries[i];
+
+        list->paths[i] = list->arena + pos;
+        pos += sprintf(list->arena + pos, "%s:%s", pack->path, pack->names + e->name_off) + 1;
+
+        list->sizes[i] = e->size;
+        list->pack_idx[i] = i;
+        list->total_bytes += e->size;
+    }
+
+    list->num_files = n;
+    list->pack = pack;
+
+    return n;
+}
+
+/*
+    Function:
+
+        pack_write_index
+
+    Description:
+
+        Writes an index at index_off and then the header pointing at it, syncing
+        between the two so the header never points at an index that isn't there
+
+    Parameters:
+
+        fd          -   Pack file, open for writing
+        index_off   -   Where the index goes, after the last payload
+        entries     -   Every entry, old and new
+        num_entries -   Number of entries
+        names       -   Name table
+        names_size  -   Size of the name table
+
+    Return:
+
+        0 on success, -1 on a write failure
+*/
+int pack_write_index(int fd, uint64_t index_off, struct pack_entry *entries, uint64_t num_entries,
+        char *names, uint64_t names_size)
+{
+    struct pack_header *hdr;
+    uint8_t *page;
+    uint8_t *index;
+    size_t entries_size = num_entries * sizeof(struct pack_entry);
+    size_t index_size = entries_size + names_size;
+    int ret = -1;
+
+    page = (uint8_t *)calloc(1, PACK_ALIGN);
+    index = (uint8_t *)malloc(index_size ? index_size : 1);
+    if (page == NULL || index == NULL) {
+        goto done;
+    }
+
+    memcpy(index, entries, entries_size);
+    memcpy(index + entries_size, names, names_size);
+
+    if (pwrite(fd, index, index_size, index_off) != (ssize_t)index_size ||
+            ftruncate(fd, index_off + index_size) != 0 ||
+            fdatasync(fd) != 0) {
+        goto done;
+    }
+
+    hdr = (struct pack_header *)page;
+    memcpy(hdr->magic, PACK_MAGIC, 8);
+    hdr->version = PACK_VERSION;
+    hdr->entry_size = sizeof(struct pack_entry);
+    hdr->num_entries = num_entries;
+    hdr->index_off = index_off;
+    hdr->names_size = names_size;
+    hash128_buf(index, index_size, hdr->index_hash);
+
+    if (pwrite(fd, page, PACK_ALIGN, 0) != PACK_ALIGN || fdatasync(fd) != 0) {
+        goto done;
+    }
+
+    ret = 0;
+
+done:
+    free(page);
+    free(index);
+    return ret;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "main.h"
+#include "dir_scan.h"
+
+/*
+    meatjet-pack corpus file:
+
+        header      PACK_ALIGN bytes, at offset 0
+        payloads    each starting on a PACK_ALIGN boundary
+        index       num_entries pack_entry structs, then the name table
+
+    The index always follows the last payload. Appending writes the new payloads
+    after the old index, then a new index after them, and only then the header
+    that points at it, so an interrupted append leaves the old pack intact (the
+    old index's space is not reused). Fields are little-endian
+*/
+#define PACK_MAGIC          "MJPACK\r\n"
+#define PACK_VERSION        (1)
+#define PACK_ALIGN          (4096)
+#define PACK_NAME_MAX       (MAX_FILE_LEN - 1)
+
+struct pack_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t num_entries;
+    uint64_t index_off;
+    uint64_t names_size;
+    uint64_t index_hash[2];
+};
+
+struct pack_entry {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash[2];
+    uint32_t crc32;
+
+    // Raw deflate payloads packed with -z: the inflated size and its CRC, else 0
+    uint32_t dcpr_crc32;
+    uint64_t dcpr_size;
+
+    uint32_t name_off;
+    uint32_t name_len;
+};
+
+/*
+    An open pack, mapped read-only and shared, so src_data can point straight at payloads
+*/
+struct pack {
+    char path[MAX_FILE_LEN];
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+
+    struct pack_header *hdr;
+    struct pack_entry *entries;
+    char *names;
+};
+
+struct pack *pack_open(char *path, bool writable);
+void pack_close(struct pack *pack);
+int pack_file_list(struct pack *pack, struct file_list *list);
+int pack_write_index(int fd, uint64_t index_off, struct pack_entry *entries, uint64_t num_entries,
+        char *names, uint64_t names_size);
@@ -0,0 +1,555 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "main.h"
+#include "pack.h"
+#include "dir_scan.h"
+#include "hash128.h"
+
+// The shared modules log through this; the tool only wants their console output
+FILE *g_log_fd;
+
+struct pack_builder {
+    struct pack_entry *entries;
+    uint64_t num;
+    uint64_t cap;
+
+    char *names;
+    uint64_t names_size;
+    uint64_t names_cap;
+
+    // Open-addressed set of entry indices by hash, for finding duplicates
+    uint32_t *slots;
+    uint64_t num_slots;
+
+    uint64_t data_end;
+    uint64_t added;
+    uint64_t added_bytes;
+    uint64_t shared;
+    uint64_t skipped;
+};
+
+static char doc[] = "meatjet-pack: build or extend a packed corpus for meatjet --pack";
+static char args_doc[] = "PATH...";
+
+struct pack_opts {
+    char out[MAX_FILE_LEN];
+    bool append;
+    bool deflate;
+    bool list;
+    char **paths;
+    int num_paths;
+};
+
+static struct argp_option argp_opts[] = {
+    {"output",      'o',    "PACK",    0, "Pack file to create (or extend, with -a) {required}", 1},
+    {"append",      'a',    NULL,      0, "Add to an existing pack instead of replacing it", 1},
+    {"deflate",     'z',    NULL,      0, "Inputs are raw deflate: also index the inflated size and CRC, for --decomp-only", 1},
+    {"list",        'l',    NULL,      0, "List the pack's entries and exit", 1},
+    {0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct pack_opts *opts = (struct pack_opts *)state->input;
+
+    switch (key)
+    {
+        case 'o':
+            strncpy(opts->out, arg, MAX_FILE_LEN - 1);
+            break;
+        case 'a':
+            opts->append = true;
+            break;
+        case 'z':
+            opts->deflate = true;
+            break;
+        case 'l':
+            opts->list = true;
+            break;
+        case ARGP_KEY_ARGS:
+            opts->paths = state->argv + state->next;
+            opts->num_paths = state->argc - state->next;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        find_dup (static)
+
+    Description:
+
+        Looks up the first entry with the same size and hash, and whether any of
+        them is already named name. Optionally inserts the given entry as well
+
+    Parameters:
+
+        b       -   Ptr to the builder
+        e       -   Ptr to the entry to look up
+        name    -   Name to look for among the matches, or NULL
+        named   -   Set if a match is named name, may be NULL with it
+        insert  -   Index to insert under, or UINT32_MAX to only look
+
+    Return:
+
+        Index of the first matching entry, or UINT32_MAX if there is none
+*/
+static uint32_t find_dup(struct pack_builder *b, struct pack_entry *e, char *name, bool *named, uint32_t insert)
+{
+    uint64_t mask = b->num_slots - 1;
+    uint64_t slot = e->hash[0] & mask;
+    uint32_t first = UINT32_MAX;
+
+    while (b->slots[slot] != UINT32_MAX)
+    {
+        struct pack_entry *o = &b->entries[b->slots[slot]];
+
+        if (o->size == e->size && o->hash[0] == e->hash[0] && o->hash[1] == e->hash[1]) {
+            if (first == UINT32_MAX) {
+                first = b->slots[slot];
+            }
+            if (name && strcmp(b->names + o->name_off, name) == 0) {
+                *named = true;
+            }
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    if (insert != UINT32_MAX) {
+        b->slots[slot] = insert;
+    }
+
+    return first;
+}
+
+/*
+    Function:
+
+        same_payload (static)
+
+    Description:
+
+        Compares a file against the payload an entry already has in the pack, so
+        two files are only made to share one when their bytes match, not just
+        their hash
+
+    Parameters:
+
+        fd      -   Pack file
+        o       -   Ptr to the entry already in the pack
+        data    -   The new file's bytes, o->size of them
+
+    Return:
+
+        true if the bytes are identical
+*/
+static bool same_payload(int fd, struct pack_entry *o, uint8_t *data)
+{
+    uint8_t buf[65536];
+
+    for (uint64_t off = 0; off < o->size; off += sizeof(buf))
+    {
+        uint64_t n = (o->size - off < sizeof(buf)) ? (o->size - off) : sizeof(buf);
+
+        if (pread(fd, buf, n, o->offset + off) != (ssize_t)n || memcmp(buf, data + off, n) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int grow_slots(struct pack_builder *b)
+{
+    uint64_t n = b->num_slots ? b->num_slots * 2 : 1024;
+    uint32_t *slots;
+
+    while (n < (b->num + 1) * 2)
+    {
+        n *= 2;
+    }
+
+    slots = (uint32_t *)malloc(n * sizeof(uint32_t));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    memset(slots, 0xff, n * sizeof(uint32_t));
+    free(b->slots);
+    b->slots = slots;
+    b->num_slots = n;
+
+    for (uint64_t i = 0; i < b->num; i++)
+    {
+        find_dup(b, &b->entries[i], NULL, NULL, i);
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        inflate_info (static)
+
+    Description:
+
+        Inflates a raw deflate payload, the way calc_dcpr_size() does, for the
+        size and CRC of its cleartext
+
+    Parameters:
+
+        data    -   Payload
+        size    -   Payload size
+        e       -   Ptr to the entry, dcpr_size and dcpr_crc32 are set
+
+    Return:
+
+        0 on success, -1 if the payload isn't a complete deflate stream
+*/
+static int inflate_info(uint8_t *data, uint64_t size, struct pack_entry *e)
+{
+    uint8_t out[65536];
+    z_stream s = {};
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int ret;
+
+    if (inflateInit2(&s, -15) != Z_OK) {
+        return -1;
+    }
+
+    s.next_in = data;
+    s.avail_in = size;
+
+    do {
+        s.next_out = out;
+        s.avail_out = sizeof(out);
+
+        ret = inflate(&s, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+
+        crc = crc32(crc, out, sizeof(out) - s.avail_out);
+    } while (ret != Z_STREAM_END);
+
+    e->dcpr_size = s.total_out;
+    e->dcpr_crc32 = crc;
+    inflateEnd(&s);
+
+    if (ret != Z_STREAM_END) {
+        e->dcpr_size = 0;
+        e->dcpr_crc32 = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        add_file (static)
+
+    Description:
+
+        Appends one file's payload to the pack at the next aligned offset and
+        records its entry. A file whose bytes are already in the pack gets an
+        entry of its own pointing at that payload instead, and one already in
+        it under the same name is skipped
+
+    Parameters:
+
+        b       -   Ptr to the builder
+        fd      -   Pack file
+        path    -   File to add; also its name in the pack
+        opts    -   Ptr to the tool's options
+
+    Return:
+
+        0 on success (including a skipped duplicate), -1 on failure
+*/
+static int add_file(struct pack_builder *b, int fd, char *path, struct pack_opts *opts)
+{
+    struct pack_entry e = {};
+    struct stat st;
+    uint8_t *data = NULL;
+    size_t name_len = strlen(path);
+    bool named = false;
+    uint32_t keep;
+    int in;
+
+    if (name_len > PACK_NAME_MAX) {
+        fprintf(stderr, "Name too long, skipped: %s\n", path);
+        return 0;
+    }
+
+    in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0 || fstat(in, &st) != 0) {
+        fprintf(stderr, "Could not open %s\n", path);
+        if (in >= 0) {
+            close(in);
+        }
+        return -1;
+    }
+
+    e.size = st.st_size;
+
+    if (e.size) {
+        data = (uint8_t *)mmap(NULL, e.size, PROT_READ, MAP_PRIVATE, in, 0);
+        if (data == MAP_FAILED) {
+            close(in);
+            return -1;
+        }
+    }
+    close(in);
+
+    hash128_buf(data, e.size, e.hash);
+
+    if (b->num_slots < (b->num + 1) * 2 && grow_slots(b) != 0) {
+        goto fail;
+    }
+
+    keep = find_dup(b, &e, path, &named, UINT32_MAX);
+    if (named) {
+        b->skipped++;
+        if (data) {
+            munmap(data, e.size);
+        }
+        return 0;
+    }
+
+    if (keep != UINT32_MAX && same_payload(fd, &b->entries[keep], data)) {
+        struct pack_entry *o = &b->entries[keep];
+
+        e.offset = o->offset;
+        e.crc32 = o->crc32;
+        e.dcpr_crc32 = o->dcpr_crc32;
+        e.dcpr_size = o->dcpr_size;
+        b->shared++;
+    } else {
+        e.crc32 = crc32(crc32(0L, Z_NULL, 0), data, e.size);
+
+        if (opts->deflate && inflate_info(data, e.size, &e) != 0) {
+            fprintf(stderr, "Not a raw deflate stream, no cleartext info: %s\n", path);
+        }
+
+        e.offset = b->data_end;
+        if (e.size && pwrite(fd, data, e.size, e.offset) != (ssize_t)e.size) {
+            goto fail;
+        }
+        b->data_end = (e.offset + e.size + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1);
+
+        b->added++;
+        b->added_bytes += e.size;
+    }
+
+    if (b->names_size + name_len + 1 > b->names_cap) {
+        uint64_t cap = b->names_cap ? b->names_cap * 2 : 65536;
+        char *names;
+
+        while (cap < b->names_size + name_len + 1)
+        {
+            cap *= 2;
+        }
+
+        names = (char *)realloc(b->names, cap);
+        if (names == NULL) {
+            goto fail;
+        }
+        b->names = names;
+        b->names_cap = cap;
+    }
+
+    e.name_off = b->names_size;
+    e.name_len = name_len;
+    memcpy(b->names + b->names_size, path, name_len + 1);
+    b->names_size += name_len + 1;
+
+    if (b->num == b->cap) {
+        uint64_t cap = b->cap ? b->cap * 2 : 1024;
+        struct pack_entry *entries = (struct pack_entry *)realloc(b->entries, cap * sizeof(struct pack_entry));
+
+        if (entries == NULL) {
+            goto fail;
+        }
+        b->entries = entries;
+        b->cap = cap;
+    }
+
+    b->entries[b->num] = e;
+    find_dup(b, &e, NULL, NULL, b->num);
+    b->num++;
+
+    if (data) {
+        munmap(data, e.size);
+    }
+
+    return 0;
+
+fail:
+    fprintf(stderr, "Could not add %s\n", path);
+    if (data) {
+        munmap(data, e.size);
+    }
+    return -1;
+}
+
+/*
+    Function:
+
+        load_existing (static)
+
+    Description:
+
+        Starts the builder from an existing pack's index, for -a. New payloads go
+        after the pack's current end, past the old index
+
+    Parameters:
+
+        b       -   Ptr to the builder
+        path    -   Pack file
+
+    Return:
+
+        0 on success, -1 on failure
+*/
+static int load_existing(struct pack_builder *b, char *path)
+{
+    struct pack *pack;
+
+    pack = pack_open(path, false);
+    if (pack == NULL) {
+        return -1;
+    }
+
+    b->num = b->cap = pack->hdr->num_entries;
+    b->names_size = b->names_cap = pack->hdr->names_size;
+    b->entries = (struct pack_entry *)malloc((b->cap ? b->cap : 1) * sizeof(struct pack_entry));
+    b->names = (char *)malloc(b->names_cap ? b->names_cap : 1);
+    if (b->entries == NULL || b->names == NULL) {
+        pack_close(pack);
+        return -1;
+    }
+
+    memcpy(b->entries, pack->entries, b->num * sizeof(struct pack_entry));
+    memcpy(b->names, pack->names, b->names_size);
+    b->data_end = (pack->map_size + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1);
+
+    pack_close(pack);
+
+    return grow_slots(b);
+}
+
+static int list_pack(char *path)
+{
+    struct pack *pack;
+
+    pack = pack_open(path, false);
+    if (pack == NULL) {
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < pack->hdr->num_entries; i++)
+    {
+        struct pack_entry *e = &pack->entries[i];
+
+        printf("%10lu  %016lx%016lx  crc %08x", e->size, e->hash[0], e->hash[1], e->crc32);
+        if (e->dcpr_size) {
+            printf("  inflated %lu crc %08x", e->dcpr_size, e->dcpr_crc32);
+        }
+        printf("  %s\n", pack->names + e->name_off);
+    }
+
+    pack_close(pack);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct argp argp = {argp_opts, parse_opt, doc, args_doc, 0, 0, 0};
+    struct pack_opts opts = {};
+    struct pack_builder b = {};
+    int fd;
+    int ret = 0;
+
+    g_log_fd = fopen("/dev/null", "w");
+
+    argp_parse(&argp, argc, argv, 0, 0, &opts);
+
+    if (!opts.out[0]) {
+        fprintf(stderr, "Error: no pack given (-o)\n");
+        return -1;
+    }
+
+    if (opts.list) {
+        return list_pack(opts.out);
+    }
+
+    b.data_end = PACK_ALIGN;
+
+    if (opts.append && load_existing(&b, opts.out) != 0) {
+        fprintf(stderr, "Error: could not read %s to append to it\n", opts.out);
+        return -1;
+    }
+
+    fd = open(opts.out, O_RDWR | O_CREAT | O_CLOEXEC | (opts.append ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", opts.out);
+        return -1;
+    }
+
+    for (int p = 0; p < opts.num_paths && ret == 0; p++)
+    {
+        struct file_list list;
+        struct stat st;
+        int n;
+
+        if (stat(opts.paths[p], &st) != 0) {
+            fprintf(stderr, "Error: %s does not exist\n", opts.paths[p]);
+            ret = -1;
+            break;
+        }
+
+        n = S_ISDIR(st.st_mode) ? dir_scan(opts.paths[p], 1, &list) : dir_scan_single(opts.paths[p], &list);
+        if (n < 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < n && ret == 0; i++)
+        {
+            ret = add_file(&b, fd, list.paths[i], &opts);
+        }
+
+        dir_scan_free(&list);
+    }
+
+    if (ret == 0 && pack_write_index(fd, b.data_end, b.entries, b.num, b.names, b.names_size) != 0) {
+        fprintf(stderr, "Error: could not write the index of %s\n", opts.out);
+        ret = -1;
+    }
+
+    close(fd);
+
+    if (ret == 0) {
+        printf("%s: added %lu files (%.2f MB) and %lu duplicates sharing their payload, skipped %lu already packed, "
+                "%lu entries in total\n", opts.out, b.added, b.added_bytes / (1024.0 * 1024.0), b.shared, b.skipped, b.num);
+    }
+
+    free(b.entries);
+    free(b.names);
+    free(b.slots);
+
+    return ret;
+}
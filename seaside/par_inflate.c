@@ -0,0 +1,537 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "par_inflate.h"
+#include "main.h"
+
+extern FILE *g_log_fd;
+
+/*
+    A batch is one caller's set of segments. Batches queue on the pool, workers claim
+    segments from the head batch, and the caller helps drain its own batch before
+    waiting for the stragglers
+*/
+struct inflate_batch {
+    struct inflate_seg *segs;
+    uint32_t num_segs;
+    uint32_t next;
+    uint32_t done;
+    pthread_cond_t done_cond;
+    struct inflate_batch *q_next;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_t *threads;
+    uint32_t num_workers;
+    bool shutdown;
+    struct inflate_batch *head;
+    struct inflate_batch *tail;
+} g_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, false, NULL, NULL };
+
+/*
+    Function:
+
+        inflate_one (static)
+
+    Description:
+
+        Raw-inflates one full-flush segment. A segment with a known output slice must
+        fill it exactly; otherwise the output buffer is grown as needed. Non-final
+        segments legitimately end without a final block, so running out of input is
+        only an error if output space ran out first
+
+    Parameters:
+
+        seg -   Ptr to the segment
+
+    Return:
+
+        none, status is left in seg->status
+*/
+static void inflate_one(struct inflate_seg *seg)
+{
+    z_stream strm;
+    int ret;
+
+    seg->produced = 0;
+    seg->crc32 = crc32(0L, Z_NULL, 0);
+
+    if (seg->in_len == 0) {
+        seg->status = Z_OK;
+        return;
+    }
+
+    if (seg->out == NULL) {
+        seg->out_cap = seg->in_len * 4;
+        seg->out = (Cpa8U *)malloc(seg->out_cap);
+        seg->owns_out = true;
+        if (seg->out == NULL) {
+            seg->status = Z_MEM_ERROR;
+            return;
+        }
+    }
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+
+    ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK) {
+        seg->status = ret;
+        return;
+    }
+
+    strm.next_in = (Bytef *)seg->in;
+    strm.avail_in = seg->in_len;
+
+    do
+    {
+        if (seg->produced == seg->out_cap) {
+            Cpa8U *tmp;
+
+            if (!seg->owns_out) {
+                ret = Z_BUF_ERROR;
+                break;
+            }
+
+            tmp = (Cpa8U *)realloc(seg->out, seg->out_cap * 2);
+            if (tmp == NULL) {
+                ret = Z_MEM_ERROR;
+                break;
+            }
+            seg->out = tmp;
+            seg->out_cap *= 2;
+        }
+
+        strm.next_out = seg->out + seg->produced;
+        strm.avail_out = seg->out_cap - seg->produced;
+
+        ret = inflate(&strm, Z_SYNC_FLUSH);
+
+        seg->produced = seg->out_cap - strm.avail_out;
+
+    } while (ret == Z_OK && strm.avail_in > 0);
+
+    if (ret == Z_BUF_ERROR && strm.avail_in == 0) {
+        ret = Z_OK;
+    }
+
+    if (ret == Z_OK && strm.avail_in > 0) {
+        ret = Z_DATA_ERROR;
+    }
+
+    (void)inflateEnd(&strm);
+
+    seg->crc32 = crc32(seg->crc32, seg->out, seg->produced);
+    seg->status = (ret == Z_STREAM_END) ? Z_OK : ret;
+}
+
+static void unlink_batch(struct inflate_batch *b)
+{
+    struct inflate_batch **pp = &g_pool.head;
+    struct inflate_batch *prev = NULL;
+
+    while (*pp && *pp != b) {
+        prev = *pp;
+        pp = &((*pp)->q_next);
+    }
+
+    if (*pp == NULL) {
+        return;
+    }
+
+    *pp = b->q_next;
+    if (g_pool.tail == b) {
+        g_pool.tail = prev;
+    }
+}
+
+/*
+    Function:
+
+        claim_seg (static)
+
+    Description:
+
+        Claims the next unclaimed segment of a batch. Must hold the pool mutex. Unlinks
+        the batch from the queue once nothing is left to claim
+
+    Parameters:
+
+        b   -   Ptr to the batch
+
+    Return:
+
+        Index of the claimed segment, or num_segs if none are left
+*/
+static uint32_t claim_seg(struct inflate_batch *b)
+{
+    uint32_t idx;
+
+    if (b->next >= b->num_segs) {
+        unlink_batch(b);
+        return b->num_segs;
+    }
+
+    idx = b->next++;
+
+    if (b->next == b->num_segs) {
+        unlink_batch(b);
+    }
+
+    return idx;
+}
+
+static void finish_seg(struct inflate_batch *b)
+{
+    pthread_mutex_lock(&g_pool.mutex);
+    b->done++;
+    if (b->done == b->num_segs) {
+        pthread_cond_broadcast(&(b->done_cond));
+    }
+    pthread_mutex_unlock(&g_pool.mutex);
+}
+
+static void *pool_entry(void *arg)
+{
+    struct inflate_batch *b;
+    uint32_t idx;
+
+    (void)arg;
+
+    pthread_mutex_lock(&g_pool.mutex);
+
+    while (!g_pool.shutdown)
+    {
+        b = g_pool.head;
+        if (b == NULL) {
+            pthread_cond_wait(&g_pool.work_cond, &g_pool.mutex);
+            continue;
+        }
+
+        idx = claim_seg(b);
+        if (idx == b->num_segs) {
+            continue;
+        }
+        pthread_mutex_unlock(&g_pool.mutex);
+
+        inflate_one(&(b->segs[idx]));
+        finish_seg(b);
+
+        pthread_mutex_lock(&g_pool.mutex);
+    }
+
+    pthread_mutex_unlock(&g_pool.mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        par_inflate_pool_init
+
+    Description:
+
+        Starts the shared inflate worker pool. Zero workers leaves verification on the
+        calling thread, exactly as before
+
+    Parameters:
+
+        workers -   Number of pool threads
+
+    Return:
+
+        none
+*/
+void par_inflate_pool_init(uint32_t workers)
+{
+    if (workers == 0) {
+        return;
+    }
+
+    g_pool.shutdown = false;
+    g_pool.threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    if (g_pool.threads == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate inflate workers, verifying serially\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        if (pthread_create(&(g_pool.threads[i]), NULL, pool_entry, NULL)) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not start inflate worker %u\n", i);
+            break;
+        }
+        g_pool.num_workers++;
+    }
+}
+
+void par_inflate_pool_destroy()
+{
+    pthread_mutex_lock(&g_pool.mutex);
+    g_pool.shutdown = true;
+    pthread_cond_broadcast(&g_pool.work_cond);
+    pthread_mutex_unlock(&g_pool.mutex);
+
+    for (uint32_t i = 0; i < g_pool.num_workers; i++)
+    {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+
+    free(g_pool.threads);
+    g_pool.threads = NULL;
+    g_pool.num_workers = 0;
+}
+
+bool par_inflate_enabled()
+{
+    return g_pool.num_workers > 0;
+}
+
+/*
+    Function:
+
+        par_inflate_segments
+
+    Description:
+
+        Inflates independent raw-deflate segments on the worker pool. The calling thread
+        works its own batch too, so this never waits on an idle pool
+
+    Parameters:
+
+        segs        -   Array of segments, in stream order
+        num_segs    -   Number of segments
+
+    Return:
+
+        Z_OK, or the zlib status of the first failing segment
+*/
+int par_inflate_segments(struct inflate_seg *segs, uint32_t num_segs)
+{
+    struct inflate_batch b;
+    uint32_t idx;
+
+    if (num_segs == 0) {
+        return Z_OK;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.segs = segs;
+    b.num_segs = num_segs;
+    pthread_cond_init(&(b.done_cond), NULL);
+
+    pthread_mutex_lock(&g_pool.mutex);
+
+    if (g_pool.tail) {
+        g_pool.tail->q_next = &b;
+    } else {
+        g_pool.head = &b;
+    }
+    g_pool.tail = &b;
+    pthread_cond_broadcast(&g_pool.work_cond);
+
+    while ((idx = claim_seg(&b)) < num_segs)
+    {
+        pthread_mutex_unlock(&g_pool.mutex);
+        inflate_one(&(segs[idx]));
+        pthread_mutex_lock(&g_pool.mutex);
+        b.done++;
+    }
+
+    while (b.done < num_segs) {
+        pthread_cond_wait(&(b.done_cond), &g_pool.mutex);
+    }
+
+    pthread_mutex_unlock(&g_pool.mutex);
+    pthread_cond_destroy(&(b.done_cond));
+
+    for (uint32_t i = 0; i < num_segs; i++)
+    {
+        if (segs[i].status != Z_OK) {
+            return segs[i].status;
+        }
+    }
+
+    return Z_OK;
+}
+
+/*
+    Function:
+
+        par_inflate_verify
+
+    Description:
+
+        Verification path for a stateless context. Each segment's decompressed size is
+        known from the recorded consumed counts, so every segment inflates straight into
+        its own slice of the output, and the CRC is combined in stream order
+
+    Parameters:
+
+        src         -   Compressed stream
+        pts         -   Flush points, one per stateless request, in order
+        num_pts     -   Number of flush points
+        out         -   Output buffer
+        out_cap     -   Size of the output buffer
+        out_size    -   Total bytes inflated
+        crc         -   Combined CRC32 of the output
+
+    Return:
+
+        Z_OK, or the zlib status of the first failing segment
+*/
+int par_inflate_verify(const Cpa8U *src, const struct flush_point *pts, uint32_t num_pts,
+        Cpa8U *out, uint64_t out_cap, uint64_t *out_size, uLong *crc)
+{
+    struct inflate_seg *segs;
+    uint64_t prev_cpr = 0;
+    uint64_t prev_src = 0;
+    int ret;
+
+    *out_size = 0;
+    *crc = crc32(0L, Z_NULL, 0);
+
+    if (num_pts == 0 || pts[num_pts - 1].src_off > out_cap) {
+        return Z_BUF_ERROR;
+    }
+
+    segs = (struct inflate_seg *)calloc(num_pts, sizeof(struct inflate_seg));
+    if (segs == NULL) {
+        struct inflate_seg whole = { 0 };
+
+        // The stream is still one valid deflate stream, so inflate it serially
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate %u inflate segments, verifying serially\n", num_pts);
+        whole.in = src;
+        whole.in_len = pts[num_pts - 1].cpr_off;
+        whole.out = out;
+        whole.out_cap = pts[num_pts - 1].src_off;
+        inflate_one(&whole);
+
+        *out_size = whole.produced;
+        *crc = whole.crc32;
+        return whole.status;
+    }
+
+    for (uint32_t i = 0; i < num_pts; i++)
+    {
+        segs[i].in = src + prev_cpr;
+        segs[i].in_len = pts[i].cpr_off - prev_cpr;
+        segs[i].out = out + prev_src;
+        segs[i].out_cap = pts[i].src_off - prev_src;
+
+        prev_cpr = pts[i].cpr_off;
+        prev_src = pts[i].src_off;
+    }
+
+    ret = par_inflate_segments(segs, num_pts);
+
+    for (uint32_t i = 0; i < num_pts; i++)
+    {
+        *crc = crc32_combine(*crc, segs[i].crc32, segs[i].produced);
+        *out_size += segs[i].produced;
+    }
+
+    free(segs);
+
+    return ret;
+}
+
+/*
+    Function:
+
+        par_inflate_stateless
+
+    Description:
+
+        General parallel decompressor for a stateless stream given only its flush
+        offsets. Segment sizes aren't known up front, so each inflates into its own
+        buffer and the results are concatenated in order
+
+    Parameters:
+
+        src         -   Compressed stream
+        cpr_offs    -   End offset of each segment in the compressed stream, in order
+        num_offs    -   Number of segments
+        out         -   Set to a malloc'd buffer with the decompressed stream
+        out_size    -   Total bytes inflated
+        crc         -   Combined CRC32 of the output
+
+    Return:
+
+        Z_OK, or the zlib status of the first failing segment
+*/
+int par_inflate_stateless(const Cpa8U *src, const uint64_t *cpr_offs, uint32_t num_offs,
+        Cpa8U **out, uint64_t *out_size, uLong *crc)
+{
+    struct inflate_seg *segs;
+    uint64_t prev = 0;
+    uint64_t pos = 0;
+    int ret;
+
+    *out = NULL;
+    *out_size = 0;
+    *crc = crc32(0L, Z_NULL, 0);
+
+    segs = (struct inflate_seg *)calloc(num_offs, sizeof(struct inflate_seg));
+    if (segs == NULL) {
+        struct inflate_seg whole = { 0 };
+
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate %u inflate segments, inflating serially\n", num_offs);
+        whole.in = src;
+        whole.in_len = num_offs ? cpr_offs[num_offs - 1] : 0;
+        inflate_one(&whole);
+
+        *out_size = whole.produced;
+        *crc = whole.crc32;
+        if (whole.status == Z_OK) {
+            *out = whole.out ? whole.out : (Cpa8U *)malloc(1);
+            if (*out == NULL) {
+                whole.status = Z_MEM_ERROR;
+            }
+        } else if (whole.owns_out) {
+            free(whole.out);
+        }
+        return whole.status;
+    }
+
+    for (uint32_t i = 0; i < num_offs; i++)
+    {
+        segs[i].in = src + prev;
+        segs[i].in_len = cpr_offs[i] - prev;
+        prev = cpr_offs[i];
+    }
+
+    ret = par_inflate_segments(segs, num_offs);
+
+    for (uint32_t i = 0; i < num_offs; i++)
+    {
+        *crc = crc32_combine(*crc, segs[i].crc32, segs[i].produced);
+        *out_size += segs[i].produced;
+    }
+
+    if (ret == Z_OK) {
+        *out = (Cpa8U *)malloc(*out_size ? *out_size : 1);
+        if (*out == NULL) {
+            ret = Z_MEM_ERROR;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_offs; i++)
+    {
+        if (ret == Z_OK) {
+            memcpy(*out + pos, segs[i].out, segs[i].produced);
+            pos += segs[i].produced;
+        }
+        if (segs[i].owns_out) {
+            free(segs[i].out);
+        }
+    }
+
+    free(segs);
+
+    return ret;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "cpa.h"
+#include "cpa_types.h"
+
+/*
+    Byte-aligned full-flush boundary after a stateless request: where it ended in the
+    compressed stream, and how much source had been consumed at that point
+*/
+struct flush_point {
+    uint64_t cpr_off;
+    uint64_t src_off;
+};
+
+struct inflate_seg {
+    const Cpa8U *in;
+    uint64_t in_len;
+    Cpa8U *out;
+    uint64_t out_cap;
+    bool owns_out;
+
+    uint64_t produced;
+    uLong crc32;
+    int status;
+};
+
+void par_inflate_pool_init(uint32_t workers);
+void par_inflate_pool_destroy();
+bool par_inflate_enabled();
+int par_inflate_segments(struct inflate_seg *segs, uint32_t num_segs);
+int par_inflate_verify(const Cpa8U *src, const struct flush_point *pts, uint32_t num_pts,
+        Cpa8U *out, uint64_t out_cap, uint64_t *out_size, uLong *crc);
+int par_inflate_stateless(const Cpa8U *src, const uint64_t *cpr_offs, uint32_t num_offs,
+        Cpa8U **out, uint64_t *out_size, uLong *crc);
@@ -0,0 +1,612 @@
+/*
+    Pipelined verification (--pipeline)
+
+    Serially, a context compresses the whole file and only then decompresses it, on the
+    same instance. Here its decompression session is on a second instance, preferably
+    on the same node, and pipeline_run starts a decompressor thread next to the
+    compression loop. meatjet_compress publishes how much output there is after every
+    request; the decompressor takes it 64KB at a time with the same SYNC requests the
+    serial verify would send, so the two instances work at once, and an encoder/decoder
+    mismatch between instances shows up as a failure. What is left, up to the FINAL
+    request, is decompressed by meatjet_verify on the worker once compression is done.
+
+    The summary gives the share of decompression that ran while compression was still
+    going, and the average context latency against the sum of the two halves, which is
+    what the context would take serially. --pipeline=measure runs contexts serially and
+    reports their latency alone, for comparison
+*/
+#include <time.h>
+#include "pipeline.h"
+#include "meatjet.h"
+#include "buf_handler.h"
+#include "credit.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+// The decompressor's SGLs, built once per worker and hung off its sgl container
+struct pipe_lane {
+    CpaBufferList *src_sgl;
+    CpaBufferList *dest_sgl;
+};
+
+// One context's run, shared by the worker and its decompressor under the mutex
+struct pipe_state {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct context *ctx;
+    struct pipe_lane *lane;
+    struct wd_binding wd;
+
+    // Compressed bytes the decompressor may read, and whether that is all of them
+    uint64_t published;
+    bool done;
+
+    // Decompressor's status, time spent in requests, and the part before compression ended
+    CpaStatus status;
+    uint64_t busy_ns;
+    uint64_t overlap_ns;
+};
+
+static struct {
+    bool enabled;
+    bool measure;
+    uint32_t num_inst;
+    uint32_t *node;
+
+    pthread_mutex_t mutex;
+    uint64_t ctxs;
+    uint64_t cross;
+    uint64_t same_node;
+    uint64_t lat_ns;
+    uint64_t cpr_ns;
+    uint64_t dcpr_ns;
+    uint64_t overlap_ns;
+} g_pipe;
+
+/*
+    Function:
+
+        pipeline_init
+
+    Description:
+
+        Sets up --pipeline and notes each instance's node, for picking a second instance
+        close to the first. Called once the instance list is final
+
+    Parameters:
+
+        opt -   Ptr to the options
+
+    Return:
+
+        0 on success, -1 on allocation failure
+*/
+int pipeline_init(struct mg_options *opt)
+{
+    memset(&g_pipe, 0, sizeof(g_pipe));
+    pthread_mutex_init(&g_pipe.mutex, NULL);
+
+    if (!opt->pipeline) {
+        return 0;
+    }
+
+    g_pipe.enabled = true;
+    g_pipe.measure = opt->pipeline_measure;
+    g_pipe.num_inst = numDcInstances_g;
+
+    g_pipe.node = (uint32_t *)calloc(g_pipe.num_inst, sizeof(uint32_t));
+    if (g_pipe.node == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the pipeline instance table\n");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < g_pipe.num_inst; i++)
+    {
+        CpaInstanceInfo2 info;
+
+        if (cpaDcInstanceGetInfo2(dcInstances_g[i], &info) == CPA_STATUS_SUCCESS) {
+            g_pipe.node[i] = info.nodeAffinity;
+        }
+    }
+
+    if (g_pipe.num_inst == 1 && !g_pipe.measure) {
+        MG_LOG_PRINT(g_log_fd, "Pipeline: only one instance, decompressing on the same one\n");
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        pipeline_enabled
+
+    Description:
+
+        Whether a context goes through pipeline_run: any context meatjet compresses and
+        verifies from memory. Decompression-only, streamed and small-input contexts keep
+        their own flows
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        true if it is pipelined, or timed as the baseline with measure
+*/
+bool pipeline_enabled(struct context *ctx)
+{
+    return g_pipe.enabled && !ctx->decomp_only && !ctx->pooled &&
+           ctx->src_data->backing != SRC_MEM_STREAMED;
+}
+
+/*
+    Function:
+
+        pipeline_peer
+
+    Description:
+
+        Chooses the instance a context's decompression session goes on and sets its
+        dcpr_inst: the next instance in service on the same node as its own, else the
+        next in service anywhere, else its own. Called by launch_ctx after health_pick
+
+    Parameters:
+
+        ctx -   Ptr to the context, whose inst is set
+
+    Return:
+
+        The instance
+*/
+uint32_t pipeline_peer(struct context *ctx)
+{
+    uint32_t peer = ctx->inst;
+
+    if (pipeline_enabled(ctx) && !g_pipe.measure) {
+        for (uint32_t k = 1; k < g_pipe.num_inst; k++)
+        {
+            uint32_t i = (ctx->inst + k) % g_pipe.num_inst;
+
+            if (!health_in_service(i)) {
+                continue;
+            }
+
+            if (g_pipe.node[i] == g_pipe.node[ctx->inst]) {
+                peer = i;
+                break;
+            }
+
+            if (peer == ctx->inst) {
+                peer = i;
+            }
+        }
+    }
+
+    ctx->dcpr_inst = peer;
+
+    return peer;
+}
+
+/*
+    Function:
+
+        pipeline_publish
+
+    Description:
+
+        Lets the context's decompressor read up to cpr_produced. Called by
+        meatjet_compress after every request; does nothing outside pipeline_run
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        none
+*/
+void pipeline_publish(struct context *ctx)
+{
+    struct pipe_state *p = ctx->pipe;
+
+    if (p == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    p->published = ctx->cpr_produced;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+/*
+    Function:
+
+        lane_get (static)
+
+    Description:
+
+        Returns the worker's decompressor SGLs, building them the first time. Their
+        metadata is sized for the largest instance, like init_sgl_mem
+
+    Parameters:
+
+        sgls    -   Ptr to the worker's sgl container
+
+    Return:
+
+        Ptr to the lane, or NULL on allocation failure
+*/
+static struct pipe_lane *lane_get(struct sgl_container *sgls)
+{
+    struct pipe_lane *lane;
+    uint32_t meta_size = 0;
+    uint32_t inst_meta;
+    CpaStatus status;
+
+    if (sgls->pipe) {
+        return sgls->pipe;
+    }
+
+    for (uint32_t i = 0; i < numDcInstances_g; i++)
+    {
+        cpaDcBufferListGetMetaSize(dcInstances_g[i], 1, &inst_meta);
+        if (inst_meta > meta_size) {
+            meta_size = inst_meta;
+        }
+    }
+
+    lane = (struct pipe_lane *)calloc(1, sizeof(struct pipe_lane));
+    if (lane == NULL) {
+        return NULL;
+    }
+
+    lane->src_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
+    lane->dest_sgl = (CpaBufferList *)calloc(1, sizeof(CpaBufferList));
+
+    status = (lane->src_sgl && lane->dest_sgl) ? CPA_STATUS_SUCCESS : CPA_STATUS_FAIL;
+    if (status == CPA_STATUS_SUCCESS) {
+        status = mg_build_sgl(lane->src_sgl, 0, 1, DEFAULT_BUF_SIZE, meta_size);
+    }
+    if (status == CPA_STATUS_SUCCESS) {
+        status = mg_build_sgl(lane->dest_sgl, 0, 1, DEFAULT_BUF_SIZE, meta_size);
+    }
+
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the pipeline decompressor SGLs\n");
+        pipeline_lane_free(lane);
+        return NULL;
+    }
+
+    sgls->pipe = lane;
+
+    return lane;
+}
+
+/*
+    Function:
+
+        pipeline_lane_free
+
+    Description:
+
+        Frees a worker's decompressor SGLs. Called from free_sgls
+
+    Parameters:
+
+        lane    -   Ptr to the lane, or NULL
+
+    Return:
+
+        none
+*/
+void pipeline_lane_free(struct pipe_lane *lane)
+{
+    if (lane == NULL) {
+        return;
+    }
+
+    if (lane->src_sgl) {
+        mg_free_sgl(lane->src_sgl);
+        free(lane->src_sgl);
+    }
+    if (lane->dest_sgl) {
+        mg_free_sgl(lane->dest_sgl);
+        free(lane->dest_sgl);
+    }
+
+    free(lane);
+}
+
+/*
+    Function:
+
+        decompressor (static)
+
+    Description:
+
+        Decompressor thread body. Sends a SYNC request whenever more than 64KB of
+        compressed output is waiting, which is exactly when the serial verify loop would,
+        and returns once compression is done and no more than that is left
+
+    Parameters:
+
+        arg -   Ptr to the pipe state
+
+    Return:
+
+        none
+*/
+static void *decompressor(void *arg)
+{
+    struct pipe_state *p = (struct pipe_state *)arg;
+    struct context *ctx = p->ctx;
+    CpaBufferList *src_sgl = p->lane->src_sgl;
+    CpaBufferList *dest_sgl = p->lane->dest_sgl;
+    Cpa32U iNum = ctx->dcpr_inst;
+    CpaStatus status;
+    Cpa32U data_copied;
+    uint64_t start;
+    bool during;
+
+    // Requests stamp the worker running the context
+    wd_adopt(p->wd);
+
+    pthread_mutex_lock(&p->mutex);
+
+    for (;;)
+    {
+        while (!p->done && (p->published - ctx->dcpr_consumed) <= DEFAULT_BUF_SIZE)
+        {
+            pthread_cond_wait(&p->cond, &p->mutex);
+        }
+
+        // The rest, FINAL request included, is meatjet_verify's
+        if ((p->published - ctx->dcpr_consumed) <= DEFAULT_BUF_SIZE) {
+            break;
+        }
+
+        during = !p->done;
+        pthread_mutex_unlock(&p->mutex);
+
+        start = now_ns();
+
+        data_copied = copy_mem_to_sgl(ctx->dest_mem + ctx->dcpr_consumed, src_sgl, DEFAULT_BUF_SIZE, DEFAULT_BUF_SIZE);
+        if (data_copied != DEFAULT_BUF_SIZE) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from dest mem to source SGL\n");
+            status = CPA_STATUS_FAIL;
+        } else {
+            credit_acquire(iNum);
+            do {
+                status = cpaDcDecompressData(dcInstances_g[iNum],
+                                             ctx->sessDcprHandle,
+                                             src_sgl,
+                                             dest_sgl,
+                                             &(ctx->dcpr_results),
+                                             CPA_DC_FLUSH_SYNC,
+                                             NULL);
+            } while (credit_retry(iNum, status));
+            credit_release(iNum);
+            health_record(iNum, ctx, status, ctx->dcpr_results.status);
+
+            if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->dcpr_results.status) {
+                MG_LOG_PRINT(g_log_fd, "Error: decompression failed with status %d (pipelined, instance %u)\n",
+                        ctx->dcpr_results.status, iNum);
+                if (status == CPA_STATUS_SUCCESS) {
+                    status = CPA_STATUS_FAIL;
+                }
+            } else {
+                status = CPA_STATUS_SUCCESS;
+            }
+        }
+
+        if (status == CPA_STATUS_SUCCESS) {
+            data_copied = copy_sgl_to_mem(dest_sgl, ctx->compare_mem + ctx->dcpr_produced,
+                                          DEFAULT_BUF_SIZE, ctx->dcpr_results.produced);
+            if (data_copied != ctx->dcpr_results.produced) {
+                MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from dest SGL to compare buffer\n");
+                status = CPA_STATUS_FAIL;
+            }
+        }
+
+        if (status == CPA_STATUS_SUCCESS) {
+            ctx->dcpr_consumed += ctx->dcpr_results.consumed;
+            ctx->dcpr_produced += ctx->dcpr_results.produced;
+
+            if (CPA_DC_OVERFLOW == ctx->dcpr_results.status) {
+                dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
+            }
+        }
+
+        pthread_mutex_lock(&p->mutex);
+
+        p->busy_ns += now_ns() - start;
+        if (during) {
+            p->overlap_ns += now_ns() - start;
+        }
+
+        if (status != CPA_STATUS_SUCCESS) {
+            p->status = status;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        add_stats (static)
+
+    Description:
+
+        Adds a context's timings to the totals
+
+    Parameters:
+
+        ctx         -   Ptr to the context
+        lat_ns      -   End to end
+        cpr_ns      -   Compressing
+        dcpr_ns     -   Decompressing and comparing, on both threads
+        overlap_ns  -   Part of dcpr_ns spent while compression ran
+
+    Return:
+
+        none
+*/
+static void add_stats(struct context *ctx, uint64_t lat_ns, uint64_t cpr_ns, uint64_t dcpr_ns, uint64_t overlap_ns)
+{
+    pthread_mutex_lock(&g_pipe.mutex);
+    g_pipe.ctxs++;
+    if (ctx->dcpr_inst != ctx->inst) {
+        g_pipe.cross++;
+        g_pipe.same_node += g_pipe.node[ctx->dcpr_inst] == g_pipe.node[ctx->inst];
+    }
+    g_pipe.lat_ns += lat_ns;
+    g_pipe.cpr_ns += cpr_ns;
+    g_pipe.dcpr_ns += dcpr_ns;
+    g_pipe.overlap_ns += overlap_ns;
+    pthread_mutex_unlock(&g_pipe.mutex);
+}
+
+/*
+    Function:
+
+        pipeline_run
+
+    Description:
+
+        meatjet() for a pipelined context: compresses with a decompressor thread
+        following on the context's second instance, then finishes and checks the
+        decompression with meatjet_verify. With measure, runs the two halves one after
+        the other and only times them
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the worker's sgl container
+
+    Return:
+
+        Status of the compress/decompress
+*/
+CpaStatus pipeline_run(struct context *ctx, struct sgl_container *sgls)
+{
+    struct pipe_state p = {};
+    CpaStatus status;
+    pthread_t thread;
+    bool threaded = false;
+    uint64_t start;
+    uint64_t cpr_end;
+    uint64_t end;
+
+    start = now_ns();
+
+    p.lane = g_pipe.measure ? NULL : lane_get(sgls);
+
+    // Serially, for the baseline or if there are no SGLs for the decompressor
+    if (p.lane == NULL) {
+        status = meatjet_compress(ctx, sgls);
+        cpr_end = now_ns();
+        status = meatjet_verify(ctx, sgls, status);
+        end = now_ns();
+
+        add_stats(ctx, end - start, cpr_end - start, end - cpr_end, 0);
+
+        return status;
+    }
+
+    pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    p.ctx = ctx;
+    p.wd = wd_current();
+    p.status = CPA_STATUS_SUCCESS;
+
+    ctx->pipe = &p;
+
+    if (pthread_create(&thread, NULL, decompressor, &p) == 0) {
+        threaded = true;
+    } else {
+        MG_LOG_PRINT(g_log_fd, "Pipeline: could not start a decompressor for ctx %lu, verifying after\n", ctx->id);
+    }
+
+    status = meatjet_compress(ctx, sgls);
+    cpr_end = now_ns();
+
+    pthread_mutex_lock(&p.mutex);
+    p.published = ctx->cpr_produced;
+    p.done = true;
+    pthread_cond_signal(&p.cond);
+    pthread_mutex_unlock(&p.mutex);
+
+    if (threaded) {
+        pthread_join(thread, NULL);
+    }
+
+    ctx->pipe = NULL;
+
+    if (p.status != CPA_STATUS_SUCCESS) {
+        status = meatjet_check(ctx, p.status);
+    } else {
+        status = meatjet_verify(ctx, sgls, status);
+    }
+    end = now_ns();
+
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.mutex);
+
+    add_stats(ctx, end - start, cpr_end - start, p.busy_ns + (end - cpr_end), p.overlap_ns);
+
+    return status;
+}
+
+/*
+    Function:
+
+        pipeline_print_stats
+
+    Description:
+
+        Prints where pipelined contexts were decompressed, how much of the decompression
+        overlapped compression, and their latency against running the halves serially
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void pipeline_print_stats()
+{
+    double n;
+
+    if (g_pipe.ctxs == 0) {
+        return;
+    }
+
+    n = (double)g_pipe.ctxs * 1e6;
+
+    if (g_pipe.measure) {
+        MG_LOG_PRINT(g_log_fd, "    Pipeline baseline (serial): %lu context(s), %.3f ms average latency "
+                "(%.3f ms compressing, %.3f ms verifying)\n\n",
+                g_pipe.ctxs, g_pipe.lat_ns / n, g_pipe.cpr_ns / n, g_pipe.dcpr_ns / n);
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Pipelined: %lu context(s), %lu decompressed on a second instance (%lu on the same node)\n",
+            g_pipe.ctxs, g_pipe.cross, g_pipe.same_node);
+    MG_LOG_PRINT(g_log_fd, "        %.1f%% of decompression overlapped compression, %.3f ms average latency "
+            "against %.3f ms serially (%.3f ms compressing + %.3f ms verifying)\n\n",
+            g_pipe.dcpr_ns ? 100.0 * g_pipe.overlap_ns / g_pipe.dcpr_ns : 0.0, g_pipe.lat_ns / n,
+            (g_pipe.cpr_ns + g_pipe.dcpr_ns) / n, g_pipe.cpr_ns / n, g_pipe.dcpr_ns / n);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+    Pipelined verification (--pipeline). A context's decompression session is set up on a
+    second instance, on the same node if there is one, and a decompressor thread follows
+    the compression: each 64KB of compressed output is decompressed as soon as it is
+    produced, while the next compression request is in flight. The decompressor sends the
+    same requests the serial verify would, only the FINAL one is left for meatjet_verify
+    once compression is done. --pipeline=measure runs contexts serially and only reports
+    their latency, as a baseline
+*/
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+#include "watchdog.h"
+
+struct pipe_lane;
+
+int pipeline_init(struct mg_options *opt);
+bool pipeline_enabled(struct context *ctx);
+uint32_t pipeline_peer(struct context *ctx);
+void pipeline_publish(struct context *ctx);
+CpaStatus pipeline_run(struct context *ctx, struct sgl_container *sgls);
+void pipeline_lane_free(struct pipe_lane *lane);
+void pipeline_print_stats();
@@ -0,0 +1,422 @@
+#include <zlib.h>
+#include "prefix_cache.h"
+#include "chunk_engine.h"
+#include "buf_handler.h"
+#include "watchdog.h"
+
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    uint64_t builds;
+    uint64_t build_bytes;
+    uint64_t splices;
+    uint64_t spliced_bytes;
+    uint64_t tail_bytes;
+} g_prefix_stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0 };
+
+/*
+    Function:
+
+        prefix_cache_create
+
+    Description:
+
+        Allocates an empty cache for one source file. Entries are built lazily by the
+        first context that needs each (level, huffman) key
+
+    Parameters:
+
+        none
+
+    Return:
+
+        Ptr to the new cache, or NULL (the file then runs without one)
+*/
+struct prefix_cache *prefix_cache_create()
+{
+    struct prefix_cache *cache;
+
+    cache = (struct prefix_cache *)calloc(1, sizeof(struct prefix_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&(cache->cache_mutex), NULL);
+    pthread_cond_init(&(cache->cache_cond), NULL);
+
+    return cache;
+}
+
+/*
+    Function:
+
+        free_entry (static)
+
+    Description:
+
+        Frees an entry and its buffers
+
+    Parameters:
+
+        ent -   Ptr to the entry
+
+    Return:
+
+        none
+*/
+static void free_entry(struct prefix_entry *ent)
+{
+    free(ent->data);
+    free(ent->offset);
+    free(ent->crc32);
+    free(ent);
+}
+
+/*
+    Function:
+
+        prefix_cache_free
+
+    Description:
+
+        Frees every entry of a file's cache. Called once the file's ref count hits zero
+
+    Parameters:
+
+        cache   -   Ptr to the cache, may be NULL
+
+    Return:
+
+        none
+*/
+void prefix_cache_free(struct prefix_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    for (int l = 0; l < PREFIX_CACHE_LEVELS; l++)
+    {
+        for (int h = 0; h < PREFIX_CACHE_HUFF_TYPES; h++)
+        {
+            struct prefix_entry *ent = cache->entries[l][h];
+
+            if (ent == NULL) {
+                continue;
+            }
+
+            free_entry(ent);
+        }
+    }
+
+    pthread_mutex_destroy(&(cache->cache_mutex));
+    pthread_cond_destroy(&(cache->cache_cond));
+    free(cache);
+}
+
+bool prefix_cache_enabled(struct context *ctx)
+{
+    return !ctx->decomp_only &&
+            ctx->src_data->prefix_cache != NULL &&
+            CPA_DC_STATELESS == ctx->sessCprSetupData.sessState;
+}
+
+/*
+    Function:
+
+        accept_into_cache (static)
+
+    Description:
+
+        chunk_engine callback, appends each completed chunk to the entry in order
+
+    Parameters:
+
+        slot    -   Completed chunk
+        chunk   -   Chunk index
+        stop    -   Unused, the whole prefix is always cached
+        arg     -   Ptr to the prefix_entry being built
+
+    Return:
+
+        CPA_STATUS_FAIL if the data buffer could not grow, otherwise CPA_STATUS_SUCCESS
+*/
+static CpaStatus accept_into_cache(struct chunk_slot *slot, uint64_t chunk, bool *stop, void *arg)
+{
+    struct prefix_entry *ent = (struct prefix_entry *)arg;
+    uint64_t end;
+
+    (void)stop;
+
+    end = ent->offset[chunk] + slot->produced;
+
+    if (end > ent->data_size) {
+        Cpa8U *tmp;
+        uint64_t new_size = ent->data_size * 2;
+
+        if (new_size < end) {
+            new_size = end;
+        }
+
+        tmp = (Cpa8U *)realloc(ent->data, new_size);
+        if (tmp == NULL) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not grow prefix cache to %lu bytes\n", new_size);
+            return CPA_STATUS_FAIL;
+        }
+
+        ent->data = tmp;
+        ent->data_size = new_size;
+    }
+
+    memcpy(ent->data + ent->offset[chunk], slot->out, slot->produced);
+
+    ent->offset[chunk + 1] = end;
+    ent->crc32[chunk + 1] = crc32_combine(ent->crc32[chunk], slot->crc32, slot->len);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        get_entry (static)
+
+    Description:
+
+        Returns the entry for the context's (level, huffman) key, building it first if
+        this is the first context to ask. Everyone else asking for the same key waits
+        for the builder rather than compressing the file again. A failed build is taken
+        out of the cache before its waiters wake, so the next of them builds it again
+        instead of every later context failing on it
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the thread's sgl container (for the chunk engine)
+        out     -   Set to the ready entry, or NULL if there is none to splice from
+
+    Return:
+
+        Status of this context's own build, CPA_STATUS_SUCCESS if it didn't run one or
+        if no entry could be allocated (*out is NULL then, and it compresses serially)
+*/
+static CpaStatus get_entry(struct context *ctx, struct sgl_container *sgls, struct prefix_entry **out)
+{
+    struct prefix_cache *cache = ctx->src_data->prefix_cache;
+    struct prefix_entry *ent;
+    Cpa32U lvl = ctx->sessCprSetupData.compLevel;
+    Cpa32U huff = ctx->sessCprSetupData.huffType;
+    CpaStatus status;
+
+    *out = NULL;
+
+    pthread_mutex_lock(&(cache->cache_mutex));
+
+    while ((ent = cache->entries[lvl][huff]) != NULL)
+    {
+        // The builder's requests are on its own slot; waiting for them isn't a stall of ours
+        ent->waiters++;
+        wd_wait_begin();
+        while (!ent->ready) {
+            pthread_cond_wait(&(cache->cache_cond), &(cache->cache_mutex));
+        }
+        wd_wait_end();
+        ent->waiters--;
+
+        if (ent->status == CPA_STATUS_SUCCESS) {
+            pthread_mutex_unlock(&(cache->cache_mutex));
+            *out = ent;
+            return CPA_STATUS_SUCCESS;
+        }
+
+        // Already unlinked by its builder: try the key again
+        if (ent->waiters == 0) {
+            free_entry(ent);
+        }
+    }
+
+    ent = (struct prefix_entry *)calloc(1, sizeof(struct prefix_entry));
+    if (ent == NULL) {
+        pthread_mutex_unlock(&(cache->cache_mutex));
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate prefix cache for [%s], compressing it serially\n",
+                ctx->src_data->filename);
+        return CPA_STATUS_SUCCESS;
+    }
+    cache->entries[lvl][huff] = ent;
+
+    pthread_mutex_unlock(&(cache->cache_mutex));
+
+    ent->num_chunks = calculate_num_buf(ctx->src_data->file_size, DEFAULT_BUF_SIZE);
+    ent->cached = ent->num_chunks ? ent->num_chunks - 1 : 0;
+    ent->offset = (uint64_t *)calloc(ent->num_chunks + 1, sizeof(uint64_t));
+    ent->crc32 = (Cpa32U *)calloc(ent->num_chunks + 1, sizeof(Cpa32U));
+    ent->data_size = ctx->src_data->file_size ? ctx->src_data->file_size : 1;
+    ent->data = (Cpa8U *)malloc(ent->data_size);
+
+    if (ent->offset == NULL || ent->crc32 == NULL || ent->data == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate prefix cache for [%s]\n", ctx->src_data->filename);
+        status = CPA_STATUS_FAIL;
+    } else {
+        status = chunk_engine_compress(ctx, sgls, ent->cached, accept_into_cache, ent);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "Prefix cache: level %u %s for [%s], %lu of %lu chunks -> %lu bytes (status %d)\n",
+            lvl, huff == CPA_DC_HT_STATIC ? "STATIC" : "DYNAMIC", ctx->src_data->filename,
+            ent->cached, ent->num_chunks, ent->offset ? ent->offset[ent->cached] : 0, status);
+
+    pthread_mutex_lock(&g_prefix_stats.mutex);
+    g_prefix_stats.builds++;
+    g_prefix_stats.build_bytes += ctx->src_data->file_size;
+    pthread_mutex_unlock(&g_prefix_stats.mutex);
+
+    pthread_mutex_lock(&(cache->cache_mutex));
+    ent->status = status;
+    ent->ready = true;
+    if (status != CPA_STATUS_SUCCESS) {
+        cache->entries[lvl][huff] = NULL;
+    }
+    pthread_cond_broadcast(&(cache->cache_cond));
+
+    // A failed entry is freed by whoever looks at it last
+    if (status != CPA_STATUS_SUCCESS) {
+        if (ent->waiters == 0) {
+            free_entry(ent);
+        }
+        pthread_mutex_unlock(&(cache->cache_mutex));
+        return status;
+    }
+    pthread_mutex_unlock(&(cache->cache_mutex));
+
+    *out = ent;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        prefix_cache_splice
+
+    Description:
+
+        Splices the cached stateless output of every chunk ahead of the context's target
+        bucket into dest_mem, and leaves the byte counts and seeded CRC where the serial
+        loop in meatjet() expects to pick up. Only the target bucket onward is then
+        actually submitted for this sweep point, and that always includes the final
+        chunk, so every context still ends its stream with its own FLUSH_FINAL request.
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the thread's sgl container
+
+    Return:
+
+        Status of the cache build, CPA_STATUS_SUCCESS if it was already cached or the
+        context compresses serially for want of memory
+*/
+CpaStatus prefix_cache_splice(struct context *ctx, struct sgl_container *sgls)
+{
+    struct prefix_entry *ent;
+    uint64_t target;
+    CpaStatus status;
+
+    status = get_entry(ctx, sgls, &ent);
+    if (status != CPA_STATUS_SUCCESS || ent == NULL) {
+        return status;
+    }
+
+    if (ctx->underflow) {
+        target = chunk_target_bucket(ctx);
+        if (target > ent->cached) {
+            target = ent->cached;
+        }
+    } else {
+        // First chunk whose produced offset puts it in the OBS bucket
+        uint64_t lo = 0;
+        uint64_t hi = ent->cached;
+
+        while (lo < hi)
+        {
+            uint64_t mid = lo + ((hi - lo) / 2);
+
+            if ((ent->offset[mid] + CHUNK_BOUND) >= ctx->obs) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+
+        target = lo;
+    }
+
+    if (ent->offset[target] > ctx->mem_size) {
+        MG_LOG_PRINT(g_log_fd, "Error: prefix cache output exceeds dest_mem [%s]\n", ctx->src_data->filename);
+        return CPA_STATUS_FAIL;
+    }
+
+    memcpy(ctx->dest_mem, ent->data, ent->offset[target]);
+
+    if (target == 0) {
+        ctx->cpr_consumed = 0;
+    } else {
+        memset(&(ctx->cpr_results), 0, sizeof(CpaDcRqResults));
+        ctx->cpr_results.status = CPA_DC_OK;
+        ctx->cpr_consumed = target * DEFAULT_BUF_SIZE;
+    }
+
+    if (target) {
+        ctx->cpr_results.checksum = ent->crc32[target];
+        ctx->cpr_produced = ent->offset[target];
+    }
+
+    for (uint64_t k = 1; k <= target; k++)
+    {
+        uint64_t src_off = k * DEFAULT_BUF_SIZE;
+
+        ctx_add_flush_point(ctx, ent->offset[k], src_off < ctx->src_data->file_size ? src_off : ctx->src_data->file_size);
+    }
+
+    pthread_mutex_lock(&g_prefix_stats.mutex);
+    g_prefix_stats.splices++;
+    g_prefix_stats.spliced_bytes += ctx->cpr_consumed;
+    g_prefix_stats.tail_bytes += ctx->src_data->file_size - ctx->cpr_consumed;
+    pthread_mutex_unlock(&g_prefix_stats.mutex);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        prefix_cache_print_stats
+
+    Description:
+
+        Appends prefix reuse numbers to the summary, if the cache was used at all
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void prefix_cache_print_stats()
+{
+    uint64_t total;
+
+    if (g_prefix_stats.builds == 0) {
+        return;
+    }
+
+    total = g_prefix_stats.spliced_bytes + g_prefix_stats.tail_bytes;
+
+    MG_LOG_PRINT(g_log_fd, "    Prefix Reuse: %lu keys built (%lu source bytes)\n",
+            g_prefix_stats.builds, g_prefix_stats.build_bytes);
+    MG_LOG_PRINT(g_log_fd, "        Splices:   %lu\n", g_prefix_stats.splices);
+    MG_LOG_PRINT(g_log_fd, "        Reused:    %lu source bytes (%.2f%% of sweep compression)\n\n",
+            g_prefix_stats.spliced_bytes, total ? (g_prefix_stats.spliced_bytes * 100.0) / total : 0.0);
+}
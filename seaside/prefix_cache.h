@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+
+#define PREFIX_CACHE_LEVELS     (10)
+#define PREFIX_CACHE_HUFF_TYPES (3)
+
+/*
+    Stateless per-chunk results for one (level, huffman) key of a file. Chunk k's
+    compressed output lives at data[offset[k]..offset[k+1]), and crc32[k] is the CRC
+    of the source up to the start of chunk k
+*/
+struct prefix_entry {
+    bool ready;
+    CpaStatus status;
+    uint64_t num_chunks;
+
+    // Contexts waiting for the build; the last one out frees an entry whose build failed
+    uint32_t waiters;
+
+    // Chunks cached: all but the final one, which every context submits itself
+    uint64_t cached;
+
+    Cpa8U *data;
+    uint64_t data_size;
+    uint64_t *offset;
+    Cpa32U *crc32;
+};
+
+struct prefix_cache {
+    pthread_mutex_t cache_mutex;
+    pthread_cond_t cache_cond;
+    struct prefix_entry *entries[PREFIX_CACHE_LEVELS][PREFIX_CACHE_HUFF_TYPES];
+};
+
+struct prefix_cache *prefix_cache_create();
+void prefix_cache_free(struct prefix_cache *cache);
+bool prefix_cache_enabled(struct context *ctx);
+CpaStatus prefix_cache_splice(struct context *ctx, struct sgl_container *sgls);
+void prefix_cache_print_stats();
@@ -0,0 +1,369 @@
+#include "readahead.h"
+#include "stream.h"
+
+extern FILE *g_log_fd;
+
+/*
+    Files are handed to the producer strictly in list order. Loaders claim the next
+    file only while fewer than depth files sit loaded (or loading) ahead of the
+    producer, and while the bytes held stay under the cap. A file is held from its
+    load until its last context frees it, not just until the producer takes it. A
+    file bigger than the cap on its own is still loaded once nothing else is held, or
+    it would never run. A file --stream won't load holds nothing
+*/
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    struct mg_options *opt;
+    struct file_list *list;
+    int num_files;
+    readahead_load_fn load;
+
+    struct src_data **slots;
+    bool *ready;
+    int next_load;
+    int taken;
+    uint64_t held;
+    uint64_t cap;
+    uint32_t depth;
+    uint32_t num_loaders;
+    pthread_t loaders[READAHEAD_MAX_LOADERS];
+
+    // Stats
+    uint64_t start_ns;
+    uint64_t last_get_ns;
+    uint64_t wait_ns;
+    uint64_t busy_ns;
+    uint64_t load_ns;
+    uint64_t waits;
+    uint64_t cap_stalls;
+    uint64_t peak_held;
+} g_ra;
+
+/*
+    Function:
+
+        held_size (static)
+
+    Description:
+
+        Bytes a list entry holds once loaded
+
+    Parameters:
+
+        idx -   Index into the file list
+
+    Return:
+
+        The file size, or 0 for a streamed file. Generated entries are
+        always built in memory, so they hold their full size.
+*/
+static uint64_t held_size(int idx)
+{
+    uint64_t size = g_ra.list->sizes[idx];
+
+    if (g_ra.list->gen) {
+        return size;
+    }
+
+    return stream_wanted(g_ra.opt, size) ? 0 : size;
+}
+
+/*
+    Function:
+
+        loader_entry (static)
+
+    Description:
+
+        Read-ahead thread: claims the next file in list order when the depth and the
+        memory cap allow, loads it, and publishes it in its slot
+
+    Parameters:
+
+        arg -   unused
+
+    Return:
+
+        none
+*/
+static void *loader_entry(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&g_ra.mutex);
+
+    while (g_ra.next_load < g_ra.num_files)
+    {
+        struct src_data *src;
+        uint64_t size;
+        uint64_t start;
+        int idx;
+
+        size = held_size(g_ra.next_load);
+
+        if ((uint32_t)(g_ra.next_load - g_ra.taken) >= g_ra.depth) {
+            pthread_cond_wait(&g_ra.cond, &g_ra.mutex);
+            continue;
+        }
+
+        if (g_ra.held && g_ra.held + size > g_ra.cap) {
+            g_ra.cap_stalls++;
+            pthread_cond_wait(&g_ra.cond, &g_ra.mutex);
+            continue;
+        }
+
+        idx = g_ra.next_load++;
+        g_ra.held += size;
+        if (g_ra.held > g_ra.peak_held) {
+            g_ra.peak_held = g_ra.held;
+        }
+
+        pthread_mutex_unlock(&g_ra.mutex);
+
+        start = now_ns();
+        src = g_ra.load(g_ra.list, idx, g_ra.opt);
+
+        pthread_mutex_lock(&g_ra.mutex);
+
+        g_ra.load_ns += now_ns() - start;
+        g_ra.slots[idx] = src;
+        g_ra.ready[idx] = true;
+        pthread_cond_broadcast(&g_ra.cond);
+    }
+
+    pthread_mutex_unlock(&g_ra.mutex);
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        readahead_start
+
+    Description:
+
+        Sets up loading of the file list. With --readahead K, up to K files are loaded
+        by background threads while the producer builds contexts for the current one.
+        Without it, readahead_get() loads each file inline as before, but the time is
+        still accounted so the two can be compared
+
+    Parameters:
+
+        opt         -   Ptr to the command line options struct
+        list        -   Files in the order they will be requested
+        load        -   Loads one file of the list into a src_data
+
+    Return:
+
+        none
+*/
+void readahead_start(struct mg_options *opt, struct file_list *list, readahead_load_fn load)
+{
+    pthread_mutex_init(&g_ra.mutex, NULL);
+    pthread_cond_init(&g_ra.cond, NULL);
+
+    g_ra.opt = opt;
+    g_ra.list = list;
+    g_ra.num_files = list->num_files;
+    g_ra.load = load;
+    g_ra.depth = opt->readahead;
+    g_ra.cap = (uint64_t)opt->readahead_mem << 20;
+    g_ra.slots = (struct src_data **)calloc(g_ra.num_files, sizeof(struct src_data *));
+    g_ra.ready = (bool *)calloc(g_ra.num_files, sizeof(bool));
+    g_ra.start_ns = g_ra.last_get_ns = now_ns();
+
+    if (g_ra.depth == 0) {
+        return;
+    }
+
+    g_ra.num_loaders = (g_ra.depth < READAHEAD_MAX_LOADERS) ? g_ra.depth : READAHEAD_MAX_LOADERS;
+
+    for (uint32_t i = 0; i < g_ra.num_loaders; i++)
+    {
+        if (pthread_create(&g_ra.loaders[i], NULL, loader_entry, NULL) != 0) {
+            MG_LOG_PRINT(g_log_fd, "Read-ahead: could only start %u loader(s)\n", i);
+            g_ra.num_loaders = i;
+            break;
+        }
+    }
+
+    // Without any loader, fall back to loading inline
+    if (g_ra.num_loaders == 0) {
+        g_ra.depth = 0;
+    }
+}
+
+/*
+    Function:
+
+        readahead_get
+
+    Description:
+
+        Returns file idx of the list, waiting for its load if it isn't ready yet.
+        Files must be requested in order. Time spent here is time the producer
+        (and so, once the queue drains, the accelerator) waited on I/O
+
+    Parameters:
+
+        idx -   Index into the file list
+
+    Return:
+
+        Ptr to the loaded src_data, NULL if the load failed
+*/
+struct src_data *readahead_get(int idx)
+{
+    struct src_data *src;
+    uint64_t start = now_ns();
+
+    pthread_mutex_lock(&g_ra.mutex);
+
+    g_ra.busy_ns += start - g_ra.last_get_ns;
+
+    if (g_ra.depth == 0) {
+        pthread_mutex_unlock(&g_ra.mutex);
+        src = g_ra.load(g_ra.list, idx, g_ra.opt);
+        pthread_mutex_lock(&g_ra.mutex);
+
+        g_ra.load_ns += now_ns() - start;
+        g_ra.waits++;
+    } else {
+        if (!g_ra.ready[idx]) {
+            g_ra.waits++;
+        }
+
+        while (!g_ra.ready[idx])
+        {
+            pthread_cond_wait(&g_ra.cond, &g_ra.mutex);
+        }
+
+        // Held until free_src_mem releases it, or now if the load failed
+        src = g_ra.slots[idx];
+        if (src) {
+            src->ra_held = held_size(idx);
+        } else {
+            g_ra.held -= held_size(idx);
+        }
+        g_ra.taken = idx + 1;
+        pthread_cond_broadcast(&g_ra.cond);
+    }
+
+    g_ra.last_get_ns = now_ns();
+    g_ra.wait_ns += g_ra.last_get_ns - start;
+
+    pthread_mutex_unlock(&g_ra.mutex);
+
+    return src;
+}
+
+/*
+    Function:
+
+        readahead_release
+
+    Description:
+
+        Takes a file's bytes off the cap once its memory is freed, letting the loaders
+        go on. Called from free_src_mem, also after readahead_stop
+
+    Parameters:
+
+        src -   Ptr to the src_data being freed
+
+    Return:
+
+        none
+*/
+void readahead_release(struct src_data *src)
+{
+    if (src->ra_held == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_ra.mutex);
+    g_ra.held -= src->ra_held;
+    src->ra_held = 0;
+    pthread_cond_broadcast(&g_ra.cond);
+    pthread_mutex_unlock(&g_ra.mutex);
+}
+
+/*
+    Function:
+
+        readahead_stop
+
+    Description:
+
+        Joins the loaders once the producer has taken every file, and frees the slots
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void readahead_stop()
+{
+    pthread_mutex_lock(&g_ra.mutex);
+    g_ra.busy_ns += now_ns() - g_ra.last_get_ns;
+    g_ra.last_get_ns = now_ns();
+    pthread_mutex_unlock(&g_ra.mutex);
+
+    for (uint32_t i = 0; i < g_ra.num_loaders; i++)
+    {
+        pthread_join(g_ra.loaders[i], NULL);
+    }
+
+    free(g_ra.slots);
+    free(g_ra.ready);
+    g_ra.slots = NULL;
+    g_ra.ready = NULL;
+
+    // The mutex stays: the files still running release their bytes through it
+}
+
+/*
+    Function:
+
+        readahead_print_stats
+
+    Description:
+
+        Prints how long the producer spent waiting on file loads versus building and
+        queueing contexts
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void readahead_print_stats()
+{
+    uint64_t total = g_ra.wait_ns + g_ra.busy_ns;
+
+    if (g_ra.opt == NULL || total == 0) {
+        return;
+    }
+
+    if (g_ra.depth) {
+        MG_LOG_PRINT(g_log_fd, "    Read-ahead: depth %u, cap %u MB, %u loader(s)\n",
+                g_ra.depth, g_ra.opt->readahead_mem, g_ra.num_loaders);
+        MG_LOG_PRINT(g_log_fd, "        peak %.2f MB held (loaded and not yet freed), %lu stall(s) on the cap\n",
+                g_ra.peak_held / (1024.0 * 1024.0), g_ra.cap_stalls);
+    } else {
+        MG_LOG_PRINT(g_log_fd, "    Read-ahead: off, files loaded inline\n");
+    }
+
+    MG_LOG_PRINT(g_log_fd, "        producer: %.3f s waiting on I/O (%lu file(s)), %.3f s building and queueing contexts (%.1f%% I/O)\n",
+            g_ra.wait_ns / 1e9, g_ra.waits, g_ra.busy_ns / 1e9, (100.0 * g_ra.wait_ns) / total);
+    MG_LOG_PRINT(g_log_fd, "        %.3f s spent loading in total\n\n", g_ra.load_ns / 1e9);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "dir_scan.h"
+
+#define READAHEAD_MAX_LOADERS   (8)
+
+typedef struct src_data *(*readahead_load_fn)(struct file_list *list, uint32_t idx, struct mg_options *opts);
+
+void readahead_start(struct mg_options *opt, struct file_list *list, readahead_load_fn load);
+struct src_data *readahead_get(int idx);
+void readahead_release(struct src_data *src);
+void readahead_stop();
+void readahead_print_stats();
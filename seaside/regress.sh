@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Regression runs for defects that only showed up at runtime. The cases emulate
+# their instances with --sw-instances, so the binary must be built with the
+# software DC backend (MG_SW_DC). Inputs are generated, nothing is read from disk
+#
+#   ./regress.sh [path to meatjet]
+#
+# Prints PASS/FAIL per case, and exits non-zero if any case failed
+#
+
+MEATJET=${1:-./meatjet}
+INPUT="--input-gen random:538624@1"
+LOG=$(mktemp)
+FAILED=0
+
+if [[ ! -x "$MEATJET" ]]; then
+    echo "No meatjet binary at [$MEATJET]"
+    exit 1
+fi
+
+trap 'rm -f "$LOG"' EXIT
+
+# Run a case: name, then the meatjet options. Leaves the output in $LOG and the exit status in $RC
+run_case() {
+    CASE=$1
+    shift
+    timeout 300 "$MEATJET" $INPUT "$@" > "$LOG" 2>&1
+    RC=$?
+}
+
+report() {
+    if [[ -z "$1" ]]; then
+        echo "[PASS] $CASE"
+    else
+        echo "[FAIL] $CASE: $1"
+        FAILED=1
+    fi
+}
+
+#
+# The chunk engine's lanes must leave the final chunk to the context's own session.
+# 538624 bytes is 9 chunks, so the lanes send 8 of them
+#
+run_case "chunk engine leaves the final chunk" -s -c 1 --static-only -o 3000000 --chunk-instances 2 --sw-instances 2
+if [[ $RC -ne 0 ]]; then
+    report "exit status $RC"
+elif ! grep -qE "Chunks: +8 " "$LOG"; then
+    report "$(grep -E "Chunks:" "$LOG" | tr -s ' ')"
+else
+    report
+fi
+
+#
+# A context waiting on another's prefix cache build has nothing in flight, so the
+# watchdog must not call it stalled, even when the build outlasts the deadline
+#
+PREFIX_WAIT="-s -c 1 --static-only --obs-step 40000 -t 4 --sw-instances 4 --prefix-reuse --dc-emu lat=60000 --deadline 100"
+
+run_case "no stall while waiting on a prefix cache build" $PREFIX_WAIT
+STALLS=$(grep -c "STALL:" "$LOG")
+if [[ $RC -ne 0 ]]; then
+    report "exit status $RC, $STALLS stall(s)"
+elif [[ $STALLS -ne 0 ]]; then
+    report "$STALLS stall(s)"
+else
+    report
+fi
+
+#
+# The same run with --abandon: with no request in flight, no instance is quarantined
+#
+run_case "no quarantine without a request in flight" $PREFIX_WAIT --abandon
+QUARANTINES=$(grep -c "quarantined:" "$LOG")
+if [[ $RC -ne 0 ]]; then
+    report "exit status $RC, $QUARANTINES quarantine(s)"
+elif [[ $QUARANTINES -ne 0 ]]; then
+    report "$QUARANTINES quarantine(s)"
+else
+    report
+fi
+
+exit $FAILED
@@ -0,0 +1,610 @@
+#include <time.h>
+#include "sample_plan.h"
+
+extern FILE *g_log_fd;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t admit_cond;
+    uint64_t rng;
+    uint64_t seed;
+    uint64_t budget_left;
+    uint32_t files_left;
+    uint32_t files_unstarted;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t admitted;
+    struct sample_file *head;
+    struct sample_file **tail;
+} g_sample = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0, 0, 0, 0, NULL, &g_sample.head };
+
+// splitmix64: small, seedable, and the same sequence on every host
+static uint64_t next_rand()
+{
+    uint64_t z = (g_sample.rng += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+    Function:
+
+        sample_plan_init
+
+    Description:
+
+        Seeds the PRNG and starts the run's budget. Called once, before any file
+        is built. The seed is logged so the same plan can be drawn again
+
+    Parameters:
+
+        opt         -   Ptr to the command line options struct
+        num_files   -   Files the budget is spread over
+
+    Return:
+
+        none
+*/
+void sample_plan_init(struct mg_options *opt, uint32_t num_files)
+{
+    if (!sample_plan_enabled(opt)) {
+        return;
+    }
+
+    if (!opt->seed_set) {
+        opt->seed = ((uint64_t)time(NULL) << 16) ^ getpid();
+    }
+
+    g_sample.seed = opt->seed;
+    g_sample.rng = opt->seed;
+    g_sample.budget_left = opt->budget;
+    g_sample.files_left = num_files;
+    g_sample.files_unstarted = num_files;
+
+    if (opt->duration) {
+        g_sample.start_ns = now_ns();
+        g_sample.end_ns = g_sample.start_ns + ((uint64_t)opt->duration * 1000000000ULL);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "Sampling: seed %lu, budget %lu contexts, duration %u s, over %u files\n",
+            opt->seed, opt->budget, opt->duration, num_files);
+}
+
+bool sample_plan_enabled(struct mg_options *opt)
+{
+    return (opt->budget || opt->duration) && !opt->decomp_only && !opt->obs && !opt->ibc;
+}
+
+/*
+    Function:
+
+        add_strata (static)
+
+    Description:
+
+        Splits one key's range into 64KB buckets and power-of-two offset bands, and
+        appends every non-empty one as a stratum
+
+    Parameters:
+
+        sf          -   Ptr to the file's plan
+        max_strata  -   Ptr to the allocated size of sf->strata
+        cpr_lvl     -   Compression level
+        huff_type   -   CPA_DC_HT_STATIC/FULL_DYNAMIC
+        start       -   First OBS/IBC of the range
+        end         -   Last OBS/IBC of the range
+        step        -   Grid spacing
+
+    Return:
+
+        false if the strata list could not grow
+*/
+static bool add_strata(struct sample_file *sf, uint32_t *max_strata, Cpa32U cpr_lvl, Cpa32U huff_type,
+        uint32_t start, uint32_t end, uint32_t step)
+{
+    for (uint64_t b = start / DEFAULT_BUF_SIZE; b <= end / DEFAULT_BUF_SIZE; b++)
+    {
+        for (uint32_t band = 0; band < SAMPLE_NUM_BANDS; band++)
+        {
+            struct sample_stratum *st;
+            uint64_t lo = (b * DEFAULT_BUF_SIZE) + (band ? (SAMPLE_FIRST_BAND << (band - 1)) : 0);
+            uint64_t hi = (b * DEFAULT_BUF_SIZE) + (SAMPLE_FIRST_BAND << band) - 1;
+            uint64_t first;
+
+            if (lo < start) {
+                lo = start;
+            }
+            if (hi > end) {
+                hi = end;
+            }
+
+            // First grid point at or after lo
+            first = start + ((((lo - start) + step - 1) / step) * step);
+            if (lo > hi || first > hi) {
+                continue;
+            }
+
+            if (sf->num_strata == *max_strata) {
+                struct sample_stratum *tmp;
+                uint32_t new_max = *max_strata ? (*max_strata * 2) : 256;
+
+                tmp = (struct sample_stratum *)realloc(sf->strata, new_max * sizeof(struct sample_stratum));
+                if (tmp == NULL) {
+                    MG_LOG_PRINT(g_log_fd, "Error: could not grow sample plan for [%s]\n", sf->filename);
+                    return false;
+                }
+
+                sf->strata = tmp;
+                *max_strata = new_max;
+            }
+
+            st = &sf->strata[sf->num_strata++];
+            memset(st, 0, sizeof(struct sample_stratum));
+
+            st->cpr_lvl = cpr_lvl;
+            st->huff_type = huff_type;
+            st->bucket = b - (start / DEFAULT_BUF_SIZE);
+            st->base = first;
+            st->count = ((hi - first) / step) + 1;
+
+            st->mul = 1;
+            if (st->count > 1) {
+                do {
+                    st->mul = 1 + (next_rand() % (st->count - 1));
+                } while (gcd(st->mul, st->count) != 1);
+            }
+            st->add = next_rand() % st->count;
+
+            sf->exhaustive += st->count;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Function:
+
+        past_deadline (static)
+
+    Description:
+
+        Whether the producer can stop drawing for a file because anything it enqueues
+        now would be dropped unrun. Called with the planner held
+
+    Parameters:
+
+        sf  -   Ptr to the file's plan
+
+    Return:
+
+        true once the run, or the file's share of it, is over
+*/
+static bool past_deadline(struct sample_file *sf)
+{
+    uint64_t now;
+
+    if (!g_sample.end_ns) {
+        return false;
+    }
+
+    now = now_ns();
+
+    return now > g_sample.end_ns || (sf->started && now > sf->deadline_ns);
+}
+
+/*
+    Function:
+
+        wait_for_consumers (static)
+
+    Description:
+
+        Paces the producer under --duration. A file may have as many contexts queued
+        ahead of the consumers as the rate measured so far can run in the time left to
+        it, so little is drawn only to be dropped at the deadline. Called with the
+        planner held, which the wait releases
+
+    Parameters:
+
+        sf      -   Ptr to the file's plan
+        emitted -   Contexts enqueued for the file so far
+
+    Return:
+
+        none
+*/
+static void wait_for_consumers(struct sample_file *sf, uint64_t emitted)
+{
+    while (!past_deadline(sf))
+    {
+        struct timespec ts;
+        uint64_t now = now_ns();
+        uint64_t elapsed = now - g_sample.start_ns;
+        uint64_t left;
+        uint64_t allowed = SAMPLE_MIN_AHEAD;
+
+        if (sf->started) {
+            left = (sf->deadline_ns > now) ? (sf->deadline_ns - now) : 0;
+        } else {
+            left = (g_sample.end_ns > now) ? (g_sample.end_ns - now) : 0;
+            left /= g_sample.files_unstarted ? g_sample.files_unstarted : 1;
+        }
+
+        if (g_sample.admitted && elapsed) {
+            double fit = ((double)g_sample.admitted * left) / elapsed;
+
+            if (fit > allowed) {
+                allowed = (uint64_t)fit;
+            }
+        }
+
+        if (emitted - sf->executed - sf->skipped < allowed) {
+            return;
+        }
+
+        // Timed, so a deadline passing wakes the producer even when nothing is admitted
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += SAMPLE_PACE_NS;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&g_sample.admit_cond, &g_sample.mutex, &ts);
+    }
+}
+
+/*
+    Function:
+
+        sample_plan_build
+
+    Description:
+
+        Producer for --budget/--duration. Takes the file's fair share of whatever
+        budget earlier files left, then draws round-robin over its strata in a freshly
+        shuffled order each round. Any prefix of the enqueue order is therefore
+        itself spread over every level, huffman type, bucket and band, which is what
+        lets a --duration cut-off stop anywhere.
+
+        With only --duration there is no count to plan to, so points are drawn lazily:
+        the bounded queue keeps the producer just ahead of the consumers, and drawing
+        stops once the file's deadline has passed. Each context takes its source
+        reference as it is enqueued, and the producer holds one of its own until it is
+        done, which the caller drops
+
+    Parameters:
+
+        opt             -   Ptr to the command line options struct
+        s               -   Ptr to the source data
+        cpr_lvl_mask    -   Compression levels to sample
+
+    Return:
+
+        none
+*/
+void sample_plan_build(struct mg_options *opt, struct src_data *s, uint16_t cpr_lvl_mask)
+{
+    struct sample_file *sf;
+    uint32_t *order;
+    uint32_t max_strata = 0;
+    uint32_t start;
+    uint32_t end;
+    uint32_t step;
+    uint64_t emitted = 0;
+    uint64_t id = 0;
+
+    if (opt->underflow) {
+        start = MIN_IBC_VALUE;
+        end = s->file_size;
+        step = opt->ibc_step ? opt->ibc_step : 1;
+    } else {
+        start = MIN_OBS_VALUE;
+        end = s->file_size / 2;
+        step = opt->obs_step ? opt->obs_step : 1;
+    }
+
+    if (end < start) {
+        end = start;
+    }
+
+    sf = (struct sample_file *)calloc(1, sizeof(struct sample_file));
+    strncpy(sf->filename, s->filename, MAX_FILE_LEN - 1);
+    sf->buckets = (end / DEFAULT_BUF_SIZE) - (start / DEFAULT_BUF_SIZE) + 1;
+    s->sample = sf;
+
+    pthread_mutex_lock(&g_sample.mutex);
+
+    for (uint32_t cpr_lvl = opt->min_cpr_lvl; cpr_lvl <= opt->max_cpr_lvl; cpr_lvl++)
+    {
+        if (((cpr_lvl_mask >> cpr_lvl) & 1) == 0) {
+            continue;
+        }
+
+        if (!opt->dynamic_only) {
+            add_strata(sf, &max_strata, cpr_lvl, CPA_DC_HT_STATIC, start, end, step);
+        }
+        if (!opt->static_only) {
+            add_strata(sf, &max_strata, cpr_lvl, CPA_DC_HT_FULL_DYNAMIC, start, end, step);
+        }
+    }
+
+    if (opt->budget) {
+        sf->planned = g_sample.files_left ? (g_sample.budget_left / g_sample.files_left) : 0;
+        if (sf->planned == 0) {
+            sf->planned = 1;
+        }
+    } else {
+        sf->planned = sf->exhaustive;
+    }
+
+    if (sf->planned > sf->exhaustive) {
+        sf->planned = sf->exhaustive;
+    }
+
+    g_sample.budget_left -= (sf->planned < g_sample.budget_left) ? sf->planned : g_sample.budget_left;
+    if (g_sample.files_left) {
+        g_sample.files_left--;
+    }
+
+    // The producer's own reference, so consumers can't free the data between enqueues
+    s->ref_count = 1;
+    s->orig_ref_count = 0;
+
+    *g_sample.tail = sf;
+    g_sample.tail = &(sf->next);
+
+    MG_LOG_PRINT(g_log_fd, "Sample plan for [%s]: %s%lu of %lu %s points over %u strata\n", s->filename,
+            opt->budget ? "" : "up to ", sf->planned, sf->exhaustive, opt->underflow ? "IBC" : "OBS", sf->num_strata);
+
+    order = (uint32_t *)malloc((sf->num_strata ? sf->num_strata : 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < sf->num_strata; i++)
+    {
+        order[i] = i;
+    }
+
+    while (emitted < sf->planned && !past_deadline(sf))
+    {
+        uint64_t round = 0;
+
+        for (uint32_t i = sf->num_strata; i > 1; i--)
+        {
+            uint32_t j = next_rand() % i;
+            uint32_t t = order[i - 1];
+
+            order[i - 1] = order[j];
+            order[j] = t;
+        }
+
+        for (uint32_t i = 0; i < sf->num_strata && emitted < sf->planned && !past_deadline(sf); i++)
+        {
+            struct sample_stratum *st = &sf->strata[order[i]];
+            struct context *ctx;
+            uint32_t point;
+
+            if (st->picked == st->count) {
+                continue;
+            }
+
+            if (g_sample.end_ns) {
+                wait_for_consumers(sf, emitted);
+                if (past_deadline(sf)) {
+                    break;
+                }
+            }
+
+            point = st->base + ((((uint64_t)st->mul * st->picked) + st->add) % st->count) * step;
+            st->picked++;
+
+            ctx = create_ctx(opt, id++);
+            fill_ctx_sess(ctx, st->cpr_lvl, st->huff_type, opt->stateless ? CPA_DC_STATELESS : CPA_DC_STATEFUL, 7);
+            ctx->src_data = s;
+            ctx->stratum = st;
+
+            if (opt->underflow) {
+                ctx->uf_ibc = point;
+            } else {
+                ctx->obs = point;
+            }
+
+            pthread_mutex_lock(&s->src_mutex);
+            s->ref_count++;
+            s->orig_ref_count++;
+            pthread_mutex_unlock(&s->src_mutex);
+
+            // The producer must not hold the planner while the Q guard blocks on consumers
+            pthread_mutex_unlock(&g_sample.mutex);
+            enq_ctx(ctx);
+            pthread_mutex_lock(&g_sample.mutex);
+
+            emitted++;
+            round++;
+        }
+
+        if (round == 0) {
+            break;
+        }
+    }
+
+    // Budget the deadline cut short goes to the files still to come
+    if (opt->budget) {
+        g_sample.budget_left += sf->planned - emitted;
+    } else {
+        MG_LOG_PRINT(g_log_fd, "Sample plan for [%s]: drew %lu points before the deadline\n", s->filename, emitted);
+    }
+    sf->planned = emitted;
+
+    pthread_mutex_unlock(&g_sample.mutex);
+
+    free(order);
+}
+
+/*
+    Function:
+
+        sample_plan_admit
+
+    Description:
+
+        Called by a consumer before running a sampled context. The first context of
+        each file fixes the file's deadline as an even share of the time left over
+        the files not yet started, so a file that finishes early hands its time on.
+        Past the deadline, contexts are dropped unrun
+
+    Parameters:
+
+        ctx -   Ptr to the dequeued context
+
+    Return:
+
+        true if the context should run
+*/
+bool sample_plan_admit(struct context *ctx)
+{
+    struct sample_file *sf = ctx->src_data->sample;
+    bool admit = true;
+    uint64_t now;
+
+    pthread_mutex_lock(&g_sample.mutex);
+
+    if (g_sample.end_ns) {
+        now = now_ns();
+
+        if (!sf->started) {
+            uint64_t left = (g_sample.end_ns > now) ? (g_sample.end_ns - now) : 0;
+
+            sf->started = true;
+            sf->deadline_ns = now + (left / (g_sample.files_unstarted ? g_sample.files_unstarted : 1));
+            if (g_sample.files_unstarted) {
+                g_sample.files_unstarted--;
+            }
+        }
+
+        admit = now <= sf->deadline_ns;
+    }
+
+    if (admit) {
+        sf->executed++;
+        ctx->stratum->executed++;
+        g_sample.admitted++;
+    } else {
+        sf->skipped++;
+    }
+
+    pthread_cond_signal(&g_sample.admit_cond);
+
+    pthread_mutex_unlock(&g_sample.mutex);
+
+    return admit;
+}
+
+/*
+    Function:
+
+        sample_plan_print_stats
+
+    Description:
+
+        Appends what sampling actually covered to the summary: contexts run against
+        the exhaustive count, and strata, buckets and keys that got at least one run
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void sample_plan_print_stats()
+{
+    if (g_sample.head == NULL) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Sampling: seed %lu (rerun with --seed=%lu)\n", g_sample.seed, g_sample.seed);
+
+    for (struct sample_file *sf = g_sample.head; sf != NULL; sf = sf->next)
+    {
+        uint32_t strata_hit = 0;
+        uint32_t buckets_hit = 0;
+        uint32_t keys = 0;
+        uint32_t keys_hit = 0;
+        bool key_hit = false;
+        bool *bucket_hit;
+
+        bucket_hit = (bool *)calloc(sf->buckets, sizeof(bool));
+
+        // Strata are laid out key by key
+        for (uint32_t i = 0; i < sf->num_strata; i++)
+        {
+            struct sample_stratum *st = &sf->strata[i];
+
+            if (i == 0 || st->cpr_lvl != sf->strata[i - 1].cpr_lvl || st->huff_type != sf->strata[i - 1].huff_type) {
+                keys++;
+                key_hit = false;
+            }
+
+            if (st->executed == 0) {
+                continue;
+            }
+
+            strata_hit++;
+            bucket_hit[st->bucket] = true;
+
+            if (!key_hit) {
+                keys_hit++;
+                key_hit = true;
+            }
+        }
+
+        for (uint32_t b = 0; b < sf->buckets; b++)
+        {
+            buckets_hit += bucket_hit[b];
+        }
+
+        free(bucket_hit);
+
+        MG_LOG_PRINT(g_log_fd, "        [%s]\n", sf->filename);
+        MG_LOG_PRINT(g_log_fd, "            Ran:     %lu of %lu planned, %lu past deadline (%.4f%% of %lu exhaustive)\n",
+                sf->executed, sf->planned, sf->skipped, sf->exhaustive ? (sf->executed * 100.0) / sf->exhaustive : 0.0,
+                sf->exhaustive);
+        MG_LOG_PRINT(g_log_fd, "            Strata:  %u of %u, buckets %u of %u, level/huffman keys %u of %u\n",
+                strata_hit, sf->num_strata, buckets_hit, sf->buckets, keys_hit, keys);
+    }
+
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
+
+void sample_plan_free_all()
+{
+    struct sample_file *sf = g_sample.head;
+
+    while (sf != NULL)
+    {
+        struct sample_file *next = sf->next;
+
+        free(sf->strata);
+        free(sf);
+
+        sf = next;
+    }
+
+    g_sample.head = NULL;
+    g_sample.tail = &g_sample.head;
+}
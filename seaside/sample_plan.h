@@ -0,0 +1,56 @@
+#pragma once
+
+#include <pthread.h>
+#include "cpr.h"
+#include "context.h"
+
+// Within-bucket offsets are banded by powers of two from [0, 256) up to [32K, 64K)
+#define SAMPLE_FIRST_BAND   (256)
+#define SAMPLE_NUM_BANDS    (9)
+
+// Under --duration, contexts a file may always have queued, and how often the producer rechecks
+#define SAMPLE_MIN_AHEAD    (256)
+#define SAMPLE_PACE_NS      (10 * 1000000L)
+
+/*
+    One stratum: a (level, huffman) key, a 64KB bucket of the OBS/IBC range and one
+    offset band inside it. Picks walk the stratum's step grid through an affine
+    permutation, so they never repeat and need no bookkeeping
+*/
+struct sample_stratum {
+    Cpa32U cpr_lvl;
+    Cpa32U huff_type;
+    uint32_t bucket;
+    uint32_t base;
+    uint32_t count;
+    uint32_t mul;
+    uint32_t add;
+    uint32_t picked;
+    uint32_t executed;
+};
+
+/*
+    Per-file plan and outcome, kept for the summary after the file's data is freed
+*/
+struct sample_file {
+    char filename[MAX_FILE_LEN];
+    uint64_t exhaustive;
+    uint64_t planned;
+    struct sample_stratum *strata;
+    uint32_t num_strata;
+    uint32_t buckets;
+
+    bool started;
+    uint64_t deadline_ns;
+    uint64_t executed;
+    uint64_t skipped;
+
+    struct sample_file *next;
+};
+
+void sample_plan_init(struct mg_options *opt, uint32_t num_files);
+bool sample_plan_enabled(struct mg_options *opt);
+void sample_plan_build(struct mg_options *opt, struct src_data *s, uint16_t cpr_lvl_mask);
+bool sample_plan_admit(struct context *ctx);
+void sample_plan_print_stats();
+void sample_plan_free_all();
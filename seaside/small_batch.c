@@ -0,0 +1,848 @@
+/*
+    Small-input path (--small)
+
+    For a file of a few KB, setting up and removing two sessions and calloc'ing two
+    buffers of twice its size costs more than the one or two requests it sends. Here a
+    worker's sessions live in its pool: up to SMALL_SESS_SLOTS compression/decompression
+    pairs per instance, one for each set of session parameters seen lately, reset between
+    contexts and only set up again when a slot is taken over by other parameters. Buffers
+    are slots in slabs of batch * 2 * max bytes, cleared up to the context's size before
+    use.
+
+    A batch uses at most SMALL_SESS_SLOTS session parameter sets, so none of its sessions
+    is taken over before it is verified. All of it is compressed before any of it is
+    verified, so each compression session goes from one input to the next without the
+    decompression requests in between, and the same again for verification. The
+    watchdog sees each context on its own, in both passes
+*/
+#include <time.h>
+#include <pthread.h>
+#include "small_batch.h"
+#include "meatjet.h"
+#include "watchdog.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+// Session pairs kept per instance, and so the most parameter sets a batch may use
+#define SMALL_SESS_SLOTS    (8)
+
+struct small_sess {
+    CpaDcSessionHandle cpr;
+    CpaDcSessionHandle dcpr;
+    CpaDcSessionSetupData cpr_sd;
+    CpaDcSessionSetupData dcpr_sd;
+
+    // Used since set up or reset, so reset before the next context
+    bool cpr_used;
+    bool dcpr_used;
+
+    // Batch that last used the pair, and when, for picking one to take over
+    uint64_t batch;
+    uint64_t last_use;
+};
+
+// One per worker thread, hung off its sgl container like the chunk engine
+struct small_pool {
+    uint32_t num_inst;
+    struct small_sess *sess;
+    uint64_t batch;
+    uint64_t tick;
+
+    size_t slab;
+    Cpa8U *dest;
+    Cpa8U *compare;
+    Cpa8U *zlib;
+
+    uint64_t setups;
+    uint64_t resets;
+};
+
+static struct {
+    bool enabled;
+    bool measure;
+    uint32_t kb;
+    uint32_t max_bytes;
+    uint32_t batch;
+    bool zlib;
+
+    pthread_mutex_t mutex;
+    uint64_t ctxs;
+    uint64_t batches;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t setups;
+    uint64_t resets;
+} g_small;
+
+/*
+    Function:
+
+        parse_spec (static)
+
+    Description:
+
+        Parses a --small spec: "key=value,..." with keys max (KB) and batch, and the
+        word measure
+
+    Parameters:
+
+        str -   Spec to parse
+
+    Return:
+
+        0 on success, -1 if the spec is malformed or out of range
+*/
+static int parse_spec(const char *str)
+{
+    char buf[MAX_FILE_LEN];
+    char *save = NULL;
+    char *tok;
+    char *end;
+
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *val = strchr(tok, '=');
+        unsigned long v;
+
+        if (!strcmp(tok, "measure")) {
+            g_small.measure = true;
+            continue;
+        }
+        if (val == NULL) {
+            return -1;
+        }
+        *val++ = '\0';
+
+        v = strtoul(val, &end, 0);
+        if (end == val || *end || v == 0) {
+            return -1;
+        }
+
+        if (!strcmp(tok, "max") && v <= SMALL_MAX_KB) {
+            g_small.kb = v;
+        } else if (!strcmp(tok, "batch") && v <= SMALL_MAX_BATCH) {
+            g_small.batch = v;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        small_init
+
+    Description:
+
+        Reads --small. Without it no context is small
+
+    Parameters:
+
+        opt -   Ptr to the options (--small, --zlibcompare)
+
+    Return:
+
+        0 on success, -1 on a bad spec
+*/
+int small_init(struct mg_options *opt)
+{
+    memset(&g_small, 0, sizeof(g_small));
+    pthread_mutex_init(&g_small.mutex, NULL);
+
+    if (opt->small[0] == '\0') {
+        return 0;
+    }
+
+    g_small.kb = SMALL_DEFAULT_KB;
+    g_small.batch = SMALL_DEFAULT_BATCH;
+
+    if (parse_spec(opt->small) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: bad --small spec \"%s\" (max=1-%u KB, batch=1-%u, measure)\n",
+                opt->small, SMALL_MAX_KB, SMALL_MAX_BATCH);
+        return -1;
+    }
+
+    g_small.max_bytes = g_small.kb << 10;
+    g_small.enabled = !g_small.measure;
+    g_small.zlib = opt->zlibcompare != 0;
+
+    return 0;
+}
+
+/*
+    Function:
+
+        small_fits
+
+    Description:
+
+        Whether a context's input is small enough for the small-input path, or for its
+        throughput to be counted with --small measure
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        true if it is small
+*/
+bool small_fits(struct context *ctx)
+{
+    struct src_data *src = ctx->src_data;
+
+    if (g_small.max_bytes == 0 || src->backing == SRC_MEM_STREAMED) {
+        return false;
+    }
+
+    // The chunk engine's lanes have sessions of their own
+    if (chunk_engine_enabled(ctx)) {
+        return false;
+    }
+
+    if (ctx->decomp_only) {
+        return src->file_size <= g_small.max_bytes && src->dcpr_size <= 2 * (size_t)g_small.max_bytes;
+    }
+
+    return src->file_size <= g_small.max_bytes;
+}
+
+bool small_batching()
+{
+    return g_small.enabled;
+}
+
+uint32_t small_batch_max()
+{
+    return g_small.batch;
+}
+
+/*
+    Function:
+
+        same_sess (static)
+
+    Description:
+
+        Whether two contexts' sessions would be set up the same way
+
+    Parameters:
+
+        a, b    -   Ptrs to the contexts
+
+    Return:
+
+        true if they would
+*/
+static bool same_sess(struct context *a, struct context *b)
+{
+    return !memcmp(&a->sessCprSetupData, &b->sessCprSetupData, sizeof(a->sessCprSetupData)) &&
+           !memcmp(&a->sessDcprSetupData, &b->sessDcprSetupData, sizeof(a->sessDcprSetupData));
+}
+
+/*
+    Function:
+
+        small_batch_can_add
+
+    Description:
+
+        Whether a small context can join a batch: it has room, and the context either
+        shares session parameters with one already in it or the batch has parameter sets
+        to spare
+
+    Parameters:
+
+        b   -   Ptr to the batch, with at least one context
+        ctx -   Ptr to the context
+
+    Return:
+
+        true if it can
+*/
+bool small_batch_can_add(struct small_batch *b, struct context *ctx)
+{
+    uint32_t sets = 0;
+
+    if (b->n >= g_small.batch || ctx->decomp_only != b->ctx[0]->decomp_only) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < b->n; i++)
+    {
+        bool first = true;
+
+        if (same_sess(b->ctx[i], ctx)) {
+            return true;
+        }
+
+        for (uint32_t j = 0; j < i && first; j++)
+        {
+            first = !same_sess(b->ctx[j], b->ctx[i]);
+        }
+        sets += first;
+    }
+
+    return sets < SMALL_SESS_SLOTS;
+}
+
+/*
+    Function:
+
+        pool_create (static)
+
+    Description:
+
+        Allocates a worker's pool: no sessions yet, and batch buffer slots of each kind
+
+    Parameters:
+
+        none
+
+    Return:
+
+        Ptr to the pool, or NULL on allocation failure
+*/
+static struct small_pool *pool_create()
+{
+    struct small_pool *pool;
+
+    pool = (struct small_pool *)calloc(1, sizeof(struct small_pool));
+    if (pool == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the small-input pool\n");
+        return NULL;
+    }
+
+    pool->num_inst = numDcInstances_g;
+    pool->slab = 2 * (size_t)g_small.max_bytes;
+    pool->sess = (struct small_sess *)calloc(pool->num_inst * SMALL_SESS_SLOTS, sizeof(struct small_sess));
+    pool->dest = (Cpa8U *)malloc(pool->slab * g_small.batch);
+    pool->compare = (Cpa8U *)malloc(pool->slab * g_small.batch);
+    if (g_small.zlib) {
+        pool->zlib = (Cpa8U *)malloc(pool->slab * g_small.batch);
+    }
+
+    if (pool->sess == NULL || pool->dest == NULL || pool->compare == NULL || (g_small.zlib && pool->zlib == NULL)) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the small-input pool\n");
+        small_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/*
+    Function:
+
+        open_sess (static)
+
+    Description:
+
+        Allocates and sets up one session on an instance
+
+    Parameters:
+
+        inst    -   Instance number
+        sd      -   Ptr to the session setup data
+        node    -   NUMA node for the session memory
+        sgls    -   Ptr to the worker's sgl container, for the context buffer
+        handle  -   Set to the session, or NULL on failure
+
+    Return:
+
+        Status of the session calls
+*/
+static CpaStatus open_sess(uint32_t inst, CpaDcSessionSetupData *sd, Cpa32U node, struct sgl_container *sgls,
+                           CpaDcSessionHandle *handle)
+{
+    CpaStatus status;
+    Cpa32U sess_size;
+    Cpa32U ctx_size;
+
+    *handle = NULL;
+
+    status = cpaDcGetSessionSize(dcInstances_g[inst], sd, &sess_size, &ctx_size);
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not get session size!\n");
+        return status;
+    }
+
+    *handle = (CpaDcSessionHandle) qaeMemAllocNUMA(sess_size, node, BYTE_ALIGNMENT_64);
+    if (*handle == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate space for session handle!\n");
+        return CPA_STATUS_FAIL;
+    }
+
+    status = cpaDcInitSession(dcInstances_g[inst], *handle, sd, sgls->context_sgl, NULL);
+    if (status != CPA_STATUS_SUCCESS) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not initialize session\n");
+        qaeMemFreeNUMA(handle);
+        *handle = NULL;
+    }
+
+    return status;
+}
+
+/*
+    Function:
+
+        close_sess (static)
+
+    Description:
+
+        Removes and frees a session set up by open_sess, if there is one
+
+    Parameters:
+
+        inst    -   Instance number
+        handle  -   Ptr to the session, set to NULL
+
+    Return:
+
+        none
+*/
+static void close_sess(uint32_t inst, CpaDcSessionHandle *handle)
+{
+    if (*handle == NULL) {
+        return;
+    }
+
+    cpaDcRemoveSession(dcInstances_g[inst], *handle);
+    qaeMemFreeNUMA(handle);
+    *handle = NULL;
+}
+
+/*
+    Function:
+
+        sess_setup (static)
+
+    Description:
+
+        Finds the instance's session pair set up the way a context wants. If there isn't
+        one, the least recently used pair the current batch hasn't touched is set up again
+        for it
+
+    Parameters:
+
+        pool    -   Ptr to the worker's pool
+        inst    -   Instance number
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the worker's sgl container
+        sess    -   Set to the pair
+
+    Return:
+
+        Status of the session calls
+*/
+static CpaStatus sess_setup(struct small_pool *pool, uint32_t inst, struct context *ctx, struct sgl_container *sgls,
+                            struct small_sess **sess)
+{
+    struct small_sess *slots = &pool->sess[inst * SMALL_SESS_SLOTS];
+    struct small_sess *s = NULL;
+    CpaStatus status;
+
+    for (uint32_t i = 0; i < SMALL_SESS_SLOTS; i++)
+    {
+        if (slots[i].cpr && !memcmp(&slots[i].cpr_sd, &ctx->sessCprSetupData, sizeof(slots[i].cpr_sd)) &&
+                !memcmp(&slots[i].dcpr_sd, &ctx->sessDcprSetupData, sizeof(slots[i].dcpr_sd))) {
+            s = &slots[i];
+            break;
+        }
+    }
+
+    if (s == NULL) {
+        // small_batch_can_add keeps a batch to SMALL_SESS_SLOTS parameter sets, so there is one
+        for (uint32_t i = 0; i < SMALL_SESS_SLOTS; i++)
+        {
+            if (slots[i].cpr && slots[i].batch == pool->batch) {
+                continue;
+            }
+            if (s == NULL || slots[i].cpr == NULL || (s->cpr && slots[i].last_use < s->last_use)) {
+                s = &slots[i];
+            }
+        }
+
+        close_sess(inst, &s->cpr);
+        close_sess(inst, &s->dcpr);
+
+        status = open_sess(inst, &ctx->sessCprSetupData, ctx->nodeId, sgls, &s->cpr);
+        if (status != CPA_STATUS_SUCCESS) {
+            return status;
+        }
+        status = open_sess(inst, &ctx->sessDcprSetupData, ctx->nodeId, sgls, &s->dcpr);
+        if (status != CPA_STATUS_SUCCESS) {
+            close_sess(inst, &s->cpr);
+            return status;
+        }
+
+        s->cpr_sd = ctx->sessCprSetupData;
+        s->dcpr_sd = ctx->sessDcprSetupData;
+        s->cpr_used = false;
+        s->dcpr_used = false;
+        pool->setups++;
+    }
+
+    s->batch = pool->batch;
+    s->last_use = ++pool->tick;
+    *sess = s;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        sess_reuse (static)
+
+    Description:
+
+        Resets a pooled session before a context uses it, unless nothing has used it yet
+
+    Parameters:
+
+        pool    -   Ptr to the worker's pool
+        inst    -   Instance number
+        handle  -   The session
+        used    -   Ptr to its used flag
+
+    Return:
+
+        Status of the reset
+*/
+static CpaStatus sess_reuse(struct small_pool *pool, uint32_t inst, CpaDcSessionHandle handle, bool *used)
+{
+    CpaStatus status = CPA_STATUS_SUCCESS;
+
+    if (*used) {
+        status = cpaDcResetSession(dcInstances_g[inst], handle);
+        if (status != CPA_STATUS_SUCCESS) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not reset session, status %d\n", status);
+            return status;
+        }
+        pool->resets++;
+    }
+    *used = true;
+
+    return status;
+}
+
+/*
+    Function:
+
+        pool_launch (static)
+
+    Description:
+
+        launch_ctx for a small context: picks its instance and gives it the pool's sessions
+        there and buffer slot slot. The context is marked pooled first, so free_ctx leaves
+        all of it to the pool whether or not this succeeds
+
+    Parameters:
+
+        pool    -   Ptr to the worker's pool
+        slot    -   Buffer slot, the context's place in its batch
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the worker's sgl container
+        sess    -   Set to the context's session pair
+
+    Return:
+
+        Status of the session calls
+*/
+static CpaStatus pool_launch(struct small_pool *pool, uint32_t slot, struct context *ctx, struct sgl_container *sgls,
+                             struct small_sess **sess)
+{
+    CpaStatus status;
+    uint32_t iNum;
+
+    ctx->pooled = true;
+
+    // The thread's own instance, unless it is quarantined
+    iNum = health_pick(ctx, sgls->t_id % numDcInstances_g);
+    ctx->dcpr_inst = iNum;
+
+    status = sess_setup(pool, iNum, ctx, sgls, sess);
+    if (status != CPA_STATUS_SUCCESS) {
+        return status;
+    }
+
+    ctx->sessCprHandle = (*sess)->cpr;
+    ctx->sessDcprHandle = (*sess)->dcpr;
+
+    ctx->mem_size = ctx->decomp_only ? ctx->src_data->dcpr_size : ctx->src_data->file_size * 2;
+    ctx->dest_mem = pool->dest + slot * pool->slab;
+    ctx->compare_mem = pool->compare + slot * pool->slab;
+    memset(ctx->dest_mem, 0, ctx->mem_size);
+    memset(ctx->compare_mem, 0, ctx->mem_size);
+    if (pool->zlib) {
+        ctx->zlib_mem = pool->zlib + slot * pool->slab;
+        memset(ctx->zlib_mem, 0, ctx->mem_size);
+    }
+
+    return status;
+}
+
+/*
+    Function:
+
+        add_stats (static)
+
+    Description:
+
+        Adds a batch, and the pool's session counts since the last one, to the totals
+
+    Parameters:
+
+        pool    -   Ptr to the worker's pool, or NULL
+        ctxs    -   Contexts finished
+        bytes   -   Their input bytes
+        ns      -   Worker time spent on them
+
+    Return:
+
+        none
+*/
+static void add_stats(struct small_pool *pool, uint64_t ctxs, uint64_t bytes, uint64_t ns)
+{
+    pthread_mutex_lock(&g_small.mutex);
+    g_small.batches += ctxs != 0;
+    g_small.ctxs += ctxs;
+    g_small.bytes += bytes;
+    g_small.ns += ns;
+    if (pool) {
+        g_small.setups += pool->setups;
+        g_small.resets += pool->resets;
+        pool->setups = 0;
+        pool->resets = 0;
+    }
+    pthread_mutex_unlock(&g_small.mutex);
+}
+
+/*
+    Function:
+
+        small_batch_run
+
+    Description:
+
+        Runs a batch of compatible small contexts on the worker's pool: compresses all of
+        them, then verifies all of them. Decompression-only contexts run whole in the
+        first pass. Fills in each context's status and timing for the caller to finish it
+        as it would a context from meatjet()
+
+    Parameters:
+
+        b       -   Ptr to the batch, with n and ctx filled in
+        sgls    -   Ptr to the worker's sgl container
+
+    Return:
+
+        true if the watchdog abandoned one of the contexts; the worker must hand the
+        ones after b->done other than b->abandoned back to the Q and exit
+*/
+bool small_batch_run(struct small_batch *b, struct sgl_container *sgls)
+{
+    struct small_pool *pool;
+    struct small_sess *sess[SMALL_MAX_BATCH];
+    bool pending[SMALL_MAX_BATCH];
+    uint64_t bytes = 0;
+    uint64_t ns = 0;
+    uint64_t t;
+
+    b->done = 0;
+    b->abandoned = -1;
+
+    if (sgls->small == NULL) {
+        sgls->small = pool_create();
+    }
+    pool = sgls->small;
+    if (pool) {
+        pool->batch++;
+    }
+
+    // Compress everything first, the compression session going from one input to the next
+    for (uint32_t i = 0; i < b->n; i++)
+    {
+        struct context *ctx = b->ctx[i];
+        struct small_sess *s = NULL;
+
+        pending[i] = false;
+        b->start_ns[i] = now_ns();
+
+        wd_ctx_begin(ctx);
+
+        b->status[i] = pool ? pool_launch(pool, i, ctx, sgls, &s) : CPA_STATUS_FAIL;
+        sess[i] = s;
+        if (b->status[i] == CPA_STATUS_SUCCESS) {
+
+            if (ctx->decomp_only) {
+                b->status[i] = sess_reuse(pool, ctx->inst, s->dcpr, &s->dcpr_used);
+                if (b->status[i] == CPA_STATUS_SUCCESS) {
+                    b->status[i] = meatjet(ctx, sgls);
+                }
+            } else {
+                b->status[i] = sess_reuse(pool, ctx->inst, s->cpr, &s->cpr_used);
+                if (b->status[i] == CPA_STATUS_SUCCESS) {
+                    b->status[i] = meatjet_compress(ctx, sgls);
+                    pending[i] = true;
+                }
+            }
+        }
+
+        if (wd_ctx_end()) {
+            b->abandoned = i;
+            add_stats(pool, 0, 0, 0);
+            return true;
+        }
+
+        b->busy_ns[i] = now_ns() - b->start_ns[i];
+    }
+
+    // Then verify in the same order, the same way through the decompression session
+    for (uint32_t i = 0; i < b->n; i++)
+    {
+        struct context *ctx = b->ctx[i];
+        struct small_sess *s = sess[i];
+
+        if (pending[i]) {
+            t = now_ns();
+
+            wd_ctx_begin(ctx);
+
+            if (sess_reuse(pool, ctx->inst, s->dcpr, &s->dcpr_used) == CPA_STATUS_SUCCESS) {
+                b->status[i] = meatjet_verify(ctx, sgls, b->status[i]);
+            } else {
+                b->status[i] = CPA_STATUS_FAIL;
+            }
+
+            if (wd_ctx_end()) {
+                b->abandoned = i;
+                add_stats(pool, b->done, bytes, ns);
+                return true;
+            }
+
+            b->busy_ns[i] += now_ns() - t;
+        }
+
+        b->done = i + 1;
+        bytes += ctx->src_data->file_size;
+        ns += b->busy_ns[i];
+    }
+
+    add_stats(pool, b->done, bytes, ns);
+
+    return false;
+}
+
+/*
+    Function:
+
+        small_record
+
+    Description:
+
+        Counts a small context run through meatjet() as usual, for --small measure
+
+    Parameters:
+
+        ctx -   Ptr to the finished context
+        ns  -   Its run time, session setup to free
+
+    Return:
+
+        none
+*/
+void small_record(struct context *ctx, uint64_t ns)
+{
+    if (!g_small.measure || !small_fits(ctx)) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_small.mutex);
+    g_small.ctxs++;
+    g_small.bytes += ctx->src_data->file_size;
+    g_small.ns += ns;
+    pthread_mutex_unlock(&g_small.mutex);
+}
+
+/*
+    Function:
+
+        small_pool_free
+
+    Description:
+
+        Removes a worker's pooled sessions and frees its buffers. Called from free_sgls
+
+    Parameters:
+
+        pool    -   Ptr to the pool, or NULL
+
+    Return:
+
+        none
+*/
+void small_pool_free(struct small_pool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; pool->sess && i < pool->num_inst * SMALL_SESS_SLOTS; i++)
+    {
+        close_sess(i / SMALL_SESS_SLOTS, &pool->sess[i].cpr);
+        close_sess(i / SMALL_SESS_SLOTS, &pool->sess[i].dcpr);
+    }
+
+    free(pool->sess);
+    free(pool->dest);
+    free(pool->compare);
+    free(pool->zlib);
+    free(pool);
+}
+
+/*
+    Function:
+
+        small_print_stats
+
+    Description:
+
+        Prints the small-input population's throughput, per worker since workers run
+        side by side, and how the batching went
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void small_print_stats()
+{
+    if (g_small.ctxs == 0) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Small inputs (<= %u KB%s): %lu context(s), %.2f MB in %.3f s of worker time (%.1f MB/s per worker)\n",
+            g_small.kb, g_small.measure ? ", regular path" : "", g_small.ctxs, g_small.bytes / (1024.0 * 1024.0),
+            g_small.ns / 1e9, g_small.ns ? (g_small.bytes / (1024.0 * 1024.0)) / (g_small.ns / 1e9) : 0.0);
+
+    if (!g_small.measure) {
+        MG_LOG_PRINT(g_log_fd, "        %lu batch(es) of %.1f on average, sessions set up %lu time(s) and reset %lu time(s)\n",
+                g_small.batches, g_small.batches ? (double)g_small.ctxs / g_small.batches : 0.0,
+                g_small.setups, g_small.resets);
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+}
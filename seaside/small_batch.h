@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+    Small-input path (--small). Contexts for inputs of at most max KB skip launch_ctx: each
+    worker keeps compression and decompression sessions per instance and resets them
+    between inputs instead of setting up and removing a pair per context, and hands out
+    dest/compare buffers from slabs allocated once. Up to batch contexts are taken off the
+    Q together, compressed back to back and then verified back to back. Their throughput
+    is reported on its own, and with measure the path is left off and only the reporting
+    is done, as a baseline
+*/
+
+#include "cpr.h"
+#include "context.h"
+
+#define SMALL_DEFAULT_KB        (64)
+#define SMALL_MAX_KB            (DEFAULT_BUF_SIZE >> 10)
+#define SMALL_DEFAULT_BATCH     (16)
+#define SMALL_MAX_BATCH         (64)
+
+struct small_pool;
+
+// Contexts run together by small_batch_run, with what became of each
+struct small_batch {
+    uint32_t n;
+    struct context *ctx[SMALL_MAX_BATCH];
+    CpaStatus status[SMALL_MAX_BATCH];
+    uint64_t start_ns[SMALL_MAX_BATCH];
+    uint64_t busy_ns[SMALL_MAX_BATCH];
+
+    // Contexts finished, from the front, and the one the watchdog abandoned or -1
+    uint32_t done;
+    int32_t abandoned;
+};
+
+int small_init(struct mg_options *opt);
+bool small_fits(struct context *ctx);
+bool small_batching();
+uint32_t small_batch_max();
+bool small_batch_can_add(struct small_batch *b, struct context *ctx);
+bool small_batch_run(struct small_batch *b, struct sgl_container *sgls);
+void small_record(struct context *ctx, uint64_t ns);
+void small_pool_free(struct small_pool *pool);
+void small_print_stats();
@@ -0,0 +1,907 @@
+/*
+    Streaming mode (--stream)
+
+    A file bigger than the stream window is never loaded. Each of its contexts reads
+    the source through a sliding window, and hands every compression request's output
+    straight to the decompression session, which verifies it against the window as it
+    comes back. Everything is counted in 64 bits, so the file can be bigger than 4GB
+    and bigger than memory; a context holds the window plus a few 64KB buffers.
+
+    With --stream-spill the compressed stream goes to an unlinked file instead, and is
+    decompressed once compression is done, the way meatjet() orders the two passes.
+    Output the window has moved past is then checked against a re-read of the source
+*/
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "stream.h"
+#include "buf_handler.h"
+#include "crc32.h"
+#include "meatjet.h"
+#include "credit.h"
+#include "watchdog.h"
+#include "health.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+struct stream_state {
+    struct context *ctx;
+    uint64_t size;
+
+    // Source, at src_off in src_fd (pack entries sit inside the pack)
+    int src_fd;
+    uint64_t src_off;
+
+    // Window over the source, from win_start
+    Cpa8U *win;
+    uint64_t win_cap;
+    uint64_t win_start;
+    uint64_t win_len;
+
+    // Compressed bytes from cb_start, staged for the decompressor
+    Cpa8U *cbuf;
+    uint64_t cb_start;
+    uint64_t cb_len;
+
+    // --stream-spill file, or -1
+    int spill_fd;
+
+    Cpa8U *dbuf;
+    Cpa8U *scratch;
+
+    uint64_t cpr_consumed;
+    uint64_t cpr_produced;
+    uint64_t dcpr_consumed;
+    uint64_t dcpr_produced;
+
+    Cpa32U src_crc;
+    uint64_t reread;
+    uint64_t mismatch;
+    int fail_code;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    uint64_t window;
+    char *spill_dir;
+    uint64_t ctxs;
+    uint64_t bytes;
+    uint64_t cpr_bytes;
+    uint64_t reread;
+    uint64_t ns;
+} g_stream;
+
+/*
+    Function:
+
+        stream_init
+
+    Description:
+
+        Sets the window size and spill directory from the command line
+
+    Parameters:
+
+        opt -   Ptr to the command line options struct
+
+    Return:
+
+        none
+*/
+void stream_init(struct mg_options *opt)
+{
+    pthread_mutex_init(&g_stream.mutex, NULL);
+
+    g_stream.window = (uint64_t)opt->stream_mb << 20;
+    g_stream.spill_dir = opt->stream_spill[0] ? opt->stream_spill : NULL;
+}
+
+/*
+    Function:
+
+        stream_wanted
+
+    Description:
+
+        Whether a file of this size is streamed rather than loaded. Only the
+        compression flow streams
+
+    Parameters:
+
+        opt     -   Ptr to the command line options struct
+        size    -   File size
+
+    Return:
+
+        true if the file is bigger than the --stream window
+*/
+bool stream_wanted(struct mg_options *opt, uint64_t size)
+{
+    return opt->stream_mb && !opt->decomp_only && size > ((uint64_t)opt->stream_mb << 20);
+}
+
+/*
+    Function:
+
+        read_full (static)
+
+    Description:
+
+        pread()s exactly len bytes, across short reads
+
+    Parameters:
+
+        fd  -   File to read
+        buf -   Destination
+        len -   Bytes to read
+        off -   Offset in the file
+
+    Return:
+
+        0 on success, -1 on an error or early EOF
+*/
+static int read_full(int fd, Cpa8U *buf, uint64_t len, uint64_t off)
+{
+    while (len)
+    {
+        ssize_t n = pread(fd, buf, len, off);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        buf += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        write_full (static)
+
+    Description:
+
+        pwrite()s exactly len bytes, across short writes
+
+    Parameters:
+
+        fd  -   File to write
+        buf -   Source
+        len -   Bytes to write
+        off -   Offset in the file
+
+    Return:
+
+        0 on success, -1 on an error
+*/
+static int write_full(int fd, Cpa8U *buf, uint64_t len, uint64_t off)
+{
+    while (len)
+    {
+        ssize_t n = pwrite(fd, buf, len, off);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        buf += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        stream_open (static)
+
+    Description:
+
+        Opens the source (and the spill file) and allocates the context's buffers
+
+    Parameters:
+
+        st  -   Ptr to the zeroed stream state
+        ctx -   Ptr to the context
+
+    Return:
+
+        0 on success, -1 on failure. stream_close() cleans up either way
+*/
+static int stream_open(struct stream_state *st, struct context *ctx)
+{
+    st->ctx = ctx;
+    st->size = ctx->src_data->file_size;
+    st->src_off = ctx->src_data->stream_off;
+    st->spill_fd = -1;
+    st->win_cap = g_stream.window;
+
+    st->src_fd = open(ctx->src_data->stream_path, O_RDONLY);
+    if (st->src_fd < 0) {
+        MG_LOG_PRINT(g_log_fd, "Stream: could not open [%s]\n", ctx->src_data->stream_path);
+        return -1;
+    }
+
+    // The compressor only ever sees the next 64KB, so sequential hints are all the kernel needs
+    posix_fadvise(st->src_fd, st->src_off, st->size, POSIX_FADV_SEQUENTIAL);
+
+    st->win = (Cpa8U *)malloc(st->win_cap);
+    st->cbuf = (Cpa8U *)malloc(STREAM_CBUF_SIZE);
+    st->dbuf = (Cpa8U *)malloc(DEST_BUF_SIZE);
+    st->scratch = (Cpa8U *)malloc(DEFAULT_BUF_SIZE);
+    if (st->win == NULL || st->cbuf == NULL || st->dbuf == NULL || st->scratch == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Stream: could not allocate a %lu MB window\n", st->win_cap >> 20);
+        return -1;
+    }
+
+    if (g_stream.spill_dir) {
+        char path[MAX_FILE_LEN + 32];
+
+        snprintf(path, sizeof(path), "%s/meatjet_spill_XXXXXX", g_stream.spill_dir);
+        st->spill_fd = mkstemp(path);
+        if (st->spill_fd < 0) {
+            MG_LOG_PRINT(g_log_fd, "Stream: could not create a spill file in [%s]\n", g_stream.spill_dir);
+            return -1;
+        }
+
+        // Gone as soon as the context closes it, however the run ends
+        unlink(path);
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        stream_close (static)
+
+    Description:
+
+        Releases everything stream_open() set up
+
+    Parameters:
+
+        st  -   Ptr to the stream state
+
+    Return:
+
+        none
+*/
+static void stream_close(struct stream_state *st)
+{
+    if (st->src_fd >= 0) {
+        close(st->src_fd);
+    }
+
+    if (st->spill_fd >= 0) {
+        close(st->spill_fd);
+    }
+
+    free(st->win);
+    free(st->cbuf);
+    free(st->dbuf);
+    free(st->scratch);
+}
+
+/*
+    Function:
+
+        window_fill (static)
+
+    Description:
+
+        Slides the window so it reaches end, then fills it as far as it goes. Output
+        the decompressor hasn't verified yet is kept, unless keeping it would leave no
+        room for the next request
+
+    Parameters:
+
+        st  -   Ptr to the stream state
+        end -   Source offset the window has to reach
+
+    Return:
+
+        0 on success, -1 if the source could not be read
+*/
+static int window_fill(struct stream_state *st, uint64_t end)
+{
+    uint64_t keep;
+    uint64_t want;
+
+    if (end <= st->win_start + st->win_len) {
+        return 0;
+    }
+
+    keep = (st->spill_fd < 0) ? MAX(st->dcpr_produced, st->win_start) : st->cpr_consumed;
+    if (end - keep > st->win_cap) {
+        keep = st->cpr_consumed;
+    }
+
+    if (keep > st->win_start) {
+        memmove(st->win, st->win + (keep - st->win_start), st->win_start + st->win_len - keep);
+        st->win_len -= keep - st->win_start;
+        st->win_start = keep;
+    }
+
+    want = MIN(st->win_cap - st->win_len, st->size - (st->win_start + st->win_len));
+
+    if (read_full(st->src_fd, st->win + st->win_len, want, st->src_off + st->win_start + st->win_len) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Stream: read failed at offset %lu of [%s]\n",
+                st->win_start + st->win_len, st->ctx->src_data->filename);
+        return -1;
+    }
+
+    st->win_len += want;
+
+    return 0;
+}
+
+/*
+    Function:
+
+        verify (static)
+
+    Description:
+
+        Compares decompressed output against the source at dcpr_produced, from the
+        window where it still holds that range, and from a re-read where it doesn't
+
+    Parameters:
+
+        st      -   Ptr to the stream state
+        data    -   Decompressed output
+        len     -   Length of the output
+
+    Return:
+
+        0 if it matches, -1 if not (st->mismatch is set) or the re-read failed
+*/
+static int verify(struct stream_state *st, Cpa8U *data, uint64_t len)
+{
+    uint64_t off = st->dcpr_produced;
+
+    while (len)
+    {
+        Cpa8U *ref;
+        uint64_t n;
+
+        if (off >= st->win_start && off < st->win_start + st->win_len) {
+            n = MIN(len, st->win_start + st->win_len - off);
+            ref = st->win + (off - st->win_start);
+        } else {
+            n = MIN(len, DEFAULT_BUF_SIZE);
+            if (read_full(st->src_fd, st->scratch, n, st->src_off + off) < 0) {
+                MG_LOG_PRINT(g_log_fd, "Stream: re-read failed at offset %lu of [%s]\n",
+                        off, st->ctx->src_data->filename);
+                st->mismatch = off;
+                return -1;
+            }
+            st->reread += n;
+            ref = st->scratch;
+        }
+
+        if (memcmp(ref, data, n)) {
+            uint64_t i = 0;
+
+            while (ref[i] == data[i])
+            {
+                i++;
+            }
+
+            st->mismatch = off + i;
+            return -1;
+        }
+
+        off += n;
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        stage_output (static)
+
+    Description:
+
+        Takes one compression request's output out of the dest SGL: into the staging
+        buffer for the decompressor, or onto the end of the spill file
+
+    Parameters:
+
+        st      -   Ptr to the stream state
+        sgls    -   Ptr to the sgl container
+        len     -   Bytes the request produced
+
+    Return:
+
+        0 on success, -1 on failure
+*/
+static int stage_output(struct stream_state *st, struct sgl_container *sgls, Cpa32U len)
+{
+    if (st->spill_fd >= 0) {
+        if (copy_sgl_to_mem(sgls->dest_sgl, st->dbuf, DEST_BUF_SIZE, len) != len ||
+                write_full(st->spill_fd, st->dbuf, len, st->cpr_produced) < 0) {
+            MG_LOG_PRINT(g_log_fd, "Stream: could not write the spill file for [%s]\n", st->ctx->src_data->filename);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    // Drop what the decompressor has consumed once the staging buffer would overflow
+    if (st->cb_len + len > STREAM_CBUF_SIZE) {
+        uint64_t drop = st->dcpr_consumed - st->cb_start;
+
+        memmove(st->cbuf, st->cbuf + drop, st->cb_len - drop);
+        st->cb_len -= drop;
+        st->cb_start = st->dcpr_consumed;
+
+        if (st->cb_len + len > STREAM_CBUF_SIZE) {
+            MG_LOG_PRINT(g_log_fd, "Stream: decompressor fell behind on [%s]\n", st->ctx->src_data->filename);
+            return -1;
+        }
+    }
+
+    if (copy_sgl_to_mem(sgls->dest_sgl, st->cbuf + st->cb_len, DEST_BUF_SIZE, len) != len) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from dest SGL to memory buffer\n");
+        return -1;
+    }
+
+    st->cb_len += len;
+
+    return 0;
+}
+
+/*
+    Function:
+
+        stage_input (static)
+
+    Description:
+
+        Makes sure the staging buffer holds the next len compressed bytes for the
+        decompressor, reading them back from the spill file if there is one
+
+    Parameters:
+
+        st  -   Ptr to the stream state
+        len -   Bytes the next decompression request needs
+
+    Return:
+
+        0 on success, -1 on failure
+*/
+static int stage_input(struct stream_state *st, uint64_t len)
+{
+    if (st->dcpr_consumed >= st->cb_start && st->dcpr_consumed + len <= st->cb_start + st->cb_len) {
+        return 0;
+    }
+
+    if (st->spill_fd < 0) {
+        MG_LOG_PRINT(g_log_fd, "Stream: compressed bytes at %lu are no longer staged\n", st->dcpr_consumed);
+        return -1;
+    }
+
+    st->cb_start = st->dcpr_consumed;
+    st->cb_len = MIN(STREAM_CBUF_SIZE, st->cpr_produced - st->cb_start);
+
+    if (read_full(st->spill_fd, st->cbuf, st->cb_len, st->cb_start) < 0) {
+        MG_LOG_PRINT(g_log_fd, "Stream: could not read back the spill file for [%s]\n", st->ctx->src_data->filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Function:
+
+        stream_drain (static)
+
+    Description:
+
+        Decompresses staged output and verifies it. Until final, the last 64KB is
+        held back, so the requests are the ones the verify loop in meatjet() would
+        send: 64KB SYNC pieces and one FINAL. The dest SGL's first buffer may be
+        holding a forced OBS for the compressor, so it is put back afterwards
+
+    Parameters:
+
+        st      -   Ptr to the stream state
+        sgls    -   Ptr to the sgl container
+        iNum    -   Instance the context runs on
+        final   -   Compression is done, drain everything
+
+    Return:
+
+        Status of the decompression. st->fail_code is set for compare/size failures
+*/
+static CpaStatus stream_drain(struct stream_state *st, struct sgl_container *sgls, Cpa32U iNum, bool final)
+{
+    struct context *ctx = st->ctx;
+    CpaStatus status = CPA_STATUS_SUCCESS;
+    CpaDcFlush flush;
+    Cpa32U cpr_dest_len;
+    Cpa32U job_size;
+
+    cpr_dest_len = sgls->dest_sgl->pBuffers[0].dataLenInBytes;
+    sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
+
+    wd_stage(WD_DECOMPRESS);
+
+    while ((st->cpr_produced - st->dcpr_consumed) > DEFAULT_BUF_SIZE ||
+            (final && (st->dcpr_consumed < st->cpr_produced || ctx->dcpr_results.status == CPA_DC_OVERFLOW)))
+    {
+        if ((st->cpr_produced - st->dcpr_consumed) > DEFAULT_BUF_SIZE) {
+            job_size = DEFAULT_BUF_SIZE;
+            flush = CPA_DC_FLUSH_SYNC;
+        } else {
+            job_size = (st->cpr_produced - st->dcpr_consumed);
+            flush = CPA_DC_FLUSH_FINAL;
+        }
+
+        if (stage_input(st, job_size) < 0) {
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (copy_mem_to_sgl(st->cbuf + (st->dcpr_consumed - st->cb_start), sgls->src_sgl,
+                    DEFAULT_BUF_SIZE, job_size) != job_size) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from dest mem to source SGL\n");
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        credit_acquire(iNum);
+        do {
+            status = cpaDcDecompressData(dcInstances_g[iNum],
+                                     ctx->sessDcprHandle,
+                                     sgls->src_sgl,
+                                     sgls->dest_sgl,
+                                     &(ctx->dcpr_results),
+                                     flush,
+                                     NULL);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->dcpr_results.status);
+
+        if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->dcpr_results.status) {
+            MG_LOG_PRINT(g_log_fd, "Error: decompression failed with status %d\n", ctx->dcpr_results.status);
+            break;
+        }
+
+        if (ctx->dcpr_results.consumed == 0 && ctx->dcpr_results.produced == 0 &&
+                ctx->dcpr_results.status != CPA_DC_OVERFLOW) {
+            MG_LOG_PRINT(g_log_fd, "Error: decompression stalled at compressed offset %lu\n", st->dcpr_consumed);
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (copy_sgl_to_mem(sgls->dest_sgl, st->dbuf, DEFAULT_BUF_SIZE,
+                    ctx->dcpr_results.produced) != ctx->dcpr_results.produced) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data from dest SGL to compare buffer\n");
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (st->dcpr_produced + ctx->dcpr_results.produced > st->size) {
+            st->fail_code = DC_FAIL_SIZE;
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (verify(st, st->dbuf, ctx->dcpr_results.produced) < 0) {
+            st->fail_code = DC_FAIL_DATA;
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        st->dcpr_consumed += ctx->dcpr_results.consumed;
+        st->dcpr_produced += ctx->dcpr_results.produced;
+
+        if (CPA_DC_OVERFLOW == ctx->dcpr_results.status) {
+            for (uint32_t n = 0; n < sgls->dest_sgl->numBuffers; n++) {
+                sgls->dest_sgl->pBuffers[n].dataLenInBytes = DEFAULT_BUF_SIZE;
+            }
+        }
+    }
+
+    sgls->dest_sgl->pBuffers[0].dataLenInBytes = cpr_dest_len;
+
+    return status;
+}
+
+/*
+    Function:
+
+        stream_log_fail (static)
+
+    Description:
+
+        Logs a streamed context's failure. The buffers mg_log() would dump don't
+        exist, so this records the 64-bit counters and where the data went wrong
+
+    Parameters:
+
+        st  -   Ptr to the stream state
+
+    Return:
+
+        none
+*/
+static void stream_log_fail(struct stream_state *st)
+{
+    struct context *ctx = st->ctx;
+
+    switch (st->fail_code)
+    {
+        case DC_FAIL_DATA:
+            MG_LOG_PRINT(g_log_fd, "\n\n\t******** DATA COMPARE ERROR ********\n");
+            break;
+        case DC_FAIL_SIZE:
+            MG_LOG_PRINT(g_log_fd, "\n\n\t******** INCORRECT DECOMP SIZE ********\n");
+            break;
+        default:
+            MG_LOG_PRINT(g_log_fd, "\n\n\t******** CRC CHECKSUM ERROR ********\n");
+            break;
+    }
+
+    MG_LOG_PRINT(g_log_fd, " ******** File [%s] (streamed, %lu bytes)\n", ctx->src_data->filename, st->size);
+    MG_LOG_PRINT(g_log_fd, " *  CompLevel %u, %s, %s, %s %u\n", ctx->sessCprSetupData.compLevel,
+            ctx->sessCprSetupData.huffType == CPA_DC_HT_STATIC ? "STATIC" : "DYNAMIC",
+            ctx->sessCprSetupData.sessState == CPA_DC_STATEFUL ? "STATEFUL" : "STATELESS",
+            ctx->underflow ? "IBC" : "OBS", ctx->underflow ? ctx->uf_ibc : ctx->obs);
+    MG_LOG_PRINT(g_log_fd, " *  Compression consumed %lu, produced %lu, checksum 0x%x (source 0x%x)\n",
+            st->cpr_consumed, st->cpr_produced, ctx->cpr_results.checksum, st->src_crc);
+    MG_LOG_PRINT(g_log_fd, " *  Decompression consumed %lu, produced %lu, checksum 0x%x, status %d\n",
+            st->dcpr_consumed, st->dcpr_produced, ctx->dcpr_results.checksum, ctx->dcpr_results.status);
+    if (st->fail_code == DC_FAIL_DATA) {
+        MG_LOG_PRINT(g_log_fd, " *  First differing byte at source offset %lu\n", st->mismatch);
+    }
+}
+
+/*
+    Function:
+
+        stream_run
+
+    Description:
+
+        meatjet() for a streamed file. Compresses through the window with the same
+        request sizes, flushes and forced OBS/IBC bucket as the in-memory flow, while
+        the decompressor verifies the output behind it. Besides the compare, the CRC
+        of the source as it was read is checked against both sessions' checksums
+
+    Parameters:
+
+        ctx     -   Ptr to the context
+        sgls    -   Ptr to the sgl container
+
+    Return:
+
+        Status of the compress/decompress
+*/
+CpaStatus stream_run(struct context *ctx, struct sgl_container *sgls)
+{
+    struct stream_state st = {};
+    CpaStatus status = CPA_STATUS_FAIL;
+    CpaDcOpData opData = {};
+    uint64_t start = now_ns();
+    Cpa32U iNum;
+    Cpa32U job_size;
+    Cpa32U actual_obs;
+    Cpa32U dest_len;
+    bool target_overflow_complete;
+    bool target_underflow_complete;
+    bool target_req;
+
+    // Streamed contexts are built with no forced OBS/IBC unless one was given
+    target_overflow_complete = ctx->underflow || ctx->obs == 0;
+    target_underflow_complete = !ctx->underflow || ctx->uf_ibc == 0;
+
+    iNum = ctx->inst;
+
+    st.src_fd = -1;
+    st.fail_code = -1;
+    if (stream_open(&st, ctx) < 0) {
+        stream_close(&st);
+        return CPA_STATUS_FAIL;
+    }
+
+    while (st.cpr_consumed < st.size || ctx->cpr_results.status == CPA_DC_OVERFLOW)
+    {
+        // Set potential underflow IBC job sizes
+        if (!target_underflow_complete && (st.cpr_consumed + DEFAULT_BUF_SIZE) >= ctx->uf_ibc) {
+            job_size = (ctx->uf_ibc > st.cpr_consumed) ? (ctx->uf_ibc - st.cpr_consumed) : 0;
+            target_underflow_complete = true;
+        } else {
+            job_size = DEFAULT_BUF_SIZE;
+        }
+
+        if ((job_size + st.cpr_consumed) < st.size) {
+            if (ctx->sessCprSetupData.sessState == CPA_DC_STATEFUL) {
+                opData.flushFlag = CPA_DC_FLUSH_SYNC;
+            } else {
+                opData.flushFlag = CPA_DC_FLUSH_FULL;
+            }
+        } else {
+            job_size = (st.size - st.cpr_consumed);
+            opData.flushFlag = CPA_DC_FLUSH_FINAL;
+        }
+
+        if (CPA_DC_STATELESS == ctx->sessCprSetupData.sessState) {
+            opData.compressAndVerify = CPA_TRUE;
+        }
+
+        if (window_fill(&st, st.cpr_consumed + job_size) < 0) {
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (copy_mem_to_sgl(st.win + (st.cpr_consumed - st.win_start), sgls->src_sgl,
+                    DEFAULT_BUF_SIZE, job_size) != job_size) {
+            MG_LOG_PRINT(g_log_fd, "Error: could not copy all data to the src SGL!\n");
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        // Room for the deflate bound, or the whole buffer for residue after an overflow
+        if (ctx->cpr_results.status == CPA_DC_OVERFLOW) {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEST_BUF_SIZE;
+        } else {
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFLATE_BOUND(job_size);
+        }
+
+        // Set the target overflow condition here
+        target_req = false;
+        if (!target_overflow_complete && (st.cpr_produced + CHUNK_BOUND) >= ctx->obs) {
+            actual_obs = (ctx->obs > st.cpr_produced) ? (ctx->obs - st.cpr_produced) : 0;
+
+            if (actual_obs < MIN_OBS_VALUE) {
+                actual_obs = MIN_OBS_VALUE;
+            }
+
+            sgls->dest_sgl->pBuffers[0].dataLenInBytes = actual_obs;
+
+            target_overflow_complete = true;
+            target_req = true;
+        }
+
+        dest_len = sgls->dest_sgl->pBuffers[0].dataLenInBytes;
+
+        wd_stage(WD_COMPRESS);
+        credit_acquire(iNum);
+        do {
+            status = cpaDcCompressData2(dcInstances_g[iNum],
+                                   ctx->sessCprHandle,
+                                   sgls->src_sgl,
+                                   sgls->dest_sgl,
+                                   &opData,
+                                   &(ctx->cpr_results),
+                                   NULL);
+        } while (credit_retry(iNum, status));
+        credit_release(iNum);
+        health_record(iNum, ctx, status, ctx->cpr_results.status);
+
+        if (CPA_STATUS_SUCCESS != status && CPA_DC_OVERFLOW != ctx->cpr_results.status) {
+            MG_LOG_PRINT(g_log_fd, "Compress Error: status %d [%s]\n", status, ctx->src_data->filename);
+            break;
+        }
+
+        if (stage_output(&st, sgls, ctx->cpr_results.produced) < 0) {
+            status = CPA_STATUS_FAIL;
+            break;
+        }
+
+        if (ctx->cpr_results.status == CPA_DC_OVERFLOW) {
+            meatjet_count_overflow(target_req);
+        }
+
+        st.src_crc = calc_crc32(st.src_crc, st.win + (st.cpr_consumed - st.win_start), ctx->cpr_results.consumed);
+
+        st.cpr_consumed += ctx->cpr_results.consumed;
+        st.cpr_produced += ctx->cpr_results.produced;
+
+        ctx_sig_add(ctx, job_size, dest_len, opData.flushFlag, &(ctx->cpr_results));
+
+        if (st.spill_fd < 0) {
+            status = stream_drain(&st, sgls, iNum, false);
+            if (status != CPA_STATUS_SUCCESS) {
+                break;
+            }
+        }
+    }
+
+    // Set the dest buffer back to the original size for verification
+    sgls->dest_sgl->pBuffers[0].dataLenInBytes = DEFAULT_BUF_SIZE;
+
+    if (status == CPA_STATUS_SUCCESS) {
+        status = stream_drain(&st, sgls, iNum, true);
+    }
+
+    if (status == CPA_STATUS_SUCCESS) {
+        if (st.dcpr_produced != st.size) {
+            st.fail_code = DC_FAIL_SIZE;
+        } else if (ctx->cpr_results.checksum != ctx->dcpr_results.checksum ||
+                ctx->cpr_results.checksum != st.src_crc) {
+            st.fail_code = DC_FAIL_CRC;
+        } else if (ctx->src_data->has_clear_crc && st.src_crc != ctx->src_data->clear_crc32) {
+            MG_LOG_PRINT(g_log_fd, "\n\n\t******** CRC DIFFERS FROM PACK INDEX ********\n");
+            st.fail_code = DC_FAIL_CRC;
+        }
+
+        if (st.fail_code >= 0) {
+            status = CPA_STATUS_FAIL;
+        }
+    }
+
+    if (st.fail_code >= 0) {
+        stream_log_fail(&st);
+    }
+
+    pthread_mutex_lock(&g_stream.mutex);
+    g_stream.ctxs++;
+    g_stream.bytes += st.cpr_consumed;
+    g_stream.cpr_bytes += st.cpr_produced;
+    g_stream.reread += st.reread;
+    g_stream.ns += now_ns() - start;
+    pthread_mutex_unlock(&g_stream.mutex);
+
+    stream_close(&st);
+
+    return status;
+}
+
+/*
+    Function:
+
+        stream_print_stats
+
+    Description:
+
+        Prints how much was streamed and how much of it had to be re-read to verify
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void stream_print_stats()
+{
+    if (g_stream.ctxs == 0) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Streaming: %lu context(s), %.2f MB through a %lu MB window in %.3f s (%.1f MB/s per context)\n",
+            g_stream.ctxs, g_stream.bytes / (1024.0 * 1024.0), g_stream.window >> 20, g_stream.ns / 1e9,
+            g_stream.ns ? (g_stream.bytes / (1024.0 * 1024.0)) / (g_stream.ns / 1e9) : 0.0);
+    MG_LOG_PRINT(g_log_fd, "        %.2f MB compressed%s%s, %.2f MB verified by re-reading the source\n\n",
+            g_stream.cpr_bytes / (1024.0 * 1024.0), g_stream.spill_dir ? ", spilled to " : "",
+            g_stream.spill_dir ? g_stream.spill_dir : "", g_stream.reread / (1024.0 * 1024.0));
+}
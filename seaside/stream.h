@@ -0,0 +1,13 @@
+#pragma once
+
+#include "cpr.h"
+#include "context.h"
+
+// Compressed bytes staged between the compressor and the decompressor: one request's
+// output on top of the 64KB the verify loop holds back for its FINAL request
+#define STREAM_CBUF_SIZE    (DEST_BUF_SIZE + DEFAULT_BUF_SIZE)
+
+void stream_init(struct mg_options *opt);
+bool stream_wanted(struct mg_options *opt, uint64_t size);
+CpaStatus stream_run(struct context *ctx, struct sgl_container *sgls);
+void stream_print_stats();
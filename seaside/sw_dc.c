@@ -0,0 +1,1107 @@
+/*
+    Software DC backend (SW_DC=1, SW_DC=only)
+
+    The subset of the cpaDc* API meatjet uses, on zlib. A software instance handle is the
+    address of an entry in g_sw_inst, and its sessions live in the session memory the caller
+    allocated from cpaDcGetSessionSize, so contexts, chunk engines and the stream path run on
+    it unchanged. Calls on any other handle go to the QAT library.
+
+    Semantics follow the hardware where meatjet can see them:
+        - stateless compress requests are independent deflate runs, and on overflow consume
+          the longest prefix that fits, so a resubmit of the rest carries on
+        - stateful sessions keep one deflate/inflate stream; SYNC, FULL and FINAL map to
+          Z_SYNC_FLUSH, Z_FULL_FLUSH and Z_FINISH
+        - consumed/produced are exact, and a request that fills its output exactly is only an
+          overflow if there really is more output; decompression finds out by inflating one
+          more byte, which is handed out at the start of the next request
+        - the CRC32 runs over the cleartext, across a stateful session's requests, and is
+          seeded from results->checksum for stateless ones
+    compLevel is the zlib level, static huffman is Z_FIXED, and the window is always 32KB.
+
+    Every request's time is counted per backend, so print_summary can put HW and SW side by side.
+    With --dc-emu, dc_emu.c decides when each request completes (see there)
+*/
+#define SW_DC_IMPL
+#include <time.h>
+#include <string.h>
+#include <sys/param.h>
+#include <zlib.h>
+#include "cpr.h"
+#include "dc_emu.h"
+
+extern CpaInstanceHandle *dcInstances_g;
+extern Cpa16U numDcInstances_g;
+extern FILE *g_log_fd;
+
+#define SW_DC_SESSION_MAGIC     (0x53574443)
+
+enum sw_dc_backend {
+    SW_DC_HW,
+    SW_DC_SW,
+    SW_DC_BACKENDS,
+};
+
+enum sw_dc_op {
+    SW_DC_CPR,
+    SW_DC_DCPR,
+    SW_DC_OPS,
+};
+
+enum sw_dc_stream {
+    SW_DC_NONE,
+    SW_DC_DEFLATE,
+    SW_DC_INFLATE,
+};
+
+// Nothing behind a software instance handle but its address
+struct sw_dc_instance {
+    uint32_t id;
+};
+
+struct sw_dc_session {
+    uint32_t magic;
+    CpaDcSessionSetupData sd;
+
+    CpaDcCallbackFn cb;
+
+    z_stream z;
+    enum sw_dc_stream kind;
+    bool ended;
+    Cpa32U crc;
+
+    // A decompressed byte the last request had no room for, and whether the stream ended with it
+    bool has_carry;
+    bool carry_end;
+    Cpa8U carry;
+};
+
+static struct sw_dc_instance g_sw_inst[SW_DC_MAX_INSTANCES];
+
+static struct {
+    // The hardware list startDcServices built, put back before stopDcServices walks it
+    CpaInstanceHandle *hw_inst;
+    Cpa16U hw_num;
+    CpaInstanceHandle *all_inst;
+    uint32_t sw_num;
+    bool attached;
+
+    struct {
+        uint64_t reqs;
+        uint64_t overflows;
+        uint64_t in;
+        uint64_t out;
+        uint64_t ns;
+    } op[SW_DC_BACKENDS][SW_DC_OPS];
+} g_sw_dc;
+
+#ifdef MG_SW_DC_ONLY
+
+//
+// No QAT library in a SW_DC=only build: no hardware instances, and ordinary memory for buffers
+//
+
+CpaInstanceHandle *dcInstances_g = NULL;
+Cpa16U numDcInstances_g = 0;
+
+CpaStatus qaeMemInit()
+{
+    return CPA_STATUS_SUCCESS;
+}
+
+void qaeMemDestroy()
+{
+}
+
+void *qaeMemAllocNUMA(size_t size, int node, size_t phys_alignment_byte)
+{
+    void *ptr;
+
+    (void)node;
+
+    if (posix_memalign(&ptr, phys_alignment_byte < sizeof(void *) ? sizeof(void *) : phys_alignment_byte,
+                       size ? size : 1)) {
+        return NULL;
+    }
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void qaeMemFreeNUMA(void **ptr)
+{
+    free(*ptr);
+    *ptr = NULL;
+}
+
+CpaStatus icp_sal_userStartMultiProcess(const char *pProcessName, CpaBoolean limitDevAccess)
+{
+    (void)pProcessName;
+    (void)limitDevAccess;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus icp_sal_userStop(void)
+{
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus startDcServices(Cpa32U buffSize)
+{
+    (void)buffSize;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus stopDcServices()
+{
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus dcCreatePollingThreadsIfPollingIsEnabled(void)
+{
+    return CPA_STATUS_SUCCESS;
+}
+
+#endif
+
+/*
+    Function:
+
+        sw_dc_attach
+
+    Description:
+
+        Appends the software instances to dcInstances_g, after the hardware ones. Called once
+        the hardware polling threads are up, so they never see a software handle
+
+    Parameters:
+
+        opt     -   Ptr to the options (--sw-instances)
+
+    Return:
+
+        CPA_STATUS_SUCCESS, or CPA_STATUS_FAIL if there would be no instances at all
+*/
+CpaStatus sw_dc_attach(struct mg_options *opt)
+{
+    uint32_t num = opt->sw_instances;
+
+#ifdef MG_SW_DC_ONLY
+    if (num == 0) {
+        num = SW_DC_DEFAULT_INSTANCES;
+    }
+#endif
+    if (num > SW_DC_MAX_INSTANCES) {
+        MG_LOG_PRINT(g_log_fd, "Software instances capped at %u\n", SW_DC_MAX_INSTANCES);
+        num = SW_DC_MAX_INSTANCES;
+    }
+    if (num + numDcInstances_g == 0) {
+        MG_LOG_PRINT(g_log_fd, "Error: no DC instances\n");
+        return CPA_STATUS_FAIL;
+    }
+    if (num == 0) {
+        return CPA_STATUS_SUCCESS;
+    }
+
+    g_sw_dc.all_inst = (CpaInstanceHandle *)calloc(numDcInstances_g + num, sizeof(CpaInstanceHandle));
+    if (g_sw_dc.all_inst == NULL) {
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the instance list\n");
+        return CPA_STATUS_FAIL;
+    }
+
+    for (uint32_t i = 0; i < numDcInstances_g; i++)
+    {
+        g_sw_dc.all_inst[i] = dcInstances_g[i];
+    }
+    for (uint32_t i = 0; i < num; i++)
+    {
+        g_sw_inst[i].id = i;
+        g_sw_dc.all_inst[numDcInstances_g + i] = (CpaInstanceHandle)&g_sw_inst[i];
+    }
+
+    if (dc_emu_start(opt, num) < 0) {
+        free(g_sw_dc.all_inst);
+        g_sw_dc.all_inst = NULL;
+        return CPA_STATUS_FAIL;
+    }
+
+    g_sw_dc.hw_inst = dcInstances_g;
+    g_sw_dc.hw_num = numDcInstances_g;
+    g_sw_dc.sw_num = num;
+    g_sw_dc.attached = true;
+
+    dcInstances_g = g_sw_dc.all_inst;
+    numDcInstances_g += num;
+
+    MG_LOG_PRINT(g_log_fd, "DC instances: %u hardware, %u software (zlib %s)\n", g_sw_dc.hw_num, num, zlibVersion());
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        sw_dc_detach
+
+    Description:
+
+        Puts the hardware instance list back for stopDcServices. Safe to call when not attached
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void sw_dc_detach()
+{
+    if (!g_sw_dc.attached) {
+        return;
+    }
+
+    dc_emu_stop();
+
+    dcInstances_g = g_sw_dc.hw_inst;
+    numDcInstances_g = g_sw_dc.hw_num;
+    free(g_sw_dc.all_inst);
+    g_sw_dc.all_inst = NULL;
+    g_sw_dc.attached = false;
+}
+
+bool sw_dc_is_instance(CpaInstanceHandle inst)
+{
+    return (struct sw_dc_instance *)inst >= &g_sw_inst[0] &&
+           (struct sw_dc_instance *)inst < &g_sw_inst[SW_DC_MAX_INSTANCES];
+}
+
+/*
+    Function:
+
+        count_req (static)
+
+    Description:
+
+        Adds one request to its backend's totals
+
+    Parameters:
+
+        backend -   SW_DC_HW or SW_DC_SW
+        op      -   SW_DC_CPR or SW_DC_DCPR
+        res     -   Ptr to the request's results
+        ns      -   Time the request took
+
+    Return:
+
+        none
+*/
+static void count_req(enum sw_dc_backend backend, enum sw_dc_op op, CpaDcRqResults *res, uint64_t ns)
+{
+    __sync_fetch_and_add(&g_sw_dc.op[backend][op].reqs, 1);
+    __sync_fetch_and_add(&g_sw_dc.op[backend][op].in, res->consumed);
+    __sync_fetch_and_add(&g_sw_dc.op[backend][op].out, res->produced);
+    __sync_fetch_and_add(&g_sw_dc.op[backend][op].ns, ns);
+    if (res->status == CPA_DC_OVERFLOW) {
+        __sync_fetch_and_add(&g_sw_dc.op[backend][op].overflows, 1);
+    }
+}
+
+/*
+    Function:
+
+        sgl_flat (static)
+
+    Description:
+
+        A contiguous view of an SGL: its buffer when it has only one, else a heap copy
+        (or, for output, uninitialised heap memory) that sgl_unflat gives back
+
+    Parameters:
+
+        list    -   Ptr to the SGL
+        len     -   Returns the SGL's total length
+        copy    -   Copy the SGL's data in
+
+    Return:
+
+        Ptr to the data, or NULL
+*/
+static Cpa8U *sgl_flat(CpaBufferList *list, Cpa32U *len, bool copy)
+{
+    Cpa32U total = 0;
+    Cpa8U *flat;
+
+    for (uint32_t i = 0; i < list->numBuffers; i++)
+    {
+        total += list->pBuffers[i].dataLenInBytes;
+    }
+    *len = total;
+
+    if (list->numBuffers == 1) {
+        return list->pBuffers[0].pData;
+    }
+
+    flat = (Cpa8U *)malloc(total ? total : 1);
+    if (flat && copy) {
+        for (uint32_t i = 0, off = 0; i < list->numBuffers; off += list->pBuffers[i].dataLenInBytes, i++)
+        {
+            memcpy(flat + off, list->pBuffers[i].pData, list->pBuffers[i].dataLenInBytes);
+        }
+    }
+
+    return flat;
+}
+
+/*
+    Function:
+
+        sgl_unflat (static)
+
+    Description:
+
+        Releases a sgl_flat view, first scattering len bytes of it back into the SGL if asked
+
+    Parameters:
+
+        list    -   Ptr to the SGL
+        flat    -   Ptr returned by sgl_flat
+        len     -   Bytes to scatter back, 0 for none
+
+    Return:
+
+        none
+*/
+static void sgl_unflat(CpaBufferList *list, Cpa8U *flat, Cpa32U len)
+{
+    if (list->numBuffers == 1) {
+        return;
+    }
+
+    for (uint32_t i = 0, off = 0; i < list->numBuffers && off < len; off += list->pBuffers[i].dataLenInBytes, i++)
+    {
+        memcpy(list->pBuffers[i].pData, flat + off, MIN(len - off, list->pBuffers[i].dataLenInBytes));
+    }
+    free(flat);
+}
+
+/*
+    Function:
+
+        sess_stream (static)
+
+    Description:
+
+        Makes sure the session has a zlib stream of the kind asked for, switching it if the
+        session was last used the other way
+
+    Parameters:
+
+        sess    -   Ptr to the software session
+        kind    -   SW_DC_DEFLATE or SW_DC_INFLATE
+
+    Return:
+
+        zlib status
+*/
+static int sess_stream(struct sw_dc_session *sess, enum sw_dc_stream kind)
+{
+    int level;
+    int ret;
+
+    if (sess->kind == kind) {
+        return Z_OK;
+    }
+
+    if (sess->kind == SW_DC_DEFLATE) {
+        deflateEnd(&sess->z);
+    } else if (sess->kind == SW_DC_INFLATE) {
+        inflateEnd(&sess->z);
+    }
+    sess->kind = SW_DC_NONE;
+
+    memset(&sess->z, 0, sizeof(sess->z));
+    if (kind == SW_DC_DEFLATE) {
+        level = MAX(1, MIN(9, (int)sess->sd.compLevel));
+        ret = deflateInit2(&sess->z, level, Z_DEFLATED, -15, 8,
+                           sess->sd.huffType == CPA_DC_HT_STATIC ? Z_FIXED : Z_DEFAULT_STRATEGY);
+    } else {
+        ret = inflateInit2(&sess->z, -15);
+    }
+    if (ret == Z_OK) {
+        sess->kind = kind;
+    }
+    sess->ended = false;
+    sess->crc = 0;
+    sess->has_carry = false;
+
+    return ret;
+}
+
+/*
+    Function:
+
+        stateless_try (static)
+
+    Description:
+
+        Compresses in[0..len) as a request of its own, and says whether the whole of it fit
+
+    Parameters:
+
+        sess    -   Ptr to the software session
+        in      -   Ptr to the input
+        len     -   Input bytes
+        out     -   Ptr to the output
+        cap     -   Output capacity
+        flush   -   Z_FULL_FLUSH, or Z_FINISH for the last request
+
+    Return:
+
+        Bytes produced, or -1 if the input didn't all fit
+*/
+static int64_t stateless_try(struct sw_dc_session *sess, Cpa8U *in, Cpa32U len, Cpa8U *out, Cpa32U cap, int flush)
+{
+    unsigned pending = 0;
+    int bits = 0;
+    bool fit;
+    int ret;
+
+    deflateReset(&sess->z);
+    sess->z.next_in = in;
+    sess->z.avail_in = len;
+    sess->z.next_out = out;
+    sess->z.avail_out = cap;
+
+    ret = deflate(&sess->z, flush);
+    if (flush == Z_FINISH) {
+        fit = ret == Z_STREAM_END;
+    } else {
+        deflatePending(&sess->z, &pending, &bits);
+        fit = sess->z.avail_in == 0 && pending == 0 && bits == 0 && sess->z.avail_out > 0;
+    }
+
+    return fit ? (int64_t)(cap - sess->z.avail_out) : -1;
+}
+
+/*
+    Function:
+
+        compress_stateless (static)
+
+    Description:
+
+        Stateless compression request. If it all doesn't fit, the longest prefix that does
+        is compressed and the request reports an overflow with that much consumed
+
+    Parameters:
+
+        sess    -   Ptr to the software session
+        in, len -   Input
+        out, cap-   Output
+        flush   -   Request's flush flag
+        res     -   Ptr to the results, checksum seeded by the caller
+
+    Return:
+
+        none
+*/
+static void compress_stateless(struct sw_dc_session *sess, Cpa8U *in, Cpa32U len, Cpa8U *out, Cpa32U cap,
+                               CpaDcFlush flush, CpaDcRqResults *res)
+{
+    int zflush = flush == CPA_DC_FLUSH_FINAL ? Z_FINISH : Z_FULL_FLUSH;
+    int64_t produced;
+    Cpa32U lo = 0;
+    Cpa32U hi = len;
+
+    produced = stateless_try(sess, in, len, out, cap, zflush);
+    if (produced >= 0) {
+        res->consumed = len;
+        res->produced = produced;
+        res->endOfLastBlock = zflush == Z_FINISH ? CPA_TRUE : CPA_FALSE;
+        res->checksum = crc32(res->checksum, in, len);
+        return;
+    }
+
+    // Largest prefix that fits as a non-final request
+    while (lo < hi)
+    {
+        Cpa32U mid = lo + (hi - lo + 1) / 2;
+
+        if (stateless_try(sess, in, mid, out, cap, Z_FULL_FLUSH) >= 0) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    res->consumed = lo;
+    res->produced = lo ? stateless_try(sess, in, lo, out, cap, Z_FULL_FLUSH) : 0;
+    res->status = CPA_DC_OVERFLOW;
+    res->checksum = crc32(res->checksum, in, lo);
+}
+
+/*
+    Function:
+
+        compress_stateful (static)
+
+    Description:
+
+        Stateful compression request on the session's deflate stream. Filling the output
+        is always reported as an overflow, since zlib may still hold input internally; a
+        resubmit with nothing left to do just produces nothing
+
+    Parameters:
+
+        sess    -   Ptr to the software session
+        in, len -   Input
+        out, cap-   Output
+        flush   -   Request's flush flag
+        res     -   Ptr to the results
+
+    Return:
+
+        none
+*/
+static void compress_stateful(struct sw_dc_session *sess, Cpa8U *in, Cpa32U len, Cpa8U *out, Cpa32U cap,
+                              CpaDcFlush flush, CpaDcRqResults *res)
+{
+    int zflush;
+    int ret;
+
+    if (sess->ended) {
+        deflateReset(&sess->z);
+        sess->ended = false;
+        sess->crc = 0;
+    }
+
+    switch (flush) {
+        case CPA_DC_FLUSH_FINAL:
+            zflush = Z_FINISH;
+            break;
+        case CPA_DC_FLUSH_FULL:
+            zflush = Z_FULL_FLUSH;
+            break;
+        case CPA_DC_FLUSH_SYNC:
+            zflush = Z_SYNC_FLUSH;
+            break;
+        default:
+            zflush = Z_NO_FLUSH;
+            break;
+    }
+
+    sess->z.next_in = in;
+    sess->z.avail_in = len;
+    sess->z.next_out = out;
+    sess->z.avail_out = cap;
+
+    ret = deflate(&sess->z, zflush);
+
+    res->consumed = len - sess->z.avail_in;
+    res->produced = cap - sess->z.avail_out;
+    sess->crc = crc32(sess->crc, in, res->consumed);
+    res->checksum = sess->crc;
+
+    if (ret == Z_STREAM_END) {
+        res->endOfLastBlock = CPA_TRUE;
+        sess->ended = true;
+    } else if (ret == Z_STREAM_ERROR) {
+        res->status = CPA_DC_FATALERR;
+    } else if (sess->z.avail_in || sess->z.avail_out == 0 || zflush == Z_FINISH) {
+        res->status = CPA_DC_OVERFLOW;
+    }
+}
+
+/*
+    Function:
+
+        decompress (static)
+
+    Description:
+
+        Decompression request on the session's inflate stream. When the output fills with
+        the input used up, one more byte is inflated to tell an exact fit from an overflow;
+        if there was one, it is the first byte of the next request's output
+
+    Parameters:
+
+        sess    -   Ptr to the software session
+        in, len -   Input
+        out, cap-   Output
+        res     -   Ptr to the results
+
+    Return:
+
+        none
+*/
+static void decompress(struct sw_dc_session *sess, Cpa8U *in, Cpa32U len, Cpa8U *out, Cpa32U cap, CpaDcRqResults *res)
+{
+    Cpa32U lead = 0;
+    int ret = Z_OK;
+
+    if (sess->sd.sessState == CPA_DC_STATELESS || sess->ended) {
+        inflateReset(&sess->z);
+        sess->ended = false;
+        sess->has_carry = false;
+        sess->crc = sess->sd.sessState == CPA_DC_STATELESS ? res->checksum : 0;
+    }
+
+    if (sess->has_carry && cap > 0) {
+        out[0] = sess->carry;
+        lead = 1;
+        sess->has_carry = false;
+        if (sess->carry_end) {
+            sess->carry_end = false;
+            ret = Z_STREAM_END;
+        }
+    }
+
+    sess->z.next_in = in;
+    sess->z.avail_in = len;
+    sess->z.next_out = out + lead;
+    sess->z.avail_out = cap - lead;
+
+    if (ret != Z_STREAM_END) {
+        ret = inflate(&sess->z, Z_SYNC_FLUSH);
+
+        if (ret == Z_OK && sess->z.avail_out == 0 && sess->z.avail_in == 0 && !sess->has_carry) {
+            sess->z.next_out = &sess->carry;
+            sess->z.avail_out = 1;
+            ret = inflate(&sess->z, Z_SYNC_FLUSH);
+            if (sess->z.avail_out == 0) {
+                sess->has_carry = true;
+                sess->carry_end = ret == Z_STREAM_END;
+                ret = Z_OK;
+            }
+            sess->z.avail_out = 0;
+        }
+    }
+
+    res->consumed = len - sess->z.avail_in;
+    res->produced = cap - sess->z.avail_out;
+    sess->crc = crc32(sess->crc, out, res->produced);
+    res->checksum = sess->crc;
+
+    if (ret == Z_STREAM_END) {
+        res->endOfLastBlock = CPA_TRUE;
+        sess->ended = true;
+    } else if (ret == Z_DATA_ERROR) {
+        res->status = CPA_DC_INVALID_CODE;
+    } else if (ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR || ret == Z_NEED_DICT) {
+        res->status = CPA_DC_FATALERR;
+    } else if (sess->has_carry || (sess->z.avail_in && sess->z.avail_out == 0)) {
+        res->status = CPA_DC_OVERFLOW;
+    }
+}
+
+/*
+    Function:
+
+        sw_dc_get_session_size
+
+    Description:
+
+        cpaDcGetSessionSize. A software session is held in place in the session memory
+
+    Parameters:
+
+        As cpaDcGetSessionSize
+
+    Return:
+
+        As cpaDcGetSessionSize
+*/
+CpaStatus sw_dc_get_session_size(CpaInstanceHandle inst, CpaDcSessionSetupData *sd, Cpa32U *sess_size, Cpa32U *ctx_size)
+{
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcGetSessionSize(inst, sd, sess_size, ctx_size);
+#endif
+    }
+
+    (void)sd;
+    *sess_size = sizeof(struct sw_dc_session);
+    if (ctx_size) {
+        *ctx_size = 0;
+    }
+
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus sw_dc_init_session(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaDcSessionSetupData *sd,
+                             CpaBufferList *ctx_buf, CpaDcCallbackFn cb)
+{
+    struct sw_dc_session *sw = (struct sw_dc_session *)sess;
+
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcInitSession(inst, sess, sd, ctx_buf, cb);
+#endif
+    }
+
+    (void)ctx_buf;
+
+    // Without the emulator requests complete before they return, so there's nothing to call back
+    if (cb != NULL && !dc_emu_enabled()) {
+        return CPA_STATUS_UNSUPPORTED;
+    }
+
+    memset(sw, 0, sizeof(*sw));
+    sw->magic = SW_DC_SESSION_MAGIC;
+    sw->sd = *sd;
+    sw->cb = cb;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus sw_dc_remove_session(const CpaInstanceHandle inst, CpaDcSessionHandle sess)
+{
+    struct sw_dc_session *sw = (struct sw_dc_session *)sess;
+
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcRemoveSession(inst, sess);
+#endif
+    }
+
+    if (sw == NULL || sw->magic != SW_DC_SESSION_MAGIC) {
+        return CPA_STATUS_INVALID_PARAM;
+    }
+
+    if (sw->kind == SW_DC_DEFLATE) {
+        deflateEnd(&sw->z);
+    } else if (sw->kind == SW_DC_INFLATE) {
+        inflateEnd(&sw->z);
+    }
+    sw->kind = SW_DC_NONE;
+    sw->magic = 0;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        sw_dc_reset_session
+
+    Description:
+
+        cpaDcResetSession. Puts the session's stream back to the start without freeing it,
+        for a session reused across inputs
+
+    Parameters:
+
+        As cpaDcResetSession
+
+    Return:
+
+        As cpaDcResetSession
+*/
+CpaStatus sw_dc_reset_session(const CpaInstanceHandle inst, CpaDcSessionHandle sess)
+{
+    struct sw_dc_session *sw = (struct sw_dc_session *)sess;
+
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcResetSession(inst, sess);
+#endif
+    }
+
+    if (sw == NULL || sw->magic != SW_DC_SESSION_MAGIC) {
+        return CPA_STATUS_INVALID_PARAM;
+    }
+
+    if (sw->kind == SW_DC_DEFLATE) {
+        deflateReset(&sw->z);
+    } else if (sw->kind == SW_DC_INFLATE) {
+        inflateReset(&sw->z);
+    }
+    sw->ended = false;
+    sw->crc = 0;
+    sw->has_carry = false;
+    sw->carry_end = false;
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        sw_dc_compress
+
+    Description:
+
+        cpaDcCompressData2, timed for the backend table
+
+    Parameters:
+
+        As cpaDcCompressData2
+
+    Return:
+
+        As cpaDcCompressData2
+*/
+CpaStatus sw_dc_compress(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaBufferList *src, CpaBufferList *dest,
+                         CpaDcOpData *op, CpaDcRqResults *res, void *tag)
+{
+    struct sw_dc_session *sw = (struct sw_dc_session *)sess;
+    uint64_t start = now_ns();
+    struct dc_emu_req req;
+    bool emu = dc_emu_enabled();
+    Cpa8U *in;
+    Cpa8U *out;
+    Cpa32U len;
+    Cpa32U cap;
+    CpaStatus status;
+
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        status = cpaDcCompressData2(inst, sess, src, dest, op, res, tag);
+        if (status == CPA_STATUS_SUCCESS || res->status == CPA_DC_OVERFLOW) {
+            count_req(SW_DC_HW, SW_DC_CPR, res, now_ns() - start);
+        }
+        return status;
+#endif
+    }
+
+    if (sw == NULL || sw->magic != SW_DC_SESSION_MAGIC || sess_stream(sw, SW_DC_DEFLATE) != Z_OK) {
+        return CPA_STATUS_INVALID_PARAM;
+    }
+
+    in = sgl_flat(src, &len, true);
+    out = sgl_flat(dest, &cap, false);
+    if (in == NULL || out == NULL) {
+        if (in) sgl_unflat(src, in, 0);
+        if (out) sgl_unflat(dest, out, 0);
+        return CPA_STATUS_RESOURCE;
+    }
+
+    if (emu) {
+        status = dc_emu_submit(((struct sw_dc_instance *)inst)->id, len, &req);
+        if (status != CPA_STATUS_SUCCESS) {
+            sgl_unflat(src, in, 0);
+            sgl_unflat(dest, out, 0);
+            return status;
+        }
+    }
+
+    res->status = CPA_DC_OK;
+    res->endOfLastBlock = CPA_FALSE;
+    if (emu && req.fault != CPA_DC_OK) {
+        res->status = req.fault;
+        res->consumed = 0;
+        res->produced = 0;
+    } else if (sw->sd.sessState == CPA_DC_STATELESS) {
+        compress_stateless(sw, in, len, out, cap, op->flushFlag, res);
+    } else {
+        compress_stateful(sw, in, len, out, cap, op->flushFlag, res);
+    }
+
+    sgl_unflat(src, in, 0);
+    sgl_unflat(dest, out, res->produced);
+
+    status = res->status == CPA_DC_OK || res->status == CPA_DC_OVERFLOW ? CPA_STATUS_SUCCESS : CPA_STATUS_FAIL;
+    if (emu) {
+        dc_emu_complete(&req, sw->cb, tag, status);
+    }
+
+    count_req(SW_DC_SW, SW_DC_CPR, res, now_ns() - start);
+
+    return status;
+}
+
+/*
+    Function:
+
+        sw_dc_decompress
+
+    Description:
+
+        cpaDcDecompressData, timed for the backend table. The flush flag makes no difference
+        to zlib's inflate
+
+    Parameters:
+
+        As cpaDcDecompressData
+
+    Return:
+
+        As cpaDcDecompressData
+*/
+CpaStatus sw_dc_decompress(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaBufferList *src, CpaBufferList *dest,
+                           CpaDcRqResults *res, CpaDcFlush flush, void *tag)
+{
+    struct sw_dc_session *sw = (struct sw_dc_session *)sess;
+    uint64_t start = now_ns();
+    struct dc_emu_req req;
+    bool emu = dc_emu_enabled();
+    Cpa8U *in;
+    Cpa8U *out;
+    Cpa32U len;
+    Cpa32U cap;
+    CpaStatus status;
+
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        status = cpaDcDecompressData(inst, sess, src, dest, res, flush, tag);
+        if (status == CPA_STATUS_SUCCESS || res->status == CPA_DC_OVERFLOW) {
+            count_req(SW_DC_HW, SW_DC_DCPR, res, now_ns() - start);
+        }
+        return status;
+#endif
+    }
+
+    (void)flush;
+
+    if (sw == NULL || sw->magic != SW_DC_SESSION_MAGIC || sess_stream(sw, SW_DC_INFLATE) != Z_OK) {
+        return CPA_STATUS_INVALID_PARAM;
+    }
+
+    in = sgl_flat(src, &len, true);
+    out = sgl_flat(dest, &cap, false);
+    if (in == NULL || out == NULL) {
+        if (in) sgl_unflat(src, in, 0);
+        if (out) sgl_unflat(dest, out, 0);
+        return CPA_STATUS_RESOURCE;
+    }
+
+    if (emu) {
+        status = dc_emu_submit(((struct sw_dc_instance *)inst)->id, cap, &req);
+        if (status != CPA_STATUS_SUCCESS) {
+            sgl_unflat(src, in, 0);
+            sgl_unflat(dest, out, 0);
+            return status;
+        }
+    }
+
+    res->status = CPA_DC_OK;
+    res->endOfLastBlock = CPA_FALSE;
+    if (emu && req.fault != CPA_DC_OK) {
+        res->status = req.fault;
+        res->consumed = 0;
+        res->produced = 0;
+    } else {
+        decompress(sw, in, len, out, cap, res);
+    }
+
+    sgl_unflat(src, in, 0);
+    sgl_unflat(dest, out, res->produced);
+
+    status = res->status == CPA_DC_OK || res->status == CPA_DC_OVERFLOW ? CPA_STATUS_SUCCESS : CPA_STATUS_FAIL;
+    if (emu) {
+        dc_emu_complete(&req, sw->cb, tag, status);
+    }
+
+    count_req(SW_DC_SW, SW_DC_DCPR, res, now_ns() - start);
+
+    return status;
+}
+
+CpaStatus sw_dc_meta_size(const CpaInstanceHandle inst, Cpa32U num_bufs, Cpa32U *size)
+{
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcBufferListGetMetaSize(inst, num_bufs, size);
+#endif
+    }
+
+    // Unused, but callers allocate it, so keep it non-zero
+    *size = 64 * (num_bufs ? num_bufs : 1);
+
+    return CPA_STATUS_SUCCESS;
+}
+
+CpaStatus sw_dc_instance_info2(const CpaInstanceHandle inst, CpaInstanceInfo2 *info)
+{
+    if (!sw_dc_is_instance(inst)) {
+#ifdef MG_SW_DC_ONLY
+        return CPA_STATUS_INVALID_PARAM;
+#else
+        return cpaDcInstanceGetInfo2(inst, info);
+#endif
+    }
+
+    // Software instances run wherever the thread does; call it node 0
+    memset(info, 0, sizeof(CpaInstanceInfo2));
+
+    return CPA_STATUS_SUCCESS;
+}
+
+/*
+    Function:
+
+        sw_dc_print_stats
+
+    Description:
+
+        Prints requests, bytes and throughput per backend and direction, and how the
+        software instances compare with the hardware ones when both ran. MB/s is per busy
+        second of one request at a time, i.e. what one instance sustains for one thread
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void sw_dc_print_stats()
+{
+    static const char *backend_name[SW_DC_BACKENDS] = { "HW", "SW" };
+    static const char *op_name[SW_DC_OPS] = { "compress", "decompress" };
+    double rate[SW_DC_BACKENDS][SW_DC_OPS] = { { 0 } };
+
+    if (g_sw_dc.sw_num == 0) {
+        return;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    DC backends (%u HW, %u SW instances):\n", g_sw_dc.hw_num, g_sw_dc.sw_num);
+    MG_LOG_PRINT(g_log_fd, "        %-4s %-10s %12s %10s %12s %12s %10s %10s\n",
+            "", "", "requests", "overflows", "MB in", "MB out", "busy s", "MB/s");
+
+    for (int b = 0; b < SW_DC_BACKENDS; b++)
+    {
+        for (int o = 0; o < SW_DC_OPS; o++)
+        {
+            if (g_sw_dc.op[b][o].reqs == 0) {
+                continue;
+            }
+
+            // Throughput is on the cleartext side either way
+            uint64_t clear = o == SW_DC_CPR ? g_sw_dc.op[b][o].in : g_sw_dc.op[b][o].out;
+
+            rate[b][o] = g_sw_dc.op[b][o].ns ? (clear / (1024.0 * 1024.0)) / (g_sw_dc.op[b][o].ns / 1e9) : 0;
+            MG_LOG_PRINT(g_log_fd, "        %-4s %-10s %12lu %10lu %12.2f %12.2f %10.3f %10.1f\n",
+                    backend_name[b], op_name[o], g_sw_dc.op[b][o].reqs, g_sw_dc.op[b][o].overflows,
+                    g_sw_dc.op[b][o].in / (1024.0 * 1024.0), g_sw_dc.op[b][o].out / (1024.0 * 1024.0),
+                    g_sw_dc.op[b][o].ns / 1e9, rate[b][o]);
+        }
+    }
+
+    for (int o = 0; o < SW_DC_OPS; o++)
+    {
+        if (rate[SW_DC_HW][o] > 0 && rate[SW_DC_SW][o] > 0) {
+            MG_LOG_PRINT(g_log_fd, "        HW/SW %s: %.2fx\n", op_name[o], rate[SW_DC_HW][o] / rate[SW_DC_SW][o]);
+        }
+    }
+    MG_LOG_PRINT(g_log_fd, "\n");
+
+    dc_emu_print_stats();
+}
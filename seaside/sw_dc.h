@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+    Software (zlib) DC backend, built in with SW_DC=1 or SW_DC=only.
+
+    The cpaDc* calls meatjet makes are routed through sw_dc_* here. Calls on a software instance
+    handle run on zlib, everything else goes to the QAT library, so --sw-instances can put software
+    instances next to the hardware ones and print_summary compares them. SW_DC=only links no QAT
+    library at all and runs on software instances alone.
+*/
+
+#include "main.h"
+#include "cpa_types.h"
+#include "cpa.h"
+#include "cpa_dc.h"
+
+#define SW_DC_MAX_INSTANCES     (64)
+
+// Software instances when a SW_DC=only build isn't given --sw-instances
+#define SW_DC_DEFAULT_INSTANCES (4)
+
+CpaStatus sw_dc_attach(struct mg_options *opt);
+void sw_dc_detach();
+bool sw_dc_is_instance(CpaInstanceHandle inst);
+void sw_dc_print_stats();
+
+CpaStatus sw_dc_get_session_size(CpaInstanceHandle inst, CpaDcSessionSetupData *sd, Cpa32U *sess_size, Cpa32U *ctx_size);
+CpaStatus sw_dc_init_session(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaDcSessionSetupData *sd,
+                             CpaBufferList *ctx_buf, CpaDcCallbackFn cb);
+CpaStatus sw_dc_remove_session(const CpaInstanceHandle inst, CpaDcSessionHandle sess);
+CpaStatus sw_dc_reset_session(const CpaInstanceHandle inst, CpaDcSessionHandle sess);
+CpaStatus sw_dc_compress(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaBufferList *src, CpaBufferList *dest,
+                         CpaDcOpData *op, CpaDcRqResults *res, void *tag);
+CpaStatus sw_dc_decompress(CpaInstanceHandle inst, CpaDcSessionHandle sess, CpaBufferList *src, CpaBufferList *dest,
+                           CpaDcRqResults *res, CpaDcFlush flush, void *tag);
+CpaStatus sw_dc_meta_size(const CpaInstanceHandle inst, Cpa32U num_bufs, Cpa32U *size);
+CpaStatus sw_dc_instance_info2(const CpaInstanceHandle inst, CpaInstanceInfo2 *info);
+
+#ifndef SW_DC_IMPL
+#define cpaDcGetSessionSize             sw_dc_get_session_size
+#define cpaDcInitSession                sw_dc_init_session
+#define cpaDcRemoveSession              sw_dc_remove_session
+#define cpaDcResetSession               sw_dc_reset_session
+#define cpaDcCompressData2              sw_dc_compress
+#define cpaDcDecompressData             sw_dc_decompress
+#define cpaDcBufferListGetMetaSize      sw_dc_meta_size
+#define cpaDcInstanceGetInfo2           sw_dc_instance_info2
+#endif
@@ -0,0 +1,772 @@
+/*
+    Stall watchdog (--deadline, --abandon)
+
+    Workers stamp their slot without locking: credit_acquire stamps the submit, credit_release
+    and stage changes stamp progress. The slot's lock is only taken when a worker starts or
+    finishes a context, and by the watchdog while it looks at one, so a context can't be freed
+    under a dump. An abandoned worker's generation no longer matches its slot's; its stamps are
+    dropped, credit_retry stops retrying for it, and wd_ctx_end tells it to clean up and exit
+*/
+#include <time.h>
+#include <pthread.h>
+#include "watchdog.h"
+#include "context.h"
+#include "meatjet.h"
+
+extern FILE *g_log_fd;
+
+#define WD_MIN_TICK_NS          (1000000ULL)
+#define WD_MAX_TICK_NS          (250000000ULL)
+
+struct wd_slot {
+    pthread_mutex_t lock;
+    pthread_cond_t exit_cond;
+    uint32_t gen;
+    bool exited;
+    bool vacant;
+
+    struct context *ctx;
+    uint64_t ctx_ns;
+    volatile enum wd_stage stage;
+    volatile uint64_t requests;
+    volatile uint64_t submit_ns;
+    volatile uint32_t submit_inst;
+    volatile uint64_t progress_ns;
+
+    // Blocked on another worker (a prefix cache build), not on a request of its own
+    volatile bool waiting;
+
+    // Last stamp when the last stall was reported, so a stall is only reported once
+    uint64_t flagged_ns;
+    bool dumped;
+} __attribute__((aligned(64)));
+
+static struct {
+    uint64_t deadline_ns;
+    bool abandon;
+    wd_abandon_fn abandon_fn;
+    uint32_t num_slots;
+    struct wd_slot *slots;
+    pthread_t thread;
+    volatile bool running;
+
+    uint64_t stalls[WD_STAGES];
+    uint64_t abandoned;
+    uint64_t longest_ns;
+} g_wd;
+
+static const char *g_stage_names[WD_STAGES] = { "idle", "session", "compress", "decompress", "verify" };
+
+static __thread struct wd_slot *t_slot;
+static __thread uint32_t t_gen;
+
+/*
+    Function:
+
+        live_slot (static)
+
+    Description:
+
+        The calling thread's slot, unless it has none or has been abandoned
+
+    Parameters:
+
+        none
+
+    Return:
+
+        Ptr to the slot, or NULL
+*/
+static struct wd_slot *live_slot()
+{
+    if (t_slot == NULL || __atomic_load_n(&t_slot->gen, __ATOMIC_RELAXED) != t_gen) {
+        return NULL;
+    }
+
+    return t_slot;
+}
+
+/*
+    Function:
+
+        dump_stall (static)
+
+    Description:
+
+        Logs where a stalled worker is, then dumps its context through mg_log like a failure,
+        on its first stall only. A streamed context has no whole buffers to write, so it only
+        gets the log lines. The buffers are a snapshot; the request may still be writing them
+
+    Parameters:
+
+        idx     -   Slot number (the worker's thread id)
+        s       -   Ptr to the slot, locked
+        now     -   Current time
+        since   -   Last submit or progress stamp
+
+    Return:
+
+        none
+*/
+static void dump_stall(uint32_t idx, struct wd_slot *s, uint64_t now, uint64_t since)
+{
+    struct context *ctx = s->ctx;
+    uint64_t submit_ns = s->submit_ns;
+
+    MG_LOG_PRINT(g_log_fd, "\n\n\t******** STALL: thread %u, no progress for %.1f ms ********\n",
+            idx, (now - since) / 1e6);
+    MG_LOG_PRINT(g_log_fd, "    ctx %lu [%s] in %s, %.1f ms in, request %lu on instance %u %s",
+            ctx->id, ctx->src_data->filename, g_stage_names[s->stage], (now - s->ctx_ns) / 1e6,
+            s->requests, s->submit_inst, submit_ns ? "submitted" : "completed");
+    if (submit_ns) {
+        MG_LOG_PRINT(g_log_fd, " %.1f ms ago\n", (now - submit_ns) / 1e6);
+    } else {
+        MG_LOG_PRINT(g_log_fd, ", none in flight\n");
+    }
+    MG_LOG_PRINT(g_log_fd, "    level %u, %s, %s, %s %u; compress %u/%u, decompress %u/%u bytes consumed/produced\n",
+            ctx->sessCprSetupData.compLevel,
+            ctx->sessCprSetupData.huffType == CPA_DC_HT_STATIC ? "static" : "dynamic",
+            ctx->sessCprSetupData.sessState == CPA_DC_STATEFUL ? "stateful" : "stateless",
+            ctx->underflow ? "ibc" : "obs", ctx->underflow ? ctx->uf_ibc : ctx->obs,
+            ctx->cpr_consumed, ctx->cpr_produced, ctx->dcpr_consumed, ctx->dcpr_produced);
+
+    if (!s->dumped && ctx->src_data->backing != SRC_MEM_STREAMED) {
+        mg_log(ctx, DC_STALL);
+        s->dumped = true;
+    }
+}
+
+/*
+    Function:
+
+        check_slot (static)
+
+    Description:
+
+        Flags the slot if a request of its context has been in flight --deadline without
+        progress, and abandons the context with --abandon. A worker with nothing in flight,
+        busy on the CPU or waiting on another worker, is not stalled
+
+    Parameters:
+
+        idx -   Slot number
+        now -   Current time
+
+    Return:
+
+        none
+*/
+static void check_slot(uint32_t idx, uint64_t now)
+{
+    struct wd_slot *s = &g_wd.slots[idx];
+    struct context *ctx;
+    uint64_t submit_ns;
+    uint32_t submit_inst;
+    uint64_t since;
+
+    pthread_mutex_lock(&s->lock);
+
+    // A request's clock starts when it went in, or at the last progress in a RETRY loop
+    submit_inst = s->submit_inst;
+    submit_ns = s->submit_ns;
+    since = MAX(s->progress_ns, submit_ns);
+    if (s->ctx == NULL || s->waiting || submit_ns == 0 || since == s->flagged_ns || now < since + g_wd.deadline_ns) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+
+    s->flagged_ns = since;
+    g_wd.stalls[s->stage]++;
+    if (now - since > g_wd.longest_ns) {
+        g_wd.longest_ns = now - since;
+    }
+
+    dump_stall(idx, s, now, since);
+
+    if (g_wd.abandon) {
+        ctx = s->ctx;
+        MG_LOG_PRINT(g_log_fd, "    Abandoning ctx %lu, thread %u starts over on a new worker\n", ctx->id, idx);
+
+        __atomic_add_fetch(&s->gen, 1, __ATOMIC_RELAXED);
+        s->ctx = NULL;
+        s->stage = WD_IDLE;
+        g_wd.abandoned++;
+
+        // Nobody is left to exit; the join skips the slot
+        if (!g_wd.abandon_fn(idx, ctx, submit_inst)) {
+            s->vacant = true;
+            s->exited = true;
+            pthread_cond_broadcast(&s->exit_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *wd_entry(void *arg)
+{
+    uint64_t tick = g_wd.deadline_ns / 4;
+    struct timespec ts;
+
+    (void)arg;
+
+    tick = tick < WD_MIN_TICK_NS ? WD_MIN_TICK_NS : (tick > WD_MAX_TICK_NS ? WD_MAX_TICK_NS : tick);
+    ts.tv_sec = tick / 1000000000ULL;
+    ts.tv_nsec = tick % 1000000000ULL;
+
+    while (g_wd.running)
+    {
+        nanosleep(&ts, NULL);
+
+        for (uint32_t i = 0; i < g_wd.num_slots; i++)
+        {
+            check_slot(i, now_ns());
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    Function:
+
+        wd_start
+
+    Description:
+
+        Sets up a slot per worker and starts the watchdog thread. Does nothing without
+        --deadline. Called before the workers are created
+
+    Parameters:
+
+        opt     -   Ptr to the options (--deadline, --abandon)
+        threads -   Number of workers, whose thread ids are the slot numbers
+        abandon -   Fails an abandoned context and starts a replacement worker
+
+    Return:
+
+        0 on success, -1 on failure
+*/
+int wd_start(struct mg_options *opt, uint32_t threads, wd_abandon_fn abandon)
+{
+    if (opt->deadline_ms == 0) {
+        return 0;
+    }
+
+    g_wd.deadline_ns = (uint64_t)opt->deadline_ms * 1000000ULL;
+    g_wd.abandon = opt->abandon;
+    g_wd.abandon_fn = abandon;
+    g_wd.num_slots = threads;
+
+    if (posix_memalign((void **)&g_wd.slots, 64, threads * sizeof(struct wd_slot))) {
+        g_wd.slots = NULL;
+        MG_LOG_PRINT(g_log_fd, "Error: could not allocate the watchdog slots\n");
+        return -1;
+    }
+    memset(g_wd.slots, 0, threads * sizeof(struct wd_slot));
+
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pthread_mutex_init(&g_wd.slots[i].lock, NULL);
+        pthread_cond_init(&g_wd.slots[i].exit_cond, NULL);
+    }
+
+    g_wd.running = true;
+    if (pthread_create(&g_wd.thread, NULL, wd_entry, NULL)) {
+        g_wd.running = false;
+        MG_LOG_PRINT(g_log_fd, "Error: could not start the watchdog\n");
+        return -1;
+    }
+
+    MG_LOG_PRINT(g_log_fd, "Watchdog: %u ms deadline%s\n", opt->deadline_ms,
+            g_wd.abandon ? ", stalled contexts are abandoned" : "");
+
+    return 0;
+}
+
+/*
+    Function:
+
+        wd_stop
+
+    Description:
+
+        Stops the watchdog thread once the workers are done
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_stop()
+{
+    if (!g_wd.running) {
+        return;
+    }
+
+    g_wd.running = false;
+    pthread_join(g_wd.thread, NULL);
+}
+
+/*
+    Function:
+
+        wd_bind
+
+    Description:
+
+        Gives the calling worker its slot. First thing a worker does, so wd_wait_exit
+        can't miss it
+
+    Parameters:
+
+        slot    -   The worker's thread id
+
+    Return:
+
+        none
+*/
+void wd_bind(uint32_t slot)
+{
+    struct wd_slot *s;
+
+    if (g_wd.slots == NULL) {
+        return;
+    }
+    s = &g_wd.slots[slot];
+
+    pthread_mutex_lock(&s->lock);
+    t_slot = s;
+    t_gen = s->gen;
+    s->exited = false;
+    s->ctx = NULL;
+    s->stage = WD_IDLE;
+    s->submit_ns = 0;
+    s->progress_ns = now_ns();
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+    Function:
+
+        wd_unbind
+
+    Description:
+
+        Marks the worker as exited, unless it was abandoned and its slot belongs to a
+        replacement
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_unbind()
+{
+    struct wd_slot *s = t_slot;
+
+    if (s == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (s->gen == t_gen) {
+        s->exited = true;
+        pthread_cond_broadcast(&s->exit_cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    t_slot = NULL;
+}
+
+/*
+    Function:
+
+        wd_current
+
+    Description:
+
+        The calling thread's binding, to hand to threads working on its behalf
+
+    Parameters:
+
+        none
+
+    Return:
+
+        The binding, slot -1 if there is none
+*/
+struct wd_binding wd_current()
+{
+    struct wd_binding b = { -1, t_gen };
+
+    if (t_slot) {
+        b.slot = t_slot - g_wd.slots;
+    }
+
+    return b;
+}
+
+/*
+    Function:
+
+        wd_adopt
+
+    Description:
+
+        Makes the calling thread stamp another thread's slot
+
+    Parameters:
+
+        b   -   Binding from wd_current
+
+    Return:
+
+        none
+*/
+void wd_adopt(struct wd_binding b)
+{
+    if (b.slot < 0) {
+        return;
+    }
+
+    t_slot = &g_wd.slots[b.slot];
+    t_gen = b.gen;
+}
+
+/*
+    Function:
+
+        wd_ctx_begin
+
+    Description:
+
+        Starts the deadline on a context the worker has picked up
+
+    Parameters:
+
+        ctx -   Ptr to the context
+
+    Return:
+
+        none
+*/
+void wd_ctx_begin(struct context *ctx)
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->ctx = ctx;
+    s->ctx_ns = now_ns();
+    s->dumped = false;
+    s->waiting = false;
+    s->stage = WD_SESSION;
+    s->requests = 0;
+    s->submit_ns = 0;
+    s->progress_ns = s->ctx_ns;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+    Function:
+
+        wd_ctx_end
+
+    Description:
+
+        Takes the worker's context off the watchdog. Waits out a dump in progress, so the
+        context can be freed afterwards
+
+    Parameters:
+
+        none
+
+    Return:
+
+        true if the context was abandoned; the watchdog has failed it and the worker must
+        clean up and exit
+*/
+bool wd_ctx_end()
+{
+    struct wd_slot *s = t_slot;
+    bool abandoned;
+
+    if (s == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    abandoned = s->gen != t_gen;
+    if (!abandoned) {
+        s->ctx = NULL;
+        s->stage = WD_IDLE;
+        s->submit_ns = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return abandoned;
+}
+
+/*
+    Function:
+
+        wd_stage
+
+    Description:
+
+        Records the stage the worker's context has moved into. Counts as progress
+
+    Parameters:
+
+        stage   -   The new stage
+
+    Return:
+
+        none
+*/
+void wd_stage(enum wd_stage stage)
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    s->stage = stage;
+    s->progress_ns = now_ns();
+}
+
+/*
+    Function:
+
+        wd_submit
+
+    Description:
+
+        Stamps a request going in. Called from credit_acquire
+
+    Parameters:
+
+        inst    -   Instance number in dcInstances_g the request goes to
+
+    Return:
+
+        none
+*/
+void wd_submit(uint32_t inst)
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    __sync_fetch_and_add(&s->requests, 1);
+    s->submit_inst = inst;
+    s->submit_ns = now_ns();
+}
+
+/*
+    Function:
+
+        wd_progress
+
+    Description:
+
+        Stamps a request completing. Called from credit_release
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_progress()
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    s->submit_ns = 0;
+    s->progress_ns = now_ns();
+}
+
+/*
+    Function:
+
+        wd_wait_begin
+
+    Description:
+
+        Marks the worker as blocked on another worker rather than on a request, so the
+        watchdog leaves it alone until wd_wait_end
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_wait_begin()
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    s->waiting = true;
+}
+
+/*
+    Function:
+
+        wd_wait_end
+
+    Description:
+
+        Ends a wd_wait_begin. Counts as progress, so the wait isn't charged to the next
+        request
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_wait_end()
+{
+    struct wd_slot *s = live_slot();
+
+    if (s == NULL) {
+        return;
+    }
+
+    s->progress_ns = now_ns();
+    s->waiting = false;
+}
+
+/*
+    Function:
+
+        wd_abandoned
+
+    Description:
+
+        Whether the calling thread's context has been abandoned
+
+    Parameters:
+
+        none
+
+    Return:
+
+        true if it has
+*/
+bool wd_abandoned()
+{
+    return t_slot != NULL && __atomic_load_n(&t_slot->gen, __ATOMIC_RELAXED) != t_gen;
+}
+
+/*
+    Function:
+
+        wd_wait_exit
+
+    Description:
+
+        Waits for whichever worker currently holds the slot to exit. An abandoned worker
+        is detached and never waited for. Returns straight away without --deadline
+
+    Parameters:
+
+        slot    -   Slot number
+
+    Return:
+
+        true if the slot's worker is there to join, false if an abandoned one was never
+        replaced
+*/
+bool wd_wait_exit(uint32_t slot)
+{
+    struct wd_slot *s;
+    bool vacant;
+
+    if (g_wd.slots == NULL) {
+        return true;
+    }
+    s = &g_wd.slots[slot];
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->exited)
+    {
+        pthread_cond_wait(&s->exit_cond, &s->lock);
+    }
+    vacant = s->vacant;
+    pthread_mutex_unlock(&s->lock);
+
+    return !vacant;
+}
+
+/*
+    Function:
+
+        wd_print_stats
+
+    Description:
+
+        Prints the stalls by stage and how many contexts were abandoned. Quiet without
+        --deadline
+
+    Parameters:
+
+        none
+
+    Return:
+
+        none
+*/
+void wd_print_stats()
+{
+    uint64_t stalls = 0;
+
+    if (g_wd.slots == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < WD_STAGES; i++)
+    {
+        stalls += g_wd.stalls[i];
+    }
+
+    MG_LOG_PRINT(g_log_fd, "    Watchdog: %lu stalls past the %lu ms deadline", stalls, (uint64_t)(g_wd.deadline_ns / 1000000));
+    if (stalls) {
+        MG_LOG_PRINT(g_log_fd, " (longest %.1f ms when flagged;", g_wd.longest_ns / 1e6);
+        for (int i = 0; i < WD_STAGES; i++)
+        {
+            if (g_wd.stalls[i]) {
+                MG_LOG_PRINT(g_log_fd, " %s %lu", g_stage_names[i], g_wd.stalls[i]);
+            }
+        }
+        MG_LOG_PRINT(g_log_fd, ")");
+    }
+    MG_LOG_PRINT(g_log_fd, ", %lu contexts abandoned\n\n", g_wd.abandoned);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+    Stall watchdog (--deadline, --abandon). Each worker thread has a slot holding the context it
+    is running, the stage it is in, how many requests it has submitted and when the one in
+    flight went in. The submit paths stamp it through credit_acquire/credit_release, so a worker
+    that makes no progress for --deadline ms, in a hung request or a RETRY loop that never gets
+    through, is flagged once and its context dumped like a failure. A worker with no request in
+    flight, or one blocked on another worker between wd_wait_begin/wd_wait_end, is never flagged. With --abandon the context
+    is failed and the thread id handed to a fresh worker; the stuck thread exits if it ever
+    comes back
+*/
+
+#include <stdbool.h>
+#include "main.h"
+
+struct context;
+
+enum wd_stage {
+    WD_IDLE,
+    WD_SESSION,
+    WD_COMPRESS,
+    WD_DECOMPRESS,
+    WD_VERIFY,
+    WD_STAGES,
+};
+
+// A worker's slot and generation, for threads working on its behalf (chunk engine lanes)
+struct wd_binding {
+    int32_t slot;
+    uint32_t gen;
+};
+
+// Called by the watchdog, under the slot's lock, for each context it abandons, with the
+// instance its overdue request went to. Returns false if no replacement worker could be
+// started, leaving the slot empty
+typedef bool (*wd_abandon_fn)(uint32_t slot, struct context *ctx, uint32_t inst);
+
+int wd_start(struct mg_options *opt, uint32_t threads, wd_abandon_fn abandon);
+void wd_stop();
+void wd_bind(uint32_t slot);
+void wd_unbind();
+struct wd_binding wd_current();
+void wd_adopt(struct wd_binding b);
+void wd_ctx_begin(struct context *ctx);
+bool wd_ctx_end();
+void wd_stage(enum wd_stage stage);
+void wd_submit(uint32_t inst);
+void wd_progress();
+void wd_wait_begin();
+void wd_wait_end();
+bool wd_abandoned();
+bool wd_wait_exit(uint32_t slot);
+void wd_print_stats();